@@ -51,6 +51,8 @@ CHudRadarPanel::CHudRadarPanel( const char *pName ) : Panel( NULL, "HudRadar" ),
 	m_bHostageFlash = true;
 	m_bHideRadar = false;
 
+	ResetBlips();
+
 	s_Radar = this;
 
 	SetHiddenBits( HIDEHUD_HEALTH | HIDEHUD_PLAYERDEAD | HIDEHUD_NEEDSUIT );
@@ -82,6 +84,8 @@ void CHudRadarPanel::LevelInit()
 
 	g_RadarFlashes.RemoveAll();
 
+	ResetBlips();
+
 	// Map Overview handles radar duties now.
 	if( g_pMapOverview )
 	{
@@ -103,87 +107,226 @@ void CHudRadarPanel::Reset()
 }
 
 //---------------------------------------------------------
-// Purpose: 
+// Purpose: Applies the blips that changed, see radar_shared.h
 //---------------------------------------------------------
 void CHudRadarPanel::MsgFunc_UpdateRadar(bf_read &msg )
 {
-	int iPlayerEntity = msg.ReadByte();
-
-	// Draw objects on the radar
-	C_BasePlayer *pLocalPlayer = C_BasePlayer::GetLocalPlayer();
+	int iMsgFlags = msg.ReadByte();
 
-	if ( !pLocalPlayer )
+	if ( iMsgFlags & RADAR_MSG_RESET )
 	{
-		return;
+		ResetBlips();
 	}
 
-	C_PlayerResource *pPR = (C_PlayerResource*)GameResources();
+	// Read everything even without a local player, the next deltas build on it
+	C_BasePlayer *pLocalPlayer = C_BasePlayer::GetLocalPlayer();
 
-	if ( !pPR )
-	{
-		return;
-	}
+	int nBlips = msg.ReadByte();
+
+	uint32 steps[ RADAR_MSG_MAX_BLIPS ];
+	msg.ReadVarInt32Array( steps, nBlips );
 
-	// Players
-	for(int i=1;i<=MAX_PLAYERS;i++)
+	int iEntity = 0;
+	for ( int i = 0; i < nBlips; ++i )
 	{
-		if( i == pLocalPlayer->entindex() )
+		iEntity += steps[i];
+		if ( iEntity >= MAX_EDICTS )
 		{
-			continue;
+			Assert( 0 );
+			return;
 		}
 
-		C_BasePlayer *pPlayer = ToBasePlayer(UTIL_PlayerByIndex(i));
+		int iOp = msg.ReadUBitLong( RADAR_BLIP_OP_BITS );
 
-		if ( pPlayer )
+		if ( iOp == RADAR_BLIP_REMOVE )
 		{
-			pPlayer->m_bDetected = false;
+			RemoveBlip( iEntity );
+			continue;
 		}
-	}
 
-	while ( iPlayerEntity > 0 )
-	{
-		int x = msg.ReadSBitLong( COORD_INTEGER_BITS-1 ) * 4;
-		int y = msg.ReadSBitLong( COORD_INTEGER_BITS-1 ) * 4;
-		int z = msg.ReadSBitLong( COORD_INTEGER_BITS-1 ) * 4;
-		int a = msg.ReadSBitLong( 9 );
+		RadarBlipState_t state;
+		state.m_flags = msg.ReadUBitLong( RADAR_BLIP_FLAG_BITS );
 
-		C_BasePlayer *pPlayer = ToBasePlayer(UTIL_PlayerByIndex(iPlayerEntity));
+		if ( iOp == RADAR_BLIP_DELTA )
+		{
+			int iBlip = m_BlipOfEntity[ iEntity ];
+			Assert( iBlip >= 0 );
 
-		Vector origin( x, y, z );
-		QAngle angles( 0, a, 0 );
+			RadarBlipState_t from = { 0, 0, 0, 0, 0 };
+			if ( iBlip >= 0 )
+			{
+				from = m_BlipState[ iBlip ];
+			}
 
-		if ( g_pMapOverview )
+			state.m_x = from.m_x + msg.ReadSBitLong( RADAR_DELTA_XY_BITS );
+			state.m_y = from.m_y + msg.ReadSBitLong( RADAR_DELTA_XY_BITS );
+			state.m_z = from.m_z + msg.ReadSBitLong( RADAR_DELTA_Z_BITS );
+		}
+		else
 		{
-			g_pMapOverview->SetPlayerPositions( iPlayerEntity-1, origin, angles );
+			state.m_x = msg.ReadSBitLong( RADAR_XY_BITS );
+			state.m_y = msg.ReadSBitLong( RADAR_XY_BITS );
+			state.m_z = msg.ReadSBitLong( RADAR_Z_BITS );
 		}
+		state.m_yaw = msg.ReadUBitLong( RADAR_YAW_BITS );
 
-		iPlayerEntity = msg.ReadByte(); // Read index for next player
+		UpdateBlip( iEntity, state );
 
-		if ( !pPlayer )
+		if ( !( state.m_flags & RADAR_BLIP_NPC ) && pLocalPlayer )
 		{
-			continue;
+			UpdatePlayerFromBlip( iEntity, state, pLocalPlayer );
 		}
+	}
+}
 
-		bool bOppositeTeams = (pLocalPlayer->GetTeamNumber() != TEAM_UNASSIGNED && pPR->GetTeam( pPlayer->entindex() ) != pLocalPlayer->GetTeamNumber());
-
-		// Don't update dead players or if they are in PVS
-		if ( pPlayer->IsObserver() || (!pPlayer->IsDormant() && bOppositeTeams == false ) )
+//---------------------------------------------------------
+// Purpose: 
+//---------------------------------------------------------
+void CHudRadarPanel::ResetBlips()
+{
+	for ( int i = 0; i < m_BlipEntity.Count(); ++i )
+	{
+		C_BasePlayer *pPlayer = ToBasePlayer( UTIL_PlayerByIndex( m_BlipEntity[i] ) );
+		if ( pPlayer )
 		{
-			continue;
+			pPlayer->m_bDetected = false;
 		}
+	}
 
-		// Update origin and angle for players out of my PVS
-		origin = pPlayer->GetAbsOrigin();
-		angles = pPlayer->GetAbsAngles();
+	m_BlipEntity.RemoveAll();
+	m_BlipState.RemoveAll();
+	m_BlipFrom.RemoveAll();
+	m_BlipTo.RemoveAll();
+	m_BlipTime.RemoveAll();
+	m_BlipInterval.RemoveAll();
 
-		origin.x = x;
-		origin.y = y;
-		angles.y = a;
+	for ( int i = 0; i < MAX_EDICTS; ++i )
+	{
+		m_BlipOfEntity[i] = -1;
+	}
+}
+
+//---------------------------------------------------------
+// Purpose: Moves the blip on from where it is drawn now, so it
+//			doesn't jump when an update comes in
+//---------------------------------------------------------
+void CHudRadarPanel::UpdateBlip( int iEntity, const RadarBlipState_t &state )
+{
+	int iBlip = m_BlipOfEntity[ iEntity ];
 
-		pPlayer->SetAbsOrigin( origin );
-		pPlayer->SetAbsAngles( angles );
-		pPlayer->m_bDetected = true;
+	if ( iBlip < 0 )
+	{
+		iBlip = m_BlipEntity.AddToTail( iEntity );
+		m_BlipState.AddToTail( state );
+		m_BlipFrom.AddToTail( state.GetOrigin() );
+		m_BlipTo.AddToTail( state.GetOrigin() );
+		m_BlipTime.AddToTail( gpGlobals->curtime );
+		m_BlipInterval.AddToTail( 0.0f );
+		m_BlipOfEntity[ iEntity ] = iBlip;
+		return;
 	}
+
+	m_BlipFrom[ iBlip ] = GetBlipOrigin( iBlip );
+	m_BlipTo[ iBlip ] = state.GetOrigin();
+	m_BlipState[ iBlip ] = state;
+	m_BlipInterval[ iBlip ] = clamp( gpGlobals->curtime - m_BlipTime[ iBlip ], 0.05f, 2.0f );
+	m_BlipTime[ iBlip ] = gpGlobals->curtime;
+}
+
+//---------------------------------------------------------
+// Purpose: 
+//---------------------------------------------------------
+void CHudRadarPanel::RemoveBlip( int iEntity )
+{
+	int iBlip = m_BlipOfEntity[ iEntity ];
+	if ( iBlip < 0 )
+		return;
+
+	C_BasePlayer *pPlayer = ToBasePlayer( UTIL_PlayerByIndex( iEntity ) );
+	if ( pPlayer && !( m_BlipState[ iBlip ].m_flags & RADAR_BLIP_NPC ) )
+	{
+		pPlayer->m_bDetected = false;
+	}
+
+	m_BlipEntity.FastRemove( iBlip );
+	m_BlipState.FastRemove( iBlip );
+	m_BlipFrom.FastRemove( iBlip );
+	m_BlipTo.FastRemove( iBlip );
+	m_BlipTime.FastRemove( iBlip );
+	m_BlipInterval.FastRemove( iBlip );
+
+	m_BlipOfEntity[ iEntity ] = -1;
+	if ( iBlip < m_BlipEntity.Count() )
+	{
+		m_BlipOfEntity[ m_BlipEntity[ iBlip ] ] = iBlip;
+	}
+}
+
+//---------------------------------------------------------
+// Purpose: Entities the client has are drawn where they are,
+//			the rest slide between their last two updates
+//---------------------------------------------------------
+Vector CHudRadarPanel::GetBlipOrigin( int iBlip ) const
+{
+	C_BaseEntity *pEnt = ClientEntityList().GetEnt( m_BlipEntity[ iBlip ] );
+	if ( pEnt && !pEnt->IsDormant() )
+	{
+		return pEnt->GetAbsOrigin();
+	}
+
+	if ( m_BlipInterval[ iBlip ] <= 0.0f )
+	{
+		return m_BlipTo[ iBlip ];
+	}
+
+	float t = clamp( ( gpGlobals->curtime - m_BlipTime[ iBlip ] ) / m_BlipInterval[ iBlip ], 0.0f, 1.0f );
+
+	Vector origin;
+	VectorLerp( m_BlipFrom[ iBlip ], m_BlipTo[ iBlip ], t, origin );
+	return origin;
+}
+
+//---------------------------------------------------------
+// Purpose: Hands a player's blip to the map overview, and moves
+//			players we don't otherwise get updates for
+//---------------------------------------------------------
+void CHudRadarPanel::UpdatePlayerFromBlip( int iPlayer, const RadarBlipState_t &state, C_BasePlayer *pLocalPlayer )
+{
+	Vector origin = state.GetOrigin();
+	QAngle angles( 0, state.GetYaw(), 0 );
+
+	if ( g_pMapOverview && iPlayer <= MAX_PLAYERS )
+	{
+		g_pMapOverview->SetPlayerPositions( iPlayer-1, origin, angles );
+	}
+
+	C_BasePlayer *pPlayer = ToBasePlayer( UTIL_PlayerByIndex( iPlayer ) );
+	C_PlayerResource *pPR = (C_PlayerResource*)GameResources();
+
+	if ( !pPlayer || !pPR || pPlayer == pLocalPlayer )
+	{
+		return;
+	}
+
+	bool bOppositeTeams = (pLocalPlayer->GetTeamNumber() != TEAM_UNASSIGNED && pPR->GetTeam( pPlayer->entindex() ) != pLocalPlayer->GetTeamNumber());
+
+	// Don't update dead players or if they are in PVS
+	if ( pPlayer->IsObserver() || (!pPlayer->IsDormant() && bOppositeTeams == false ) )
+	{
+		return;
+	}
+
+	// Update origin and angle for players out of my PVS
+	Vector playerOrigin = pPlayer->GetAbsOrigin();
+	QAngle playerAngles = pPlayer->GetAbsAngles();
+
+	playerOrigin.x = origin.x;
+	playerOrigin.y = origin.y;
+	playerAngles.y = angles.y;
+
+	pPlayer->SetAbsOrigin( playerOrigin );
+	pPlayer->SetAbsAngles( playerAngles );
+	pPlayer->m_bDetected = true;
 }
 
 //---------------------------------------------------------
@@ -209,13 +352,111 @@ void CHudRadarPanel::SetVisible(bool state)
 	}
 }
 
+//---------------------------------------------------------
+// Purpose: Same shapes as DrawRadarDot() with RADAR_DOT_NORMAL, added to a batch
+//---------------------------------------------------------
+static void AddRadarRect( CUtlVector< IntRect > &rects, int x, int y, int w, int h )
+{
+	IntRect &rect = rects[ rects.AddToTail() ];
+	rect.x0 = x;
+	rect.y0 = y;
+	rect.x1 = x + w;
+	rect.y1 = y + h;
+}
+
+static void AddRadarDotRects( CUtlVector< IntRect > &rects, int x, int y, float z_diff, int iBaseDotSize )
+{
+	if ( z_diff < -128 || z_diff > 128 )
+	{
+		int iBar = (int)( MIN( fabs( z_diff ), 3096 ) / 400 ) + 2;
+
+		iBaseDotSize /= 2;
+
+		// Horizontal
+		AddRadarRect( rects, x-(2*iBaseDotSize), y, 5*iBaseDotSize, iBaseDotSize );
+
+		// Vertical, up from the bar if the dot is below the player and down if it's above
+		if ( z_diff < 0 )
+		{
+			AddRadarRect( rects, x, y - iBar*iBaseDotSize, iBaseDotSize, iBar*iBaseDotSize );
+		}
+		else
+		{
+			AddRadarRect( rects, x, y, iBaseDotSize, iBar*iBaseDotSize );
+		}
+	}
+	else
+	{
+		AddRadarRect( rects, x, y, iBaseDotSize, iBaseDotSize );
+	}
+}
+
 //---------------------------------------------------------
 // Purpose: 
 //---------------------------------------------------------
 void CHudRadarPanel::Paint()
 {
-	// We are the hud element still, but Overview is in charge of the new style now.
-	return;
+	C_BasePlayer *pLocalPlayer = C_BasePlayer::GetLocalPlayer();
+	if ( !pLocalPlayer || !m_BlipEntity.Count() )
+	{
+		return;
+	}
+
+	// We are the hud element still, but Overview is in charge of the players when it shows the radar.
+	bool bDrawPlayers = !g_pMapOverview || g_pMapOverview->GetMode() != CMapOverview::MAP_MODE_RADAR;
+
+	C_PlayerResource *pPR = (C_PlayerResource*)GameResources();
+
+	static const Color s_BlipColors[ RADAR_COLOR_COUNT ] =
+	{
+		Color( 75, 75, 250, 235 ),		// RADAR_COLOR_TEAMMATE
+		Color( 250, 0, 0, 235 ),		// RADAR_COLOR_ENEMY
+		Color( 60, 200, 60, 235 ),		// RADAR_COLOR_NPC
+		Color( 230, 110, 25, 235 ),		// RADAR_COLOR_HOSTILE_NPC
+	};
+
+	for ( int c = 0; c < RADAR_COLOR_COUNT; ++c )
+	{
+		m_BlipRects[c].RemoveAll();
+	}
+
+	int iBaseDotSize = MAX( ScreenWidth() / 256, 2 );
+	Vector localOrigin = pLocalPlayer->GetAbsOrigin();
+	QAngle localAngles = pLocalPlayer->LocalEyeAngles();
+
+	// Sort the blips into one batch per color
+	for ( int i = 0; i < m_BlipEntity.Count(); ++i )
+	{
+		int flags = m_BlipState[i].m_flags;
+		int color;
+
+		if ( flags & RADAR_BLIP_NPC )
+		{
+			color = ( flags & RADAR_BLIP_HOSTILE ) ? RADAR_COLOR_HOSTILE_NPC : RADAR_COLOR_NPC;
+		}
+		else
+		{
+			if ( !bDrawPlayers )
+				continue;
+
+			bool bOppositeTeams = pPR && pLocalPlayer->GetTeamNumber() != TEAM_UNASSIGNED && pPR->GetTeam( m_BlipEntity[i] ) != pLocalPlayer->GetTeamNumber();
+			color = bOppositeTeams ? RADAR_COLOR_ENEMY : RADAR_COLOR_TEAMMATE;
+		}
+
+		float x, y, z_delta;
+		WorldToRadar( GetBlipOrigin( i ), localOrigin, localAngles, x, y, z_delta );
+
+		AddRadarDotRects( m_BlipRects[ color ], (int)x, (int)y, z_delta, iBaseDotSize );
+	}
+
+	for ( int c = 0; c < RADAR_COLOR_COUNT; ++c )
+	{
+		if ( !m_BlipRects[c].Count() )
+			continue;
+
+		surface()->DrawSetColor( s_BlipColors[c] );
+		surface()->DrawFilledRectArray( m_BlipRects[c].Base(), m_BlipRects[c].Count() );
+	}
 }
 
 //---------------------------------------------------------
@@ -11,8 +11,10 @@
 #endif
 
 #include "hudelement.h"
+#include <vgui/ISurface.h>
 #include <vgui_controls/Panel.h>
 #include <vgui_controls/Label.h>
+#include "radar_shared.h"
 
 class C_BasePlayer;
 void Radar_FlashPlayer(int iPlayer);
@@ -63,6 +65,22 @@ private:
 	void FillRect(int x, int y, int w, int h);
 	void DrawRadarDot(int x, int y, float z_diff, int iBaseDotSize, int flags, int r, int g, int b, int a);
 
+	void ResetBlips();
+	void UpdateBlip(int iEntity, const RadarBlipState_t &state);
+	void RemoveBlip(int iEntity);
+	void UpdatePlayerFromBlip(int iPlayer, const RadarBlipState_t &state, C_BasePlayer *pLocalPlayer);
+	Vector GetBlipOrigin(int iBlip) const;
+
+	enum
+	{
+		RADAR_COLOR_TEAMMATE,
+		RADAR_COLOR_ENEMY,
+		RADAR_COLOR_NPC,
+		RADAR_COLOR_HOSTILE_NPC,
+
+		RADAR_COLOR_COUNT
+	};
+
 	CHudTexture *m_pBackground;
 	CHudTexture *m_pBackgroundTrans;
 
@@ -72,6 +90,17 @@ private:
 	float m_flNextHostageFlashTime;
 	bool m_bHostageFlash;
 	bool m_bHideRadar;
+
+	// Blips from UpdateRadar, one slot per tracked entity. Removing one moves the last slot into its place.
+	CUtlVector< int > m_BlipEntity;
+	CUtlVector< RadarBlipState_t > m_BlipState;		// as last received, the next delta applies to this
+	CUtlVector< Vector > m_BlipFrom;				// where the blip was drawn when its last update came in
+	CUtlVector< Vector > m_BlipTo;
+	CUtlVector< float > m_BlipTime;					// when its last update came in
+	CUtlVector< float > m_BlipInterval;				// time between its last two updates
+	short m_BlipOfEntity[ MAX_EDICTS ];				// -1 if the entity has no blip
+
+	CUtlVector< IntRect > m_BlipRects[ RADAR_COLOR_COUNT ];	// Paint()'s batches, kept between frames
 };
 
 #endif // HUD_RADAR_PANEL_H
\ No newline at end of file
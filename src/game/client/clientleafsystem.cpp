@@ -33,6 +33,8 @@ static ConVar cl_drawleaf("cl_drawleaf", "-1", FCVAR_CHEAT );
 static ConVar r_PortalTestEnts( "r_PortalTestEnts", "1", FCVAR_CHEAT, "Clip entities against portal frustums." );
 static ConVar r_portalsopenall( "r_portalsopenall", "0", FCVAR_CHEAT, "Open all portals" );
 static ConVar cl_threaded_client_leaf_system("cl_threaded_client_leaf_system", "0"  );
+static ConVar cl_leafsystem_incremental( "cl_leafsystem_incremental", "1", 0, "Only relink renderables into the leaf tree when they leave their cached bounds." );
+static ConVar cl_leafsystem_bloat( "cl_leafsystem_bloat", "12", 0, "How far (in units) cached renderable leaf bounds are expanded to absorb small movements." );
 
 
 DEFINE_FIXEDSIZE_ALLOCATOR( CClientRenderablesList, 1, CUtlMemoryPool::GROW_SLOW );
@@ -56,6 +58,34 @@ static void CallComputeFXBlend( IClientRenderable *&pRenderable )
 	pRenderable->ComputeFxBlend();
 }
 
+//-----------------------------------------------------------------------------
+// Collects the leaves in a box into a CUtlVector; safe to use from any thread
+//-----------------------------------------------------------------------------
+class CLeafListEnumerator : public ISpatialLeafEnumerator
+{
+public:
+	bool EnumerateLeaf( int leaf, int context )
+	{
+		CUtlVector< int > *pLeaves = (CUtlVector< int > *)context;
+		pLeaves->AddToTail( leaf );
+		return true;
+	}
+};
+
+static CLeafListEnumerator s_LeafListEnumerator;
+
+static int __cdecl LeafIndexCompare( const int *pLeft, const int *pRight )
+{
+	return *pLeft - *pRight;
+}
+
+static inline bool IsBoxInsideBox( const Vector &innerMins, const Vector &innerMaxs, const Vector &outerMins, const Vector &outerMaxs )
+{
+	return ( innerMins.x >= outerMins.x ) && ( innerMaxs.x <= outerMaxs.x ) &&
+		( innerMins.y >= outerMins.y ) && ( innerMaxs.y <= outerMaxs.y ) &&
+		( innerMins.z >= outerMins.z ) && ( innerMaxs.z <= outerMaxs.z );
+}
+
 //-----------------------------------------------------------------------------
 // The client leaf system
 //-----------------------------------------------------------------------------
@@ -229,6 +259,20 @@ private:
 		mdlcache->EndLock();
 	}
 
+	// Adds all shadows in a leaf to a renderable (once per m_ShadowEnum)
+	void AddShadowsInLeafToRenderable( int leaf, ClientRenderHandle_t handle );
+
+	// Removes/rebuilds the shadows projected onto a renderable
+	void RemoveShadowsFromRenderable( ClientRenderHandle_t handle );
+	void AddLeafShadowsToRenderable( ClientRenderHandle_t handle );
+
+	// Incremental reinsertion of dirty renderables
+	struct RenderableLeafUpdate_t;
+	void UpdateDirtyRenderablesIncremental();
+	void ComputeLeafUpdate( RenderableLeafUpdate_t &update );
+	void CommitLeafUpdate( RenderableLeafUpdate_t &update );
+	void RelinkRenderableLeaves( ClientRenderHandle_t handle, const CUtlVector< int > &leaves );
+
 private:
 	enum
 	{
@@ -238,6 +282,14 @@ private:
 		RENDER_FLAGS_STUDIO_MODEL	= 0x08,
 		RENDER_FLAGS_HASCHANGED		= 0x10,
 		RENDER_FLAGS_ALTERNATE_SORTING = 0x20,
+		RENDER_FLAGS_LEAFCACHE_VALID = 0x40,	// m_vecAbsMins/m_vecBloatedAbsMins describe the current leaf set
+	};
+
+	enum LeafUpdateAction_t
+	{
+		LEAF_UPDATE_NONE = 0,		// bounds didn't change
+		LEAF_UPDATE_SHADOWS,		// moved, but still inside the cached bounds; leaves are unchanged
+		LEAF_UPDATE_RELINK,			// left the cached bounds; diff against the new leaf set
 	};
 
 	// All the information associated with a particular handle
@@ -255,6 +307,13 @@ private:
 		unsigned short		m_FirstShadow;	// The first shadow caster that cast on it
 		short m_Area;	// -1 if the renderable spans multiple areas.
 		signed char			m_TranslucencyCalculatedView;
+
+		// Bounds the renderable had when it was last placed, and the
+		// expanded bounds its current leaf set was enumerated with
+		Vector				m_vecAbsMins;
+		Vector				m_vecAbsMaxs;
+		Vector				m_vecBloatedAbsMins;
+		Vector				m_vecBloatedAbsMaxs;
 	};
 
 	// The leaf contains an index into a list of renderables
@@ -292,6 +351,19 @@ private:
 		ClientRenderHandle_t handle;
 	};
 
+	// Per-renderable work item for the incremental reinsertion pass.
+	// Computed in parallel, committed to the leaf lists serially.
+	struct RenderableLeafUpdate_t
+	{
+		ClientRenderHandle_t	m_Handle;
+		int						m_nAction;		// LeafUpdateAction_t
+		Vector					m_vecAbsMins;
+		Vector					m_vecAbsMaxs;
+		Vector					m_vecBloatedAbsMins;
+		Vector					m_vecBloatedAbsMaxs;
+		CUtlVector< int >		m_Leaves;		// sorted; only valid for LEAF_UPDATE_RELINK
+	};
+
 	// Stores data associated with each leaf.
 	CUtlVector< ClientLeaf_t >	m_Leaf;
 
@@ -313,6 +385,10 @@ private:
 	// Dirty list of renderables
 	CUtlVector< ClientRenderHandle_t >	m_DirtyRenderables;
 
+	// Work items for the dirty renderables; kept around so the leaf lists don't reallocate every frame
+	CUtlVector< RenderableLeafUpdate_t >	m_LeafUpdates;
+	float m_flLeafBloat;
+
 	// List of renderables in view model render groups
 	CUtlVector< ClientRenderHandle_t >	m_ViewModels;
 
@@ -435,7 +511,7 @@ void CalcRenderableWorldSpaceAABB_Fast( IClientRenderable *pRenderable, Vector &
 //-----------------------------------------------------------------------------
 // constructor, destructor
 //-----------------------------------------------------------------------------
-CClientLeafSystem::CClientLeafSystem() : m_DrawStaticProps(true), m_DrawSmallObjects(true)
+CClientLeafSystem::CClientLeafSystem() : m_DrawStaticProps(true), m_DrawSmallObjects(true), m_flLeafBloat(0.0f)
 {
 	// Set up the bi-directional lists...
 	m_RenderablesInLeaf.Init( FirstRenderableInLeaf, FirstLeafInRenderable );
@@ -518,6 +594,7 @@ void CClientLeafSystem::LevelShutdownPostEntity()
 	m_ShadowsInLeaf.Purge();
 	m_ShadowsOnRenderable.Purge();
 	m_DirtyRenderables.Purge();
+	m_LeafUpdates.Purge();
 }
 
 
@@ -528,6 +605,12 @@ void CClientLeafSystem::PreRender()
 {
 	VPROF_BUDGET( "CClientLeafSystem::PreRender", "PreRender" );
 
+	if ( cl_leafsystem_incremental.GetBool() )
+	{
+		UpdateDirtyRenderablesIncremental();
+		return;
+	}
+
 	int i;
 	int nIterations = 0;
 
@@ -597,6 +680,201 @@ void CClientLeafSystem::PreRender()
 }
 
 
+//-----------------------------------------------------------------------------
+// Updates the dirty renderables, only touching the leaf lists of the ones
+// that left the bounds their current leaf set was computed for
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::UpdateDirtyRenderablesIncremental()
+{
+	m_flLeafBloat = MAX( cl_leafsystem_bloat.GetFloat(), 0.0f );
+
+	int nIterations = 0;
+	while ( m_DirtyRenderables.Count() )
+	{
+		if ( ++nIterations > 10 )
+		{
+			Warning( "Too many dirty renderables!\n" );
+			break;
+		}
+
+		// Committing can result in new renderables being added, so only handle the current ones
+		int nDirty = m_DirtyRenderables.Count();
+		if ( m_LeafUpdates.Count() < nDirty )
+		{
+			m_LeafUpdates.EnsureCount( nDirty );
+		}
+
+		int i;
+		for ( i = 0; i < nDirty; ++i )
+		{
+			Assert( m_Renderables[ m_DirtyRenderables[i] ].m_Flags & RENDER_FLAGS_HASCHANGED );
+			m_LeafUpdates[i].m_Handle = m_DirtyRenderables[i];
+		}
+
+		// Bounds computation and leaf enumeration don't touch the leaf lists, so they can go wide
+		bool bThreaded = ( nDirty > 5 && cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumThreads() );
+		if ( !bThreaded )
+		{
+			for ( i = 0; i < nDirty; ++i )
+			{
+				ComputeLeafUpdate( m_LeafUpdates[i] );
+			}
+		}
+		else
+		{
+			ParallelProcess( "CClientLeafSystem::ComputeLeafUpdate", m_LeafUpdates.Base(), nDirty, this, &CClientLeafSystem::ComputeLeafUpdate, &CClientLeafSystem::FrameLock, &CClientLeafSystem::FrameUnlock );
+		}
+
+		for ( i = 0; i < nDirty; ++i )
+		{
+			CommitLeafUpdate( m_LeafUpdates[i] );
+		}
+
+		m_DirtyRenderables.RemoveMultiple( 0, nDirty );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Figures out what has to happen to a dirty renderable. May run on a worker thread.
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::ComputeLeafUpdate( RenderableLeafUpdate_t &update )
+{
+	const RenderableInfo_t &info = m_Renderables[update.m_Handle];
+
+	update.m_Leaves.RemoveAll();
+	CalcRenderableWorldSpaceAABB_Fast( info.m_pRenderable, update.m_vecAbsMins, update.m_vecAbsMaxs );
+	Assert( update.m_vecAbsMins.IsValid() && update.m_vecAbsMaxs.IsValid() );
+
+	if ( info.m_Flags & RENDER_FLAGS_LEAFCACHE_VALID )
+	{
+		// Brush models have shadows decals placed by origin + angles, which an identical
+		// AABB doesn't guarantee, so they always get their shadows rebuilt
+		if ( ( update.m_vecAbsMins == info.m_vecAbsMins ) && ( update.m_vecAbsMaxs == info.m_vecAbsMaxs ) &&
+			( ( info.m_Flags & RENDER_FLAGS_BRUSH_MODEL ) == 0 ) )
+		{
+			update.m_nAction = LEAF_UPDATE_NONE;
+			return;
+		}
+
+		if ( IsBoxInsideBox( update.m_vecAbsMins, update.m_vecAbsMaxs, info.m_vecBloatedAbsMins, info.m_vecBloatedAbsMaxs ) )
+		{
+			update.m_nAction = LEAF_UPDATE_SHADOWS;
+			return;
+		}
+	}
+
+	// Expand the box so that small movements next frame stay inside it
+	Vector vecBloat( m_flLeafBloat, m_flLeafBloat, m_flLeafBloat );
+	VectorSubtract( update.m_vecAbsMins, vecBloat, update.m_vecBloatedAbsMins );
+	VectorAdd( update.m_vecAbsMaxs, vecBloat, update.m_vecBloatedAbsMaxs );
+
+	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
+	pQuery->EnumerateLeavesInBox( update.m_vecBloatedAbsMins, update.m_vecBloatedAbsMaxs, &s_LeafListEnumerator, (int)&update.m_Leaves );
+	update.m_Leaves.Sort( LeafIndexCompare );
+
+	update.m_nAction = LEAF_UPDATE_RELINK;
+}
+
+
+//-----------------------------------------------------------------------------
+// Applies a computed update to the leaf lists. Main thread only.
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::CommitLeafUpdate( RenderableLeafUpdate_t &update )
+{
+	ClientRenderHandle_t handle = update.m_Handle;
+	RenderableInfo_t &info = m_Renderables[handle];
+	info.m_Flags &= ~RENDER_FLAGS_HASCHANGED;
+
+	switch ( update.m_nAction )
+	{
+	case LEAF_UPDATE_NONE:
+		break;
+
+	case LEAF_UPDATE_SHADOWS:
+		info.m_vecAbsMins = update.m_vecAbsMins;
+		info.m_vecAbsMaxs = update.m_vecAbsMaxs;
+		RemoveShadowsFromRenderable( handle );
+		AddLeafShadowsToRenderable( handle );
+		break;
+
+	case LEAF_UPDATE_RELINK:
+		info.m_vecAbsMins = update.m_vecAbsMins;
+		info.m_vecAbsMaxs = update.m_vecAbsMaxs;
+		info.m_vecBloatedAbsMins = update.m_vecBloatedAbsMins;
+		info.m_vecBloatedAbsMaxs = update.m_vecBloatedAbsMaxs;
+		info.m_Flags |= RENDER_FLAGS_LEAFCACHE_VALID;
+
+		RemoveShadowsFromRenderable( handle );
+		RelinkRenderableLeaves( handle, update.m_Leaves );
+		AddLeafShadowsToRenderable( handle );
+		m_Renderables[handle].m_Area = GetRenderableArea( handle );
+		break;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Moves a renderable to a new (sorted) set of leaves, only unlinking the leaves
+// it left and linking the leaves it entered
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::RelinkRenderableLeaves( ClientRenderHandle_t handle, const CUtlVector< int > &leaves )
+{
+	int nLeafCount = leaves.Count();
+	bool *pStillIn = (bool *)stackalloc( nLeafCount * sizeof(bool) );
+	memset( pStillIn, 0, nLeafCount * sizeof(bool) );
+
+	unsigned short i = m_RenderablesInLeaf.FirstBucket( handle );
+	while ( i != m_RenderablesInLeaf.InvalidIndex() )
+	{
+		int nLeaf = m_RenderablesInLeaf.Bucket( i );
+
+		// Binary search the new leaf set
+		int nLow = 0;
+		int nHigh = nLeafCount - 1;
+		int nFound = -1;
+		while ( nLow <= nHigh )
+		{
+			int nMid = ( nLow + nHigh ) >> 1;
+			if ( leaves[nMid] == nLeaf )
+			{
+				nFound = nMid;
+				break;
+			}
+			if ( leaves[nMid] < nLeaf )
+			{
+				nLow = nMid + 1;
+			}
+			else
+			{
+				nHigh = nMid - 1;
+			}
+		}
+
+		if ( nFound >= 0 )
+		{
+			pStillIn[nFound] = true;
+			i = m_RenderablesInLeaf.NextBucket( i );
+		}
+		else
+		{
+			i = m_RenderablesInLeaf.RemoveBucketFromElement( handle, i );
+		}
+	}
+
+	for ( int j = 0; j < nLeafCount; ++j )
+	{
+		if ( !pStillIn[j] )
+		{
+#ifdef VALIDATE_CLIENT_LEAF_SYSTEM
+			m_RenderablesInLeaf.ValidateAddElementToBucket( leaves[j], handle );
+#endif
+			m_RenderablesInLeaf.AddElementToBucket( leaves[j], handle );
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Creates a new renderable
 //-----------------------------------------------------------------------------
@@ -1097,7 +1375,15 @@ void CClientLeafSystem::AddRenderableToLeaf( int leaf, ClientRenderHandle_t rend
 	if ( !ShouldRenderableReceiveShadow( renderable, SHADOW_FLAGS_PROJECTED_TEXTURE_TYPE_MASK ) )
 		return;
 
-	// Add all shadows in the leaf to the renderable...
+	AddShadowsInLeafToRenderable( leaf, renderable );
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds all shadows in a leaf to a renderable
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::AddShadowsInLeafToRenderable( int leaf, ClientRenderHandle_t renderable )
+{
 	unsigned short i = m_ShadowsInLeaf.FirstElement( leaf );
 	while (i != m_ShadowsInLeaf.InvalidIndex() )
 	{
@@ -1116,6 +1402,24 @@ void CClientLeafSystem::AddRenderableToLeaf( int leaf, ClientRenderHandle_t rend
 }
 
 
+//-----------------------------------------------------------------------------
+// Re-adds the shadows in all the leaves a renderable is in
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::AddLeafShadowsToRenderable( ClientRenderHandle_t handle )
+{
+	if ( !ShouldRenderableReceiveShadow( handle, SHADOW_FLAGS_PROJECTED_TEXTURE_TYPE_MASK ) )
+		return;
+
+	// Make sure each shadow is added exactly once to the renderable
+	m_ShadowEnum++;
+
+	for ( unsigned short i = m_RenderablesInLeaf.FirstBucket( handle ); i != m_RenderablesInLeaf.InvalidIndex(); i = m_RenderablesInLeaf.NextBucket( i ) )
+	{
+		AddShadowsInLeafToRenderable( m_RenderablesInLeaf.Bucket( i ), handle );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Adds a renderable to a set of leaves
 //-----------------------------------------------------------------------------
@@ -1182,8 +1486,17 @@ void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t &handle )
 void CClientLeafSystem::RemoveFromTree( ClientRenderHandle_t handle )
 {
 	m_RenderablesInLeaf.RemoveElement( handle );
+	m_Renderables[handle].m_Flags &= ~RENDER_FLAGS_LEAFCACHE_VALID;
+
+	RemoveShadowsFromRenderable( handle );
+}
 
-	// Remove all shadows cast onto the object
+
+//-----------------------------------------------------------------------------
+// Removes all shadows cast onto a renderable
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::RemoveShadowsFromRenderable( ClientRenderHandle_t handle )
+{
 	m_ShadowsOnRenderable.RemoveBucket( handle );
 
 	// If the renderable is a brush model, then remove all shadows from it
@@ -147,6 +147,11 @@ public:
 	// Get at the location of the texture
 	void			GetTextureRect(TextureHandle_t handle, int& x, int& y, int& w, int& h );
 
+	// Get at the block the texture lives in, and how many fragments that block holds
+	int				GetTextureBlock( TextureHandle_t handle );
+	int				GetBlockFragmentCount( int block ) const;
+	void			GetBlockRect( int block, int& x, int& y, int& w, int& h ) const;
+
 	// Get at the texture it's a part of
 	ITexture		*GetTexture();
 	
@@ -673,6 +678,33 @@ void CTextureAllocator::GetTextureRect(TextureHandle_t handle, int& x, int& y, i
 }
 
 
+//-----------------------------------------------------------------------------
+// Returns the block in the page a texture lives in
+//-----------------------------------------------------------------------------
+int CTextureAllocator::GetTextureBlock( TextureHandle_t handle )
+{
+	TextureInfo_t& info = m_Textures[handle];
+	Assert( info.m_Fragment != INVALID_FRAGMENT_HANDLE );
+	return m_Fragments[info.m_Fragment].m_Block;
+}
+
+int CTextureAllocator::GetBlockFragmentCount( int block ) const
+{
+	int fragmentsPerRow = BLOCK_SIZE >> m_Blocks[block].m_FragmentPower;
+	return fragmentsPerRow * fragmentsPerRow;
+}
+
+void CTextureAllocator::GetBlockRect( int block, int& x, int& y, int& w, int& h ) const
+{
+	int blockY = block / BLOCKS_PER_ROW;
+	int blockX = block - blockY * BLOCKS_PER_ROW;
+	x = blockX * BLOCK_SIZE;
+	y = blockY * BLOCK_SIZE;
+	w = BLOCK_SIZE;
+	h = BLOCK_SIZE;
+}
+
+
 //-----------------------------------------------------------------------------
 // Defines how big of a shadow texture we should be making per caster...
 //-----------------------------------------------------------------------------
@@ -819,12 +851,53 @@ private:
 		EHANDLE					m_hTargetEntity;
 	};
 
+	enum ShadowBuildType_t
+	{
+		SHADOW_BUILD_ORTHO = 0,
+		SHADOW_BUILD_RENDER_TO_TEXTURE,
+		SHADOW_BUILD_FLASHLIGHT,
+	};
+
+	// The projection of a shadow or flashlight. Everything in here is computed
+	// without touching the material or shadow systems, so the compute step can
+	// run on worker threads; the commit step must happen on the main thread.
+	struct ShadowBuild_t
+	{
+		ClientShadowHandle_t	m_hShadow;
+		IClientRenderable		*m_pRenderable;
+		int						m_nBuildType;	// ShadowBuildType_t
+
+		Vector					m_vecMins;
+		Vector					m_vecMaxs;
+		Vector					m_vecWorldOrigin;
+		Vector					m_vecShadowDir;
+		Vector2D				m_vecSize;
+		VMatrix					m_matWorldToTexture;
+		float					m_flMaxHeight;
+		float					m_flFalloffStart;
+
+		int						m_nClipPlaneCount;
+		Vector					m_vecClipPlaneNormal[MAX_CLIP_PLANE_COUNT];
+		float					m_flClipPlaneDist[MAX_CLIP_PLANE_COUNT];
+
+		CUtlVector< int >		m_LeafList;
+	};
+
 private:
 	// Shadow update functions
 	void UpdateStudioShadow( IClientRenderable *pRenderable, ClientShadowHandle_t handle );
 	void UpdateBrushShadow( IClientRenderable *pRenderable, ClientShadowHandle_t handle );
+	void UpdateModelShadow( IClientRenderable *pRenderable, ClientShadowHandle_t handle );
 	void UpdateShadow( ClientShadowHandle_t handle, bool force );
 
+	// Builds a shadow projection now, or queues it up when batching dirty shadows
+	void BuildShadow( IClientRenderable *pRenderable, ClientShadowHandle_t handle, ShadowBuildType_t type );
+	void BuildDeferredShadows();
+	void ComputeShadowBuild( ShadowBuild_t &build );
+	void CommitShadowBuild( ShadowBuild_t &build );
+	void ShadowBuildLock();
+	void ShadowBuildUnlock();
+
 	// Gets the entity whose shadow this shadow will render into
 	IClientRenderable *GetParentShadowEntity( ClientShadowHandle_t handle );
 
@@ -857,23 +930,24 @@ private:
 	ShadowType_t GetActualShadowCastType( IClientRenderable *pRenderable ) const;
 
 	// Builds a simple blobby shadow
-	void BuildOrthoShadow( IClientRenderable* pRenderable, ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs);
+	void BuildOrthoShadow( ShadowBuild_t &build );
 
 	// Builds a more complex shadow...
-	void BuildRenderToTextureShadow( IClientRenderable* pRenderable, 
-			ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs );
+	void BuildRenderToTextureShadow( ShadowBuild_t &build );
+
+	// Hands a built blobby or render-to-texture shadow to the shadow + leaf systems
+	void ProjectBuiltShadow( ShadowBuild_t &build );
 
 	// Build a projected-texture flashlight
-	void BuildFlashlight( ClientShadowHandle_t handle );
+	void BuildFlashlight( ShadowBuild_t &build );
+	void ProjectBuiltFlashlight( ShadowBuild_t &build );
 
 	// Does all the lovely stuff we need to do to have render-to-texture shadows
 	void SetupRenderToTextureShadow( ClientShadowHandle_t h );
 	void CleanUpRenderToTextureShadow( ClientShadowHandle_t h );
 
 	// Compute the extra shadow planes
-	void ComputeExtraClipPlanes( IClientRenderable* pRenderable, 
-		ClientShadowHandle_t handle, const Vector* vec, 
-		const Vector& mins, const Vector& maxs, const Vector& localShadowDir );
+	void ComputeExtraClipPlanes( ShadowBuild_t &build, const Vector* vec, const Vector& localShadowDir );
 
 	// Set extra clip planes related to shadows...
 	void ClearExtraClipPlanes( ClientShadowHandle_t h );
@@ -887,10 +961,15 @@ private:
 	// Causes all shadows to be re-updated
 	void UpdateAllShadows();
 
-	// One of these gets called with every shadow that potentially will need to re-render
+	// One of these gets called with every shadow that potentially will need to re-render;
+	// returns true if the shadow was queued up to be redrawn
 	bool DrawRenderToTextureShadow( unsigned short clientShadowHandle, float flArea );
 	void DrawRenderToTextureShadowLOD( unsigned short clientShadowHandle );
 
+	// Redraws the queued shadow textures, one texture page block at a time
+	void DrawQueuedRenderToTextureShadows();
+	void RedrawRenderToTextureShadow( unsigned short clientShadowHandle, bool bClear );
+
 	// Draws all children shadows into our own
 	bool DrawShadowHierarchy( IClientRenderable *pRenderable, const ClientShadow_t &shadow, bool bChild = false );
 
@@ -957,12 +1036,17 @@ private:
 	bool m_RenderToTextureActive;
 	bool m_bRenderTargetNeedsClear;
 	bool m_bUpdatingDirtyShadows;
+	bool m_bDeferShadowBuilds;
 	bool m_bThreaded;
 	float m_flShadowCastDist;
 	float m_flMinShadowArea;
 	CUtlRBTree< ClientShadowHandle_t, unsigned short >	m_DirtyShadows;
 	CUtlVector< ClientShadowHandle_t > m_TransparentShadows;
 
+	// Dirty shadows queued up during PreRender; never shrunk so the leaf lists keep their memory
+	CUtlVector< ShadowBuild_t > m_ShadowBuilds;
+	int m_nShadowBuildCount;
+
 	// These members maintain current state of depth texturing (size and global active state)
 	// If either changes in a frame, PreRender() will catch it and do the appropriate allocation, deallocation or reallocation
 	bool m_bDepthTextureActive;
@@ -1022,6 +1106,22 @@ static CVisibleShadowList			s_VisibleShadowList;
 //
 //-----------------------------------------------------------------------------
 static CUtlVector<C_BaseAnimating *> s_NPCShadowBoneSetups;
+
+// Shadow textures that need to be redrawn this frame, sorted by the texture page block they live in
+struct ShadowTextureDraw_t
+{
+	unsigned short	m_hShadow;
+	unsigned short	m_nBlock;
+	int				m_nOrder;
+};
+static CUtlVector<ShadowTextureDraw_t> s_ShadowTextureDraws;
+
+static int __cdecl ShadowTextureDrawCompare( const ShadowTextureDraw_t *pLeft, const ShadowTextureDraw_t *pRight )
+{
+	if ( pLeft->m_nBlock != pRight->m_nBlock )
+		return (int)pLeft->m_nBlock - (int)pRight->m_nBlock;
+	return pLeft->m_nOrder - pRight->m_nOrder;
+}
 static CUtlVector<C_BaseAnimating *> s_NonNPCShadowBoneSetups;
 
 //-----------------------------------------------------------------------------
@@ -1172,6 +1272,9 @@ CClientShadowMgr::CClientShadowMgr() :
 {
 	m_nDepthTextureResolution = r_flashlightdepthres.GetInt();
 	m_bThreaded = false;
+	m_bUpdatingDirtyShadows = false;
+	m_bDeferShadowBuilds = false;
+	m_nShadowBuildCount = 0;
 }
 
 
@@ -2171,13 +2274,14 @@ void CClientShadowMgr::AddExtraClipPlane( ClientShadowHandle_t h, const Vector&
 //-----------------------------------------------------------------------------
 // Compute the extra shadow planes
 //-----------------------------------------------------------------------------
-void CClientShadowMgr::ComputeExtraClipPlanes( IClientRenderable* pRenderable, 
-	ClientShadowHandle_t handle, const Vector* vec, 
-	const Vector& mins, const Vector& maxs, const Vector& localShadowDir )
+void CClientShadowMgr::ComputeExtraClipPlanes( ShadowBuild_t &build, const Vector* vec, const Vector& localShadowDir )
 {
+	const Vector &mins = build.m_vecMins;
+	const Vector &maxs = build.m_vecMaxs;
+
 	// Compute the world-space position of the corner of the bounding box
 	// that's got the highest dotproduct with the local shadow dir...
-	Vector origin = pRenderable->GetRenderOrigin( );
+	Vector origin = build.m_pRenderable->GetRenderOrigin( );
 	float dir[3];
 
 	int i;
@@ -2197,22 +2301,25 @@ void CClientShadowMgr::ComputeExtraClipPlanes( IClientRenderable* pRenderable,
 
 	// Now that we have it, create 3 planes...
 	Vector normal;
-	ClearExtraClipPlanes(handle);
+	build.m_nClipPlaneCount = 0;
 	for ( i = 0; i < 3; ++i )
 	{
 		VectorMultiply( vec[i], dir[i], normal );
-		float dist = DotProduct( normal, origin );
-		AddExtraClipPlane( handle, normal, dist );
+		build.m_vecClipPlaneNormal[build.m_nClipPlaneCount] = normal;
+		build.m_flClipPlaneDist[build.m_nClipPlaneCount] = DotProduct( normal, origin );
+		++build.m_nClipPlaneCount;
 	}
 
-	ClientShadow_t& shadow = m_Shadows[handle];
+	ClientShadow_t& shadow = m_Shadows[build.m_hShadow];
 	C_BaseEntity *pEntity = ClientEntityList().GetBaseEntityFromHandle( shadow.m_Entity );
 	if ( pEntity && pEntity->m_bEnableRenderingClipPlane )
 	{
 		normal[ 0 ] = -pEntity->m_fRenderingClipPlane[ 0 ];
 		normal[ 1 ] = -pEntity->m_fRenderingClipPlane[ 1 ];
 		normal[ 2 ] = -pEntity->m_fRenderingClipPlane[ 2 ];
-		AddExtraClipPlane( handle, normal, -pEntity->m_fRenderingClipPlane[ 3 ] - 0.5f );
+		build.m_vecClipPlaneNormal[build.m_nClipPlaneCount] = normal;
+		build.m_flClipPlaneDist[build.m_nClipPlaneCount] = -pEntity->m_fRenderingClipPlane[ 3 ] - 0.5f;
+		++build.m_nClipPlaneCount;
 	}
 }
 
@@ -2250,22 +2357,26 @@ inline ShadowType_t CClientShadowMgr::GetActualShadowCastType( IClientRenderable
 class CShadowLeafEnum : public ISpatialLeafEnumerator
 {
 public:
+	CShadowLeafEnum( CUtlVector< int > &leafList ) : m_LeafList( leafList ) {}
+
 	bool EnumerateLeaf( int leaf, int context )
 	{
 		m_LeafList.AddToTail( leaf );
 		return true;
 	}
 
-	CUtlVectorFixedGrowable< int, 512 > m_LeafList;
+	CUtlVector< int > &m_LeafList;
 };
 
 
 //-----------------------------------------------------------------------------
 // Builds a list of leaves inside the shadow volume
 //-----------------------------------------------------------------------------
-static void BuildShadowLeafList( CShadowLeafEnum *pEnum, const Vector& origin, 
+static void BuildShadowLeafList( CUtlVector< int > &leafList, const Vector& origin, 
 	const Vector& dir, const Vector2D& size, float maxDist )
 {
+	CShadowLeafEnum leafEnum( leafList );
+
 	Ray_t ray;
 	VectorCopy( origin, ray.m_Start );
 	VectorMultiply( dir, maxDist, ray.m_Delta );
@@ -2277,16 +2388,20 @@ static void BuildShadowLeafList( CShadowLeafEnum *pEnum, const Vector& origin,
 	ray.m_IsSwept = true;
 
 	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
-	pQuery->EnumerateLeavesAlongRay( ray, pEnum, 0 );
+	pQuery->EnumerateLeavesAlongRay( ray, &leafEnum, 0 );
 }
 
 
 //-----------------------------------------------------------------------------
 // Builds a simple blobby shadow
 //-----------------------------------------------------------------------------
-void CClientShadowMgr::BuildOrthoShadow( IClientRenderable* pRenderable, 
-		ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs)
+void CClientShadowMgr::BuildOrthoShadow( ShadowBuild_t &build )
 {
+	IClientRenderable *pRenderable = build.m_pRenderable;
+	ClientShadowHandle_t handle = build.m_hShadow;
+	const Vector &mins = build.m_vecMins;
+	const Vector &maxs = build.m_vecMaxs;
+
 	// Get the object's basis
 	Vector vec[3];
 	AngleVectors( pRenderable->GetRenderAngles(), &vec[0], &vec[1], &vec[2] );
@@ -2368,21 +2483,46 @@ void CClientShadowMgr::BuildOrthoShadow( IClientRenderable* pRenderable,
 	float flShadowCastDistance = GetShadowDistance( pRenderable );
 	float maxHeight = flShadowCastDistance + falloffStart; //3.0f * sqrt( shadowArea );
 
-	CShadowLeafEnum leafList;
-	BuildShadowLeafList( &leafList, worldOrigin, vecShadowDir, size, maxHeight );
-	int nCount = leafList.m_LeafList.Count();
-	const int *pLeafList = leafList.m_LeafList.Base();
+	build.m_vecWorldOrigin = worldOrigin;
+	build.m_vecShadowDir = vecShadowDir;
+	build.m_vecSize = size;
+	build.m_matWorldToTexture = matWorldToTexture;
+	build.m_flMaxHeight = maxHeight;
+	build.m_flFalloffStart = falloffStart;
 
-	shadowmgr->ProjectShadow( m_Shadows[handle].m_ShadowHandle, worldOrigin,
-		vecShadowDir, matWorldToTexture, size, nCount, pLeafList, maxHeight, falloffStart, MAX_FALLOFF_AMOUNT, pRenderable->GetRenderOrigin() );
+	BuildShadowLeafList( build.m_LeafList, worldOrigin, vecShadowDir, size, maxHeight );
 
 	// Compute extra clip planes to prevent poke-thru
 // FIXME!!!!!!!!!!!!!!  Removing this for now since it seems to mess up the blobby shadows.
-//	ComputeExtraClipPlanes( pEnt, handle, vec, mins, maxs, localShadowDir );
+//	ComputeExtraClipPlanes( build, vec, localShadowDir );
+}
+
+
+//-----------------------------------------------------------------------------
+// Projects a built blobby or render-to-texture shadow
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ProjectBuiltShadow( ShadowBuild_t &build )
+{
+	ClientShadow_t &shadow = m_Shadows[build.m_hShadow];
+	int nCount = build.m_LeafList.Count();
+	const int *pLeafList = build.m_LeafList.Base();
+
+	shadowmgr->ProjectShadow( shadow.m_ShadowHandle, build.m_vecWorldOrigin, build.m_vecShadowDir, 
+		build.m_matWorldToTexture, build.m_vecSize, nCount, pLeafList, build.m_flMaxHeight, 
+		build.m_flFalloffStart, MAX_FALLOFF_AMOUNT, build.m_pRenderable->GetRenderOrigin() );
+
+	if ( build.m_nBuildType == SHADOW_BUILD_RENDER_TO_TEXTURE )
+	{
+		ClearExtraClipPlanes( build.m_hShadow );
+		for ( int i = 0; i < build.m_nClipPlaneCount; ++i )
+		{
+			AddExtraClipPlane( build.m_hShadow, build.m_vecClipPlaneNormal[i], build.m_flClipPlaneDist[i] );
+		}
+	}
 
 	// Add the shadow to the client leaf system so it correctly marks 
 	// leafs as being affected by a particular shadow
-	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
+	ClientLeafSystem()->ProjectShadow( shadow.m_ClientLeafShadowHandle, nCount, pLeafList );
 }
 
 
@@ -2461,14 +2601,12 @@ extern ConVar cl_shadowtextureoverlaysize;
 //-----------------------------------------------------------------------------
 // Builds a more complex shadow...
 //-----------------------------------------------------------------------------
-void CClientShadowMgr::BuildRenderToTextureShadow( IClientRenderable* pRenderable, 
-		ClientShadowHandle_t handle, const Vector& mins, const Vector& maxs)
+void CClientShadowMgr::BuildRenderToTextureShadow( ShadowBuild_t &build )
 {
-	if ( cl_drawshadowtexture.GetInt() )
-	{
-		// Red wireframe bounding box around objects whose RTT shadows are being updated that frame
-		DrawRenderToTextureDebugInfo( pRenderable, mins, maxs );
-	}
+	IClientRenderable *pRenderable = build.m_pRenderable;
+	ClientShadowHandle_t handle = build.m_hShadow;
+	const Vector &mins = build.m_vecMins;
+	const Vector &maxs = build.m_vecMaxs;
 
 	// Get the object's basis
 	Vector vec[3];
@@ -2548,20 +2686,17 @@ void CClientShadowMgr::BuildRenderToTextureShadow( IClientRenderable* pRenderabl
 	float flShadowCastDistance = GetShadowDistance( pRenderable );
 	float maxHeight = flShadowCastDistance + falloffStart; //3.0f * sqrt( shadowArea );
 
-	CShadowLeafEnum leafList;
-	BuildShadowLeafList( &leafList, worldOrigin, vecShadowDir, size, maxHeight );
-	int nCount = leafList.m_LeafList.Count();
-	const int *pLeafList = leafList.m_LeafList.Base();
+	build.m_vecWorldOrigin = worldOrigin;
+	build.m_vecShadowDir = vecShadowDir;
+	build.m_vecSize = size;
+	build.m_matWorldToTexture = matWorldToTexture;
+	build.m_flMaxHeight = maxHeight;
+	build.m_flFalloffStart = falloffStart;
 
-	shadowmgr->ProjectShadow( m_Shadows[handle].m_ShadowHandle, worldOrigin, 
-		vecShadowDir, matWorldToTexture, size, nCount, pLeafList, maxHeight, falloffStart, MAX_FALLOFF_AMOUNT, pRenderable->GetRenderOrigin() );
+	BuildShadowLeafList( build.m_LeafList, worldOrigin, vecShadowDir, size, maxHeight );
 
 	// Compute extra clip planes to prevent poke-thru
-	ComputeExtraClipPlanes( pRenderable, handle, vec, mins, maxs, localShadowDir );
-
-	// Add the shadow to the client leaf system so it correctly marks 
-	// leafs as being affected by a particular shadow
-	ClientLeafSystem()->ProjectShadow( m_Shadows[handle].m_ClientLeafShadowHandle, nCount, pLeafList );
+	ComputeExtraClipPlanes( build, vec, localShadowDir );
 }
 
 static void LineDrawHelper( const Vector &startShadowSpace, const Vector &endShadowSpace, 
@@ -2605,20 +2740,38 @@ static void DebugDrawFrustum( const Vector &vOrigin, const VMatrix &matWorldToFl
 //-----------------------------------------------------------------------------
 // Builds a list of leaves inside the flashlight volume
 //-----------------------------------------------------------------------------
-static void BuildFlashlightLeafList( CShadowLeafEnum *pEnum, const VMatrix &worldToShadow )
+static void BuildFlashlightLeafList( CUtlVector< int > &leafList, const VMatrix &worldToShadow )
 {
 	// Use an AABB around the frustum to enumerate leaves.
 	Vector mins, maxs;
 	CalculateAABBFromProjectionMatrix( worldToShadow, &mins, &maxs );
+	CShadowLeafEnum leafEnum( leafList );
 	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
-	pQuery->EnumerateLeavesInBox( mins, maxs, pEnum, 0 );
+	pQuery->EnumerateLeavesInBox( mins, maxs, &leafEnum, 0 );
 }
 
 
-void CClientShadowMgr::BuildFlashlight( ClientShadowHandle_t handle )
+void CClientShadowMgr::BuildFlashlight( ShadowBuild_t &build )
 {
 	// For the 360, we just draw flashlights with the main geometry
 	// and bypass the entire shadow casting system.
+	if ( IsX360() || r_flashlight_version2.GetInt() )
+		return;
+
+	ClientShadow_t &shadow = m_Shadows[build.m_hShadow];
+	bool bLightModels = r_flashlightmodels.GetBool();
+	bool bLightSpecificEntity = shadow.m_hTargetEntity.Get() != NULL;
+	bool bLightWorld = ( shadow.m_Flags & SHADOW_FLAGS_LIGHT_WORLD ) != 0;
+	if ( bLightWorld || ( bLightModels && !bLightSpecificEntity ) )
+	{
+		BuildFlashlightLeafList( build.m_LeafList, shadow.m_WorldToShadow );
+	}
+}
+
+
+void CClientShadowMgr::ProjectBuiltFlashlight( ShadowBuild_t &build )
+{
+	ClientShadowHandle_t handle = build.m_hShadow;
 	ClientShadow_t &shadow = m_Shadows[handle];
 	if ( IsX360() || r_flashlight_version2.GetInt() )
 	{
@@ -2627,23 +2780,14 @@ void CClientShadowMgr::BuildFlashlight( ClientShadowHandle_t handle )
 		return;
 	}
 
-	VPROF_BUDGET( "CClientShadowMgr::BuildFlashlight", VPROF_BUDGETGROUP_SHADOW_DEPTH_TEXTURING );
+	VPROF_BUDGET( "CClientShadowMgr::ProjectBuiltFlashlight", VPROF_BUDGETGROUP_SHADOW_DEPTH_TEXTURING );
 
 	bool bLightModels = r_flashlightmodels.GetBool();
 	bool bLightSpecificEntity = shadow.m_hTargetEntity.Get() != NULL;
-	bool bLightWorld = ( shadow.m_Flags & SHADOW_FLAGS_LIGHT_WORLD ) != 0;
-	int nCount = 0;
-	const int *pLeafList = 0;
+	int nCount = build.m_LeafList.Count();
+	const int *pLeafList = build.m_LeafList.Base();
 
-	CShadowLeafEnum leafList;
-	if ( bLightWorld || ( bLightModels && !bLightSpecificEntity ) )
-	{
-		BuildFlashlightLeafList( &leafList, shadow.m_WorldToShadow );
-		nCount = leafList.m_LeafList.Count();
-		pLeafList = leafList.m_LeafList.Base();
-	}
-
-	if( bLightWorld )
+	if( shadow.m_Flags & SHADOW_FLAGS_LIGHT_WORLD )
 	{
 		shadowmgr->ProjectFlashlight( shadow.m_ShadowHandle, shadow.m_WorldToShadow, nCount, pLeafList );
 	}
@@ -2758,22 +2902,19 @@ void CClientShadowMgr::UpdateStudioShadow( IClientRenderable *pRenderable, Clien
 {
 	if( !( m_Shadows[handle].m_Flags & SHADOW_FLAGS_FLASHLIGHT ) )
 	{
-		Vector mins, maxs;
-		ComputeHierarchicalBounds( pRenderable, mins, maxs );
-
 		ShadowType_t shadowType = GetActualShadowCastType( handle );
 		if ( shadowType != SHADOWS_RENDER_TO_TEXTURE )
 		{
-			BuildOrthoShadow( pRenderable, handle, mins, maxs );
+			BuildShadow( pRenderable, handle, SHADOW_BUILD_ORTHO );
 		}
 		else
 		{
-			BuildRenderToTextureShadow( pRenderable, handle, mins, maxs );
+			BuildShadow( pRenderable, handle, SHADOW_BUILD_RENDER_TO_TEXTURE );
 		}
 	}
 	else
 	{
-		BuildFlashlight( handle );
+		BuildShadow( pRenderable, handle, SHADOW_BUILD_FLASHLIGHT );
 	}
 }
 
@@ -2781,28 +2922,174 @@ void CClientShadowMgr::UpdateBrushShadow( IClientRenderable *pRenderable, Client
 {
 	if( !( m_Shadows[handle].m_Flags & SHADOW_FLAGS_FLASHLIGHT ) )
 	{
-		// Compute the bounding box in the space of the shadow...
-		Vector mins, maxs;
-		ComputeHierarchicalBounds( pRenderable, mins, maxs );
-
 		ShadowType_t shadowType = GetActualShadowCastType( handle );
 		if ( shadowType != SHADOWS_RENDER_TO_TEXTURE )
 		{
-			BuildOrthoShadow( pRenderable, handle, mins, maxs );
+			BuildShadow( pRenderable, handle, SHADOW_BUILD_ORTHO );
 		}
 		else
 		{
-			BuildRenderToTextureShadow( pRenderable, handle, mins, maxs );
+			BuildShadow( pRenderable, handle, SHADOW_BUILD_RENDER_TO_TEXTURE );
 		}
 	}
 	else
 	{
 		VPROF_BUDGET( "CClientShadowMgr::UpdateBrushShadow", VPROF_BUDGETGROUP_SHADOW_DEPTH_TEXTURING );
 
-		BuildFlashlight( handle );
+		BuildShadow( pRenderable, handle, SHADOW_BUILD_FLASHLIGHT );
+	}
+}
+
+void CClientShadowMgr::UpdateModelShadow( IClientRenderable *pRenderable, ClientShadowHandle_t handle )
+{
+	const model_t *pModel = pRenderable->GetModel();
+	switch( modelinfo->GetModelType( pModel ) )
+	{
+	case mod_brush:
+		UpdateBrushShadow( pRenderable, handle );
+		break;
+
+	case mod_studio:
+		UpdateStudioShadow( pRenderable, handle );
+		break;
+
+	default:
+		// Shouldn't get here if not a brush or studio
+		Assert(0);
+		break;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds a shadow projection. While PreRender is batching up the dirty shadows
+// this only queues it; the build happens in BuildDeferredShadows.
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::BuildShadow( IClientRenderable *pRenderable, ClientShadowHandle_t handle, ShadowBuildType_t type )
+{
+	if ( m_bDeferShadowBuilds )
+	{
+		if ( m_ShadowBuilds.Count() <= m_nShadowBuildCount )
+		{
+			m_ShadowBuilds.AddToTail();
+		}
+
+		ShadowBuild_t &build = m_ShadowBuilds[m_nShadowBuildCount++];
+		build.m_hShadow = handle;
+		build.m_pRenderable = pRenderable;
+		build.m_nBuildType = type;
+		return;
+	}
+
+	ShadowBuild_t build;
+	build.m_hShadow = handle;
+	build.m_pRenderable = pRenderable;
+	build.m_nBuildType = type;
+	ComputeShadowBuild( build );
+	CommitShadowBuild( build );
+}
+
+
+//-----------------------------------------------------------------------------
+// Computes matrices, bounds and leaves of a shadow. Safe to run on a worker
+// thread as long as the mdlcache is locked.
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ComputeShadowBuild( ShadowBuild_t &build )
+{
+	build.m_LeafList.RemoveAll();
+	build.m_nClipPlaneCount = 0;
+
+	switch( build.m_nBuildType )
+	{
+	case SHADOW_BUILD_ORTHO:
+		ComputeHierarchicalBounds( build.m_pRenderable, build.m_vecMins, build.m_vecMaxs );
+		BuildOrthoShadow( build );
+		break;
+
+	case SHADOW_BUILD_RENDER_TO_TEXTURE:
+		ComputeHierarchicalBounds( build.m_pRenderable, build.m_vecMins, build.m_vecMaxs );
+		BuildRenderToTextureShadow( build );
+		break;
+
+	case SHADOW_BUILD_FLASHLIGHT:
+		BuildFlashlight( build );
+		break;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Hands a computed shadow to the engine's shadow manager and the leaf system
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::CommitShadowBuild( ShadowBuild_t &build )
+{
+	switch( build.m_nBuildType )
+	{
+	case SHADOW_BUILD_ORTHO:
+		ProjectBuiltShadow( build );
+		break;
+
+	case SHADOW_BUILD_RENDER_TO_TEXTURE:
+		if ( cl_drawshadowtexture.GetInt() )
+		{
+			// Red wireframe bounding box around objects whose RTT shadows are being updated that frame
+			DrawRenderToTextureDebugInfo( build.m_pRenderable, build.m_vecMins, build.m_vecMaxs );
+		}
+		ProjectBuiltShadow( build );
+		break;
+
+	case SHADOW_BUILD_FLASHLIGHT:
+		ProjectBuiltFlashlight( build );
+		break;
 	}
 }
 
+void CClientShadowMgr::ShadowBuildLock()
+{
+	mdlcache->BeginLock();
+}
+
+void CClientShadowMgr::ShadowBuildUnlock()
+{
+	mdlcache->EndLock();
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds all shadows queued up by PreRender
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::BuildDeferredShadows()
+{
+	int nCount = m_nShadowBuildCount;
+	m_nShadowBuildCount = 0;
+	if ( nCount == 0 )
+		return;
+
+	bool bThreaded = ( nCount > 4 && r_threaded_client_shadow_manager.GetBool() && g_pThreadPool->NumThreads() );
+	if ( bThreaded )
+	{
+		ParallelProcess( "CClientShadowMgr::ComputeShadowBuild", m_ShadowBuilds.Base(), nCount, this, 
+			&CClientShadowMgr::ComputeShadowBuild, &CClientShadowMgr::ShadowBuildLock, &CClientShadowMgr::ShadowBuildUnlock );
+	}
+	else
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			ComputeShadowBuild( m_ShadowBuilds[i] );
+		}
+	}
+
+	// The shadow manager calls happen here, in the same order the shadows were dirtied
+	CMatRenderContextPtr pRenderContext( materials );
+	MaterialFogMode_t fogMode = pRenderContext->GetFogMode();
+	pRenderContext->FogMode( MATERIAL_FOG_NONE );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		CommitShadowBuild( m_ShadowBuilds[i] );
+	}
+	pRenderContext->FogMode( fogMode );
+}
+
 
 #ifdef _DEBUG
 
@@ -2934,6 +3221,8 @@ void CClientShadowMgr::PreRender()
 
 	m_bUpdatingDirtyShadows = true;
 
+	// Figure out which shadows need to be rebuilt, then build them all at once
+	m_bDeferShadowBuilds = true;
 	unsigned short i = m_DirtyShadows.FirstInorder();
 	while ( i != m_DirtyShadows.InvalidIndex() )
 	{
@@ -2944,6 +3233,9 @@ void CClientShadowMgr::PreRender()
 		i = m_DirtyShadows.NextInorder(i);
 	}
 	m_DirtyShadows.RemoveAll();
+	m_bDeferShadowBuilds = false;
+
+	BuildDeferredShadows();
 
 	// Transparent shadows must remain dirty, since they were not re-projected
 	int nCount = m_TransparentShadows.Count();
@@ -3136,26 +3428,19 @@ void CClientShadowMgr::UpdateShadow( ClientShadowHandle_t handle, bool force )
 		VectorCopy( origin, shadow.m_LastOrigin );
 		VectorCopy( angles, shadow.m_LastAngles );
 
-		CMatRenderContextPtr pRenderContext( materials );
-		const model_t *pModel = pRenderable->GetModel();
-		MaterialFogMode_t fogMode = pRenderContext->GetFogMode();
-		pRenderContext->FogMode( MATERIAL_FOG_NONE );
-		switch( modelinfo->GetModelType( pModel ) )
+		if ( m_bDeferShadowBuilds )
 		{
-		case mod_brush:
-			UpdateBrushShadow( pRenderable, handle );
-			break;
-
-		case mod_studio:
-			UpdateStudioShadow( pRenderable, handle );
-			break;
-
-		default:
-			// Shouldn't get here if not a brush or studio
-			Assert(0);
-			break;
+			// BuildDeferredShadows sets up the fog state once for the whole batch
+			UpdateModelShadow( pRenderable, handle );
+		}
+		else
+		{
+			CMatRenderContextPtr pRenderContext( materials );
+			MaterialFogMode_t fogMode = pRenderContext->GetFogMode();
+			pRenderContext->FogMode( MATERIAL_FOG_NONE );
+			UpdateModelShadow( pRenderable, handle );
+			pRenderContext->FogMode( fogMode );
 		}
-		pRenderContext->FogMode( fogMode );
 	}
 
 	// NOTE: We can't do this earlier because pEnt->GetRenderOrigin() can
@@ -3741,8 +4026,9 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 	}
 
 	// Mark texture as being used...
+	// NOTE: UseTexture never steals a fragment that was already used this frame,
+	// so it's fine to select every texture before drawing any of them
 	bool bDirtyTexture = (shadow.m_Flags & SHADOW_FLAGS_TEXTURE_DIRTY) != 0;
-	bool bDrewTexture = false;
 	bool bNeedsRedraw = ( !m_bThreaded && m_ShadowAllocator.UseTexture( shadow.m_ShadowTexture, bDirtyTexture, flArea ) );
 
 	if ( !m_ShadowAllocator.HasValidTexture( shadow.m_ShadowTexture ) )
@@ -3753,58 +4039,123 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 
 	if ( bNeedsRedraw || bDirtyTexture )
 	{
-		// shadow to be redrawn; for now, we'll always do it.
-		IClientRenderable *pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
-
-		CMatRenderContextPtr pRenderContext( materials );
-		
-		// Sets the viewport state
+		int i = s_ShadowTextureDraws.AddToTail();
+		s_ShadowTextureDraws[i].m_hShadow = clientShadowHandle;
+		s_ShadowTextureDraws[i].m_nBlock = m_ShadowAllocator.GetTextureBlock( shadow.m_ShadowTexture );
+		s_ShadowTextureDraws[i].m_nOrder = i;
+		return true;
+	}
+	
+	if ( bPreviouslyUsingLODShadow )
+	{
+		// In this case, we were previously using the LOD shadow, but we didn't
+		// have to reconstitute the texture. In this case, we need to reset the texcoord
 		int x, y, w, h;
 		m_ShadowAllocator.GetTextureRect( shadow.m_ShadowTexture, x, y, w, h );
-		pRenderContext->Viewport( IsX360() ? 0 : x, IsX360() ? 0 : y, w, h ); 
+		SetRenderToTextureShadowTexCoords( shadow.m_ShadowHandle, x, y, w, h );
+	}
 
-		// Clear the selected viewport only (don't need to clear depth)
-		pRenderContext->ClearBuffers( true, false );
+	return false;
+}
 
-		pRenderContext->MatrixMode( MATERIAL_VIEW );
-		pRenderContext->LoadMatrix( shadowmgr->GetInfo( shadow.m_ShadowHandle ).m_WorldToShadow );
-   
-		if ( DrawShadowHierarchy( pRenderable, shadow ) )
+
+//-----------------------------------------------------------------------------
+// Draws the shadow textures queued up by DrawRenderToTextureShadow. They're
+// drawn a block at a time; blocks in which every fragment gets redrawn are
+// cleared with a single clear instead of one per fragment.
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::DrawQueuedRenderToTextureShadows()
+{
+	int nCount = s_ShadowTextureDraws.Count();
+	if ( nCount == 0 )
+		return;
+
+	s_ShadowTextureDraws.Sort( ShadowTextureDrawCompare );
+
+	CMatRenderContextPtr pRenderContext( materials );
+
+	int nFirst = 0;
+	while ( nFirst < nCount )
+	{
+		int nBlock = s_ShadowTextureDraws[nFirst].m_nBlock;
+		int nLast = nFirst + 1;
+		while ( nLast < nCount && s_ShadowTextureDraws[nLast].m_nBlock == nBlock )
 		{
-			bDrewTexture = true;
-			if ( IsX360() )
-			{
-				// resolve render target to system memory texture
-				Rect_t srcRect = { 0, 0, w, h };
-				Rect_t dstRect = { x, y, w, h };
-				pRenderContext->CopyRenderTargetToTextureEx( m_ShadowAllocator.GetTexture(), 0, &srcRect, &dstRect );
-			}
+			++nLast;
 		}
-		else
+
+		// The 360 renders each fragment at the origin of its edram surface and resolves it, so it can't do this
+		bool bClearBlock = !IsX360() && ( nLast - nFirst == m_ShadowAllocator.GetBlockFragmentCount( nBlock ) );
+		if ( bClearBlock )
 		{
-			// NOTE: Think the flags reset + texcoord set should only happen in DrawShadowHierarchy
-			// but it's 2 days before 360 ship.. not going to change this now.
-			DevMsg( "Didn't draw shadow hierarchy.. bad shadow texcoords probably going to happen..grab Brian!\n" );
+			int x, y, w, h;
+			m_ShadowAllocator.GetBlockRect( nBlock, x, y, w, h );
+			pRenderContext->Viewport( x, y, w, h );
+			pRenderContext->ClearBuffers( true, false );
 		}
 
-		// Only clear the dirty flag if the caster isn't animating
-		if ( (shadow.m_Flags & SHADOW_FLAGS_ANIMATING_SOURCE) == 0 )
+		for ( int i = nFirst; i < nLast; ++i )
 		{
-			shadow.m_Flags &= ~SHADOW_FLAGS_TEXTURE_DIRTY;
+			RedrawRenderToTextureShadow( s_ShadowTextureDraws[i].m_hShadow, !bClearBlock );
 		}
 
-		SetRenderToTextureShadowTexCoords( shadow.m_ShadowHandle, x, y, w, h );
+		nFirst = nLast;
+	}
+
+	s_ShadowTextureDraws.RemoveAll();
+}
+
+
+//-----------------------------------------------------------------------------
+// Renders a shadow caster into its fragment of the shadow texture page
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::RedrawRenderToTextureShadow( unsigned short clientShadowHandle, bool bClear )
+{
+	ClientShadow_t& shadow = m_Shadows[clientShadowHandle];
+
+	// shadow to be redrawn; for now, we'll always do it.
+	IClientRenderable *pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
+
+	CMatRenderContextPtr pRenderContext( materials );
+	
+	// Sets the viewport state
+	int x, y, w, h;
+	m_ShadowAllocator.GetTextureRect( shadow.m_ShadowTexture, x, y, w, h );
+	pRenderContext->Viewport( IsX360() ? 0 : x, IsX360() ? 0 : y, w, h ); 
+
+	// Clear the selected viewport only (don't need to clear depth)
+	if ( bClear )
+	{
+		pRenderContext->ClearBuffers( true, false );
 	}
-	else if ( bPreviouslyUsingLODShadow )
+
+	pRenderContext->MatrixMode( MATERIAL_VIEW );
+	pRenderContext->LoadMatrix( shadowmgr->GetInfo( shadow.m_ShadowHandle ).m_WorldToShadow );
+
+	if ( DrawShadowHierarchy( pRenderable, shadow ) )
 	{
-		// In this case, we were previously using the LOD shadow, but we didn't
-		// have to reconstitute the texture. In this case, we need to reset the texcoord
-		int x, y, w, h;
-		m_ShadowAllocator.GetTextureRect( shadow.m_ShadowTexture, x, y, w, h );
-		SetRenderToTextureShadowTexCoords( shadow.m_ShadowHandle, x, y, w, h );
+		if ( IsX360() )
+		{
+			// resolve render target to system memory texture
+			Rect_t srcRect = { 0, 0, w, h };
+			Rect_t dstRect = { x, y, w, h };
+			pRenderContext->CopyRenderTargetToTextureEx( m_ShadowAllocator.GetTexture(), 0, &srcRect, &dstRect );
+		}
+	}
+	else
+	{
+		// NOTE: Think the flags reset + texcoord set should only happen in DrawShadowHierarchy
+		// but it's 2 days before 360 ship.. not going to change this now.
+		DevMsg( "Didn't draw shadow hierarchy.. bad shadow texcoords probably going to happen..grab Brian!\n" );
 	}
 
-	return bDrewTexture;
+	// Only clear the dirty flag if the caster isn't animating
+	if ( (shadow.m_Flags & SHADOW_FLAGS_ANIMATING_SOURCE) == 0 )
+	{
+		shadow.m_Flags &= ~SHADOW_FLAGS_TEXTURE_DIRTY;
+	}
+
+	SetRenderToTextureShadowTexCoords( shadow.m_ShadowHandle, x, y, w, h );
 }
 
 
@@ -4088,6 +4439,8 @@ void CClientShadowMgr::ComputeShadowTextures( const CViewSetup &view, int leafCo
 		}
 	}
 
+	DrawQueuedRenderToTextureShadows();
+
 	// Render to the backbuffer again
 	pRenderContext->PopRenderTargetAndViewport();
 
@@ -50,6 +50,7 @@ struct model_t;
 
 ConVar cl_detaildist( "cl_detaildist", "1600", 0, "Distance at which detail props are no longer visible" );
 ConVar cl_detailfade( "cl_detailfade", "800", 0, "Distance across which detail props fade in" );
+ConVar cl_detail_incremental_sort( "cl_detail_incremental_sort", "1", 0, "Re-sort fast detail sprites starting from the previous frame's order instead of from scratch" );
 #if defined( USE_DETAIL_SHAPES ) 
 ConVar cl_detail_max_sway( "cl_detail_max_sway", "0", FCVAR_ARCHIVE, "Amplitude of the detail prop sway" );
 ConVar cl_detail_avoid_radius( "cl_detail_avoid_radius", "0", FCVAR_ARCHIVE, "radius around detail sprite to avoid players" );
@@ -334,12 +335,18 @@ class CFastDetailLeafSpriteList : public CClientLeafSubSystemData
 	// simd pointers into larger array - don't free individually or you will be sad
 	FastSpriteX4_t *m_pSprites;
 
+	// back-to-front order of the sprites as of the last time this leaf was drawn. also
+	// points into a larger array. Camera motion is small from frame to frame, so this
+	// is almost sorted already and makes a good starting point for the next sort.
+	int *m_pSortOrder;
+
 	// state for partially drawn sprite lists
 	int m_nNumPendingSprites;
 	int m_nStartSpriteIndex;
 
 	CFastDetailLeafSpriteList( void )
 	{
+		m_pSortOrder = NULL;
 		m_nNumPendingSprites = 0;
 		m_nStartSpriteIndex = 0;
 	}
@@ -462,6 +469,7 @@ private:
 	// Sorts sprites in back-to-front order
 	static bool SortLessFunc( const SortInfo_t &left, const SortInfo_t &right );
 	int SortSpritesBackToFront( int nLeaf, const Vector &viewOrigin, const Vector &viewForward, SortInfo_t *pSortInfo );
+	static bool InsertionSortBackToFront( SortInfo_t *pSortInfo, int nCount );
 
 	// For fast detail object insertion
 	IterationRetval_t EnumElement( int userId, int context );
@@ -472,6 +480,7 @@ private:
 	CUtlVector<DetailPropSpriteDict_t>		m_DetailSpriteDictFlipped;
 	CUtlVector<DetailPropLightstylesLump_t>	m_DetailLighting;
 	FastSpriteX4_t *m_pFastSpriteData;
+	int *m_pFastSpriteSortOrder;
 
 	// Necessary to get sprites to batch correctly
 	CMaterialReference m_DetailSpriteMaterial;
@@ -485,6 +494,8 @@ private:
 	SortInfo_t *m_pSortInfo;
 	SortInfo_t *m_pFastSortInfo;
 	FastSpriteQuadBuildoutBufferX4_t *m_pBuildoutBuffer;
+	fltx4 *m_pFastSpriteDistances;
+	uint8 *m_pFastSpriteCullMasks;
 
 	float m_flDefaultFadeStart;
 	float m_flDefaultFadeEnd;
@@ -1399,9 +1410,12 @@ void CDetailModel::DrawSwayingQuad( CMeshBuilder &meshBuilder, Vector vecOrigin,
 CDetailObjectSystem::CDetailObjectSystem() : m_DetailSpriteDict( 0, 32 ), m_DetailObjectDict( 0, 32 ), m_DetailSpriteDictFlipped( 0, 32 )
 {
 	m_pFastSpriteData = NULL;
+	m_pFastSpriteSortOrder = NULL;
 	m_pSortInfo = NULL;
 	m_pFastSortInfo = NULL;
 	m_pBuildoutBuffer = NULL;
+	m_pFastSpriteDistances = NULL;
+	m_pFastSpriteCullMasks = NULL;
 }
 
 void CDetailObjectSystem::FreeSortBuffers( void )
@@ -1421,6 +1435,21 @@ void CDetailObjectSystem::FreeSortBuffers( void )
 		MemAlloc_FreeAligned(  m_pBuildoutBuffer );
 		m_pBuildoutBuffer = NULL;
 	}
+	if ( m_pFastSpriteDistances )
+	{
+		MemAlloc_FreeAligned(  m_pFastSpriteDistances );
+		m_pFastSpriteDistances = NULL;
+	}
+	if ( m_pFastSpriteCullMasks )
+	{
+		MemAlloc_FreeAligned(  m_pFastSpriteCullMasks );
+		m_pFastSpriteCullMasks = NULL;
+	}
+	if ( m_pFastSpriteSortOrder )
+	{
+		MemAlloc_FreeAligned(  m_pFastSpriteSortOrder );
+		m_pFastSpriteSortOrder = NULL;
+	}
 }
 
 CDetailObjectSystem::~CDetailObjectSystem()
@@ -1750,6 +1779,11 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 			MemAlloc_AllocAligned( 
 				( 1 + nMaxFastInLeaf / 4 ) * sizeof( FastSpriteQuadBuildoutBufferX4_t ),
 				sizeof( fltx4 ) ) );
+
+		m_pFastSpriteDistances = reinterpret_cast<fltx4 *> (
+			MemAlloc_AllocAligned( ( 1 + nMaxFastInLeaf / 4 ) * sizeof( fltx4 ), sizeof( fltx4 ) ) );
+		m_pFastSpriteCullMasks = reinterpret_cast<uint8 *> (
+			MemAlloc_AllocAligned( ( 1 + nMaxFastInLeaf / 4 ) * sizeof( uint8 ), sizeof( fltx4 ) ) );
 	}
 
 	if ( nNumFastSpritesToAllocate )
@@ -1760,6 +1794,8 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 			MemAlloc_AllocAligned( 
 				( nNumFastSpritesToAllocate >> 2 ) * sizeof( FastSpriteX4_t ),
 				sizeof( fltx4 ) ) );
+		m_pFastSpriteSortOrder = reinterpret_cast<int *> (
+			MemAlloc_AllocAligned( nNumFastSpritesToAllocate * sizeof( int ), sizeof( fltx4 ) ) );
 	}
 
 	m_DetailObjects.EnsureCapacity( nNumOldStyleObjects  );
@@ -1789,6 +1825,11 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 					pNew->m_nNumSprites = nNumFastObjectsInCurLeaf;
 					pNew->m_nNumSIMDSprites = ( 3 + nNumFastObjectsInCurLeaf ) >> 2;
 					pNew->m_pSprites = pCurFastSpriteOut;
+					pNew->m_pSortOrder = m_pFastSpriteSortOrder + ( ( pCurFastSpriteOut - m_pFastSpriteData ) << 2 );
+					for ( int j = 0; j < nNumFastObjectsInCurLeaf; j++ )
+					{
+						pNew->m_pSortOrder[j] = j;
+					}
 					pCurFastSpriteOut += pNew->m_nNumSIMDSprites;
 					ClientLeafSystem()->SetSubSystemDataInLeaf( 
 						detailObjectLeaf, CLSUBSYSTEM_DETAILOBJECTS, pNew );
@@ -1874,6 +1915,11 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 			pNew->m_nNumSprites = nNumFastObjectsInCurLeaf;
 			pNew->m_nNumSIMDSprites = ( 3 + nNumFastObjectsInCurLeaf ) >> 2;
 			pNew->m_pSprites = pCurFastSpriteOut;
+			pNew->m_pSortOrder = m_pFastSpriteSortOrder + ( ( pCurFastSpriteOut - m_pFastSpriteData ) << 2 );
+			for ( int j = 0; j < nNumFastObjectsInCurLeaf; j++ )
+			{
+				pNew->m_pSortOrder[j] = j;
+			}
 			pCurFastSpriteOut += pNew->m_nNumSIMDSprites;
 			ClientLeafSystem()->SetSubSystemDataInLeaf( 
 				detailObjectLeaf, CLSUBSYSTEM_DETAILOBJECTS, pNew );
@@ -2041,6 +2087,36 @@ inline bool CDetailObjectSystem::SortLessFunc( const CDetailObjectSystem::SortIn
 }
 
 
+//-----------------------------------------------------------------------------
+// Insertion sort for lists that are nearly in back-to-front order already.
+// Gives up (returning false) once it has moved too many elements, which
+// happens when the view jumped; the caller should do a full sort then.
+//-----------------------------------------------------------------------------
+bool CDetailObjectSystem::InsertionSortBackToFront( SortInfo_t *pSortInfo, int nCount )
+{
+	int nMaxMoves = 8 * nCount;
+	for ( int i = 1; i < nCount; ++i )
+	{
+		SortInfo_t info = pSortInfo[i];
+		int j = i - 1;
+		if ( !SortLessFunc( info, pSortInfo[j] ) )
+			continue;
+
+		do
+		{
+			pSortInfo[j + 1] = pSortInfo[j];
+			--j;
+		} while ( ( j >= 0 ) && SortLessFunc( info, pSortInfo[j] ) );
+		pSortInfo[j + 1] = info;
+
+		nMaxMoves -= i - 1 - j;
+		if ( nMaxMoves < 0 )
+			return false;
+	}
+	return true;
+}
+
+
 int CDetailObjectSystem::SortSpritesBackToFront( int nLeaf, const Vector &viewOrigin, const Vector &viewForward, SortInfo_t *pSortInfo )
 {
 	VPROF_BUDGET( "CDetailObjectSystem::SortSpritesBackToFront", VPROF_BUDGETGROUP_DETAILPROP_RENDERING );
@@ -2137,13 +2213,15 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 												Vector const &viewRight,
 												Vector const &viewUp )
 {
-	// part 1 - do all vertex math, fading, etc into a buffer, using as much simd as we can
+	// part 1 - do all vertex math, fading, etc into a buffer, using as much simd as we can.
+	// the buildout buffer is indexed by simd sprite, so the sort order of the previous
+	// frame remains valid as an index into it.
 	int nSIMDSprites = pData->m_nNumSIMDSprites;
 	FastSpriteX4_t const *pSprites = pData->m_pSprites;
-	SortInfo_t *pOut = m_pFastSortInfo;
 	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = m_pBuildoutBuffer;
-	int curidx = 0;
-	int nLastBfMask = 0;
+	fltx4 *pDistanceOut = m_pFastSpriteDistances;
+	uint8 *pCullMaskOut = m_pFastSpriteCullMasks;
+	int nNumVisibleSIMDSprites = 0;
 
 	FourVectors vecViewPos;
 	vecViewPos.DuplicateVector( viewOrigin );
@@ -2164,8 +2242,10 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 		ofs -= vecViewPos;
 		fltx4 ofsDotFwd = ofs * vecFwd;
 		fltx4 distanceSquared = ofs * ofs;
-		nLastBfMask = TestSignSIMD( OrSIMD( ofsDotFwd, CmpGtSIMD( distanceSquared, maxsqdist ) ) );		//  cull
-		if ( nLastBfMask != 0xf )
+		int nBfMask = TestSignSIMD( OrSIMD( ofsDotFwd, CmpGtSIMD( distanceSquared, maxsqdist ) ) );		//  cull
+		*( pCullMaskOut++ ) = nBfMask;
+		*( pDistanceOut++ ) = distanceSquared;
+		if ( nBfMask != 0xf )
 		{
 			FourVectors dx1;
 			dx1.x = fnegate( ofs.y );
@@ -2202,34 +2282,54 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 			fetch4 = *( ( fltx4 *) ( &pSprites->m_RGBColor[0][0] ) );
 			*( (fltx4 *) ( & ( pQuadBufferOut->m_RGBColor[0][0] ) ) ) = fetch4;
 
-			//!! bug!! store distance
-			// !! speed!! simd?
-			pOut[0].m_nIndex = curidx;
-			pOut[0].m_flDistance = SubFloat( distanceSquared, 0 );
-			pOut[1].m_nIndex = curidx+1;
-			pOut[1].m_flDistance = SubFloat( distanceSquared, 1 );
-			pOut[2].m_nIndex = curidx+2;
-			pOut[2].m_flDistance = SubFloat( distanceSquared, 2 );
-			pOut[3].m_nIndex = curidx+3;
-			pOut[3].m_flDistance = SubFloat( distanceSquared, 3 );
-			curidx += 4;
-			pOut += 4;
-			pQuadBufferOut++;
+			nNumVisibleSIMDSprites++;
 		}
+		pQuadBufferOut++;
 		pSprites++;
 	} while( --nSIMDSprites );
 
-	// adjust count for tail
+	if ( nNumVisibleSIMDSprites == 0 )
+		return 0;
+
+	// part 2 - gather the sprites that survived the cull, in last frame's order. Culled
+	// sprites keep their relative order and get moved to the end of the order list.
+	int nNumSprites = pData->m_nNumSprites;
+	int *pOrder = pData->m_pSortOrder;
+	float const *pDistances = reinterpret_cast<float const *>( m_pFastSpriteDistances );
+	SortInfo_t *pOut = m_pFastSortInfo;
+	int nNumCulled = 0;
+	for ( int i = 0; i < nNumSprites; i++ )
+	{
+		int nIndex = pOrder[i];
+		if ( m_pFastSpriteCullMasks[nIndex >> 2] & ( 1 << ( nIndex & 3 ) ) )
+		{
+			pOrder[nNumCulled++] = nIndex;
+		}
+		else
+		{
+			pOut->m_nIndex = nIndex;
+			pOut->m_flDistance = pDistances[nIndex];
+			pOut++;
+		}
+	}
 	int nCount = pOut - m_pFastSortInfo;
-	if ( nLastBfMask != 0xf )						// if last not skipped
-		nCount -= ( 0 - pData->m_nNumSprites ) & 3;
 
-	// part 2 - sort
+	// part 3 - sort
 	if ( nCount )
 	{
 		VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
-		std::make_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
-		std::sort_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
+		if ( !cl_detail_incremental_sort.GetBool() || !InsertionSortBackToFront( m_pFastSortInfo, nCount ) )
+		{
+			std::make_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
+			std::sort_heap( m_pFastSortInfo, m_pFastSortInfo + nCount, SortLessFunc ); 
+		}
+	}
+
+	// remember the order for next frame
+	memmove( pOrder + nCount, pOrder, nNumCulled * sizeof( int ) );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pOrder[i] = m_pFastSortInfo[i].m_nIndex;
 	}
 	return nCount;
 }
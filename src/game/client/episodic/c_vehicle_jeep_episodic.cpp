@@ -36,24 +36,10 @@ public:
 
 	void OnEnteredVehicle( C_BasePlayer *pPlayer );
 	void Simulate( void );
-
-public:
-	int		m_iNumRadarContacts;
-	Vector	m_vecRadarContactPos[ RADAR_MAX_CONTACTS ];
-	int		m_iRadarContactType[ RADAR_MAX_CONTACTS ];
 };
 C_PropJeepEpisodic *g_pJalopy = NULL;
 
 IMPLEMENT_CLIENTCLASS_DT( C_PropJeepEpisodic, DT_CPropJeepEpisodic, CPropJeepEpisodic )
-	//CNetworkVar( int, m_iNumRadarContacts );
-	RecvPropInt( RECVINFO(m_iNumRadarContacts) ),
-
-	//CNetworkArray( Vector, m_vecRadarContactPos, RADAR_MAX_CONTACTS );
-	RecvPropArray( RecvPropVector(RECVINFO(m_vecRadarContactPos[0])), m_vecRadarContactPos ),
-
-	//CNetworkArray( int, m_iRadarContactType, RADAR_MAX_CONTACTS );
-	RecvPropArray( RecvPropInt( RECVINFO(m_iRadarContactType[0] ) ), m_iRadarContactType ),
-
 END_RECV_TABLE()
 
 //-----------------------------------------------------------------------------
@@ -61,6 +47,19 @@ END_RECV_TABLE()
 //-----------------------------------------------------------------------------
 void __MsgFunc_UpdateJalopyRadar(bf_read &msg) 
 {
+	// The contacts come in the message, so they always match it
+	int iNumRadarContacts = msg.ReadByte();
+	if( iNumRadarContacts > RADAR_MAX_CONTACTS )
+	{
+		Assert( 0 );
+		return;
+	}
+
+	Vector vecRadarContactPos[ RADAR_MAX_CONTACTS ];
+	uint32 iRadarContactType[ RADAR_MAX_CONTACTS ];
+	msg.ReadBitVec3CoordArray( vecRadarContactPos, iNumRadarContacts );
+	msg.ReadVarInt32Array( iRadarContactType, iNumRadarContacts );
+
 	// Radar code here!
 	if( !GetHudRadar() )
 		return;
@@ -69,9 +68,9 @@ void __MsgFunc_UpdateJalopyRadar(bf_read &msg)
 	// Usually we do not, so default to false.
 	GetHudRadar()->m_bUseFastUpdate = false;
 
-	for( int i = 0 ; i < g_pJalopy->m_iNumRadarContacts ; i++ )
+	for( int i = 0 ; i < iNumRadarContacts ; i++ )
 	{
-		if( g_pJalopy->m_iRadarContactType[i] == RADAR_CONTACT_DOG )
+		if( iRadarContactType[i] == RADAR_CONTACT_DOG )
 		{
 			GetHudRadar()->m_bUseFastUpdate = true;
 			break;
@@ -89,9 +88,9 @@ void __MsgFunc_UpdateJalopyRadar(bf_read &msg)
 		flContactTimeToLive = RADAR_UPDATE_FREQUENCY;
 	}
 
-	for( int i = 0 ; i < g_pJalopy->m_iNumRadarContacts ; i++ )
+	for( int i = 0 ; i < iNumRadarContacts ; i++ )
 	{
-		GetHudRadar()->AddRadarContact( g_pJalopy->m_vecRadarContactPos[i], g_pJalopy->m_iRadarContactType[i], flContactTimeToLive );	
+		GetHudRadar()->AddRadarContact( vecRadarContactPos[i], iRadarContactType[i], flContactTimeToLive );	
 	}
 }
 
@@ -59,7 +59,9 @@ void LoadHudTextures( CUtlDict< CHudTexture *, int >& list, const char *szFilena
 {
 	KeyValues *pTemp, *pTextureSection;
 
-	KeyValues *pKeyValuesData = ReadEncryptedKVFile( filesystem, szFilenameWithoutExtension, pICEKey );
+	// everything below is copied out, so the tree only has to live as long as the arena
+	CKeyValuesArena arena;
+	KeyValues *pKeyValuesData = ReadEncryptedKVFile( filesystem, szFilenameWithoutExtension, pICEKey, false, &arena );
 	if ( pKeyValuesData )
 	{
 		CUtlVector<HudTextureFileRef> hudTextureFileRefs;
@@ -135,9 +137,6 @@ void LoadHudTextures( CUtlDict< CHudTexture *, int >& list, const char *szFilena
 			}
 		}
 	}
-
-	// Failed for some reason. Delete the Key data and abort.
-	pKeyValuesData->deleteThis();
 }
 
 //-----------------------------------------------------------------------------
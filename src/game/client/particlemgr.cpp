@@ -56,6 +56,34 @@ static ConCommand cl_particle_stats_start( "cl_particle_stats_start", StatsParti
 static ConCommand cl_particle_stats_stop( "cl_particle_stats_stop", StatsParticlesStop, "Stop particle stats, or snapshot this frame - also dumps to particle_stats.csv") ;
 static ConVar cl_particle_stats_trigger_count( "cl_particle_stats_trigger_count", "0", 0, "Dump stats if the particle count exceeds this number." );
 
+// Simulation LOD for old-style (CParticleEffectBinding) effects
+static ConVar cl_particle_sim_lod( "cl_particle_sim_lod", "1", 0, "Simulate off-screen and distant particle effects at a reduced rate." );
+static ConVar cl_particle_sim_lod_far_dist( "cl_particle_sim_lod_far_dist", "1500", 0, "Particle effects further away than this are simulated at cl_particle_sim_lod_far_interval." );
+static ConVar cl_particle_sim_lod_far_interval( "cl_particle_sim_lod_far_interval", "0.05", 0, "Seconds between simulations of distant particle effects." );
+static ConVar cl_particle_sim_lod_offscreen_interval( "cl_particle_sim_lod_offscreen_interval", "0.1", 0, "Seconds between simulations of particle effects that weren't drawn last frame." );
+static ConVar cl_particle_sim_lod_pvs_interval( "cl_particle_sim_lod_pvs_interval", "0.5", 0, "Seconds between simulations of particle effects outside the PVS." );
+static ConVar cl_particle_sim_max_catchup( "cl_particle_sim_max_catchup", "0.5", 0, "Most time a skipped particle effect catches up on when it next simulates. Anything beyond this is dropped." );
+static ConVar cl_particle_sim_budget_ms( "cl_particle_sim_budget_ms", "0", 0, "Once simulating old-style particle effects took this many ms in a frame, only visible nearby effects keep simulating. 0 = no budget." );
+static ConVar cl_particle_sim_overlay( "cl_particle_sim_overlay", "0", 0, "Show the N most expensive particle effects to simulate." );
+
+enum
+{
+	PARTICLE_SIM_LOD_FULL = 0,
+	PARTICLE_SIM_LOD_FAR,
+	PARTICLE_SIM_LOD_OFFSCREEN,
+	PARTICLE_SIM_LOD_OUTSIDE_PVS,
+	PARTICLE_SIM_LOD_OVER_BUDGET,
+};
+
+static const char *s_pParticleSimLODNames[] = 
+{
+	"full",
+	"far",
+	"offscreen",
+	"pvs",
+	"budget",
+};
+
 
 
 #define BUCKET_SORT_EVERY_N		8			// It does a bucket sort for each material approximately every N times.
@@ -69,6 +97,9 @@ static ConVar cl_particle_stats_trigger_count( "cl_particle_stats_trigger_count"
 
 #define PARTICLE_SIZE	96
 
+// Longest time step a legacy effect is ever simulated over
+#define PARTICLE_SIM_MAX_STEP	0.1f
+
 CParticleMgr *ParticleMgr()
 {
 	static CParticleMgr s_ParticleMgr;
@@ -154,6 +185,10 @@ CParticleEffectBinding::CParticleEffectBinding()
 
 	m_UpdateBBoxCounter = 0;
 
+	m_flSimTimeAccumulated = 0.0f;
+	m_flSimCostMS = 0.0f;
+	m_nSimLOD = PARTICLE_SIM_LOD_FULL;
+
 	memset( m_EffectMaterialHash, 0, sizeof( m_EffectMaterialHash ) );
 }
 
@@ -631,17 +666,39 @@ void CParticleEffectBinding::DetectChanges()
 }
 
 
+//-----------------------------------------------------------------------------
+// Grows a box to contain all the particles in a list. Returns false if the list is empty.
+// NOTE: This loads 4 floats at m_Pos; that's fine since particles are PARTICLE_SIZE bytes.
+//-----------------------------------------------------------------------------
+static bool GrowBBoxFromParticleList( Particle *pHead, Vector &bbMin, Vector &bbMax )
+{
+	Particle *pCur = pHead->m_pNext;
+	if ( pCur == pHead )
+		return false;
+
+	fltx4 fl4Min = LoadUnaligned3SIMD( bbMin.Base() );
+	fltx4 fl4Max = LoadUnaligned3SIMD( bbMax.Base() );
+	for( ; pCur != pHead; pCur=pCur->m_pNext )
+	{
+		fltx4 fl4Pos = LoadUnaligned3SIMD( pCur->m_Pos.Base() );
+		fl4Min = MinSIMD( fl4Min, fl4Pos );
+		fl4Max = MaxSIMD( fl4Max, fl4Pos );
+	}
+	StoreUnaligned3SIMD( bbMin.Base(), fl4Min );
+	StoreUnaligned3SIMD( bbMax.Base(), fl4Max );
+	return true;
+}
+
+
 void CParticleEffectBinding::GrowBBoxFromParticlePositions( CEffectMaterial *pMaterial, bool &bboxSet, Vector &bbMin, Vector &bbMax )
 {
 	// If its bbox is manually set, don't bother updating it here.
 	if ( !GetAutoUpdateBBox() )
 		return;
 
-	for( Particle *pCur=pMaterial->m_Particles.m_pNext; pCur != &pMaterial->m_Particles; pCur=pCur->m_pNext )
+	// Update bounding box 
+	if ( GrowBBoxFromParticleList( &pMaterial->m_Particles, bbMin, bbMax ) )
 	{
-		// Update bounding box 
-		VectorMin( bbMin, pCur->m_Pos, bbMin );
-		VectorMax( bbMax, pCur->m_Pos, bbMax );
 		bboxSet = true;
 	}
 }
@@ -867,57 +924,89 @@ void CParticleEffectBinding::RenderEnd( VMatrix &tempModel, VMatrix &tempView )
 }
 
 
+//-----------------------------------------------------------------------------
+// Maps a float onto an unsigned int that sorts in the same order
+//-----------------------------------------------------------------------------
+static inline uint32 FloatToSortKey( float f )
+{
+	uint32 nBits = *(uint32*)&f;
+	uint32 nMask = -(int32)( nBits >> 31 ) | 0x80000000;
+	return nBits ^ nMask;
+}
+
+#define RADIX_SORT_BITS		8
+#define RADIX_SORT_BUCKETS	( 1 << RADIX_SORT_BITS )
+
+struct ParticleSortEntry_t
+{
+	uint32 m_nKey;
+	Particle *m_pParticle;
+};
+
+static ParticleSortEntry_t s_ParticleSortEntries[2][MAX_TOTAL_PARTICLES];
+
+
 void CParticleEffectBinding::DoBucketSort( CEffectMaterial *pMaterial, float *zCoords, int nZCoords, float minZ, float maxZ )
 {
-	// Do an O(N) bucket sort. This helps the sort when there are lots of particles.
-	#define NUM_BUCKETS	32
-	Particle buckets[NUM_BUCKETS];
-	for( int iBucket=0; iBucket < NUM_BUCKETS; iBucket++ )
-	{
-		buckets[iBucket].m_pPrev = buckets[iBucket].m_pNext = &buckets[iBucket];
-	}
-	
-	// Sort into buckets.
-	int iCurParticle = 0;
+	// Do an O(N) radix sort on the z coordinates gathered while rendering. Unlike the old
+	// 32-bucket sort this leaves the particles exactly ordered, so the incremental sort
+	// done while rendering has nothing left to fix up between full sorts.
+	ParticleSortEntry_t *pSrc = s_ParticleSortEntries[0];
+	ParticleSortEntry_t *pDest = s_ParticleSortEntries[1];
+
+	// Gather the keys, pulling the particles out of the list.
+	int nCount = 0;
 	Particle *pNext, *pCur;
-	for( pCur=pMaterial->m_Particles.m_pNext; pCur != &pMaterial->m_Particles; pCur=pNext )
+	for( pCur=pMaterial->m_Particles.m_pNext; pCur != &pMaterial->m_Particles && nCount < nZCoords; pCur=pNext )
 	{
 		pNext = pCur->m_pNext;
-		if( iCurParticle >= nZCoords )
-			break;
-
-		// Remove it..
 		UnlinkParticle( pCur );
 
-		// Add it to the appropriate bucket.
-		float flPercent;
-		if (maxZ == minZ)
-			flPercent = 0;
-		else
-			flPercent = (zCoords[iCurParticle] - minZ) / (maxZ - minZ);
-
-		int iAddBucket = (int)( flPercent * (NUM_BUCKETS - 0.0001f) );
-		iAddBucket = NUM_BUCKETS - iAddBucket - 1;
-		Assert( iAddBucket >= 0 && iAddBucket < NUM_BUCKETS );
-
-		InsertParticleAfter( pCur, &buckets[iAddBucket] );
+		pSrc[nCount].m_nKey = FloatToSortKey( zCoords[nCount] );
+		pSrc[nCount].m_pParticle = pCur;
+		++nCount;
+	}
 
-		++iCurParticle;
+	// Skip the high passes when all the keys share those bits.
+	uint32 nKeyDiff = 0;
+	for( int i = 1; i < nCount; i++ )
+	{
+		nKeyDiff |= pSrc[i].m_nKey ^ pSrc[0].m_nKey;
 	}
 
-	// Put the buckets back into the main list.
-	for( int iReAddBucket=0; iReAddBucket < NUM_BUCKETS; iReAddBucket++ )
+	for( int nShift = 0; nShift < 32; nShift += RADIX_SORT_BITS )
 	{
-		Particle *pListHead = &buckets[iReAddBucket];
-		for( pCur=pListHead->m_pNext; pCur != pListHead; pCur=pNext )
+		if ( ( ( nKeyDiff >> nShift ) & ( RADIX_SORT_BUCKETS - 1 ) ) == 0 )
+			continue;
+
+		int nOffsets[RADIX_SORT_BUCKETS];
+		memset( nOffsets, 0, sizeof( nOffsets ) );
+		for( int i = 0; i < nCount; i++ )
 		{
-			pNext = pCur->m_pNext;
-			InsertParticleAfter( pCur, &pMaterial->m_Particles );
-			--iCurParticle;
+			++nOffsets[( pSrc[i].m_nKey >> nShift ) & ( RADIX_SORT_BUCKETS - 1 )];
 		}
+
+		int nTotal = 0;
+		for( int iBucket = 0; iBucket < RADIX_SORT_BUCKETS; iBucket++ )
+		{
+			int nBucketCount = nOffsets[iBucket];
+			nOffsets[iBucket] = nTotal;
+			nTotal += nBucketCount;
+		}
+
+		for( int i = 0; i < nCount; i++ )
+		{
+			pDest[nOffsets[( pSrc[i].m_nKey >> nShift ) & ( RADIX_SORT_BUCKETS - 1 )]++] = pSrc[i];
+		}
+
+		V_swap( pSrc, pDest );
 	}
 
-	Assert(iCurParticle==0);
+	// Put them back at the head of the list, lowest z first.
+	for( int i = nCount; --i >= 0; )
+	{
+		InsertParticleAfter( pSrc[i].m_pParticle, &pMaterial->m_Particles );
+	}
 }
 
 
@@ -988,12 +1077,7 @@ bool CParticleEffectBinding::RecalculateBoundingBox()
 	FOR_EACH_LL( m_Materials, iMaterial )
 	{
 		CEffectMaterial *pMaterial = m_Materials[iMaterial];
-		
-		for( Particle *pCur=pMaterial->m_Particles.m_pNext; pCur != &pMaterial->m_Particles; pCur=pCur->m_pNext )
-		{
-			VectorMin( bbMin, pCur->m_Pos, bbMin );
-			VectorMax( bbMax, pCur->m_Pos, bbMax );
-		}
+		GrowBBoxFromParticleList( &pMaterial->m_Particles, bbMin, bbMax );
 	}
 
 	// Get the bbox into world space.
@@ -1034,7 +1118,8 @@ CEffectMaterial* CParticleEffectBinding::GetEffectMaterial( CParticleSubTexture
 //-----------------------------------------------------------------------------
 // CParticleMgr
 //-----------------------------------------------------------------------------
-CParticleMgr::CParticleMgr()
+CParticleMgr::CParticleMgr() : 
+	m_ParticlePool( PARTICLE_SIZE, MAX_TOTAL_PARTICLES, CUtlMemoryPool::GROW_SLOW, "CParticleMgr::m_ParticlePool", 16 )
 {
 	m_nToolParticleEffectId = 0;
 	m_bUpdatingEffects = false;
@@ -1052,6 +1137,7 @@ CParticleMgr::CParticleMgr()
 	m_DefaultInvalidSubTexture.m_tCoordMaxs[0] = m_DefaultInvalidSubTexture.m_tCoordMaxs[1] = 1;
 	
 	m_nCurrentParticlesAllocated = 0;
+	m_flSimTimeThisFrameMS = 0.0f;
 
 	SetDefLessFunc( m_effectFactories );
 }
@@ -1171,8 +1257,13 @@ Particle *CParticleMgr::AllocParticle( int size )
 	// Enforce max particle limit.
 	if ( m_nCurrentParticlesAllocated >= MAX_TOTAL_PARTICLES )
 		return NULL;
+
+	// Every block in the pool is PARTICLE_SIZE bytes
+	Assert( size <= PARTICLE_SIZE );
+	if ( size > PARTICLE_SIZE )
+		return NULL;
 		
-	Particle *pRet = (Particle *)malloc( size );
+	Particle *pRet = (Particle *)m_ParticlePool.Alloc();
 	if ( pRet )
 		++m_nCurrentParticlesAllocated;
 
@@ -1182,10 +1273,11 @@ Particle *CParticleMgr::AllocParticle( int size )
 void CParticleMgr::FreeParticle( Particle *pParticle )
 {
 	Assert( m_nCurrentParticlesAllocated > 0 );
-	if ( pParticle )
-		--m_nCurrentParticlesAllocated;
-	
-	free( pParticle );
+	if ( !pParticle )
+		return;
+
+	--m_nCurrentParticlesAllocated;
+	m_ParticlePool.Free( pParticle );
 }
 
 
@@ -1442,6 +1534,156 @@ void CParticleMgr::IncrementFrameCode()
 }
 
 
+bool g_bMeasureParticlePerformance;
+bool g_bDisplayParticlePerformance;
+
+//-----------------------------------------------------------------------------
+// Simulates an old-style effect, possibly at a reduced rate. Effects that weren't
+// drawn last frame, are far away, or we're over budget for, bank the time they
+// didn't simulate and catch up on it once their interval is up.
+//-----------------------------------------------------------------------------
+void CParticleMgr::SimulateEffectLOD( CParticleEffectBinding *pEffect, float flTimeDelta, bool bOverBudget )
+{
+	pEffect->m_flSimTimeAccumulated += flTimeDelta;
+
+	int nLOD = PARTICLE_SIM_LOD_FULL;
+	float flInterval = 0.0f;
+	if ( cl_particle_sim_lod.GetBool() && !g_bMeasureParticlePerformance )
+	{
+		if ( !pEffect->WasDrawnPrevFrame() )
+		{
+			if ( !engine->IsBoxInViewCluster( pEffect->m_Min, pEffect->m_Max ) )
+			{
+				nLOD = PARTICLE_SIM_LOD_OUTSIDE_PVS;
+				flInterval = cl_particle_sim_lod_pvs_interval.GetFloat();
+			}
+			else
+			{
+				nLOD = PARTICLE_SIM_LOD_OFFSCREEN;
+				flInterval = cl_particle_sim_lod_offscreen_interval.GetFloat();
+			}
+		}
+		else
+		{
+			Vector vecCenter;
+			VectorLerp( pEffect->m_Min, pEffect->m_Max, 0.5f, vecCenter );
+			float flFarDist = cl_particle_sim_lod_far_dist.GetFloat();
+			if ( vecCenter.DistToSqr( MainViewOrigin() ) > flFarDist * flFarDist )
+			{
+				nLOD = PARTICLE_SIM_LOD_FAR;
+				flInterval = cl_particle_sim_lod_far_interval.GetFloat();
+			}
+		}
+	}
+
+	float flMaxCatchup = cl_particle_sim_max_catchup.GetFloat();
+	if ( bOverBudget && nLOD != PARTICLE_SIM_LOD_FULL )
+	{
+		// Only nearby visible effects keep simulating; everything else waits until it has to catch up
+		nLOD = PARTICLE_SIM_LOD_OVER_BUDGET;
+		flInterval = flMaxCatchup;
+	}
+
+	pEffect->m_nSimLOD = nLOD;
+	if ( pEffect->m_flSimTimeAccumulated < MIN( flInterval, flMaxCatchup ) )
+		return;
+
+	// Time banked past cl_particle_sim_max_catchup is dropped; the effect just falls
+	// behind real time while it isn't being simulated.
+	float flSimTime = MIN( pEffect->m_flSimTimeAccumulated, flMaxCatchup );
+	pEffect->m_flSimTimeAccumulated = 0.0f;
+
+	CFastTimer timer;
+	timer.Start();
+
+	// Catch up in steps no longer than UpdateAllEffects ever hands a normal frame
+	while ( flSimTime > 0.0f )
+	{
+		float flStep = MIN( flSimTime, PARTICLE_SIM_MAX_STEP );
+		pEffect->SimulateParticles( flStep );
+		flSimTime -= flStep;
+	}
+	timer.End();
+
+	float flCostMS = timer.GetDuration().GetMillisecondsF();
+	m_flSimTimeThisFrameMS += flCostMS;
+	pEffect->m_flSimCostMS = pEffect->m_flSimCostMS * 0.9f + flCostMS * 0.1f;
+}
+
+
+//-----------------------------------------------------------------------------
+// Simulation cost stats
+//-----------------------------------------------------------------------------
+static int SimCostSort( CParticleEffectBinding * const *p1, CParticleEffectBinding * const *p2 )
+{
+	float flCost1 = (*p1)->GetSimCostMS();
+	float flCost2 = (*p2)->GetSimCostMS();
+	if ( flCost1 != flCost2 )
+		return ( flCost1 < flCost2 ) ? 1 : -1;
+	return 0;
+}
+
+static void BuildSimCostList( CUtlLinkedList< CParticleEffectBinding*, unsigned short > &effects, CUtlVector< CParticleEffectBinding* > &list )
+{
+	list.EnsureCapacity( effects.Count() );
+	FOR_EACH_LL( effects, i )
+	{
+		list.AddToTail( effects[i] );
+	}
+	list.Sort( SimCostSort );
+}
+
+void CParticleMgr::SimStatsSpew( int nMaxEffects )
+{
+	CUtlVector< CParticleEffectBinding* > list;
+	BuildSimCostList( m_Effects, list );
+
+	int nCounts[ARRAYSIZE( s_pParticleSimLODNames )];
+	memset( nCounts, 0, sizeof( nCounts ) );
+	float flTotalCost = 0.0f;
+	for ( int i = 0; i < list.Count(); ++i )
+	{
+		++nCounts[list[i]->m_nSimLOD];
+		flTotalCost += list[i]->m_flSimCostMS;
+	}
+
+	Msg( "%d old-style particle effects, %.3f ms to simulate last frame (avg total %.3f ms)\n", list.Count(), m_flSimTimeThisFrameMS, flTotalCost );
+	for ( int i = 0; i < ARRAYSIZE( s_pParticleSimLODNames ); ++i )
+	{
+		Msg( "  %-10s %d\n", s_pParticleSimLODNames[i], nCounts[i] );
+	}
+
+	Msg( "%-32s %9s %8s %10s\n", "effect", "particles", "lod", "cost (ms)" );
+	for ( int i = 0; i < list.Count() && i < nMaxEffects; ++i )
+	{
+		CParticleEffectBinding *pEffect = list[i];
+		Msg( "%-32s %9d %8s %10.4f\n", pEffect->m_pSim->GetEffectName(), pEffect->GetNumActiveParticles(), 
+			s_pParticleSimLODNames[pEffect->m_nSimLOD], pEffect->m_flSimCostMS );
+	}
+}
+
+void CParticleMgr::SimStatsOverlay( int nMaxEffects )
+{
+	CUtlVector< CParticleEffectBinding* > list;
+	BuildSimCostList( m_Effects, list );
+
+	int nLine = 0;
+	engine->Con_NPrintf( nLine++, "particle sim: %d effects, %.3f ms", list.Count(), m_flSimTimeThisFrameMS );
+	for ( int i = 0; i < list.Count() && i < nMaxEffects; ++i )
+	{
+		CParticleEffectBinding *pEffect = list[i];
+		engine->Con_NPrintf( nLine++, "%-32s %5d %-9s %.4f ms", pEffect->m_pSim->GetEffectName(), pEffect->GetNumActiveParticles(), 
+			s_pParticleSimLODNames[pEffect->m_nSimLOD], pEffect->m_flSimCostMS );
+	}
+}
+
+CON_COMMAND( cl_particle_sim_stats, "Lists the most expensive old-style particle effects to simulate. Usage: cl_particle_sim_stats [count]" )
+{
+	int nMaxEffects = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 20;
+	ParticleMgr()->SimStatsSpew( nMaxEffects );
+}
+
+
 //-----------------------------------------------------------------------------
 // Main rendering loop
 //-----------------------------------------------------------------------------
@@ -1459,9 +1701,6 @@ void CParticleMgr::Simulate( float flTimeDelta )
 	UpdateAllEffects( flTimeDelta );
 }
 
-bool g_bMeasureParticlePerformance;
-bool g_bDisplayParticlePerformance;
-
 static int64 g_nNumParticlesSimulated;
 static int64 g_nNumUSSpentSimulatingParticles;
 static double g_flStartSimTime;
@@ -1916,8 +2155,11 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 
 	m_bUpdatingEffects = true;
 
-	if( flTimeDelta > 0.1f )
-		flTimeDelta = 0.1f;
+	if( flTimeDelta > PARTICLE_SIM_MAX_STEP )
+		flTimeDelta = PARTICLE_SIM_MAX_STEP;
+
+	m_flSimTimeThisFrameMS = 0.0f;
+	float flBudgetMS = cl_particle_sim_budget_ms.GetFloat();
 
 	FOR_EACH_LL( m_Effects, iEffect )
 	{
@@ -1949,7 +2191,7 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 		if ( pEffect->GetFirstFrameFlag() )
 			pEffect->SetFirstFrameFlag( false );
 		else
-			pEffect->SimulateParticles( flTimeDelta );
+			SimulateEffectLOD( pEffect, flTimeDelta, ( flBudgetMS > 0.0f ) && ( m_flSimTimeThisFrameMS >= flBudgetMS ) );
 
 		// Update its position in the leaf system if its bbox changed.
 		pEffect->DetectChanges();
@@ -1969,6 +2211,11 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 
 	m_bUpdatingEffects = false;
 
+	if ( cl_particle_sim_overlay.GetInt() > 0 )
+	{
+		SimStatsOverlay( cl_particle_sim_overlay.GetInt() );
+	}
+
 	// Remove any effects that were flagged to be removed.
 	int iNext;
 	for ( int i=m_Effects.Head(); i != m_Effects.InvalidIndex(); i=iNext )
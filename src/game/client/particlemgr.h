@@ -126,6 +126,7 @@ entities. Each one is useful under different conditions.
 #endif
 #include "tier1/utlintrusivelist.h"
 #include "tier1/utlstring.h"
+#include "tier1/mempool.h"
 
 
 //-----------------------------------------------------------------------------
@@ -161,6 +162,14 @@ class CParticleSubTextureGroup;
 
 //-----------------------------------------------------------------------------
 // The basic particle description; all particles need to inherit from this.
+//
+// Particles stay array-of-structs. Every effect casts Particle* to its own
+// struct (SimpleParticle, FireParticle, ...) and reads and writes fields on it
+// directly from its SimulateParticles and RenderParticles, so there is no
+// struct-of-arrays store behind this. CParticleMgr packs the structs into one
+// pool of PARTICLE_SIZE blocks, does the bounding box with SIMD loads of m_Pos
+// and radix sorts the depths. Per-field SIMD simulation would mean porting
+// each effect off Particle*; that hasn't been done.
 //-----------------------------------------------------------------------------
 
 struct Particle
@@ -442,6 +451,9 @@ public:
 	// Get the current number of particles in the effect.
 	int				GetNumActiveParticles();
 
+	// Running average of what simulating this effect costs (ms)
+	float			GetSimCostMS() const						{ return m_flSimCostMS; }
+
 	// The is the max size of the particles for use in bounding	computation
 	void			SetParticleCullRadius( float flMaxParticleRadius );
 
@@ -587,6 +599,11 @@ private:
 
 	// auto updates the bbox after N frames
 	unsigned short					m_UpdateBBoxCounter;
+
+	// Simulation LOD: time that hasn't been simulated yet, and what simulating this effect costs.
+	float							m_flSimTimeAccumulated;
+	float							m_flSimCostMS;
+	unsigned char					m_nSimLOD;
 };
 
 
@@ -707,6 +724,16 @@ private:
 	// Call Update() on all the effects.
 	void UpdateAllEffects( float flTimeDelta );
 
+	// Simulates an old-style effect at the rate its simulation LOD allows
+	void SimulateEffectLOD( CParticleEffectBinding *pEffect, float flTimeDelta, bool bOverBudget );
+
+public:
+	// Per-effect simulation cost, for cl_particle_sim_stats and cl_particle_sim_overlay
+	void SimStatsSpew( int nMaxEffects );
+	void SimStatsOverlay( int nMaxEffects );
+
+private:
+
 	void UpdateNewEffects( float flTimeDelta );				// update new particle effects
 
 	CParticleSubTextureGroup* FindOrAddSubTextureGroup( IMaterial *pPageMaterial );
@@ -723,6 +750,13 @@ private:
 
 	int m_nCurrentParticlesAllocated;
 
+	// Time spent simulating old-style effects this frame (ms)
+	float m_flSimTimeThisFrameMS;
+
+	// Particles for the legacy effects all come from here, so they're packed together
+	// in a few big blobs instead of scattered around the heap by malloc.
+	CUtlMemoryPool m_ParticlePool;
+
 	// Directional lighting info.
 	CParticleLightInfo m_DirectionalLight;
 
@@ -0,0 +1,313 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Sends each player the UpdateRadar message for CHudRadarPanel.
+//			Every player has a copy of the blips as last sent to them, and
+//			only what changed since then goes out. See radar_shared.h.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "ai_basenpc.h"
+#include "radar_shared.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar sv_radar_feed( "sv_radar_feed", "1", FCVAR_NONE, "Send player and NPC positions to the HUD radar." );
+ConVar sv_radar_update_interval( "sv_radar_update_interval", "0.5", FCVAR_NONE, "Seconds between radar updates to a player." );
+ConVar sv_radar_range( "sv_radar_range", "4096", FCVAR_NONE, "Only track blips this close to the player, 0 for everywhere." );
+
+
+//-----------------------------------------------------------------------------
+// Purpose: What one player's radar currently shows
+//-----------------------------------------------------------------------------
+struct RadarClientState_t
+{
+	RadarClientState_t() : m_blips( DefLessFunc( int ) )
+	{
+		m_userID = -1;
+		m_flNextUpdate = 0.0f;
+	}
+
+	int m_userID;							// the blips belong to this player, not whoever has the slot now
+	float m_flNextUpdate;
+	CUtlMap< int, RadarBlipState_t > m_blips;	// by entity index
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: One blip waiting to go out in the current message
+//-----------------------------------------------------------------------------
+struct RadarBlipRecord_t
+{
+	int m_entindex;
+	int m_op;
+	RadarBlipState_t m_blip;
+	RadarBlipState_t m_from;	// for RADAR_BLIP_DELTA
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+class CRadarFeed : public CAutoGameSystemPerFrame
+{
+public:
+	CRadarFeed() : CAutoGameSystemPerFrame( "CRadarFeed" )
+	{
+	}
+
+	virtual void LevelInitPreEntity()
+	{
+		for ( int i = 0; i < MAX_PLAYERS; ++i )
+		{
+			m_clients[i].m_userID = -1;
+			m_clients[i].m_flNextUpdate = 0.0f;
+			m_clients[i].m_blips.RemoveAll();
+		}
+	}
+
+	virtual void FrameUpdatePostEntityThink()
+	{
+		if ( !sv_radar_feed.GetBool() )
+			return;
+
+		VPROF( "CRadarFeed::FrameUpdatePostEntityThink" );
+
+		for ( int i = 1; i <= gpGlobals->maxClients; ++i )
+		{
+			CBasePlayer *player = UTIL_PlayerByIndex( i );
+			if ( !player || player->IsBot() || !player->IsConnected() )
+				continue;
+
+			RadarClientState_t &client = m_clients[ i - 1 ];
+			if ( gpGlobals->curtime < client.m_flNextUpdate && client.m_userID == player->GetUserID() )
+				continue;
+
+			// spread the players out over the interval
+			client.m_flNextUpdate = gpGlobals->curtime + sv_radar_update_interval.GetFloat() * RandomFloat( 0.9f, 1.1f );
+
+			UpdateClient( player, client );
+		}
+	}
+
+private:
+	void GatherBlips( CBasePlayer *player, CUtlMap< int, RadarBlipState_t > &blips );
+	void UpdateClient( CBasePlayer *player, RadarClientState_t &client );
+	void SendRecords( IRecipientFilter &filter, int msgFlags );
+
+	RadarClientState_t m_clients[ MAX_PLAYERS ];
+	CUtlMap< int, RadarBlipState_t > m_current;		// scratch, what the player's radar should show now
+	CUtlVectorFixed< RadarBlipRecord_t, RADAR_MSG_MAX_BLIPS > m_records;	// scratch, the message being built
+};
+
+static CRadarFeed g_RadarFeed;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Live teammates and live NPCs in range. Players on another team are
+//			left out, the client would draw them wherever they are, walls or
+//			not. Without teams (TEAM_UNASSIGNED) everybody counts as a teammate,
+//			the same as on the client's radar.
+//-----------------------------------------------------------------------------
+void CRadarFeed::GatherBlips( CBasePlayer *player, CUtlMap< int, RadarBlipState_t > &blips )
+{
+	blips.RemoveAll();
+
+	float range = sv_radar_range.GetFloat();
+	float rangeSqr = ( range > 0.0f ) ? range * range : FLT_MAX;
+	const Vector &center = player->GetAbsOrigin();
+
+	RadarBlipState_t blip;
+
+	int team = player->GetTeamNumber();
+
+	for ( int i = 1; i <= gpGlobals->maxClients; ++i )
+	{
+		CBasePlayer *other = UTIL_PlayerByIndex( i );
+		if ( !other || other == player || !other->IsAlive() || other->IsObserver() )
+			continue;
+
+		// only a different real team makes an enemy
+		int otherTeam = other->GetTeamNumber();
+		if ( team > TEAM_SPECTATOR && otherTeam > TEAM_SPECTATOR && otherTeam != team )
+			continue;
+
+		if ( ( other->GetAbsOrigin() - center ).LengthSqr() > rangeSqr )
+			continue;
+
+		blip.Quantize( other->GetAbsOrigin(), other->EyeAngles().y, 0 );
+		blips.Insert( i, blip );
+	}
+
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+	for ( int i = 0; i < g_AI_Manager.NumAIs(); ++i )
+	{
+		CAI_BaseNPC *npc = ppAIs[i];
+		if ( !npc->IsAlive() || npc->IsEffectActive( EF_NODRAW ) )
+			continue;
+
+		if ( ( npc->GetAbsOrigin() - center ).LengthSqr() > rangeSqr )
+			continue;
+
+		int flags = RADAR_BLIP_NPC;
+		if ( npc->IRelationType( player ) == D_HT )
+		{
+			flags |= RADAR_BLIP_HOSTILE;
+		}
+
+		blip.Quantize( npc->GetAbsOrigin(), npc->GetAbsAngles().y, flags );
+		blips.InsertOrReplace( npc->entindex(), blip );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends the blips that changed since the player's last update,
+//			split over as many messages as it takes
+//-----------------------------------------------------------------------------
+void CRadarFeed::UpdateClient( CBasePlayer *player, RadarClientState_t &client )
+{
+	CSingleUserRecipientFilter filter( player );
+	filter.MakeReliable();
+
+	int msgFlags = 0;
+	if ( client.m_userID != player->GetUserID() )
+	{
+		client.m_userID = player->GetUserID();
+		client.m_blips.RemoveAll();
+		msgFlags |= RADAR_MSG_RESET;
+	}
+
+	GatherBlips( player, m_current );
+
+	m_records.RemoveAll();
+	int bits = 0;
+	int lastIndex = 0;
+
+	// walk both sorted maps at once: removes, changes and new blips
+	unsigned short sent = client.m_blips.FirstInorder();
+	unsigned short now = m_current.FirstInorder();
+	while ( sent != client.m_blips.InvalidIndex() || now != m_current.InvalidIndex() )
+	{
+		int sentIndex = ( sent != client.m_blips.InvalidIndex() ) ? client.m_blips.Key( sent ) : INT_MAX;
+		int nowIndex = ( now != m_current.InvalidIndex() ) ? m_current.Key( now ) : INT_MAX;
+
+		int entindex = MIN( sentIndex, nowIndex );
+		int op;
+		if ( nowIndex > sentIndex )
+		{
+			op = RADAR_BLIP_REMOVE;
+		}
+		else if ( nowIndex < sentIndex )
+		{
+			op = RADAR_BLIP_FULL;
+		}
+		else if ( m_current[ now ] == client.m_blips[ sent ] )
+		{
+			// nothing to tell
+			sent = client.m_blips.NextInorder( sent );
+			now = m_current.NextInorder( now );
+			continue;
+		}
+		else
+		{
+			op = m_current[ now ].FitsDelta( client.m_blips[ sent ] ) ? RADAR_BLIP_DELTA : RADAR_BLIP_FULL;
+		}
+
+		if ( m_records.Count() == RADAR_MSG_MAX_BLIPS || bits + RADAR_BLIP_FULL_BITS > RADAR_MSG_MAX_BITS )
+		{
+			SendRecords( filter, msgFlags );
+			msgFlags = 0;
+			bits = 0;
+			lastIndex = 0;
+		}
+
+		RadarBlipRecord_t &record = m_records[ m_records.AddToTail() ];
+		record.m_entindex = entindex;
+		record.m_op = op;
+		bits += RadarIndexStepBits( entindex - lastIndex ) + RADAR_BLIP_OP_BITS;
+		lastIndex = entindex;
+
+		if ( op == RADAR_BLIP_REMOVE )
+		{
+			unsigned short removed = sent;
+			sent = client.m_blips.NextInorder( sent );
+			client.m_blips.RemoveAt( removed );
+			continue;
+		}
+
+		record.m_blip = m_current[ now ];
+		if ( op == RADAR_BLIP_DELTA )
+		{
+			record.m_from = client.m_blips[ sent ];
+			bits += RADAR_BLIP_FLAG_BITS + 2 * RADAR_DELTA_XY_BITS + RADAR_DELTA_Z_BITS + RADAR_YAW_BITS;
+		}
+		else
+		{
+			bits += RADAR_BLIP_FLAG_BITS + 2 * RADAR_XY_BITS + RADAR_Z_BITS + RADAR_YAW_BITS;
+		}
+
+		client.m_blips.InsertOrReplace( entindex, record.m_blip );
+
+		// a new blip sorts before sent, which stays where it was
+		if ( nowIndex == sentIndex )
+		{
+			sent = client.m_blips.NextInorder( sent );
+		}
+		now = m_current.NextInorder( now );
+	}
+
+	// the client still has to hear about a reset, even with nothing else to say
+	if ( m_records.Count() || ( msgFlags & RADAR_MSG_RESET ) )
+	{
+		SendRecords( filter, msgFlags );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes out m_records as one UpdateRadar message. The entity
+//			indexes go first, as one varint array of steps.
+//-----------------------------------------------------------------------------
+void CRadarFeed::SendRecords( IRecipientFilter &filter, int msgFlags )
+{
+	uint32 steps[ RADAR_MSG_MAX_BLIPS ];
+	int lastIndex = 0;
+	for ( int i = 0; i < m_records.Count(); ++i )
+	{
+		steps[i] = m_records[i].m_entindex - lastIndex;
+		lastIndex = m_records[i].m_entindex;
+	}
+
+	UserMessageBegin( filter, "UpdateRadar" );
+	MessageWriteByte( msgFlags );
+	MessageWriteByte( m_records.Count() );
+	MessageWriteVarInt32Array( steps, m_records.Count() );
+
+	for ( int i = 0; i < m_records.Count(); ++i )
+	{
+		const RadarBlipRecord_t &record = m_records[i];
+		MessageWriteUBitLong( record.m_op, RADAR_BLIP_OP_BITS );
+		if ( record.m_op == RADAR_BLIP_REMOVE )
+			continue;
+
+		const RadarBlipState_t &blip = record.m_blip;
+		MessageWriteUBitLong( blip.m_flags, RADAR_BLIP_FLAG_BITS );
+
+		if ( record.m_op == RADAR_BLIP_DELTA )
+		{
+			MessageWriteSBitLong( blip.m_x - record.m_from.m_x, RADAR_DELTA_XY_BITS );
+			MessageWriteSBitLong( blip.m_y - record.m_from.m_y, RADAR_DELTA_XY_BITS );
+			MessageWriteSBitLong( blip.m_z - record.m_from.m_z, RADAR_DELTA_Z_BITS );
+		}
+		else
+		{
+			MessageWriteSBitLong( blip.m_x, RADAR_XY_BITS );
+			MessageWriteSBitLong( blip.m_y, RADAR_XY_BITS );
+			MessageWriteSBitLong( blip.m_z, RADAR_Z_BITS );
+		}
+		MessageWriteUBitLong( blip.m_yaw, RADAR_YAW_BITS );
+	}
+
+	MessageEnd();
+	m_records.RemoveAll();
+}
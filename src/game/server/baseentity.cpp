@@ -62,6 +62,7 @@
 #include "env_debughistory.h"
 #include "tier1/utlstring.h"
 #include "utlhashtable.h"
+#include "datadesc_lookup.h"
 
 #if defined( TF_DLL )
 #include "tf_gamerules.h"
@@ -3881,86 +3882,75 @@ bool CBaseEntity::AcceptInput( const char *szInputName, CBaseEntity *pActivator,
 		NDebugOverlay::Box( GetAbsOrigin(), Vector(-4, -4, -4), Vector(4, 4, 4), 0, 255, 0, 0, 3 );
 	}
 
-	// loop through the data description list, restoring each data desc block
-	for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
+	// find the input in the data description
+	typedescription_t *pField = DataDesc_FindInput( GetDataDescMap(), szInputName );
+	if ( pField )
 	{
-		// search through all the actions in the data description, looking for a match
-		for ( int i = 0; i < dmap->dataNumFields; i++ )
+		char szBuffer[256];
+		// mapper debug message
+		if (pCaller != NULL)
 		{
-			if ( dmap->dataDesc[i].flags & FTYPEDESC_INPUT )
-			{
-				if ( !Q_stricmp(dmap->dataDesc[i].externalName, szInputName) )
-				{
-					// found a match
-
-					char szBuffer[256];
-					// mapper debug message
-					if (pCaller != NULL)
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
-					}
-					else
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
-					}
-					DevMsg( 2, "%s", szBuffer );
-					ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
-
-					if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
-					{
-						DrawInputOverlay(szInputName,pCaller,Value);
-					}
+			Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
+		}
+		else
+		{
+			Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
+		}
+		DevMsg( 2, "%s", szBuffer );
+		ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 
-					// convert the value if necessary
-					if ( Value.FieldType() != dmap->dataDesc[i].fieldType )
-					{
-						if ( !(Value.FieldType() == FIELD_VOID && dmap->dataDesc[i].fieldType == FIELD_STRING) ) // allow empty strings
-						{
-							if ( !Value.Convert( (fieldtype_t)dmap->dataDesc[i].fieldType ) )
-							{
-								// bad conversion
-								Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
-									STRING(m_iClassname), GetDebugName(), szInputName, 
-									( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
-									( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
-								return false;
-							}
-						}
-					}
+		if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
+		{
+			DrawInputOverlay(szInputName,pCaller,Value);
+		}
 
-					// call the input handler, or if there is none just set the value
-					inputfunc_t pfnInput = dmap->dataDesc[i].inputFunc;
+		// convert the value if necessary
+		if ( Value.FieldType() != pField->fieldType )
+		{
+			if ( !(Value.FieldType() == FIELD_VOID && pField->fieldType == FIELD_STRING) ) // allow empty strings
+			{
+				if ( !Value.Convert( (fieldtype_t)pField->fieldType ) )
+				{
+					// bad conversion
+					Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
+						STRING(m_iClassname), GetDebugName(), szInputName, 
+						( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
+						( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
+					return false;
+				}
+			}
+		}
 
-					if ( pfnInput )
-					{ 
-						// Package the data into a struct for passing to the input handler.
-						inputdata_t data;
-						data.pActivator = pActivator;
-						data.pCaller = pCaller;
-						data.value = Value;
-						data.nOutputID = outputID;
+		// call the input handler, or if there is none just set the value
+		inputfunc_t pfnInput = pField->inputFunc;
 
-						(this->*pfnInput)( data );
-					}
-					else if ( dmap->dataDesc[i].flags & FTYPEDESC_KEY )
-					{
-						// set the value directly
-						Value.SetOther( ((char*)this) + dmap->dataDesc[i].fieldOffset[ TD_OFFSET_NORMAL ]);
-					
-						// TODO: if this becomes evil and causes too many full entity updates, then we should make
-						// a macro like this:
-						//
-						// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
-						//
-						// Then the datadesc points at that function and we call it here. The only pain is to add
-						// that function for all the DEFINE_INPUT calls.
-						NetworkStateChanged();
-					}
+		if ( pfnInput )
+		{ 
+			// Package the data into a struct for passing to the input handler.
+			inputdata_t data;
+			data.pActivator = pActivator;
+			data.pCaller = pCaller;
+			data.value = Value;
+			data.nOutputID = outputID;
 
-					return true;
-				}
-			}
+			(this->*pfnInput)( data );
 		}
+		else if ( pField->flags & FTYPEDESC_KEY )
+		{
+			// set the value directly
+			Value.SetOther( ((char*)this) + pField->fieldOffset[ TD_OFFSET_NORMAL ]);
+		
+			// TODO: if this becomes evil and causes too many full entity updates, then we should make
+			// a macro like this:
+			//
+			// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
+			//
+			// Then the datadesc points at that function and we call it here. The only pain is to add
+			// that function for all the DEFINE_INPUT calls.
+			NetworkStateChanged();
+		}
+
+		return true;
 	}
 
 	DevMsg( 2, "unhandled input: (%s) -> (%s,%s)\n", szInputName, STRING(m_iClassname), GetDebugName()/*,", from (%s,%s)" STRING(pCaller->m_iClassname), STRING(pCaller->m_iName)*/ );
@@ -89,6 +89,7 @@ void MessageWriteCoord( float flValue);
 void MessageWriteVec3Coord( const Vector& rgflValue);
 void MessageWriteVec3Normal( const Vector& rgflValue);
 void MessageWriteAngles( const QAngle& rgflValue);
+void MessageWriteVec3CoordArray( const Vector *pValues, int nCount );
 void MessageWriteString( const char *sz );
 void MessageWriteEntity( int iValue);
 void MessageWriteEHandle( CBaseEntity *pEntity ); //encoded as a long
@@ -99,6 +100,7 @@ void MessageWriteBool( bool bValue );
 void MessageWriteUBitLong( unsigned int data, int numbits );
 void MessageWriteSBitLong( int data, int numbits );
 void MessageWriteBits( const void *pIn, int nBits );
+void MessageWriteVarInt32Array( const uint32 *pValues, int nCount );
 
 #ifndef NO_STEAM
 
@@ -121,6 +123,7 @@ extern CSteamID GetSteamIDForPlayerIndex( int iPlayerIndex );
 #define WRITE_VEC3COORD	(MessageWriteVec3Coord)
 #define WRITE_VEC3NORMAL (MessageWriteVec3Normal)
 #define WRITE_ANGLES	(MessageWriteAngles)
+#define WRITE_VEC3COORD_ARRAY	(MessageWriteVec3CoordArray)
 #define WRITE_STRING	(MessageWriteString)
 #define WRITE_ENTITY	(MessageWriteEntity)
 #define WRITE_EHANDLE	(MessageWriteEHandle)
@@ -130,5 +133,6 @@ extern CSteamID GetSteamIDForPlayerIndex( int iPlayerIndex );
 #define WRITE_UBITLONG	(MessageWriteUBitLong)
 #define WRITE_SBITLONG	(MessageWriteSBitLong)
 #define WRITE_BITS		(MessageWriteBits)
+#define WRITE_VARINT32_ARRAY	(MessageWriteVarInt32Array)
 
 #endif		//ENGINECALLBACK_H
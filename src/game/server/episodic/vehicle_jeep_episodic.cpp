@@ -367,14 +367,6 @@ BEGIN_DATADESC( CPropJeepEpisodic )
 END_DATADESC();
 
 IMPLEMENT_SERVERCLASS_ST(CPropJeepEpisodic, DT_CPropJeepEpisodic)
-	//CNetworkVar( int, m_iNumRadarContacts );
-	SendPropInt( SENDINFO(m_iNumRadarContacts), 8 ),
-
-	//CNetworkArray( Vector, m_vecRadarContactPos, RADAR_MAX_CONTACTS );
-	SendPropArray( SendPropVector( SENDINFO_ARRAY(m_vecRadarContactPos), -1, SPROP_COORD), m_vecRadarContactPos ),
-
-	//CNetworkArray( int, m_iRadarContactType, RADAR_MAX_CONTACTS );
-	SendPropArray( SendPropInt(SENDINFO_ARRAY(m_iRadarContactType), RADAR_CONTACT_TYPE_BITS ), m_iRadarContactType ),
 END_SEND_TABLE()
 
 
@@ -918,8 +910,8 @@ void CPropJeepEpisodic::UpdateRadar( bool forceUpdate )
 		{
 			Vector vecPos = pEnt->WorldSpaceCenter();
 
-			m_vecRadarContactPos.Set( m_iNumRadarContacts, vecPos );
-			m_iRadarContactType.Set( m_iNumRadarContacts, type );
+			m_vecRadarContactPos[ m_iNumRadarContacts ] = vecPos;
+			m_iRadarContactType[ m_iNumRadarContacts ] = type;
 			m_iNumRadarContacts++;
 
 			if( m_iNumRadarContacts == RADAR_MAX_CONTACTS )
@@ -956,8 +948,16 @@ void CPropJeepEpisodic::UpdateRadar( bool forceUpdate )
 
 	CBasePlayer *pPlayer = AI_GetSinglePlayer();
 	CSingleUserRecipientFilter filter(pPlayer);
+	uint32 iContactTypes[ RADAR_MAX_CONTACTS ];
+	for( int i = 0 ; i < m_iNumRadarContacts ; i++ )
+	{
+		iContactTypes[i] = m_iRadarContactType[i];
+	}
+
 	UserMessageBegin( filter, "UpdateJalopyRadar" );
-	WRITE_BYTE( 0 ); // end marker
+	WRITE_BYTE( m_iNumRadarContacts );
+	WRITE_VEC3COORD_ARRAY( m_vecRadarContactPos, m_iNumRadarContacts );
+	WRITE_VARINT32_ARRAY( iContactTypes, m_iNumRadarContacts );
 	MessageEnd();	// send message
 }
 
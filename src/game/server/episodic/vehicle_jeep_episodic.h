@@ -142,9 +142,10 @@ private:
 
 	bool	m_bBusterHopperVisible;	// is the hopper assembly visible on the vehicle? please do not set this directly - use the accessor funct.
 
-	CNetworkVar( int, m_iNumRadarContacts );
-	CNetworkArray( Vector, m_vecRadarContactPos, RADAR_MAX_CONTACTS );
-	CNetworkArray( int, m_iRadarContactType, RADAR_MAX_CONTACTS );
+	// Sent to the driver in the UpdateJalopyRadar message
+	int		m_iNumRadarContacts;
+	Vector	m_vecRadarContactPos[ RADAR_MAX_CONTACTS ];
+	int		m_iRadarContactType[ RADAR_MAX_CONTACTS ];
 };
 
 #endif // VEHICLE_JEEP_EPISODIC_H
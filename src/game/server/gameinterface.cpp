@@ -3387,6 +3387,14 @@ void MessageWriteAngles( const QAngle& rgflValue)
 	g_pMsgBuffer->WriteBitAngles( rgflValue );
 }
 
+void MessageWriteVec3CoordArray( const Vector *pValues, int nCount )
+{
+	if (!g_pMsgBuffer)
+		Error( "WriteVec3CoordArray called with no active message\n" );
+
+	g_pMsgBuffer->WriteBitVec3CoordArray( pValues, nCount );
+}
+
 void MessageWriteString( const char *sz )
 {
 	if (!g_pMsgBuffer)
@@ -3458,6 +3466,14 @@ void MessageWriteBits( const void *pIn, int nBits )
 	g_pMsgBuffer->WriteBits( pIn, nBits );
 }
 
+void MessageWriteVarInt32Array( const uint32 *pValues, int nCount )
+{
+	if (!g_pMsgBuffer)
+		Error( "WriteVarInt32Array called with no active message\n" );
+
+	g_pMsgBuffer->WriteVarInt32Array( pValues, nCount );
+}
+
 class CServerDLLSharedAppSystems : public IServerDLLSharedAppSystems
 {
 public:
@@ -12,6 +12,7 @@
 #endif
 
 class CBasePlayer;
+class CBaseAnimating;
 class CUserCmd;
 
 //-----------------------------------------------------------------------------
@@ -23,6 +24,10 @@ public:
 	// Called during player movement to set up/restore after lag compensation
 	virtual void	StartLagCompensation( CBasePlayer *player, CUserCmd *cmd ) = 0;
 	virtual void	FinishLagCompensation( CBasePlayer *player ) = 0;
+
+	// Players are always tracked, other entities have to register themselves
+	virtual void	AddAdditionalEntity( CBaseAnimating *pEntity ) = 0;
+	virtual void	RemoveAdditionalEntity( CBaseAnimating *pEntity ) = 0;
 };
 
 extern ILagCompensationManager *lagcompensation;
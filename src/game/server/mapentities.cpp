@@ -18,6 +18,8 @@
 #include "datacache/imdlcache.h"
 #include "world.h"
 #include "toolframework/iserverenginetools.h"
+#include "vstdlib/jobthread.h"
+#include "datadesc_lookup.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -313,6 +315,411 @@ void SpawnAllEntities( int nEntities, HierarchicalSpawn_t *pSpawnList, bool bAct
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Threaded entity lump loading. The lump is first split into entity blocks,
+// then worker threads tokenize the blocks and look each key up in the
+// datadesc of the entity's class, converting the value to the field's type
+// as they go. Creation, KeyValue() and Spawn() still run on the main thread
+// in map order; a looked up key only lets CBaseEntity::KeyValue() skip its
+// datadesc lookup, so KeyValue() overrides see every key just as before.
+//-----------------------------------------------------------------------------
+struct MapEntityParsedKey_t
+{
+	char				*m_pKeyName;		// writable, KeyValue() strips '#' suffixes in place
+	const char			*m_pValue;
+	datamap_t			*m_pDataMap;		// the datadesc the key was looked up in
+	typedescription_t	*m_pField;			// NULL if the datadesc doesn't have the key
+	int					m_nOwnerOffset;		// offset of the (embedded) object holding m_pField
+	bool				m_bResolved;		// false if the key was left for KeyValue() to look up
+	union
+	{
+		string_t		m_iszValue;
+		float			m_flValue;
+		int				m_nValue;
+		float			m_vecValue[3];
+		color32			m_clrValue;
+	};
+};
+
+struct MapEntityBlock_t
+{
+	const char			*m_pData;			// just past the entity's '{'
+	const char			*m_pEnd;			// where the last key ends, as CEntityMapData::CurrentBufferPosition() returns it
+	const char			*m_pClassName;		// NULL if the entity has none
+	CUtlVector< MapEntityParsedKey_t > m_Keys;
+	CUtlVector< char >	m_Strings;
+};
+
+ConVar sv_parallel_entity_parse( "sv_parallel_entity_parse", "1", 0, "Tokenize the entity lump and look up entity keys on worker threads when a map loads." );
+
+extern bool ParseKeyvalueField( void *pObject, typedescription_t *pField, const char *szValue );
+
+// The key the main thread is currently handing to KeyValue(), if it was parsed ahead of time
+static const MapEntityParsedKey_t *s_pCurrentParsedKey = NULL;
+
+//-----------------------------------------------------------------------------
+// Purpose: Steps over one token exactly as MapEntity_ParseToken() would read
+//			it, without copying it out.
+// Output : The position after the token, NULL at the end of the data.
+//			*pFirst and *pbSingle receive the token's first character and
+//			whether it is one character long. *pbBad is set for tokens
+//			MapEntity_ParseToken() mangles (unterminated or overlong quotes).
+//-----------------------------------------------------------------------------
+static const char *MapEntity_SkipToken( const char *data, char *pFirst, bool *pbSingle, bool *pbBad )
+{
+	int c;
+
+skipwhite:
+	while ( (c = *data) <= ' ' )
+	{
+		if ( c == 0 )
+			return NULL;
+		data++;
+	}
+
+	if ( c == '/' && data[1] == '/' )
+	{
+		while ( *data && *data != '\n' )
+			data++;
+		goto skipwhite;
+	}
+
+	if ( c == '\"' )
+	{
+		data++;
+		*pFirst = *data;
+		for ( int len = 0; len < MAPKEY_MAXLENGTH; len++ )
+		{
+			c = *data++;
+			if ( c == '\"' )
+			{
+				*pbSingle = ( len == 1 );
+				return data;
+			}
+			if ( !c )
+				break;
+		}
+
+		*pbBad = true;
+		return NULL;
+	}
+
+	*pFirst = c;
+	if ( c == '{' || c == '}' || c == '(' || c == ')' || c == '\'' )
+	{
+		*pbSingle = true;
+		return data + 1;
+	}
+
+	const char *pStart = data;
+	do
+	{
+		data++;
+		c = *data;
+		if ( c == '{' || c == '}' || c == '(' || c == ')' || c == '\'' )
+			break;
+	} while ( c > 32 );
+
+	*pbSingle = ( data - pStart == 1 );
+	return data;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds where each entity block starts and where its keys end, the
+//			same positions the serial loop below arrives at.
+// Output : false if the lump has anything the serial parser handles
+//			specially (stray braces, keys without values, overlong tokens),
+//			in which case it should parse the lump itself.
+//-----------------------------------------------------------------------------
+static bool MapEntity_SplitEntityBlocks( const char *pMapData, CUtlVector< MapEntityBlock_t > &blocks )
+{
+	char first;
+	bool bSingle, bBad = false;
+
+	while ( true )
+	{
+		pMapData = MapEntity_SkipToken( pMapData, &first, &bSingle, &bBad );
+		if ( !pMapData )
+			return !bBad;
+
+		if ( first != '{' )
+			return false;
+
+		MapEntityBlock_t &block = blocks[ blocks.AddToTail() ];
+		block.m_pData = pMapData;
+
+		while ( true )
+		{
+			// key, or the closing brace
+			const char *pKeyStart = pMapData;
+			pMapData = MapEntity_SkipToken( pMapData, &first, &bSingle, &bBad );
+			if ( !pMapData )
+				return false;
+
+			if ( first == '}' )
+			{
+				if ( !bSingle )
+					return false;
+
+				block.m_pEnd = pKeyStart;
+				break;
+			}
+
+			// value
+			pMapData = MapEntity_SkipToken( pMapData, &first, &bSingle, &bBad );
+			if ( !pMapData || first == '}' )
+				return false;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Looks a key up in the datadesc of a class and converts its value.
+//			Runs on worker threads, so anything that isn't a plain conversion
+//			(custom fields, matrices) is left for the main thread.
+//-----------------------------------------------------------------------------
+static void MapEntity_ResolveKey( MapEntityParsedKey_t &key, datamap_t *pDataMap )
+{
+	key.m_pDataMap = pDataMap;
+	key.m_pField = NULL;
+	key.m_nOwnerOffset = 0;
+	key.m_bResolved = true;
+
+	// KeyValue() will have stripped the # suffix by the time it gets to the datadesc
+	char szKeyName[MAPKEY_MAXLENGTH];
+	Q_strncpy( szKeyName, key.m_pKeyName, sizeof( szKeyName ) );
+	char *s = strchr( szKeyName, '#' );
+	if ( s )
+	{
+		*s = '\0';
+	}
+
+	const DataDescKey_t *pKey = DataDesc_FindKey( pDataMap, szKeyName );
+	if ( !pKey )
+		return;
+
+	key.m_pField = pKey->m_pField;
+	key.m_nOwnerOffset = pKey->m_nOwnerOffset;
+
+	switch( key.m_pField->fieldType )
+	{
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+	case FIELD_STRING:
+		key.m_iszValue = AllocPooledString( key.m_pValue );
+		break;
+
+	case FIELD_TIME:
+	case FIELD_FLOAT:
+		key.m_flValue = atof( key.m_pValue );
+		break;
+
+	case FIELD_BOOLEAN:
+	case FIELD_CHARACTER:
+	case FIELD_SHORT:
+	case FIELD_INTEGER:
+	case FIELD_TICK:
+		key.m_nValue = atoi( key.m_pValue );
+		break;
+
+	case FIELD_POSITION_VECTOR:
+	case FIELD_VECTOR:
+		UTIL_StringToVector( key.m_vecValue, key.m_pValue );
+		break;
+
+	case FIELD_COLOR32:
+		UTIL_StringToColor32( &key.m_clrValue, key.m_pValue );
+		break;
+
+	case FIELD_VMATRIX:
+	case FIELD_VMATRIX_WORLDSPACE:
+	case FIELD_MATRIX3X4_WORLDSPACE:
+	case FIELD_CUSTOM:
+		// converted by ParseKeyvalueField() on the main thread
+		break;
+
+	default:
+		// bad field types only warn, leave that to KeyValue() on the main thread
+		key.m_pField = NULL;
+		key.m_bResolved = false;
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Worker thread half of loading one entity block
+//-----------------------------------------------------------------------------
+static void MapEntity_ParseEntityBlock( MapEntityBlock_t &block )
+{
+	CEntityMapData entData( (char*)block.m_pData );
+
+	// The strings go in one buffer and get pointed to once it stops growing
+	char keyName[MAPKEY_MAXLENGTH];
+	char value[MAPKEY_MAXLENGTH];
+	intp nClassName = -1;
+	if ( entData.ExtractValue( "classname", value ) )
+	{
+		nClassName = block.m_Strings.Count();
+		block.m_Strings.AddMultipleToTail( V_strlen( value ) + 1, value );
+	}
+
+	if ( entData.GetFirstKey( keyName, value ) )
+	{
+		do 
+		{
+			int nKeyLen = V_strlen( keyName ) + 1;
+			int nValueLen = V_strlen( value ) + 1;
+
+			MapEntityParsedKey_t &key = block.m_Keys[ block.m_Keys.AddToTail() ];
+			key.m_pKeyName = (char *)(intp)block.m_Strings.Count();
+			block.m_Strings.AddMultipleToTail( nKeyLen, keyName );
+			key.m_pValue = (const char *)(intp)block.m_Strings.Count();
+			block.m_Strings.AddMultipleToTail( nValueLen, value );
+		} 
+		while ( entData.GetNextKey( keyName, value ) );
+	}
+	Assert( entData.CurrentBufferPosition() == block.m_pEnd );
+
+	block.m_pClassName = ( nClassName >= 0 ) ? block.m_Strings.Base() + nClassName : NULL;
+
+	IEntityFactory *pFactory = block.m_pClassName ? EntityFactoryDictionary()->FindFactory( block.m_pClassName ) : NULL;
+	datamap_t *pDataMap = pFactory ? pFactory->GetDataDescMap() : NULL;
+
+	for ( int i = 0; i < block.m_Keys.Count(); i++ )
+	{
+		MapEntityParsedKey_t &key = block.m_Keys[i];
+		key.m_pKeyName = block.m_Strings.Base() + (intp)key.m_pKeyName;
+		key.m_pValue = block.m_Strings.Base() + (intp)key.m_pValue;
+
+		if ( pDataMap )
+		{
+			MapEntity_ResolveKey( key, pDataMap );
+		}
+		else
+		{
+			key.m_pDataMap = NULL;
+			key.m_pField = NULL;
+			key.m_bResolved = false;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Called by CBaseEntity::KeyValue() in place of its datadesc lookup.
+// Output : true if this is the key the loader is applying and it was looked
+//			up ahead of time, with *pbHandled saying whether the datadesc has
+//			it. false means the caller has to look the key up itself.
+//-----------------------------------------------------------------------------
+bool MapEntity_ApplyParsedKey( CBaseEntity *pEntity, const char *szKeyName, const char *szValue, bool *pbHandled )
+{
+	const MapEntityParsedKey_t *pKey = s_pCurrentParsedKey;
+
+	// overrides may pass on a different key or value, and the entity may
+	// not be of the class the worker looked the key up in
+	if ( !pKey || !pKey->m_bResolved || pKey->m_pKeyName != szKeyName || pKey->m_pValue != szValue )
+		return false;
+	if ( pKey->m_pDataMap != pEntity->GetDataDescMap() )
+		return false;
+
+	*pbHandled = ( pKey->m_pField != NULL );
+	if ( !pKey->m_pField )
+		return true;
+
+	char *pOwner = (char *)pEntity + pKey->m_nOwnerOffset;
+	void *pDest = pOwner + pKey->m_pField->fieldOffset[ TD_OFFSET_NORMAL ];
+
+	switch( pKey->m_pField->fieldType )
+	{
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+	case FIELD_STRING:
+		*(string_t *)pDest = pKey->m_iszValue;
+		break;
+
+	case FIELD_TIME:
+	case FIELD_FLOAT:
+		*(float *)pDest = pKey->m_flValue;
+		break;
+
+	case FIELD_BOOLEAN:
+		*(bool *)pDest = ( pKey->m_nValue != 0 );
+		break;
+
+	case FIELD_CHARACTER:
+		*(char *)pDest = (char)pKey->m_nValue;
+		break;
+
+	case FIELD_SHORT:
+		*(short *)pDest = (short)pKey->m_nValue;
+		break;
+
+	case FIELD_INTEGER:
+	case FIELD_TICK:
+		*(int *)pDest = pKey->m_nValue;
+		break;
+
+	case FIELD_POSITION_VECTOR:
+	case FIELD_VECTOR:
+		((float *)pDest)[0] = pKey->m_vecValue[0];
+		((float *)pDest)[1] = pKey->m_vecValue[1];
+		((float *)pDest)[2] = pKey->m_vecValue[2];
+		break;
+
+	case FIELD_COLOR32:
+		*(color32 *)pDest = pKey->m_clrValue;
+		break;
+
+	default:
+		*pbHandled = ParseKeyvalueField( pOwner, pKey->m_pField, szValue );
+		break;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Main thread half of loading one entity block, the counterpart of
+//			MapEntity_ParseEntity().
+// Output : Returns the position in the entity data where the keys end.
+//-----------------------------------------------------------------------------
+static const char *MapEntity_CreateParsedEntity( CBaseEntity *&pEntity, const MapEntityBlock_t &block, IMapEntityFilter *pFilter )
+{
+	if ( !block.m_pClassName )
+	{
+		Error( "classname missing from entity!\n" );
+	}
+
+	pEntity = NULL;
+	if ( !pFilter || pFilter->ShouldCreateEntity( block.m_pClassName ) )
+	{
+		if ( pFilter )
+			pEntity = pFilter->CreateNextEntity( block.m_pClassName );
+		else
+			pEntity = CreateEntityByName( block.m_pClassName );
+
+		if ( pEntity != NULL )
+		{
+#ifdef _DEBUG
+			pEntity->ValidateDataDescription();
+#endif
+
+			for ( int i = 0; i < block.m_Keys.Count(); i++ )
+			{
+				const MapEntityParsedKey_t &key = block.m_Keys[i];
+				s_pCurrentParsedKey = &key;
+				pEntity->KeyValue( key.m_pKeyName, key.m_pValue );
+			}
+			s_pCurrentParsedKey = NULL;
+		}
+		else
+		{
+			Warning( "Can't init %s\n", block.m_pClassName );
+		}
+	}
+
+	return block.m_pEnd;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Only called on BSP load. Parses and spawns all the entities in the BSP.
 // Input  : pMapData - Pointer to the entity data block to parse.
@@ -335,6 +742,29 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		pMapData = serverenginetools->GetEntityData( pMapData );
 	}
 
+	// Tokenize every entity and look up its keys on worker threads up front
+	CUtlVector< MapEntityBlock_t > entityBlocks;
+	bool bParsedBlocks = false;
+	if ( pMapData && sv_parallel_entity_parse.GetBool() )
+	{
+		VPROF( "MapEntity_ParseAllEntities_ParseBlocks" );
+
+		// MapEntity_ParseToken() builds its character table on first use, get that done here
+		char token[MAPKEY_MAXLENGTH];
+		MapEntity_ParseToken( pMapData, token );
+
+		bParsedBlocks = MapEntity_SplitEntityBlocks( pMapData, entityBlocks );
+		if ( bParsedBlocks )
+		{
+			ParallelProcess( "MapEntity_ParseEntityBlock", entityBlocks.Base(), entityBlocks.Count(), &MapEntity_ParseEntityBlock );
+		}
+		else
+		{
+			DevWarning( "MapEntity_ParseAllEntities: entity lump needs the serial parser\n" );
+		}
+	}
+	int iBlock = 0;
+
 	//  Loop through all entities in the map data, creating each.
 	for ( ; true; pMapData = MapEntity_SkipToNextEntity(pMapData, szTokenBuffer) )
 	{
@@ -361,7 +791,15 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		//
 		CBaseEntity *pEntity;
 		const char *pCurMapData = pMapData;
-		pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
+		if ( bParsedBlocks )
+		{
+			Assert( entityBlocks[iBlock].m_pData == pCurMapData );
+			pMapData = MapEntity_CreateParsedEntity( pEntity, entityBlocks[iBlock++], pFilter );
+		}
+		else
+		{
+			pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
+		}
 		if (pEntity == NULL)
 			continue;
 
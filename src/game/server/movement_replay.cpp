@@ -0,0 +1,406 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Movement recording and replay, see movement_replay.h
+//
+//			movement_record <userid> <file>	starts recording a player
+//			movement_record_stop				writes the recording out
+//			movement_replay <file> [userid] [passes]
+//
+//			The replay runs every command from the recorded move and player
+//			state on the given player (a bot is best), reports the time and
+//			hull traces per command and which commands ended somewhere else
+//			than they did when recorded, then puts the player back.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "player.h"
+#include "usercmd.h"
+#include "igamemovement.h"
+#include "gamemovement.h"
+#include "player_command.h"
+#include "movement_replay.h"
+#include "filesystem.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlbuffer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+extern IGameMovement *g_pGameMovement;
+
+#define MOVEMENT_REPLAY_ID		( ( 'R' << 24 ) + ( 'V' << 16 ) + ( 'O' << 8 ) + 'M' )
+#define MOVEMENT_REPLAY_VERSION	1
+
+ConVar movement_replay_tolerance( "movement_replay_tolerance", "0.01", 0, "How far a replayed command's origin or velocity may be from the recorded one before it counts as diverged." );
+
+//-----------------------------------------------------------------------------
+// What a recording holds. Raw structs, so only the build that recorded a
+// file can replay it; the header sizes catch the rest.
+//-----------------------------------------------------------------------------
+struct MovementReplayHeader_t
+{
+	int			m_nId;
+	int			m_nVersion;
+	int			m_nMoveDataSize;
+	int			m_nRecordSize;
+	int			m_nRecords;
+	char		m_szMapName[64];
+};
+
+// The parts of a command movement looks at
+struct MovementReplayCmd_t
+{
+	int			m_nCommandNumber;
+	int			m_nTickCount;
+	QAngle		m_vecViewAngles;
+	float		m_flForwardMove;
+	float		m_flSideMove;
+	float		m_flUpMove;
+	int			m_nButtons;
+	int			m_nImpulse;
+	int			m_nRandomSeed;
+};
+
+// Player state that movement reads besides CMoveData
+struct MovementReplayState_t
+{
+	int			m_fFlags;
+	int			m_nGroundEntity;		// entity index, -1 for none
+	int			m_nWaterLevel;
+	int			m_nWaterType;
+	Vector		m_vecBaseVelocity;
+	QAngle		m_vecPunchAngle;
+	QAngle		m_vecPunchAngleVel;
+	bool		m_bDucked;
+	bool		m_bDucking;
+	bool		m_bInDuckJump;
+	float		m_flDucktime;
+	float		m_flDuckJumpTime;
+	float		m_flJumpTime;
+	float		m_flFallVelocity;
+
+	// mobility
+	bool		m_bIsPowerSliding;
+	bool		m_bWallRunBumpAhead;
+	int			m_nWallRunState;
+	int			m_nAirJumpState;
+	Vector		m_vecWallNorm;
+	Vector		m_vecLastWallRunPos;
+	Vector		m_vecCornerEscapeVel;
+	float		m_flAutoViewTime;
+	float		m_flCoyoteTime;
+	float		m_flNextWallRunTime;
+};
+
+struct MovementReplayRecord_t
+{
+	float					m_flCurTime;
+	float					m_flFrameTime;
+	MovementReplayCmd_t		m_Cmd;
+	MovementReplayState_t	m_State;
+	CMoveData				m_MoveIn;
+	CMoveData				m_MoveOut;
+	int						m_nWallRunStateOut;
+};
+
+
+//-----------------------------------------------------------------------------
+// Player state
+//-----------------------------------------------------------------------------
+static void GetMovementReplayState( CBasePlayer *pPlayer, MovementReplayState_t &state )
+{
+	state.m_fFlags = pPlayer->GetFlags();
+	state.m_nGroundEntity = pPlayer->GetGroundEntity() ? pPlayer->GetGroundEntity()->entindex() : -1;
+	state.m_nWaterLevel = pPlayer->GetWaterLevel();
+	state.m_nWaterType = pPlayer->GetWaterType();
+	state.m_vecBaseVelocity = pPlayer->GetBaseVelocity();
+	state.m_vecPunchAngle = pPlayer->m_Local.m_vecPunchAngle;
+	state.m_vecPunchAngleVel = pPlayer->m_Local.m_vecPunchAngleVel;
+	state.m_bDucked = pPlayer->m_Local.m_bDucked;
+	state.m_bDucking = pPlayer->m_Local.m_bDucking;
+	state.m_bInDuckJump = pPlayer->m_Local.m_bInDuckJump;
+	state.m_flDucktime = pPlayer->m_Local.m_flDucktime;
+	state.m_flDuckJumpTime = pPlayer->m_Local.m_flDuckJumpTime;
+	state.m_flJumpTime = pPlayer->m_Local.m_flJumpTime;
+	state.m_flFallVelocity = pPlayer->m_Local.m_flFallVelocity;
+
+	state.m_bIsPowerSliding = pPlayer->m_bIsPowerSliding;
+	state.m_bWallRunBumpAhead = pPlayer->m_bWallRunBumpAhead;
+	state.m_nWallRunState = pPlayer->m_nWallRunState;
+	state.m_nAirJumpState = pPlayer->m_nAirJumpState;
+	state.m_vecWallNorm = pPlayer->m_vecWallNorm;
+	state.m_vecLastWallRunPos = pPlayer->m_vecLastWallRunPos;
+	state.m_vecCornerEscapeVel = pPlayer->GetEscapeVel();
+	state.m_flAutoViewTime = pPlayer->m_flAutoViewTime;
+	state.m_flCoyoteTime = pPlayer->m_flCoyoteTime;
+	state.m_flNextWallRunTime = pPlayer->m_flNextWallRunTime;
+}
+
+static void SetMovementReplayState( CBasePlayer *pPlayer, const MovementReplayState_t &state )
+{
+	pPlayer->RemoveFlag( pPlayer->GetFlags() );
+	pPlayer->AddFlag( state.m_fFlags );
+	pPlayer->SetGroundEntity( ( state.m_nGroundEntity >= 0 ) ? UTIL_EntityByIndex( state.m_nGroundEntity ) : NULL );
+	pPlayer->SetWaterLevel( state.m_nWaterLevel );
+	pPlayer->SetWaterType( state.m_nWaterType );
+	pPlayer->SetBaseVelocity( state.m_vecBaseVelocity );
+	pPlayer->m_Local.m_vecPunchAngle = state.m_vecPunchAngle;
+	pPlayer->m_Local.m_vecPunchAngleVel = state.m_vecPunchAngleVel;
+	pPlayer->m_Local.m_bDucked = state.m_bDucked;
+	pPlayer->m_Local.m_bDucking = state.m_bDucking;
+	pPlayer->m_Local.m_bInDuckJump = state.m_bInDuckJump;
+	pPlayer->m_Local.m_flDucktime = state.m_flDucktime;
+	pPlayer->m_Local.m_flDuckJumpTime = state.m_flDuckJumpTime;
+	pPlayer->m_Local.m_flJumpTime = state.m_flJumpTime;
+	pPlayer->m_Local.m_flFallVelocity = state.m_flFallVelocity;
+
+	pPlayer->m_bIsPowerSliding = state.m_bIsPowerSliding;
+	pPlayer->m_bWallRunBumpAhead = state.m_bWallRunBumpAhead;
+	pPlayer->m_nWallRunState = (WallRunState)state.m_nWallRunState;
+	pPlayer->m_nAirJumpState = (AirJumpState)state.m_nAirJumpState;
+	pPlayer->m_vecWallNorm = state.m_vecWallNorm;
+	pPlayer->m_vecLastWallRunPos = state.m_vecLastWallRunPos;
+	pPlayer->SetEscapeVel( state.m_vecCornerEscapeVel );
+	pPlayer->m_flAutoViewTime = state.m_flAutoViewTime;
+	pPlayer->m_flCoyoteTime = state.m_flCoyoteTime;
+	pPlayer->m_flNextWallRunTime = state.m_flNextWallRunTime;
+}
+
+
+//-----------------------------------------------------------------------------
+// Recording
+//-----------------------------------------------------------------------------
+static CHandle<CBasePlayer> s_hRecordPlayer;
+static CUtlVector<MovementReplayRecord_t> s_Recording;
+static char s_szRecordFile[MAX_PATH];
+
+void MovementRecorder_PreMove( CBasePlayer *pPlayer, const CUserCmd *pCmd, const CMoveData *pMove )
+{
+	if ( !s_hRecordPlayer || s_hRecordPlayer != pPlayer )
+		return;
+
+	MovementReplayRecord_t &record = s_Recording[ s_Recording.AddToTail() ];
+	record.m_flCurTime = gpGlobals->curtime;
+	record.m_flFrameTime = gpGlobals->frametime;
+	record.m_Cmd.m_nCommandNumber = pCmd->command_number;
+	record.m_Cmd.m_nTickCount = pCmd->tick_count;
+	record.m_Cmd.m_vecViewAngles = pCmd->viewangles;
+	record.m_Cmd.m_flForwardMove = pCmd->forwardmove;
+	record.m_Cmd.m_flSideMove = pCmd->sidemove;
+	record.m_Cmd.m_flUpMove = pCmd->upmove;
+	record.m_Cmd.m_nButtons = pCmd->buttons;
+	record.m_Cmd.m_nImpulse = pCmd->impulse;
+	record.m_Cmd.m_nRandomSeed = pCmd->random_seed;
+	GetMovementReplayState( pPlayer, record.m_State );
+	record.m_MoveIn = *pMove;
+}
+
+void MovementRecorder_PostMove( CBasePlayer *pPlayer, const CMoveData *pMove )
+{
+	if ( !s_hRecordPlayer || s_hRecordPlayer != pPlayer || !s_Recording.Count() )
+		return;
+
+	MovementReplayRecord_t &record = s_Recording.Tail();
+	record.m_MoveOut = *pMove;
+	record.m_nWallRunStateOut = pPlayer->m_nWallRunState;
+}
+
+CON_COMMAND( movement_record, "Record a player's movement commands. Arguments: <userid> <file>" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 3 )
+	{
+		Msg( "Usage: movement_record <userid> <file>\n" );
+		return;
+	}
+
+	CBasePlayer *pPlayer = UTIL_PlayerByUserId( atoi( args[1] ) );
+	if ( !pPlayer )
+	{
+		Warning( "movement_record: no player with userid %s\n", args[1] );
+		return;
+	}
+
+	s_hRecordPlayer = pPlayer;
+	s_Recording.RemoveAll();
+	Q_strncpy( s_szRecordFile, args[2], sizeof( s_szRecordFile ) );
+	Msg( "Recording the movement of %s to %s\n", pPlayer->GetPlayerName(), s_szRecordFile );
+}
+
+CON_COMMAND( movement_record_stop, "Stop recording movement and write the recording out." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !s_szRecordFile[0] )
+		return;
+
+	MovementReplayHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.m_nId = MOVEMENT_REPLAY_ID;
+	header.m_nVersion = MOVEMENT_REPLAY_VERSION;
+	header.m_nMoveDataSize = sizeof( CMoveData );
+	header.m_nRecordSize = sizeof( MovementReplayRecord_t );
+	header.m_nRecords = s_Recording.Count();
+	Q_strncpy( header.m_szMapName, STRING( gpGlobals->mapname ), sizeof( header.m_szMapName ) );
+
+	CUtlBuffer buf;
+	buf.Put( &header, sizeof( header ) );
+	buf.Put( s_Recording.Base(), s_Recording.Count() * sizeof( MovementReplayRecord_t ) );
+
+	if ( filesystem->WriteFile( s_szRecordFile, "MOD", buf ) )
+	{
+		Msg( "Wrote %d movement commands to %s\n", s_Recording.Count(), s_szRecordFile );
+	}
+	else
+	{
+		Warning( "movement_record_stop: couldn't write %s\n", s_szRecordFile );
+	}
+
+	s_hRecordPlayer = NULL;
+	s_Recording.Purge();
+	s_szRecordFile[0] = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Replay
+//-----------------------------------------------------------------------------
+CON_COMMAND( movement_replay, "Replay recorded movement commands and time them. Arguments: <file> [userid] [passes]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: movement_replay <file> [userid] [passes]\n" );
+		return;
+	}
+
+	CBasePlayer *pPlayer = ( args.ArgC() >= 3 ) ? UTIL_PlayerByUserId( atoi( args[2] ) ) : UTIL_GetCommandClient();
+	if ( !pPlayer )
+	{
+		pPlayer = UTIL_PlayerByIndex( 1 );
+	}
+	if ( !pPlayer || !pPlayer->IsAlive() )
+	{
+		Warning( "movement_replay: no live player to replay on\n" );
+		return;
+	}
+	int nPasses = ( args.ArgC() >= 4 ) ? MAX( atoi( args[3] ), 1 ) : 1;
+
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( args[1], "MOD", buf ) || buf.TellPut() < (int)sizeof( MovementReplayHeader_t ) )
+	{
+		Warning( "movement_replay: couldn't read %s\n", args[1] );
+		return;
+	}
+
+	MovementReplayHeader_t header;
+	buf.Get( &header, sizeof( header ) );
+	if ( header.m_nId != MOVEMENT_REPLAY_ID || header.m_nVersion != MOVEMENT_REPLAY_VERSION ||
+		header.m_nMoveDataSize != sizeof( CMoveData ) || header.m_nRecordSize != sizeof( MovementReplayRecord_t ) ||
+		buf.GetBytesRemaining() < header.m_nRecords * (int)sizeof( MovementReplayRecord_t ) )
+	{
+		Warning( "movement_replay: %s wasn't recorded by this build\n", args[1] );
+		return;
+	}
+
+	if ( Q_stricmp( header.m_szMapName, STRING( gpGlobals->mapname ) ) )
+	{
+		Warning( "movement_replay: %s was recorded on %s, this is %s\n", args[1], header.m_szMapName, STRING( gpGlobals->mapname ) );
+	}
+
+	const MovementReplayRecord_t *pRecords = (const MovementReplayRecord_t *)buf.PeekGet();
+	CGameMovement *pGameMovement = static_cast<CGameMovement *>( g_pGameMovement );
+
+	// everything the replay touches, to put back afterwards
+	MovementReplayState_t savedState;
+	GetMovementReplayState( pPlayer, savedState );
+	Vector vecSavedOrigin = pPlayer->GetAbsOrigin();
+	Vector vecSavedVelocity = pPlayer->GetAbsVelocity();
+	QAngle angSavedAngles = pPlayer->GetAbsAngles();
+	int nSavedHealth = pPlayer->GetHealth();
+	float flSavedCurTime = gpGlobals->curtime;
+	float flSavedFrameTime = gpGlobals->frametime;
+
+	float flTolerance = movement_replay_tolerance.GetFloat();
+	int nDiverged = 0;
+	int iFirstDiverged = -1;
+	double flTotalSeconds = 0;
+	double flWorstSeconds = 0;
+	pGameMovement->ResetMoveTraceStats();
+
+	CMoveData move;
+	CUserCmd cmd;
+	for ( int iPass = 0; iPass < nPasses; iPass++ )
+	{
+		for ( int i = 0; i < header.m_nRecords; i++ )
+		{
+			const MovementReplayRecord_t &record = pRecords[i];
+
+			cmd.Reset();
+			cmd.command_number = record.m_Cmd.m_nCommandNumber;
+			cmd.tick_count = record.m_Cmd.m_nTickCount;
+			cmd.viewangles = record.m_Cmd.m_vecViewAngles;
+			cmd.forwardmove = record.m_Cmd.m_flForwardMove;
+			cmd.sidemove = record.m_Cmd.m_flSideMove;
+			cmd.upmove = record.m_Cmd.m_flUpMove;
+			cmd.buttons = record.m_Cmd.m_nButtons;
+			cmd.impulse = record.m_Cmd.m_nImpulse;
+			cmd.random_seed = record.m_Cmd.m_nRandomSeed;
+
+			gpGlobals->curtime = record.m_flCurTime;
+			gpGlobals->frametime = record.m_flFrameTime;
+			SetMovementReplayState( pPlayer, record.m_State );
+			move = record.m_MoveIn;
+			move.m_nPlayerHandle = pPlayer->GetRefEHandle();
+			pPlayer->SetAbsOrigin( move.GetAbsOrigin() );
+			pPlayer->SetAbsVelocity( move.m_vecVelocity );
+
+			CFastTimer timer;
+			timer.Start();
+			PlayerMove()->ReplayMovement( pPlayer, &cmd, &move );
+			timer.End();
+
+			double flSeconds = timer.GetDuration().GetSeconds();
+			flTotalSeconds += flSeconds;
+			flWorstSeconds = MAX( flWorstSeconds, flSeconds );
+
+			if ( iPass == 0 &&
+				( !VectorsAreEqual( move.GetAbsOrigin(), record.m_MoveOut.GetAbsOrigin(), flTolerance ) ||
+				  !VectorsAreEqual( move.m_vecVelocity, record.m_MoveOut.m_vecVelocity, flTolerance ) ||
+				  pPlayer->m_nWallRunState != record.m_nWallRunStateOut ) )
+			{
+				if ( iFirstDiverged < 0 )
+				{
+					iFirstDiverged = i;
+					Msg( "  command %d diverged: origin (%.3f %.3f %.3f), recorded (%.3f %.3f %.3f)\n", i,
+						move.GetAbsOrigin().x, move.GetAbsOrigin().y, move.GetAbsOrigin().z,
+						record.m_MoveOut.GetAbsOrigin().x, record.m_MoveOut.GetAbsOrigin().y, record.m_MoveOut.GetAbsOrigin().z );
+				}
+				nDiverged++;
+			}
+		}
+	}
+
+	gpGlobals->curtime = flSavedCurTime;
+	gpGlobals->frametime = flSavedFrameTime;
+	SetMovementReplayState( pPlayer, savedState );
+	pPlayer->SetAbsOrigin( vecSavedOrigin );
+	pPlayer->SetAbsVelocity( vecSavedVelocity );
+	pPlayer->SetAbsAngles( angSavedAngles );
+	pPlayer->SetHealth( nSavedHealth );
+
+	int nCommands = MAX( header.m_nRecords * nPasses, 1 );
+	const CGameMovement::MoveTraceStats_t &stats = pGameMovement->GetMoveTraceStats();
+	Msg( "Replayed %d commands x %d passes on %s\n", header.m_nRecords, nPasses, pPlayer->GetPlayerName() );
+	Msg( "  %.0f ns per command, worst %.0f ns\n", flTotalSeconds * 1e9 / nCommands, flWorstSeconds * 1e9 );
+	Msg( "  %.2f hull traces per command, %.2f from the memo, %.2f against the gathered collision\n",
+		(float)stats.m_nTraces / nCommands, (float)stats.m_nMemoHits / nCommands, (float)stats.m_nListTraces / nCommands );
+	Msg( "  %d of %d commands diverged\n", nDiverged, header.m_nRecords );
+}
@@ -0,0 +1,23 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Records the movement commands of a player together with the move
+//			state they ran from, and replays them through the game movement
+//			code to time it and to check it still ends up where it did.
+//
+//=============================================================================//
+
+#ifndef MOVEMENT_REPLAY_H
+#define MOVEMENT_REPLAY_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CBasePlayer;
+class CUserCmd;
+class CMoveData;
+
+// Called by CPlayerMove::RunCommand around ProcessMovement()
+void MovementRecorder_PreMove( CBasePlayer *pPlayer, const CUserCmd *pCmd, const CMoveData *pMove );
+void MovementRecorder_PostMove( CBasePlayer *pPlayer, const CMoveData *pMove );
+
+#endif // MOVEMENT_REPLAY_H
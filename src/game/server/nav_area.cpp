@@ -19,6 +19,8 @@
 #include "nav_mesh.h"
 #include "nav_node.h"
 #include "nav_pathfind.h"
+#include "nav_compact.h"
+#include "nav_path_query.h"
 #include "nav_colors.h"
 #include "fmtstr.h"
 #include "props_shared.h"
@@ -183,6 +185,7 @@ CNavArea::CNavArea( void )
 	m_nearNavSearchMarker = 0;
 	m_damagingTickCount = 0;
 	m_openMarker = 0;
+	m_compactIndex = -1;
 
 	m_parent = NULL;
 	m_parentHow = GO_NORTH;
@@ -527,6 +530,8 @@ public:
  */
 CNavArea::~CNavArea()
 {
+	TheNavCompactMesh.Invalidate();
+
 	// spot encounters aren't owned by anything else, so free them up here
 	m_spotEncounters.PurgeAndDeleteElements();
 
@@ -801,6 +806,7 @@ void CNavArea::ConnectTo( CNavArea *area, NavDirType dir )
 	con.area = area;
 	con.length = ( area->GetCenter() - GetCenter() ).Length();
 	m_connect[ dir ].AddToTail( con );
+	TheNavCompactMesh.Invalidate();
 	m_incomingConnect[ dir ].FindAndRemove( con );
 
 	NavDirType dirOpposite = OppositeDirection( dir );
@@ -824,6 +830,7 @@ void CNavArea::ConnectTo( CNavLadder *ladder )
 	float center = (ladder->m_top.z + ladder->m_bottom.z) * 0.5f;
 
 	Disconnect( ladder ); // just in case
+	TheNavCompactMesh.Invalidate();
 
 	if ( GetCenter().z > center )
 	{
@@ -841,6 +848,8 @@ void CNavArea::ConnectTo( CNavLadder *ladder )
  */
 void CNavArea::Disconnect( CNavArea *area )
 {
+	TheNavCompactMesh.Invalidate();
+
 	NavConnect connect;
 	connect.area = area;
 
@@ -872,6 +881,8 @@ void CNavArea::Disconnect( CNavArea *area )
  */
 void CNavArea::Disconnect( CNavLadder *ladder )
 {
+	TheNavCompactMesh.Invalidate();
+
 	NavLadderConnect con;
 	con.ladder = ladder;
 
@@ -4646,9 +4657,27 @@ bool CNavArea::IsBlocked( int teamID, bool ignoreNavBlockers ) const
 	return m_isBlocked[ teamIdx ];
 }
 
+//--------------------------------------------------------------------------------------------------------------
+// The blocked flags as a bit per team, for NavPathQuery_OnAreaBlockedChanged()
+static unsigned char GetBlockedTeamBits( const bool *isBlocked )
+{
+	unsigned char blockedTeams = 0;
+	for ( int i=0; i<MAX_NAV_TEAMS; ++i )
+	{
+		if ( isBlocked[ i ] )
+		{
+			blockedTeams |= ( 1 << i );
+		}
+	}
+	return blockedTeams;
+}
+
 //--------------------------------------------------------------------------------------------------------
 void CNavArea::MarkAsBlocked( int teamID, CBaseEntity *blocker, bool bGenerateEvent )
 {
+	unsigned char oldBlockedTeams = GetBlockedTeamBits( m_isBlocked );
+	int oldAttributes = m_attributeFlags;
+
 	if ( blocker && blocker->ClassMatches( "func_nav_blocker" ) )
 	{
 		m_attributeFlags |= NAV_MESH_NAV_BLOCKER;
@@ -4670,6 +4699,9 @@ void CNavArea::MarkAsBlocked( int teamID, CBaseEntity *blocker, bool bGenerateEv
 		m_isBlocked[ teamIdx ] = true;
 	}
 
+	TheNavCompactMesh.UpdateBlocked( this );
+	NavPathQuery_OnAreaBlockedChanged( this, oldBlockedTeams, oldAttributes );
+
 	if ( !wasBlocked )
 	{
 		if ( bGenerateEvent )
@@ -4721,6 +4753,9 @@ void CNavArea::UpdateBlockedFromNavBlockers( void )
 	Extent bounds;
 	GetExtent( &bounds );
 
+	unsigned char oldBlockedTeams = GetBlockedTeamBits( m_isBlocked );
+	int oldAttributes = m_attributeFlags;
+
 	// Save off old values, reset to not blocked state
 	m_attributeFlags &= ~NAV_MESH_NAV_BLOCKER;
 	bool oldBlocked[MAX_NAV_TEAMS];
@@ -4739,6 +4774,9 @@ void CNavArea::UpdateBlockedFromNavBlockers( void )
 		m_attributeFlags |= NAV_MESH_NAV_BLOCKER;
 	}
 
+	TheNavCompactMesh.UpdateBlocked( this );
+	NavPathQuery_OnAreaBlockedChanged( this, oldBlockedTeams, oldAttributes );
+
 	// If we're unblocked, fire a nav_blocked event.
 	if ( wasBlocked != isBlocked )
 	{
@@ -4774,6 +4812,7 @@ void CNavArea::UpdateBlockedFromNavBlockers( void )
 void CNavArea::UnblockArea( int teamID )
 {
 	bool wasBlocked = IsBlocked( teamID );
+	unsigned char oldBlockedTeams = GetBlockedTeamBits( m_isBlocked );
 
 	if ( teamID == TEAM_ANY )
 	{
@@ -4788,6 +4827,9 @@ void CNavArea::UnblockArea( int teamID )
 		m_isBlocked[ teamIdx ] = false;
 	}
 
+	TheNavCompactMesh.UpdateBlocked( this );
+	NavPathQuery_OnAreaBlockedChanged( this, oldBlockedTeams, m_attributeFlags );
+
 	if ( wasBlocked )
 	{
 		IGameEvent * event = gameeventmanager->CreateEvent( "nav_blocked" );
@@ -4847,6 +4889,7 @@ void CNavArea::UpdateBlocked( bool force, int teamID )
 	bounds.hi.Init( sizeX, sizeY, VEC_DUCK_HULL_MAX.z - HalfHumanHeight );
 
 	bool wasBlocked = IsBlocked( TEAM_ANY );
+	unsigned char oldBlockedTeams = GetBlockedTeamBits( m_isBlocked );
 
 	// See if spot is valid
 #ifdef TERROR
@@ -4907,6 +4950,8 @@ void CNavArea::UpdateBlocked( bool force, int teamID )
 	}
 
 	bool isBlocked = IsBlocked( TEAM_ANY );
+	TheNavCompactMesh.UpdateBlocked( this );
+	NavPathQuery_OnAreaBlockedChanged( this, oldBlockedTeams, m_attributeFlags );
 
 	if ( wasBlocked != isBlocked )
 	{
@@ -5721,6 +5766,16 @@ bool CNavArea::IsPotentiallyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	if ( nav_compact_mesh.GetBool() )
+	{
+		int index = TheNavCompactMesh.GetIndex( this );
+		int viewedIndex = TheNavCompactMesh.GetIndex( viewedArea );
+		if ( index >= 0 && viewedIndex >= 0 )
+		{
+			return TheNavCompactMesh.IsPotentiallyVisible( index, viewedIndex );
+		}
+	}
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5766,6 +5821,16 @@ bool CNavArea::IsCompletelyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	if ( nav_compact_mesh.GetBool() )
+	{
+		int index = TheNavCompactMesh.GetIndex( this );
+		int viewedIndex = TheNavCompactMesh.GetIndex( viewedArea );
+		if ( index >= 0 && viewedIndex >= 0 )
+		{
+			return TheNavCompactMesh.IsCompletelyVisible( index, viewedIndex );
+		}
+	}
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
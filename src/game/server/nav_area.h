@@ -13,6 +13,7 @@
 #define _NAV_AREA_H_
 
 #include "nav_ladder.h"
+#include "nav_compact.h"
 #include "tier1/memstack.h"
 
 // BOTPORT: Clean up relationship between team index and danger storage in nav areas
@@ -534,6 +535,11 @@ public:
 	{
 		int i;
 
+		// the packed rows already have the inherited areas merged in
+		int compactIndex = nav_compact_mesh.GetBool() ? TheNavCompactMesh.GetIndex( this ) : -1;
+		if ( compactIndex >= 0 )
+			return TheNavCompactMesh.ForAllVisibleAreas( compactIndex, false, func );
+
 		++s_nCurrVisTestCounter;
 
 		for ( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
@@ -591,6 +597,10 @@ public:
 	{
 		int i;
 
+		int compactIndex = nav_compact_mesh.GetBool() ? TheNavCompactMesh.GetIndex( this ) : -1;
+		if ( compactIndex >= 0 )
+			return TheNavCompactMesh.ForAllVisibleAreas( compactIndex, true, func );
+
 		++s_nCurrVisTestCounter;
 
 		for ( i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
@@ -642,6 +652,7 @@ public:
 private:
 	friend class CNavMesh;
 	friend class CNavLadder;
+	friend class CNavCompactMesh;
 	friend class CCSNavArea;									// allow CS load code to complete replace our default load behavior
 
 	static bool m_isReset;										// if true, don't bother cleaning up in destructor since everything is going away
@@ -755,6 +766,8 @@ private:
 	uint32 m_nVisTestCounter;
 	static uint32 s_nCurrVisTestCounter;
 
+	int m_compactIndex;											// where this area is in TheNavCompactMesh, see CNavCompactMesh::GetIndex()
+
 	CUtlVector< CHandle< CFuncNavCost > > m_funcNavCostVector;	// active, overlapping cost entities
 };
 
@@ -0,0 +1,581 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Packed copy of the nav mesh, see nav_compact.h
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "nav_compact.h"
+#include "nav_mesh.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar nav_compact_mesh( "nav_compact_mesh", "1", FCVAR_CHEAT, "Answer nav area lookups from the packed copy of the mesh." );
+
+CNavCompactMesh TheNavCompactMesh;
+
+
+//-----------------------------------------------------------------------------
+CNavCompactMesh::CNavCompactMesh() : m_indexByID( DefLessFunc( unsigned int ) )
+{
+	m_isBuilt = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies the hot data out of TheNavAreas and CNavMesh's grid
+//-----------------------------------------------------------------------------
+void CNavCompactMesh::Build( void )
+{
+	VPROF( "CNavCompactMesh::Build" );
+
+	int count = TheNavAreas.Count();
+
+	m_areas.SetCount( count );
+	m_ids.SetCount( count );
+	m_centers.SetCount( count );
+	m_surfaces.SetCount( count );
+	m_attributes.SetCount( count );
+	m_blockedTeams.SetCount( count );
+	m_firstLink.SetCount( count + 1 );
+	m_links.RemoveAll();
+	m_indexByID.RemoveAll();
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		m_indexByID.Insert( TheNavAreas[ it ]->GetID(), it );
+	}
+
+	for ( int i = 0; i < count; ++i )
+	{
+		CNavArea *area = TheNavAreas[ i ];
+
+		m_areas[ i ] = area;
+		m_ids[ i ] = area->GetID();
+		area->m_compactIndex = i;
+		m_centers[ i ] = area->m_center;
+
+		NavCompactSurface_t &surface = m_surfaces[ i ];
+		surface.m_nwCorner = area->m_nwCorner;
+		surface.m_seCorner = area->m_seCorner;
+		surface.m_invDxCorners = area->m_invDxCorners;
+		surface.m_invDyCorners = area->m_invDyCorners;
+		surface.m_neZ = area->m_neZ;
+		surface.m_swZ = area->m_swZ;
+
+		m_attributes[ i ] = 0;
+		m_blockedTeams[ i ] = 0;
+
+		// links go in the order NavAreaBuildPath() visits them
+		m_firstLink[ i ] = m_links.Count();
+
+		for ( int dir = 0; dir < NUM_DIRECTIONS; ++dir )
+		{
+			const NavConnectVector *floorList = area->GetAdjacentAreas( (NavDirType)dir );
+			FOR_EACH_VEC( (*floorList), c )
+			{
+				const NavConnect &connect = floorList->Element( c );
+				unsigned short found = m_indexByID.Find( connect.area->GetID() );
+				if ( found == m_indexByID.InvalidIndex() )
+					continue;
+
+				NavCompactLink_t &link = m_links[ m_links.AddToTail() ];
+				link.m_area = m_indexByID[ found ];
+				link.m_length = ( connect.length > 0.0f ) ? connect.length : ( connect.area->GetCenter() - area->GetCenter() ).Length();
+				link.m_how = (unsigned char)dir;
+			}
+		}
+
+		const NavLadderConnectVector *ladderList = area->GetLadders( CNavLadder::LADDER_UP );
+		FOR_EACH_VEC( (*ladderList), c )
+		{
+			const CNavLadder *ladder = ladderList->Element( c ).ladder;
+
+			// do not use BEHIND connection, as its very hard to get to when going up a ladder
+			CNavArea *topAreas[] = { ladder->m_topForwardArea, ladder->m_topLeftArea, ladder->m_topRightArea };
+			for ( int t = 0; t < ARRAYSIZE( topAreas ); ++t )
+			{
+				if ( !topAreas[ t ] )
+					continue;
+
+				unsigned short found = m_indexByID.Find( topAreas[ t ]->GetID() );
+				if ( found == m_indexByID.InvalidIndex() )
+					continue;
+
+				NavCompactLink_t &link = m_links[ m_links.AddToTail() ];
+				link.m_area = m_indexByID[ found ];
+				link.m_length = ladder->m_length;
+				link.m_how = GO_LADDER_UP;
+			}
+		}
+
+		ladderList = area->GetLadders( CNavLadder::LADDER_DOWN );
+		FOR_EACH_VEC( (*ladderList), c )
+		{
+			const CNavLadder *ladder = ladderList->Element( c ).ladder;
+			if ( !ladder->m_bottomArea )
+				continue;
+
+			unsigned short found = m_indexByID.Find( ladder->m_bottomArea->GetID() );
+			if ( found == m_indexByID.InvalidIndex() )
+				continue;
+
+			NavCompactLink_t &link = m_links[ m_links.AddToTail() ];
+			link.m_area = m_indexByID[ found ];
+			link.m_length = ladder->m_length;
+			link.m_how = GO_LADDER_DOWN;
+		}
+
+		if ( area->GetElevator() )
+		{
+			const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+			FOR_EACH_VEC( elevatorAreas, c )
+			{
+				CNavArea *elevatorArea = elevatorAreas[ c ].area;
+				unsigned short found = m_indexByID.Find( elevatorArea->GetID() );
+				if ( found == m_indexByID.InvalidIndex() )
+					continue;
+
+				NavCompactLink_t &link = m_links[ m_links.AddToTail() ];
+				link.m_area = m_indexByID[ found ];
+				link.m_length = ( elevatorArea->GetCenter() - area->GetCenter() ).Length();
+				link.m_how = ( elevatorArea->GetCenter().z > area->GetCenter().z ) ? GO_ELEVATOR_UP : GO_ELEVATOR_DOWN;
+			}
+		}
+
+		UpdateBlocked( area );
+	}
+	m_firstLink[ count ] = m_links.Count();
+
+	// the grid, cell by cell in the same order
+	const CUtlVector< NavAreaVector > &grid = TheNavMesh->m_grid;
+	m_firstInCell.SetCount( grid.Count() + 1 );
+	m_cellAreas.RemoveAll();
+	FOR_EACH_VEC( grid, cell )
+	{
+		m_firstInCell[ cell ] = m_cellAreas.Count();
+		FOR_EACH_VEC( grid[ cell ], it )
+		{
+			unsigned short found = m_indexByID.Find( grid[ cell ][ it ]->GetID() );
+			if ( found != m_indexByID.InvalidIndex() )
+			{
+				m_cellAreas.AddToTail( m_indexByID[ found ] );
+			}
+		}
+	}
+	m_firstInCell[ grid.Count() ] = m_cellAreas.Count();
+
+	BuildVisibility();
+
+	m_isBuilt = true;
+}
+
+//-----------------------------------------------------------------------------
+static int __cdecl CompareVisWords( const unsigned short *lhs, const unsigned short *rhs )
+{
+	return (int)*lhs - (int)*rhs;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Resolves each area's visibility list against the list it inherits
+//			from into a row of bits. The area's own entries win, including the
+//			NOT_VISIBLE ones that take an inherited area back out.
+//-----------------------------------------------------------------------------
+void CNavCompactMesh::BuildVisibility( void )
+{
+	VPROF( "CNavCompactMesh::BuildVisibility" );
+
+	int count = m_areas.Count();
+	int wordCount = ( count + BITS_PER_INT - 1 ) >> LOG2_BITS_PER_INT;
+
+	m_visFirstWord.SetCount( count + 1 );
+	m_visWordIndex.RemoveAll();
+	m_visPotential.RemoveAll();
+	m_visComplete.RemoveAll();
+
+	// scratch row, cleared word by word as each row is copied out
+	CUtlVector< unsigned int > decided;
+	CUtlVector< unsigned int > potential;
+	CUtlVector< unsigned int > complete;
+	CUtlVector< unsigned short > touched;
+	decided.SetCount( wordCount );
+	potential.SetCount( wordCount );
+	complete.SetCount( wordCount );
+	for ( int w = 0; w < wordCount; ++w )
+	{
+		decided[ w ] = potential[ w ] = complete[ w ] = 0;
+	}
+
+	for ( int i = 0; i < count; ++i )
+	{
+		const CNavArea *area = m_areas[ i ];
+		m_visFirstWord[ i ] = m_visWordIndex.Count();
+
+		const CNavArea::CAreaBindInfoArray *lists[2] = { &area->m_potentiallyVisibleAreas, NULL };
+		if ( area->m_inheritVisibilityFrom.area )
+		{
+			lists[1] = &area->m_inheritVisibilityFrom.area->m_potentiallyVisibleAreas;
+		}
+
+		touched.RemoveAll();
+		for ( int l = 0; l < ARRAYSIZE( lists ) && lists[ l ]; ++l )
+		{
+			const CNavArea::CAreaBindInfoArray &list = *lists[ l ];
+			FOR_EACH_VEC( list, it )
+			{
+				int viewedIndex = FindIndex( list[ it ].area );
+				if ( viewedIndex < 0 )
+					continue;
+
+				int w = viewedIndex >> LOG2_BITS_PER_INT;
+				unsigned int bit = 1u << ( viewedIndex & ( BITS_PER_INT - 1 ) );
+
+				// the first entry for an area decides it
+				if ( decided[ w ] & bit )
+					continue;
+
+				if ( !decided[ w ] )
+				{
+					touched.AddToTail( (unsigned short)w );
+				}
+				decided[ w ] |= bit;
+
+				unsigned char attributes = list[ it ].attributes;
+				if ( attributes != CNavArea::NOT_VISIBLE )
+				{
+					potential[ w ] |= bit;
+				}
+				if ( attributes & CNavArea::COMPLETELY_VISIBLE )
+				{
+					complete[ w ] |= bit;
+				}
+			}
+		}
+
+		touched.Sort( CompareVisWords );
+
+		FOR_EACH_VEC( touched, it )
+		{
+			int w = touched[ it ];
+			if ( potential[ w ] )
+			{
+				m_visWordIndex.AddToTail( (unsigned short)w );
+				m_visPotential.AddToTail( potential[ w ] );
+				m_visComplete.AddToTail( complete[ w ] );
+			}
+
+			decided[ w ] = potential[ w ] = complete[ w ] = 0;
+		}
+	}
+	m_visFirstWord[ count ] = m_visWordIndex.Count();
+}
+
+//-----------------------------------------------------------------------------
+bool CNavCompactMesh::IsVisible( const CUtlVector< unsigned int > &bits, int index, int viewedIndex ) const
+{
+	unsigned short w = (unsigned short)( viewedIndex >> LOG2_BITS_PER_INT );
+
+	int lo = m_visFirstWord[ index ];
+	int hi = m_visFirstWord[ index + 1 ] - 1;
+	while ( lo <= hi )
+	{
+		int mid = ( lo + hi ) >> 1;
+		if ( m_visWordIndex[ mid ] < w )
+		{
+			lo = mid + 1;
+		}
+		else if ( m_visWordIndex[ mid ] > w )
+		{
+			hi = mid - 1;
+		}
+		else
+		{
+			return ( bits[ mid ] & ( 1u << ( viewedIndex & ( BITS_PER_INT - 1 ) ) ) ) != 0;
+		}
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+int CNavCompactMesh::GetIndex( unsigned int areaID ) const
+{
+	unsigned short it = m_indexByID.Find( areaID );
+	return ( it != m_indexByID.InvalidIndex() ) ? m_indexByID[ it ] : -1;
+}
+
+//-----------------------------------------------------------------------------
+int CNavCompactMesh::GetIndex( const CNavArea *area ) const
+{
+	return m_isBuilt ? FindIndex( area ) : -1;
+}
+
+//-----------------------------------------------------------------------------
+int CNavCompactMesh::FindIndex( const CNavArea *area ) const
+{
+	if ( !area )
+		return -1;
+
+	int index = area->m_compactIndex;
+	return ( index >= 0 && index < m_areas.Count() && m_areas[ index ] == area ) ? index : -1;
+}
+
+//-----------------------------------------------------------------------------
+// Blocked state and the nav blocker attribute change at run time, the rest
+// of the attributes don't
+//-----------------------------------------------------------------------------
+void CNavCompactMesh::UpdateBlocked( const CNavArea *area )
+{
+	if ( !m_areas.Count() )
+		return;
+
+	int index = FindIndex( area );
+	if ( index < 0 )
+		return;
+
+	unsigned char blockedTeams = 0;
+	for ( int i = 0; i < MAX_NAV_TEAMS; ++i )
+	{
+		if ( area->m_isBlocked[ i ] )
+		{
+			blockedTeams |= ( 1 << i );
+		}
+	}
+
+	m_blockedTeams[ index ] = blockedTeams;
+	m_attributes[ index ] = area->GetAttributes();
+}
+
+//-----------------------------------------------------------------------------
+// Same as CNavArea::IsBlocked()
+//-----------------------------------------------------------------------------
+bool CNavCompactMesh::IsBlocked( int index, int teamID, bool ignoreNavBlockers ) const
+{
+	if ( ignoreNavBlockers && ( m_attributes[ index ] & NAV_MESH_NAV_BLOCKER ) )
+	{
+		return false;
+	}
+
+	if ( teamID == TEAM_ANY )
+	{
+		return ( m_blockedTeams[ index ] != 0 );
+	}
+
+	int teamIdx = teamID % MAX_NAV_TEAMS;
+	return ( m_blockedTeams[ index ] & ( 1 << teamIdx ) ) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Same as CNavArea::IsOverlapping() with no tolerance
+//-----------------------------------------------------------------------------
+bool CNavCompactMesh::IsOverlapping( int index, const Vector &pos ) const
+{
+	const NavCompactSurface_t &surface = m_surfaces[ index ];
+	return ( pos.x >= surface.m_nwCorner.x && pos.x <= surface.m_seCorner.x &&
+			 pos.y >= surface.m_nwCorner.y && pos.y <= surface.m_seCorner.y );
+}
+
+//-----------------------------------------------------------------------------
+// Same as CNavArea::GetZ()
+//-----------------------------------------------------------------------------
+float CNavCompactMesh::GetZ( int index, const Vector &pos ) const
+{
+	const NavCompactSurface_t &surface = m_surfaces[ index ];
+
+	// guard against division by zero due to degenerate areas
+	if ( surface.m_invDxCorners == 0.0f || surface.m_invDyCorners == 0.0f )
+		return surface.m_neZ;
+
+	float u = ( pos.x - surface.m_nwCorner.x ) * surface.m_invDxCorners;
+	float v = ( pos.y - surface.m_nwCorner.y ) * surface.m_invDyCorners;
+
+	// clamp Z values to (x,y) volume
+	u = fsel( u, u, 0 );			// u >= 0 ? u : 0
+	u = fsel( u - 1.0f, 1.0f, u );	// u >= 1 ? 1 : u
+
+	v = fsel( v, v, 0 );			// v >= 0 ? v : 0
+	v = fsel( v - 1.0f, 1.0f, v );	// v >= 1 ? 1 : v
+
+	float northZ = surface.m_nwCorner.z + u * ( surface.m_neZ - surface.m_nwCorner.z );
+	float southZ = surface.m_swZ + u * ( surface.m_seCorner.z - surface.m_swZ );
+
+	return northZ + v * ( southZ - northZ );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: CNavMesh::GetNavArea() over the packed arrays
+//-----------------------------------------------------------------------------
+CNavArea *CNavCompactMesh::GetNavArea( const Vector &pos, float beneathLimit ) const
+{
+	VPROF_BUDGET( "CNavCompactMesh::GetNavArea", "NextBot" );
+
+	if ( m_firstInCell.Count() < 2 )
+		return NULL;
+
+	// get list in cell that contains position
+	int x = TheNavMesh->WorldToGridX( pos.x );
+	int y = TheNavMesh->WorldToGridY( pos.y );
+	int cell = x + y * TheNavMesh->m_gridSizeX;
+
+	// search cell list to find correct area
+	int use = -1;
+	float useZ = -99999999.9f;
+	Vector testPos = pos + Vector( 0, 0, 5 );
+
+	for ( int it = m_firstInCell[ cell ]; it < m_firstInCell[ cell + 1 ]; ++it )
+	{
+		int index = m_cellAreas[ it ];
+
+		// check if position is within 2D boundaries of this area
+		if ( IsOverlapping( index, testPos ) )
+		{
+			// project position onto area to get Z
+			float z = GetZ( index, testPos );
+
+			// if area is above us, skip it
+			if ( z > testPos.z )
+				continue;
+
+			// if area is too far below us, skip it
+			if ( z < pos.z - beneathLimit )
+				continue;
+
+			// if area is higher than the one we have, use this instead
+			if ( z > useZ )
+			{
+				use = index;
+				useZ = z;
+			}
+		}
+	}
+
+	return ( use >= 0 ) ? m_areas[ use ] : NULL;
+}
+
+//-----------------------------------------------------------------------------
+int CNavCompactMesh::GetMemoryUsage( void ) const
+{
+	return m_areas.Count() * ( sizeof( CNavArea * ) + sizeof( unsigned int ) + sizeof( Vector ) + sizeof( NavCompactSurface_t ) + sizeof( int ) + sizeof( unsigned char ) + sizeof( int ) ) +
+		m_links.Count() * sizeof( NavCompactLink_t ) +
+		( m_firstInCell.Count() + m_cellAreas.Count() ) * sizeof( int ) +
+		m_visFirstWord.Count() * sizeof( int ) +
+		m_visWordIndex.Count() * ( sizeof( unsigned short ) + 2 * sizeof( unsigned int ) );
+}
+
+
+//-----------------------------------------------------------------------------
+class CollectVisibleAreas
+{
+public:
+	bool operator() ( CNavArea *area )
+	{
+		m_areas.AddToTail( area );
+		return true;
+	}
+
+	CUtlVector< CNavArea * > m_areas;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Times CNavMesh::GetNavArea() on the CNavAreas against the packed
+//			copy, at random spots over random areas, and the same for
+//			visibility between random pairs of areas
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( nav_compact_benchmark, "Time nav area lookups on the nav mesh against its packed copy. Arguments: [count]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !TheNavAreas.Count() || !TheNavCompactMesh.IsBuilt() )
+	{
+		Msg( "No navigation mesh loaded.\n" );
+		return;
+	}
+
+	int count = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100000;
+
+	CUtlVector< Vector > spots;
+	spots.SetCount( count );
+	FOR_EACH_VEC( spots, it )
+	{
+		CNavArea *area = TheNavAreas[ RandomInt( 0, TheNavAreas.Count() - 1 ) ];
+		spots[ it ] = area->GetRandomPoint() + Vector( 0, 0, RandomFloat( -StepHeight, HumanHeight ) );
+	}
+
+	CUtlVector< CNavArea * > found;
+	found.SetCount( count );
+
+	bool wasCompact = nav_compact_mesh.GetBool();
+	nav_compact_mesh.SetValue( 0 );
+
+	double areaStart = Plat_FloatTime();
+	FOR_EACH_VEC( spots, it )
+	{
+		found[ it ] = TheNavMesh->GetNavArea( spots[ it ] );
+	}
+	double areaTime = Plat_FloatTime() - areaStart;
+
+	int mismatches = 0;
+	double compactStart = Plat_FloatTime();
+	FOR_EACH_VEC( spots, it )
+	{
+		if ( TheNavCompactMesh.GetNavArea( spots[ it ], 120.0f ) != found[ it ] )
+		{
+			++mismatches;
+		}
+	}
+	double compactTime = Plat_FloatTime() - compactStart;
+
+	Msg( "%d GetNavArea lookups: areas %.2f ms, packed %.2f ms, %d results differ\n", count, areaTime * 1000.0, compactTime * 1000.0, mismatches );
+
+	CUtlVector< int > pairs;
+	pairs.SetCount( 2 * count );
+	CUtlVector< bool > visible;
+	visible.SetCount( count );
+	for ( int it = 0; it < count; ++it )
+	{
+		CNavArea *area = TheNavAreas[ RandomInt( 0, TheNavAreas.Count() - 1 ) ];
+		CNavArea *viewedArea = TheNavAreas[ RandomInt( 0, TheNavAreas.Count() - 1 ) ];
+
+		// bias toward visible pairs, random pairs are almost never visible
+		if ( RandomInt( 0, 1 ) )
+		{
+			CollectVisibleAreas collect;
+			area->ForAllPotentiallyVisibleAreas( collect );
+			if ( collect.m_areas.Count() )
+			{
+				viewedArea = collect.m_areas[ RandomInt( 0, collect.m_areas.Count() - 1 ) ];
+			}
+		}
+
+		pairs[ 2 * it ] = TheNavCompactMesh.GetIndex( area );
+		pairs[ 2 * it + 1 ] = TheNavCompactMesh.GetIndex( viewedArea );
+	}
+
+	areaStart = Plat_FloatTime();
+	for ( int it = 0; it < count; ++it )
+	{
+		visible[ it ] = TheNavCompactMesh.GetArea( pairs[ 2 * it ] )->IsPotentiallyVisible( TheNavCompactMesh.GetArea( pairs[ 2 * it + 1 ] ) );
+	}
+	areaTime = Plat_FloatTime() - areaStart;
+
+	mismatches = 0;
+	compactStart = Plat_FloatTime();
+	for ( int it = 0; it < count; ++it )
+	{
+		// the area query counts an area as visible from itself
+		bool isVisible = ( pairs[ 2 * it ] == pairs[ 2 * it + 1 ] ) || TheNavCompactMesh.IsPotentiallyVisible( pairs[ 2 * it ], pairs[ 2 * it + 1 ] );
+		if ( isVisible != visible[ it ] )
+		{
+			++mismatches;
+		}
+	}
+	compactTime = Plat_FloatTime() - compactStart;
+
+	nav_compact_mesh.SetValue( wasCompact );
+
+	Msg( "%d IsPotentiallyVisible lookups: areas %.2f ms, packed %.2f ms, %d results differ\n", count, areaTime * 1000.0, compactTime * 1000.0, mismatches );
+	Msg( "Packed mesh: %d areas, %d links, %d bytes\n", TheNavCompactMesh.Count(), TheNavCompactMesh.GetFirstLink( TheNavCompactMesh.Count() ), TheNavCompactMesh.GetMemoryUsage() );
+}
@@ -0,0 +1,152 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Packed, index addressed copy of the data pathfinding and area
+//			lookups read, built from the CNavAreas once the mesh is loaded.
+//			Each field lives in its own array so a search only pulls in the
+//			cache lines it uses. The CNavAreas stay the real mesh for editing
+//			and everything else.
+//
+//			Area to area visibility is kept as one bit row per area, with the
+//			inheritance deltas from the .nav file already applied. Rows only
+//			store their non-empty 32 area words, so a pair lookup is a short
+//			binary search and a row scan walks whole words.
+//
+//=============================================================================//
+
+#ifndef NAV_COMPACT_H
+#define NAV_COMPACT_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "nav.h"
+#include "tier1/utlmap.h"
+#include "bitvec.h"
+
+class CNavArea;
+
+//-----------------------------------------------------------------------------
+// What CNavArea::GetZ() and IsOverlapping() need
+//-----------------------------------------------------------------------------
+struct NavCompactSurface_t
+{
+	Vector m_nwCorner;
+	Vector m_seCorner;
+	float m_invDxCorners;
+	float m_invDyCorners;
+	float m_neZ;
+	float m_swZ;
+};
+
+//-----------------------------------------------------------------------------
+// A way out of an area: floor connection, ladder or elevator
+//-----------------------------------------------------------------------------
+struct NavCompactLink_t
+{
+	int m_area;									// index of the area it leads to
+	float m_length;								// ladder length, connection length or distance between the centers, as ShortestPathCost measures it
+	unsigned char m_how;						// NavTraverseType
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: The packed mesh. Rebuilt by CNavMesh::Update() whenever the areas
+//			have changed under it; IsBuilt() is false until then.
+//-----------------------------------------------------------------------------
+class CNavCompactMesh
+{
+public:
+	CNavCompactMesh();
+
+	void Build( void );
+	void Invalidate( void )						{ m_isBuilt = false; }
+	bool IsBuilt( void ) const					{ return m_isBuilt; }
+
+	int Count( void ) const						{ return m_areas.Count(); }
+	int GetIndex( unsigned int areaID ) const;	// -1 if there is no such area
+	int GetIndex( const CNavArea *area ) const;	// -1 if the area isn't in the packed mesh
+	CNavArea *GetArea( int index ) const		{ return m_areas[ index ]; }
+	unsigned int GetID( int index ) const		{ return m_ids[ index ]; }
+
+	const Vector &GetCenter( int index ) const	{ return m_centers[ index ]; }
+	int GetAttributes( int index ) const		{ return m_attributes[ index ]; }
+	bool IsBlocked( int index, int teamID, bool ignoreNavBlockers = false ) const;
+	bool IsOverlapping( int index, const Vector &pos ) const;
+	float GetZ( int index, const Vector &pos ) const;
+
+	// links out of an area are [ GetFirstLink( index ), GetFirstLink( index + 1 ) )
+	int GetFirstLink( int index ) const			{ return m_firstLink[ index ]; }
+	const NavCompactLink_t &GetLink( int link ) const { return m_links[ link ]; }
+
+	CNavArea *GetNavArea( const Vector &pos, float beneathLimit ) const;	// same answer as CNavMesh::GetNavArea()
+
+	void UpdateBlocked( const CNavArea *area );	// copy the area's blocked state after it changed
+
+	// same answers as CNavArea::IsPotentiallyVisible() and IsCompletelyVisible()
+	bool IsPotentiallyVisible( int index, int viewedIndex ) const	{ return IsVisible( m_visPotential, index, viewedIndex ); }
+	bool IsCompletelyVisible( int index, int viewedIndex ) const	{ return IsVisible( m_visComplete, index, viewedIndex ); }
+
+	// calls func( CNavArea * ) for each area visible from index, returns false as soon as func does
+	template < typename Functor >
+	bool ForAllVisibleAreas( int index, bool completely, Functor &func ) const;
+
+	int GetMemoryUsage( void ) const;
+
+private:
+	void BuildVisibility( void );
+	int FindIndex( const CNavArea *area ) const;
+	bool IsVisible( const CUtlVector< unsigned int > &bits, int index, int viewedIndex ) const;
+
+	bool m_isBuilt;
+
+	CUtlVector< CNavArea * > m_areas;
+	CUtlVector< unsigned int > m_ids;
+	CUtlVector< Vector > m_centers;
+	CUtlVector< NavCompactSurface_t > m_surfaces;
+	CUtlVector< int > m_attributes;
+	CUtlVector< unsigned char > m_blockedTeams;	// bit per team
+	CUtlVector< int > m_firstLink;
+	CUtlVector< NavCompactLink_t > m_links;
+	CUtlMap< unsigned int, int > m_indexByID;
+
+	// CNavMesh's grid, as area indices
+	CUtlVector< int > m_firstInCell;
+	CUtlVector< int > m_cellAreas;
+
+	// visibility words of an area are [ m_visFirstWord[ index ], m_visFirstWord[ index + 1 ] ),
+	// sorted by which 32 areas they cover
+	CUtlVector< int > m_visFirstWord;
+	CUtlVector< unsigned short > m_visWordIndex;
+	CUtlVector< unsigned int > m_visPotential;
+	CUtlVector< unsigned int > m_visComplete;		// always a subset of m_visPotential
+};
+
+
+//-----------------------------------------------------------------------------
+template < typename Functor >
+bool CNavCompactMesh::ForAllVisibleAreas( int index, bool completely, Functor &func ) const
+{
+	const CUtlVector< unsigned int > &bits = completely ? m_visComplete : m_visPotential;
+
+	for ( int w = m_visFirstWord[ index ]; w < m_visFirstWord[ index + 1 ]; ++w )
+	{
+		unsigned int word = bits[ w ];
+		int base = m_visWordIndex[ w ] << LOG2_BITS_PER_INT;
+
+		while ( word )
+		{
+			int viewedIndex = FirstBitInWord( word, base );
+			word &= word - 1;
+
+			if ( func( m_areas[ viewedIndex ] ) == false )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+extern CNavCompactMesh TheNavCompactMesh;
+extern ConVar nav_compact_mesh;
+
+#endif // NAV_COMPACT_H
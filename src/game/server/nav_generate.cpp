@@ -17,6 +17,8 @@
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
+#include "collisionproperty.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -33,6 +35,7 @@ static float lastMsgTime = 0.0f;
 
 bool TraceAdjacentNode( int depth, const Vector& start, const Vector& end, trace_t *trace, float zLimit = DeathDrop );
 bool StayOnFloor( trace_t *trace, float zLimit = DeathDrop );
+static void ClearSampleProbes( void );
 
 ConVar nav_slope_limit( "nav_slope_limit", "0.7", FCVAR_CHEAT, "The ground unit normal's Z component must be greater than this for nav areas to be generated." );
 ConVar nav_slope_tolerance( "nav_slope_tolerance", "0.1", FCVAR_CHEAT, "The ground unit normal's Z component must be this close to the nav area's Z component to be generated." );
@@ -42,6 +45,8 @@ ConVar nav_generate_fixup_jump_areas( "nav_generate_fixup_jump_areas", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_parallel( "nav_generate_parallel", "1", FCVAR_CHEAT, "Probe the steps ahead of the walkable space search on worker threads." );
+ConVar nav_generate_parallel_depth( "nav_generate_parallel_depth", "3", FCVAR_CHEAT, "How many steps ahead of the walkable space search to probe." );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -3449,6 +3454,7 @@ void CNavMesh::BeginGeneration( bool incremental )
 
 	// the system will see this NULL and select the next walkable seed
 	m_currentNode = NULL;
+	ClearSampleProbes();
 
 	// if there are no seed points, we can't generate
 	if (m_walkableSeeds.Count() == 0)
@@ -3640,6 +3646,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			}
 
 			// sampling is complete, now build nav areas
+			ClearSampleProbes();
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
 
 			return true;
@@ -4331,6 +4338,328 @@ static bool IsNodeOverlapped( const Vector& pos, const Vector& offset )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The outcome of trying to step from a sampled node to the grid point next to it. Only the world
+ * and the existing nav areas go into it, none of the node graph, so steps can be probed ahead of
+ * the search on other threads and give the same answer the search would have worked out itself.
+ */
+struct NavSampleProbe_t
+{
+	Vector m_from;								// position of the node the step starts from
+	NavDirType m_dir;
+	bool m_bAllowOverlap;						// don't give up on positions already covered by nav areas
+
+	bool m_bCanMove;							// if false, no node goes at the end of this step
+	Vector m_to;
+	Vector m_toNormal;
+	bool m_isOnDisplacement;
+	float m_obstacleHeight;
+	float m_obstacleStartDist;
+	float m_obstacleEndDist;
+};
+
+static bool SampleProbeLessFunc( const NavSampleProbe_t &lhs, const NavSampleProbe_t &rhs )
+{
+	if ( lhs.m_from.x != rhs.m_from.x )
+		return lhs.m_from.x < rhs.m_from.x;
+	if ( lhs.m_from.y != rhs.m_from.y )
+		return lhs.m_from.y < rhs.m_from.y;
+	if ( lhs.m_from.z != rhs.m_from.z )
+		return lhs.m_from.z < rhs.m_from.z;
+	return lhs.m_dir < rhs.m_dir;
+}
+
+// steps probed ahead of the search that it hasn't taken yet
+static CUtlRBTree< NavSampleProbe_t > s_SampleProbes( 0, 0, SampleProbeLessFunc );
+const int MaxSampleProbes = 65536;
+const int MaxSampleProbeWave = 1024;
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the grid point one step from the given node position in the given direction
+ */
+static Vector GetSampleStepGoal( const Vector &from, NavDirType dir )
+{
+	// start at current node position
+	Vector pos = from;
+
+	// snap to grid
+	int cx = TheNavMesh->SnapToGrid( pos.x );
+	int cy = TheNavMesh->SnapToGrid( pos.y );
+
+	switch( dir )
+	{
+		case NORTH:		cy -= GenerationStepSize; break;
+		case SOUTH:		cy += GenerationStepSize; break;
+		case EAST:		cx += GenerationStepSize; break;
+		case WEST:		cx -= GenerationStepSize; break;
+	}
+
+	pos.x = cx;
+	pos.y = cy;
+
+	return pos;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void InitSampleProbe( NavSampleProbe_t *probe, const Vector &from, NavDirType dir, bool allowOverlap )
+{
+	probe->m_from = from;
+	probe->m_dir = dir;
+	probe->m_bAllowOverlap = allowOverlap;
+	probe->m_bCanMove = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Trace the step described by the probe. Safe to run on worker threads, as long as nothing
+ * moves the world or the nav areas while it does.
+ */
+static void ProbeSampleStep( NavSampleProbe_t &probe )
+{
+	probe.m_bCanMove = false;
+
+	trace_t result;
+	const Vector &from = probe.m_from;
+	Vector pos = GetSampleStepGoal( from, probe.m_dir );
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	Vector to, toNormal;
+	float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
+	if ( TraceAdjacentNode( 0, from, pos, &result ) )
+	{
+		to = result.endpos;
+		toNormal = result.plane.normal;
+	}
+	else
+	{
+		// test going up ClimbUpHeight
+		bool success = false;
+		for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
+		{						
+			trace_t tr;
+			Vector start( from );
+			Vector end( pos );
+			start.z += height;
+			end.z += height;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, TheNavMesh->GetGenerationTraceMask(), &filter, &tr );
+			if ( !tr.startsolid && tr.fraction == 1.0f )
+			{
+				if ( !StayOnFloor( &tr ) )
+				{
+					break;
+				}
+
+				to = tr.endpos;
+				toNormal = tr.plane.normal;
+
+				start = end = from;
+				end.z += height;
+				UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, TheNavMesh->GetGenerationTraceMask(), &filter, &tr );
+				if ( tr.fraction < 1.0f )
+				{
+					break;
+				}
+
+				// keep track of far up we had to go to find a path to the next node
+				obstacleHeight = height;
+				success = true;
+				break;
+			}
+			else
+			{
+				// Could not trace from node to node at this height, something is in the way.
+				// Trace in the other direction to see if we hit something
+				Vector vecToObstacleStart = tr.endpos - start;
+				Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
+				if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
+				{
+					UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, TheNavMesh->GetGenerationTraceMask(), &filter, &tr );
+					if ( !tr.startsolid && tr.fraction < 1.0 )
+					{
+						// We hit something going the other direction.  There is some obstacle between the two nodes.
+						Vector vecToObstacleEnd = tr.endpos - start;
+						Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
+						if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
+						{
+							// Remember the distances to start and end of the obstacle (with respect to the "from" node).
+							// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
+							// If we do eventually clear the obstacle, these values will be the start and end distance to the
+							// very tip of the obstacle.
+							obstacleStartDist = vecToObstacleStart.Length();
+							obstacleEndDist = vecToObstacleEnd.Length();
+							if ( obstacleEndDist == 0 )
+							{
+								obstacleEndDist = GenerationStepSize;
+							}
+						}								
+					}
+				}
+			}
+		}
+
+		if ( !success )
+		{
+			return;
+		}
+	}
+
+	// Don't generate nodes if we spill off the end of the world onto skybox
+	if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+	{
+		return;
+	}
+
+	// If we're incrementally generating, don't overlap existing nav areas.
+	Vector testPos( to );
+	bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
+	bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
+	bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
+	bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
+	if ( overlapSE && overlapSW && overlapNE && overlapNW && !probe.m_bAllowOverlap )
+	{
+		return;
+	}
+
+	bool isOnDisplacement = result.IsDispSurface();
+
+	if ( nav_displacement_test.GetInt() > 0 )
+	{
+		// Test for nodes under displacement surfaces.
+		// This happens during development, and is a pain because the space underneath a displacement
+		// is not 'solid'.
+		Vector start = to + Vector( 0, 0, 0 );
+		Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
+		UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, TheNavMesh->GetGenerationTraceMask(), &filter, &result );
+
+		if ( result.fraction > 0 )
+		{
+			end = start;
+			start = result.endpos;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, TheNavMesh->GetGenerationTraceMask(), &filter, &result );
+			if ( result.fraction < 1 )
+			{
+				// if we made it down to within StepHeight, maybe we're on a static prop
+				if ( result.endpos.z > to.z + StepHeight )
+				{
+					return;
+				}
+			}
+		}
+	}
+
+	float deltaZ = to.z - from.z;
+	// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
+	// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
+	// and distances
+	if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	{
+		obstacleHeight = 0;
+		obstacleStartDist = 0;
+		obstacleEndDist = GenerationStepSize;
+	}
+
+	probe.m_bCanMove = true;
+	probe.m_to = to;
+	probe.m_toNormal = toNormal;
+	probe.m_isOnDisplacement = isOnDisplacement;
+	probe.m_obstacleHeight = obstacleHeight;
+	probe.m_obstacleStartDist = obstacleStartDist;
+	probe.m_obstacleEndDist = obstacleEndDist;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Take the probed result of the given step, if it was probed ahead of time
+ */
+static bool FindSampleProbe( const Vector &from, NavDirType dir, NavSampleProbe_t *probe )
+{
+	NavSampleProbe_t key;
+	key.m_from = from;
+	key.m_dir = dir;
+
+	unsigned short it = s_SampleProbes.Find( key );
+	if ( it == s_SampleProbes.InvalidIndex() )
+		return false;
+
+	*probe = s_SampleProbes[ it ];
+	s_SampleProbes.RemoveAt( it );
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void ClearSampleProbes( void )
+{
+	s_SampleProbes.Purge();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Probe the steps the search is about to take from the given node on worker threads, a wave at
+ * a time: its own untried directions first, then those of the new nodes each successful step
+ * would create, nav_generate_parallel_depth waves deep. The search itself stays serial and takes
+ * the results in its own order, so it builds exactly the node graph it would have without them.
+ */
+static void PrefetchSampleProbes( CNavNode *node, NavDirType firstDir, bool allowOverlap )
+{
+	if ( s_SampleProbes.Count() > MaxSampleProbes )
+	{
+		ClearSampleProbes();
+	}
+
+	CUtlVector< NavSampleProbe_t > wave;
+	for( int dir = firstDir; dir < NUM_DIRECTIONS; dir++ )
+	{
+		if ( dir == firstDir || !node->HasVisited( (NavDirType)dir ) )
+		{
+			InitSampleProbe( &wave[ wave.AddToTail() ], *node->GetPosition(), (NavDirType)dir, allowOverlap );
+		}
+	}
+
+	// the workers mustn't be the ones to flush entities that moved
+	UpdateDirtySpatialPartitionEntities();
+
+	CUtlVector< NavSampleProbe_t > nextWave;
+	for ( int depth = 0; depth < nav_generate_parallel_depth.GetInt() && wave.Count(); ++depth )
+	{
+		ParallelProcess( "CNavMesh::SampleStep", wave.Base(), wave.Count(), &ProbeSampleStep );
+
+		nextWave.RemoveAll();
+		FOR_EACH_VEC( wave, it )
+		{
+			const NavSampleProbe_t &probe = wave[ it ];
+			s_SampleProbes.InsertIfNotFound( probe );
+
+			// the search only moves on to nodes that don't exist yet
+			if ( !probe.m_bCanMove || CNavNode::GetNode( probe.m_to ) )
+				continue;
+
+			for( int dir = NORTH; dir < NUM_DIRECTIONS && nextWave.Count() < MaxSampleProbeWave; dir++ )
+			{
+				// the way back is usually marked as visited when the node is added
+				if ( dir == OppositeDirection( probe.m_dir ) )
+					continue;
+
+				NavSampleProbe_t &next = nextWave[ nextWave.AddToTail() ];
+				InitSampleProbe( &next, probe.m_to, (NavDirType)dir, allowOverlap );
+				if ( s_SampleProbes.Find( next ) != s_SampleProbes.InvalidIndex() )
+				{
+					nextWave.RemoveMultipleFromTail( 1 );
+				}
+			}
+		}
+
+		wave.Swap( nextWave );
+	}
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Search the world and build a map of possible movements.
@@ -4389,24 +4718,8 @@ bool CNavMesh::SampleStep( void )
 			{
 				// have not searched in this direction yet
 
-				// start at current node position
-				Vector pos = *m_currentNode->GetPosition();
-
-				// snap to grid
-				int cx = SnapToGrid( pos.x );
-				int cy = SnapToGrid( pos.y );
-
 				// attempt to move to adjacent node
-				switch( dir )
-				{
-					case NORTH:		cy -= GenerationStepSize; break;
-					case SOUTH:		cy += GenerationStepSize; break;
-					case EAST:		cx += GenerationStepSize; break;
-					case WEST:		cx -= GenerationStepSize; break;
-				}
-
-				pos.x = cx;
-				pos.y = cy;
+				Vector pos = GetSampleStepGoal( *m_currentNode->GetPosition(), (NavDirType)dir );
 
 				m_generationDir = (NavDirType)dir;
 
@@ -4442,103 +4755,23 @@ bool CNavMesh::SampleStep( void )
 					}
 				}
 
-				// test if we can move to new position
-				trace_t result;
-				Vector from( *m_currentNode->GetPosition() );
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				Vector to, toNormal;
-				float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
-				if ( TraceAdjacentNode( 0, from, pos, &result ) )
+				// test if we can move to new position, using a result gathered ahead of time if there is one
+				NavSampleProbe_t probe;
+				if ( !FindSampleProbe( *m_currentNode->GetPosition(), m_generationDir, &probe ) )
 				{
-					to = result.endpos;
-					toNormal = result.plane.normal;
-				}
-				else
-				{
-					// test going up ClimbUpHeight
-					bool success = false;
-					for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
-					{						
-						trace_t tr;
-						Vector start( from );
-						Vector end( pos );
-						start.z += height;
-						end.z += height;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-						if ( !tr.startsolid && tr.fraction == 1.0f )
-						{
-							if ( !StayOnFloor( &tr ) )
-							{
-								break;
-							}
-
-							to = tr.endpos;
-							toNormal = tr.plane.normal;
-
-							start = end = from;
-							end.z += height;
-							UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-							if ( tr.fraction < 1.0f )
-							{
-								break;
-							}
-
-							// keep track of far up we had to go to find a path to the next node
-							obstacleHeight = height;
-							success = true;
-							break;
-						}
-						else
-						{
-							// Could not trace from node to node at this height, something is in the way.
-							// Trace in the other direction to see if we hit something
-							Vector vecToObstacleStart = tr.endpos - start;
-							Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
-							if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
-							{
-								UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-								if ( !tr.startsolid && tr.fraction < 1.0 )
-								{
-									// We hit something going the other direction.  There is some obstacle between the two nodes.
-									Vector vecToObstacleEnd = tr.endpos - start;
-									Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
-									if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
-									{
-										// Remember the distances to start and end of the obstacle (with respect to the "from" node).
-										// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
-										// If we do eventually clear the obstacle, these values will be the start and end distance to the
-										// very tip of the obstacle.
-										obstacleStartDist = vecToObstacleStart.Length();
-										obstacleEndDist = vecToObstacleEnd.Length();
-										if ( obstacleEndDist == 0 )
-										{
-											obstacleEndDist = GenerationStepSize;
-										}
-									}								
-								}
-							}
-						}
+					if ( nav_generate_parallel.GetBool() )
+					{
+						PrefetchSampleProbes( m_currentNode, m_generationDir, m_generationMode != GENERATE_SIMPLIFY );
 					}
 
-					if ( !success )
+					if ( !FindSampleProbe( *m_currentNode->GetPosition(), m_generationDir, &probe ) )
 					{
-						return true;
+						InitSampleProbe( &probe, *m_currentNode->GetPosition(), m_generationDir, m_generationMode != GENERATE_SIMPLIFY );
+						ProbeSampleStep( probe );
 					}
 				}
 
-				// Don't generate nodes if we spill off the end of the world onto skybox
-				if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
-				{
-					return true;
-				}
-
-				// If we're incrementally generating, don't overlap existing nav areas.
-				Vector testPos( to );
-				bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
-				bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
-				bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
-				bool overlapNW = IsNodeOverlapped( testPos, Vector( -1, -1, HalfHumanHeight ) );
-				if ( overlapSE && overlapSW && overlapNE && overlapNW && m_generationMode != GENERATE_SIMPLIFY )
+				if ( !probe.m_bCanMove )
 				{
 					return true;
 				}
@@ -4547,7 +4780,7 @@ bool CNavMesh::SampleStep( void )
 				if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
 				{
 					bool bValid = false;
-					int zPos = to.z;
+					int zPos = probe.m_to.z;
 					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
 					{
 						const Vector &seedPos = m_walkableSeeds[i].pos;
@@ -4565,48 +4798,9 @@ bool CNavMesh::SampleStep( void )
 						return true;
 				}
 
-
-				bool isOnDisplacement = result.IsDispSurface();
-
-				if ( nav_displacement_test.GetInt() > 0 )
-				{
-					// Test for nodes under displacement surfaces.
-					// This happens during development, and is a pain because the space underneath a displacement
-					// is not 'solid'.
-					Vector start = to + Vector( 0, 0, 0 );
-					Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
-					UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-
-					if ( result.fraction > 0 )
-					{
-						end = start;
-						start = result.endpos;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-						if ( result.fraction < 1 )
-						{
-							// if we made it down to within StepHeight, maybe we're on a static prop
-							if ( result.endpos.z > to.z + StepHeight )
-							{
-								return true;
-							}
-						}
-					}
-				}
-
-				float deltaZ = to.z - m_currentNode->GetPosition()->z;
-				// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
-				// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
-				// and distances
-				if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
-				{
-					obstacleHeight = 0;
-					obstacleStartDist = 0;
-					obstacleEndDist = GenerationStepSize;
-				}
-
 				// we can move here
 				// create a new navigation node, and update current node pointer
-				AddNode( to, toNormal, m_generationDir, m_currentNode, isOnDisplacement, obstacleHeight, obstacleStartDist, obstacleEndDist );
+				AddNode( probe.m_to, probe.m_toNormal, m_generationDir, m_currentNode, probe.m_isOnDisplacement, probe.m_obstacleHeight, probe.m_obstacleStartDist, probe.m_obstacleEndDist );
 
 				return true;
 			}
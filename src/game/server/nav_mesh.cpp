@@ -13,6 +13,8 @@
 #include "filesystem.h"
 #include "nav_mesh.h"
 #include "nav_node.h"
+#include "nav_path_query.h"
+#include "nav_compact.h"
 #include "fmtstr.h"
 #include "utlbuffer.h"
 #include "tier0/vprof.h"
@@ -156,6 +158,10 @@ CNavArea *CNavMesh::GetMarkedArea( void ) const
  */
 void CNavMesh::DestroyNavigationMesh( bool incremental )
 {
+	// queued and cached paths refer to areas by ID, which are about to be reused
+	NavPathQuery_OnMeshDestroyed();
+	TheNavCompactMesh.Invalidate();
+
 	m_blockedAreas.RemoveAll();
 	m_avoidanceObstacleAreas.RemoveAll();
 	m_transientAreas.RemoveAll();
@@ -252,10 +258,21 @@ void CNavMesh::Update( void )
 
 	if (IsGenerating())
 	{
+		TheNavCompactMesh.Invalidate();
 		UpdateGeneration( 0.03 );
 		return; // don't bother trying to draw stuff while we're generating
 	}
 
+	// areas are edited in place, so only keep the packed copy when nobody is editing
+	if ( nav_edit.GetBool() )
+	{
+		TheNavCompactMesh.Invalidate();
+	}
+	else if ( !TheNavCompactMesh.IsBuilt() && TheNavAreas.Count() )
+	{
+		TheNavCompactMesh.Build();
+	}
+
 	// Test all of the areas for blocked status
 	if ( m_updateBlockedAreasTimer.HasStarted() && m_updateBlockedAreasTimer.IsElapsed() )
 	{
@@ -266,6 +283,9 @@ void CNavMesh::Update( void )
 	UpdateBlockedAreas();
 	UpdateAvoidanceObstacleAreas();
 
+	// run path queries submitted since last frame, now that blocked areas are up to date
+	NavPathQuery_Update();
+
 	if (nav_edit.GetBool())
 	{
 		if (m_isEditing == false)
@@ -464,6 +484,8 @@ void CNavMesh::AllocateGrid( float minX, float maxX, float minY, float maxY )
  */
 void CNavMesh::AddNavArea( CNavArea *area )
 {
+	TheNavCompactMesh.Invalidate();
+
 	if ( !m_grid.Count() )
 	{
 		// If we somehow have no grid (manually creating a nav area without loading or generating a mesh), don't crash
@@ -517,6 +539,8 @@ void CNavMesh::AddNavArea( CNavArea *area )
  */
 void CNavMesh::RemoveNavArea( CNavArea *area )
 {
+	TheNavCompactMesh.Invalidate();
+
 	// add to grid
 	int loX = WorldToGridX( area->GetCorner( NORTH_WEST ).x );
 	int loY = WorldToGridY( area->GetCorner( NORTH_WEST ).y );
@@ -692,6 +716,9 @@ CNavArea *CNavMesh::GetNavArea( const Vector &pos, float beneathLimit ) const
 	if ( !m_grid.Count() )
 		return NULL;
 
+	if ( nav_compact_mesh.GetBool() && TheNavCompactMesh.IsBuilt() )
+		return TheNavCompactMesh.GetNavArea( pos, beneathLimit );
+
 	// get list in cell that contains position
 	int x = WorldToGridX( pos.x );
 	int y = WorldToGridY( pos.y );
@@ -1063,6 +1063,7 @@ private:
 	friend class CNavArea;
 	friend class CNavNode;
 	friend class CNavUIBasePanel;
+	friend class CNavCompactMesh;
 
 	mutable CUtlVector<NavAreaVector> m_grid;
 	float m_gridCellSize;										// the width/height of a grid cell for spatially partitioning nav areas for fast access
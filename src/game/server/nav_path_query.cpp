@@ -0,0 +1,792 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Batched nav mesh path queries, see nav_path_query.h
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "nav_path_query.h"
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+#include "nav_compact.h"
+#include "tier0/vprof.h"
+#include "tier1/utlmap.h"
+#include "tier1/utlpriorityqueue.h"
+#include "vstdlib/jobthread.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar nav_path_query_parallel( "nav_path_query_parallel", "1", FCVAR_CHEAT, "Run queued nav path queries on worker threads." );
+ConVar nav_path_query_max_per_frame( "nav_path_query_max_per_frame", "64", FCVAR_CHEAT, "Most queued nav path queries to run in one frame, 0 for no limit." );
+ConVar nav_path_query_cache_size( "nav_path_query_cache_size", "256", FCVAR_CHEAT, "How many area to area path query results to keep, 0 to turn the cache off." );
+
+
+//-----------------------------------------------------------------------------
+// Paths are kept as area IDs, so a result outliving its areas is noticed
+// when it is collected instead of handing out freed pointers
+//-----------------------------------------------------------------------------
+struct NavPathQueryAreaStep_t
+{
+	unsigned int m_areaID;
+	NavTraverseType m_how;
+};
+
+typedef CUtlVector< NavPathQueryAreaStep_t > NavPathQueryAreaPath_t;
+
+//-----------------------------------------------------------------------------
+// A queued query and, once it has run, its result
+//-----------------------------------------------------------------------------
+struct NavPathQuery_t
+{
+	unsigned int m_startID;
+	unsigned int m_goalID;
+	Vector m_goalPos;
+	bool m_hasGoalPos;
+	float m_maxPathLength;
+	int m_teamID;
+	bool m_ignoreNavBlockers;
+
+	// filled in on the main thread right before the query runs, as indices into TheNavCompactMesh
+	int m_startIndex;
+	int m_goalIndex;
+	CUtlVector< int > m_goalPosIndices;	// the areas that contain m_goalPos
+
+	NavPathQueryStatus_t m_status;
+	NavPathQueryAreaPath_t m_path;
+	unsigned int m_closestAreaID;
+
+	bool IsCacheable( void ) const
+	{
+		return ( m_goalID != 0 && !m_hasGoalPos && m_maxPathLength <= 0.0f );
+	}
+};
+
+static CUtlMap< NavPathQueryHandle_t, NavPathQuery_t * > s_Queries( DefLessFunc( NavPathQueryHandle_t ) );
+static NavPathQueryHandle_t s_nextQueryHandle = NAV_PATH_QUERY_INVALID_HANDLE;
+
+
+//-----------------------------------------------------------------------------
+// Cache of area to area results
+//-----------------------------------------------------------------------------
+struct NavPathCacheKey_t
+{
+	unsigned int m_startID;
+	unsigned int m_goalID;
+	int m_teamID;
+	bool m_ignoreNavBlockers;
+};
+
+struct NavPathCacheEntry_t
+{
+	bool m_succeeded;
+	NavPathQueryAreaPath_t m_path;
+	unsigned int m_closestAreaID;
+	int m_lastUsedTick;
+};
+
+static bool NavPathCacheKeyLessFunc( const NavPathCacheKey_t &lhs, const NavPathCacheKey_t &rhs )
+{
+	if ( lhs.m_startID != rhs.m_startID )
+		return lhs.m_startID < rhs.m_startID;
+	if ( lhs.m_goalID != rhs.m_goalID )
+		return lhs.m_goalID < rhs.m_goalID;
+	if ( lhs.m_teamID != rhs.m_teamID )
+		return lhs.m_teamID < rhs.m_teamID;
+	return lhs.m_ignoreNavBlockers < rhs.m_ignoreNavBlockers;
+}
+
+static CUtlMap< NavPathCacheKey_t, NavPathCacheEntry_t * > s_PathCache( 0, 0, NavPathCacheKeyLessFunc );
+
+static NavPathCacheKey_t GetCacheKey( const NavPathQuery_t *query )
+{
+	NavPathCacheKey_t key;
+	key.m_startID = query->m_startID;
+	key.m_goalID = query->m_goalID;
+	key.m_teamID = query->m_teamID;
+	key.m_ignoreNavBlockers = query->m_ignoreNavBlockers;
+	return key;
+}
+
+static void PurgePathCache( void )
+{
+	s_PathCache.PurgeAndDeleteElements();
+}
+
+static bool LookupPathCache( NavPathQuery_t *query )
+{
+	unsigned short it = s_PathCache.Find( GetCacheKey( query ) );
+	if ( it == s_PathCache.InvalidIndex() )
+		return false;
+
+	NavPathCacheEntry_t *entry = s_PathCache[ it ];
+	entry->m_lastUsedTick = gpGlobals->tickcount;
+
+	query->m_status = entry->m_succeeded ? NAV_PATH_QUERY_SUCCEEDED : NAV_PATH_QUERY_FAILED;
+	query->m_path = entry->m_path;
+	query->m_closestAreaID = entry->m_closestAreaID;
+	return true;
+}
+
+static void AddToPathCache( const NavPathQuery_t *query )
+{
+	int maxEntries = nav_path_query_cache_size.GetInt();
+	if ( maxEntries <= 0 )
+		return;
+
+	NavPathCacheKey_t key = GetCacheKey( query );
+	if ( s_PathCache.Find( key ) != s_PathCache.InvalidIndex() )
+		return;
+
+	// make room by dropping whatever was used longest ago
+	while ( s_PathCache.Count() >= maxEntries )
+	{
+		unsigned short oldest = s_PathCache.InvalidIndex();
+		FOR_EACH_MAP_FAST( s_PathCache, it )
+		{
+			if ( oldest == s_PathCache.InvalidIndex() || s_PathCache[ it ]->m_lastUsedTick < s_PathCache[ oldest ]->m_lastUsedTick )
+			{
+				oldest = it;
+			}
+		}
+
+		delete s_PathCache[ oldest ];
+		s_PathCache.RemoveAt( oldest );
+	}
+
+	NavPathCacheEntry_t *entry = new NavPathCacheEntry_t;
+	entry->m_succeeded = ( query->m_status == NAV_PATH_QUERY_SUCCEEDED );
+	entry->m_path = query->m_path;
+	entry->m_closestAreaID = query->m_closestAreaID;
+	entry->m_lastUsedTick = gpGlobals->tickcount;
+	s_PathCache.Insert( key, entry );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: A* over TheNavCompactMesh with the search state held here rather
+//			than on the areas. Expands links in the same order as
+//			NavAreaBuildPath() expands neighbors.
+//-----------------------------------------------------------------------------
+class CNavPathSearch
+{
+public:
+	CNavPathSearch() : m_open( 0, 0, OpenLessFunc ) {}
+
+	void Run( NavPathQuery_t *query );
+
+private:
+	struct Node_t
+	{
+		int m_area;
+		int m_parent;
+		NavTraverseType m_how;
+		float m_costSoFar;
+		float m_totalCost;
+		float m_pathLengthSoFar;
+		bool m_isClosed;
+	};
+
+	// Nodes aren't moved within the heap when their cost drops, they are
+	// pushed again and the stale entries skipped when they come up
+	struct OpenEntry_t
+	{
+		float m_totalCost;
+		int m_node;
+	};
+
+	static bool OpenLessFunc( const OpenEntry_t &lhs, const OpenEntry_t &rhs )
+	{
+		return lhs.m_totalCost > rhs.m_totalCost;
+	}
+
+	int FindOrAddNode( int area, bool *isNew );
+	void Open( int node );
+	float GetCost( int area, int fromNode, const NavCompactLink_t &link ) const;
+	void BuildPath( int node, NavPathQueryAreaPath_t *path ) const;
+
+	CUtlVector< Node_t > m_nodes;
+	CUtlVector< int > m_nodeOfArea;				// -1 for areas the search hasn't reached
+	CUtlPriorityQueue< OpenEntry_t > m_open;
+};
+
+int CNavPathSearch::FindOrAddNode( int area, bool *isNew )
+{
+	if ( m_nodeOfArea[ area ] != -1 )
+	{
+		*isNew = false;
+		return m_nodeOfArea[ area ];
+	}
+
+	int node = m_nodes.AddToTail();
+	m_nodes[ node ].m_area = area;
+	m_nodes[ node ].m_parent = -1;
+	m_nodes[ node ].m_how = NUM_TRAVERSE_TYPES;
+	m_nodes[ node ].m_isClosed = false;
+	m_nodeOfArea[ area ] = node;
+
+	*isNew = true;
+	return node;
+}
+
+void CNavPathSearch::Open( int node )
+{
+	OpenEntry_t entry;
+	entry.m_totalCost = m_nodes[ node ].m_totalCost;
+	entry.m_node = node;
+	m_open.Insert( entry );
+}
+
+//-----------------------------------------------------------------------------
+// ShortestPathCost, reading the cost so far from our own nodes
+//-----------------------------------------------------------------------------
+float CNavPathSearch::GetCost( int area, int fromNode, const NavCompactLink_t &link ) const
+{
+	float dist = link.m_length;
+	float cost = dist + m_nodes[ fromNode ].m_costSoFar;
+
+	int attributes = TheNavCompactMesh.GetAttributes( area );
+
+	// if this is a "crouch" area, add penalty
+	if ( attributes & NAV_MESH_CROUCH )
+	{
+		const float crouchPenalty = 20.0f;
+		cost += crouchPenalty * dist;
+	}
+
+	// if this is a "jump" area, add penalty
+	if ( attributes & NAV_MESH_JUMP )
+	{
+		const float jumpPenalty = 5.0f;
+		cost += jumpPenalty * dist;
+	}
+
+	return cost;
+}
+
+void CNavPathSearch::BuildPath( int node, NavPathQueryAreaPath_t *path ) const
+{
+	path->RemoveAll();
+	for ( int it = node; it != -1; it = m_nodes[ it ].m_parent )
+	{
+		NavPathQueryAreaStep_t step;
+		step.m_areaID = TheNavCompactMesh.GetID( m_nodes[ it ].m_area );
+		step.m_how = m_nodes[ it ].m_how;
+		path->AddToHead( step );
+	}
+}
+
+void CNavPathSearch::Run( NavPathQuery_t *query )
+{
+	VPROF_BUDGET( "CNavPathSearch::Run", "NextBotSpiky" );
+
+	query->m_status = NAV_PATH_QUERY_FAILED;
+	query->m_path.RemoveAll();
+	query->m_closestAreaID = 0;
+
+	int startArea = query->m_startIndex;
+	if ( startArea < 0 )
+		return;
+
+	const CNavCompactMesh &mesh = TheNavCompactMesh;
+
+	m_nodes.RemoveAll();
+	m_open.RemoveAll();
+	m_nodeOfArea.SetCount( mesh.Count() );
+	memset( m_nodeOfArea.Base(), 0xff, mesh.Count() * sizeof( int ) );
+
+	bool isNew;
+	int startNode = FindOrAddNode( startArea, &isNew );
+	int closestNode = startNode;
+
+	int goalArea = query->m_goalIndex;
+	if ( goalArea >= 0 && mesh.IsBlocked( goalArea, query->m_teamID, query->m_ignoreNavBlockers ) )
+	{
+		goalArea = -1;
+	}
+
+	if ( goalArea < 0 && !query->m_hasGoalPos )
+	{
+		BuildPath( startNode, &query->m_path );
+		query->m_closestAreaID = mesh.GetID( startArea );
+		return;
+	}
+
+	// if we are already in the goal area, build trivial path
+	if ( startArea == goalArea )
+	{
+		BuildPath( startNode, &query->m_path );
+		query->m_closestAreaID = mesh.GetID( startArea );
+		query->m_status = NAV_PATH_QUERY_SUCCEEDED;
+		return;
+	}
+
+	Vector actualGoalPos = query->m_hasGoalPos ? query->m_goalPos : mesh.GetCenter( goalArea );
+	bool haveMaxPathLength = ( query->m_maxPathLength > 0.0f );
+
+	m_nodes[ startNode ].m_costSoFar = 0.0f;
+	m_nodes[ startNode ].m_totalCost = ( mesh.GetCenter( startArea ) - actualGoalPos ).Length();
+	m_nodes[ startNode ].m_pathLengthSoFar = 0.0f;
+	Open( startNode );
+
+	// keep track of the area we visit that is closest to the goal
+	float closestAreaDist = m_nodes[ startNode ].m_totalCost;
+
+	while ( m_open.Count() )
+	{
+		OpenEntry_t entry = m_open.ElementAtHead();
+		m_open.RemoveAtHead();
+
+		int node = entry.m_node;
+		if ( m_nodes[ node ].m_isClosed || m_nodes[ node ].m_totalCost != entry.m_totalCost )
+			continue;
+
+		int area = m_nodes[ node ].m_area;
+
+		// don't consider blocked areas
+		if ( mesh.IsBlocked( area, query->m_teamID, query->m_ignoreNavBlockers ) )
+		{
+			m_nodes[ node ].m_isClosed = true;
+			continue;
+		}
+
+		// check if we have found the goal area or position
+		if ( area == goalArea || ( goalArea < 0 && query->m_goalPosIndices.HasElement( area ) ) )
+		{
+			BuildPath( node, &query->m_path );
+			query->m_closestAreaID = mesh.GetID( area );
+			query->m_status = NAV_PATH_QUERY_SUCCEEDED;
+			return;
+		}
+
+		int parentArea = ( m_nodes[ node ].m_parent != -1 ) ? m_nodes[ m_nodes[ node ].m_parent ].m_area : -1;
+		const Vector &center = mesh.GetCenter( area );
+
+		for ( int it = mesh.GetFirstLink( area ); it < mesh.GetFirstLink( area + 1 ); ++it )
+		{
+			const NavCompactLink_t &link = mesh.GetLink( it );
+			int newArea = link.m_area;
+
+			// don't backtrack
+			if ( newArea == parentArea || newArea == area )
+				continue;
+
+			// don't consider blocked areas
+			if ( mesh.IsBlocked( newArea, query->m_teamID, query->m_ignoreNavBlockers ) )
+				continue;
+
+			// make sure that any jump to a new area incurs some pathfinding cost
+			float newCostSoFar = GetCost( newArea, node, link );
+			float minNewCostSoFar = m_nodes[ node ].m_costSoFar * 1.00001 + 0.00001;
+			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
+
+			// stop if path length limit reached
+			float newLengthSoFar = 0.0f;
+			if ( haveMaxPathLength )
+			{
+				newLengthSoFar = m_nodes[ node ].m_pathLengthSoFar + ( mesh.GetCenter( newArea ) - center ).Length();
+				if ( newLengthSoFar > query->m_maxPathLength )
+					continue;
+			}
+
+			int newNode = FindOrAddNode( newArea, &isNew );
+			if ( !isNew && m_nodes[ newNode ].m_costSoFar <= newCostSoFar )
+			{
+				// this is a worse path - skip it
+				continue;
+			}
+
+			// compute estimate of distance left to go
+			float distSq = ( mesh.GetCenter( newArea ) - actualGoalPos ).LengthSqr();
+			float newCostRemaining = ( distSq > 0.0 ) ? FastSqrt( distSq ) : 0.0;
+
+			// track closest area to goal in case path fails
+			if ( newCostRemaining < closestAreaDist )
+			{
+				closestNode = newNode;
+				closestAreaDist = newCostRemaining;
+			}
+
+			Node_t &next = m_nodes[ newNode ];
+			next.m_parent = node;
+			next.m_how = (NavTraverseType)link.m_how;
+			next.m_costSoFar = newCostSoFar;
+			next.m_totalCost = newCostSoFar + newCostRemaining;
+			next.m_pathLengthSoFar = newLengthSoFar;
+			next.m_isClosed = false;
+			Open( newNode );
+		}
+
+		// we have searched this area
+		m_nodes[ node ].m_isClosed = true;
+	}
+
+	BuildPath( closestNode, &query->m_path );
+	query->m_closestAreaID = mesh.GetID( m_nodes[ closestNode ].m_area );
+}
+
+static void RunNavPathQuery( NavPathQuery_t *&query )
+{
+	CNavPathSearch search;
+	search.Run( query );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Queues a query, answering it right away from the cache if possible
+//-----------------------------------------------------------------------------
+NavPathQueryHandle_t NavPathQuery_Submit( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, float maxPathLength, int teamID, bool ignoreNavBlockers )
+{
+	NavPathQuery_t *query = new NavPathQuery_t;
+	query->m_startID = startArea ? startArea->GetID() : 0;
+	query->m_goalID = goalArea ? goalArea->GetID() : 0;
+	query->m_hasGoalPos = ( goalPos != NULL );
+	query->m_goalPos = goalPos ? *goalPos : vec3_origin;
+	query->m_maxPathLength = maxPathLength;
+	query->m_teamID = teamID;
+	query->m_ignoreNavBlockers = ignoreNavBlockers;
+	query->m_startIndex = -1;
+	query->m_goalIndex = -1;
+	query->m_status = NAV_PATH_QUERY_PENDING;
+	query->m_closestAreaID = 0;
+
+	if ( query->IsCacheable() && nav_path_query_cache_size.GetInt() > 0 )
+	{
+		LookupPathCache( query );
+	}
+
+	if ( ++s_nextQueryHandle == NAV_PATH_QUERY_INVALID_HANDLE )
+	{
+		++s_nextQueryHandle;
+	}
+
+	s_Queries.Insert( s_nextQueryHandle, query );
+	return s_nextQueryHandle;
+}
+
+NavPathQueryStatus_t NavPathQuery_Collect( NavPathQueryHandle_t hQuery, CUtlVector< NavPathQueryStep_t > *path, CNavArea **closestArea )
+{
+	unsigned short it = s_Queries.Find( hQuery );
+	if ( it == s_Queries.InvalidIndex() )
+		return NAV_PATH_QUERY_UNKNOWN;
+
+	NavPathQuery_t *query = s_Queries[ it ];
+	if ( query->m_status == NAV_PATH_QUERY_PENDING )
+		return NAV_PATH_QUERY_PENDING;
+
+	NavPathQueryStatus_t status = query->m_status;
+
+	if ( path )
+	{
+		path->RemoveAll();
+		path->EnsureCapacity( query->m_path.Count() );
+		FOR_EACH_VEC( query->m_path, i )
+		{
+			NavPathQueryStep_t step;
+			step.m_area = TheNavMesh->GetNavAreaByID( query->m_path[ i ].m_areaID );
+			step.m_how = query->m_path[ i ].m_how;
+			if ( !step.m_area )
+			{
+				// the mesh was edited under the result
+				path->RemoveAll();
+				status = NAV_PATH_QUERY_FAILED;
+				break;
+			}
+			path->AddToTail( step );
+		}
+	}
+
+	if ( closestArea )
+	{
+		*closestArea = TheNavMesh->GetNavAreaByID( query->m_closestAreaID );
+	}
+
+	delete query;
+	s_Queries.RemoveAt( it );
+	return status;
+}
+
+void NavPathQuery_Cancel( NavPathQueryHandle_t hQuery )
+{
+	unsigned short it = s_Queries.Find( hQuery );
+	if ( it == s_Queries.InvalidIndex() )
+		return;
+
+	delete s_Queries[ it ];
+	s_Queries.RemoveAt( it );
+}
+
+
+//-----------------------------------------------------------------------------
+// Collects the areas a goal position can be reached in. Contains() walks the
+// mesh with the shared search marker, so this has to be done up front.
+//-----------------------------------------------------------------------------
+class CollectOverlappingAreas
+{
+public:
+	bool operator()( CNavArea *area )
+	{
+		m_areas.AddToTail( area );
+		return true;
+	}
+
+	NavAreaVector m_areas;
+};
+
+static void FindGoalPosAreas( NavPathQuery_t *query )
+{
+	query->m_goalPosIndices.RemoveAll();
+
+	Extent extent;
+	extent.lo = extent.hi = query->m_goalPos;
+
+	CollectOverlappingAreas collector;
+	TheNavMesh->ForAllAreasOverlappingExtent( collector, extent );
+
+	FOR_EACH_VEC( collector.m_areas, it )
+	{
+		if ( collector.m_areas[ it ]->Contains( query->m_goalPos ) )
+		{
+			query->m_goalPosIndices.AddToTail( TheNavCompactMesh.GetIndex( collector.m_areas[ it ]->GetID() ) );
+		}
+	}
+}
+
+static void PrepareNavPathQuery( NavPathQuery_t *query )
+{
+	query->m_startIndex = ( query->m_startID != 0 ) ? TheNavCompactMesh.GetIndex( query->m_startID ) : -1;
+	query->m_goalIndex = ( query->m_goalID != 0 ) ? TheNavCompactMesh.GetIndex( query->m_goalID ) : -1;
+
+	// also needed with a goal area, in case that area turns out to be blocked
+	if ( query->m_hasGoalPos )
+	{
+		FindGoalPosAreas( query );
+	}
+	else
+	{
+		query->m_goalPosIndices.RemoveAll();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the queries waiting since last frame, oldest first. The
+//			mesh and its blocked state mustn't change until the batch is done.
+//-----------------------------------------------------------------------------
+void NavPathQuery_Update( void )
+{
+	VPROF_BUDGET( "NavPathQuery_Update", "NextBot" );
+
+	int maxQueries = nav_path_query_max_per_frame.GetInt();
+
+	CUtlVector< NavPathQuery_t * > batch;
+	for ( unsigned short it = s_Queries.FirstInorder(); it != s_Queries.InvalidIndex(); it = s_Queries.NextInorder( it ) )
+	{
+		NavPathQuery_t *query = s_Queries[ it ];
+		if ( query->m_status != NAV_PATH_QUERY_PENDING )
+			continue;
+
+		if ( maxQueries > 0 && batch.Count() >= maxQueries )
+			break;
+
+		// an earlier query of this frame may have answered it already
+		if ( query->IsCacheable() && nav_path_query_cache_size.GetInt() > 0 && LookupPathCache( query ) )
+			continue;
+
+		batch.AddToTail( query );
+	}
+
+	if ( !batch.Count() )
+		return;
+
+	// the searches run over the packed mesh, which isn't kept while the mesh is being edited
+	if ( !TheNavCompactMesh.IsBuilt() )
+	{
+		TheNavCompactMesh.Build();
+	}
+
+	FOR_EACH_VEC( batch, it )
+	{
+		PrepareNavPathQuery( batch[ it ] );
+	}
+
+	if ( nav_path_query_parallel.GetBool() && batch.Count() > 1 )
+	{
+		ParallelProcess( "NavPathQuery_Update", batch.Base(), batch.Count(), &RunNavPathQuery );
+	}
+	else
+	{
+		FOR_EACH_VEC( batch, it )
+		{
+			RunNavPathQuery( batch[ it ] );
+		}
+	}
+
+	FOR_EACH_VEC( batch, it )
+	{
+		if ( batch[ it ]->IsCacheable() && batch[ it ]->m_startIndex >= 0 )
+		{
+			AddToPathCache( batch[ it ] );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Same as CNavArea::IsBlocked(), for the state an area had before an update
+//-----------------------------------------------------------------------------
+static bool WasAreaBlocked( unsigned char blockedTeams, int attributes, int teamID, bool ignoreNavBlockers )
+{
+	if ( ignoreNavBlockers && ( attributes & NAV_MESH_NAV_BLOCKER ) )
+	{
+		return false;
+	}
+
+	if ( teamID == TEAM_ANY )
+	{
+		return ( blockedTeams != 0 );
+	}
+
+	int teamIdx = teamID % MAX_NAV_TEAMS;
+	return ( blockedTeams & ( 1 << teamIdx ) ) != 0;
+}
+
+//-----------------------------------------------------------------------------
+// Cache invalidation, per entry, as each entry was searched for one team. An
+// area becoming blocked can only break paths through it, but one becoming
+// unblocked can open a shorter way between any two areas.
+//-----------------------------------------------------------------------------
+void NavPathQuery_OnAreaBlockedChanged( CNavArea *area, unsigned char oldBlockedTeams, int oldAttributes )
+{
+	if ( !s_PathCache.Count() )
+		return;
+
+	// most updates leave the area as it was
+	unsigned char blockedTeams = 0;
+	for ( int i = 0; i < MAX_NAV_TEAMS; ++i )
+	{
+		if ( area->IsBlocked( i ) )
+		{
+			blockedTeams |= ( 1 << i );
+		}
+	}
+
+	if ( blockedTeams == oldBlockedTeams && ( area->GetAttributes() & NAV_MESH_NAV_BLOCKER ) == ( oldAttributes & NAV_MESH_NAV_BLOCKER ) )
+		return;
+
+	unsigned int areaID = area->GetID();
+
+	for ( unsigned short it = s_PathCache.FirstInorder(); it != s_PathCache.InvalidIndex(); )
+	{
+		unsigned short next = s_PathCache.NextInorder( it );
+
+		const NavPathCacheKey_t &key = s_PathCache.Key( it );
+		bool wasBlocked = WasAreaBlocked( oldBlockedTeams, oldAttributes, key.m_teamID, key.m_ignoreNavBlockers );
+		bool isBlocked = area->IsBlocked( key.m_teamID, key.m_ignoreNavBlockers );
+
+		bool isStale = false;
+		if ( wasBlocked && !isBlocked )
+		{
+			isStale = true;
+		}
+		else if ( !wasBlocked && isBlocked )
+		{
+			const NavPathQueryAreaPath_t &path = s_PathCache[ it ]->m_path;
+			FOR_EACH_VEC( path, i )
+			{
+				if ( path[ i ].m_areaID == areaID )
+				{
+					isStale = true;
+					break;
+				}
+			}
+		}
+
+		if ( isStale )
+		{
+			delete s_PathCache[ it ];
+			s_PathCache.RemoveAt( it );
+		}
+
+		it = next;
+	}
+}
+
+void NavPathQuery_OnMeshDestroyed( void )
+{
+	PurgePathCache();
+	s_Queries.PurgeAndDeleteElements();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Times random area to area searches three ways: NavAreaBuildPath()
+//			on the CNavAreas, CNavPathSearch on the packed mesh on this thread
+//			alone, and CNavPathSearch as a batch on the worker threads
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( nav_path_query_benchmark, "Time nav path searches between random areas. Arguments: [count]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( TheNavAreas.Count() < 2 )
+	{
+		Msg( "No navigation mesh loaded.\n" );
+		return;
+	}
+
+	if ( !TheNavCompactMesh.IsBuilt() )
+	{
+		TheNavCompactMesh.Build();
+	}
+
+	int count = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 100;
+
+	CUtlVector< NavPathQuery_t > queries;
+	queries.SetCount( count );
+	FOR_EACH_VEC( queries, it )
+	{
+		NavPathQuery_t &query = queries[ it ];
+		query.m_startID = TheNavAreas[ RandomInt( 0, TheNavAreas.Count() - 1 ) ]->GetID();
+		query.m_goalID = TheNavAreas[ RandomInt( 0, TheNavAreas.Count() - 1 ) ]->GetID();
+		query.m_hasGoalPos = false;
+		query.m_maxPathLength = 0.0f;
+		query.m_teamID = TEAM_ANY;
+		query.m_ignoreNavBlockers = false;
+		PrepareNavPathQuery( &query );
+	}
+
+	CUtlVector< bool > found;
+	ShortestPathCost cost;
+	double areaStart = Plat_FloatTime();
+	FOR_EACH_VEC( queries, it )
+	{
+		found.AddToTail( NavAreaBuildPath( TheNavMesh->GetNavAreaByID( queries[ it ].m_startID ), TheNavMesh->GetNavAreaByID( queries[ it ].m_goalID ), NULL, cost ) );
+	}
+	double areaTime = Plat_FloatTime() - areaStart;
+
+	int mismatches = 0;
+	double compactStart = Plat_FloatTime();
+	FOR_EACH_VEC( queries, it )
+	{
+		NavPathQuery_t *query = &queries[ it ];
+		RunNavPathQuery( query );
+		if ( ( query->m_status == NAV_PATH_QUERY_SUCCEEDED ) != found[ it ] )
+		{
+			++mismatches;
+		}
+	}
+	double compactTime = Plat_FloatTime() - compactStart;
+
+	CUtlVector< NavPathQuery_t * > batch;
+	FOR_EACH_VEC( queries, it )
+	{
+		batch.AddToTail( &queries[ it ] );
+	}
+
+	double batchStart = Plat_FloatTime();
+	ParallelProcess( "nav_path_query_benchmark", batch.Base(), batch.Count(), &RunNavPathQuery );
+	double batchTime = Plat_FloatTime() - batchStart;
+
+	Msg( "%d searches: CNavArea A* %.2f ms, packed A* %.2f ms, packed A* batched %.2f ms, %d results differ\n", count, areaTime * 1000.0, compactTime * 1000.0, batchTime * 1000.0, mismatches );
+}
@@ -0,0 +1,65 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Nav mesh path queries that are queued up and run in one batch on
+//			worker threads at the start of the next CNavMesh::Update(). Each
+//			query keeps its own search state instead of the open and closed
+//			lists on CNavArea, so any number of them can search at once.
+//			Recent area to area results are cached until an area becomes
+//			blocked or unblocked.
+//
+//			Nothing in this game submits queries yet. NPCs path over the AI
+//			node graph, there are no nav mesh bots, and the NavAreaBuildPath()
+//			calls in nav_file.cpp are CSTRIKE_DLL only or compiled out.
+//
+//=============================================================================//
+
+#ifndef NAV_PATH_QUERY_H
+#define NAV_PATH_QUERY_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "nav.h"
+
+class CNavArea;
+
+typedef unsigned int NavPathQueryHandle_t;
+#define NAV_PATH_QUERY_INVALID_HANDLE	0
+
+enum NavPathQueryStatus_t
+{
+	NAV_PATH_QUERY_UNKNOWN,			// no query with this handle, or it was already collected
+	NAV_PATH_QUERY_PENDING,			// hasn't run yet, try again next tick
+	NAV_PATH_QUERY_SUCCEEDED,
+	NAV_PATH_QUERY_FAILED,			// no path, the path to the closest area reached is returned instead
+};
+
+//-----------------------------------------------------------------------------
+// One area along a found path
+//-----------------------------------------------------------------------------
+struct NavPathQueryStep_t
+{
+	CNavArea *m_area;
+	NavTraverseType m_how;			// how m_area is entered from the step before it, NUM_TRAVERSE_TYPES for the first
+};
+
+// Queues a search from startArea to goalArea, or to the area containing goalPos if goalArea is
+// NULL, costed like NavAreaBuildPath() with ShortestPathCost.
+NavPathQueryHandle_t NavPathQuery_Submit( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
+
+// Once the query has run, copies out the path from start to goal and releases the handle.
+// path and closestArea are left alone while the query is still pending.
+NavPathQueryStatus_t NavPathQuery_Collect( NavPathQueryHandle_t hQuery, CUtlVector< NavPathQueryStep_t > *path, CNavArea **closestArea = NULL );
+
+// Releases a query whose result is no longer wanted
+void NavPathQuery_Cancel( NavPathQueryHandle_t hQuery );
+
+// Hooks for CNavMesh
+void NavPathQuery_Update( void );
+void NavPathQuery_OnMeshDestroyed( void );
+
+// Hook for CNavArea, called after its blocked flags were updated. oldBlockedTeams has a bit
+// per team and oldAttributes are the area's attribute flags, both from before the update.
+void NavPathQuery_OnAreaBlockedChanged( CNavArea *area, unsigned char oldBlockedTeams, int oldAttributes );
+
+#endif // NAV_PATH_QUERY_H
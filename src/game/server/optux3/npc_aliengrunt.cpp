@@ -65,6 +65,7 @@
 #include "vphysics_interface.h"
 #include "vphysics/constraints.h"
 #include "physics_saverestore.h"
+#include "ilagcompensationmanager.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -305,6 +306,8 @@ void CNPC_AlienGrunt::UpdateOnRemove()
 {
 	DestroyPlayerConstrain();
 
+	lagcompensation->RemoveAdditionalEntity( this );
+
 	BaseClass::UpdateOnRemove();
 }
 
@@ -1896,6 +1899,9 @@ void CNPC_AlienGrunt::Spawn()
 	
 	// Don't allow us to skip animation setup because our attachments are critical to us!
 	SetBoneCacheFlags( BCF_NO_ANIMATION_SKIP );
+
+	// Let players hit what they see
+	lagcompensation->AddAdditionalEntity( this );
 }
 
 //=========================================================
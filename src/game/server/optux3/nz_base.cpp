@@ -36,6 +36,7 @@
 #include "weapon_physcannon.h"
 #include "ammodef.h"
 #include "vehicle_base.h"
+#include "ilagcompensationmanager.h"
  
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1657,6 +1658,9 @@ void CNPC_NZBase::Spawn( void )
 	GetEnemies()->SetFreeKnowledgeDuration( 6.0 );
 
 	m_ActBusyBehavior.SetUseRenderBounds(true);
+
+	// Let players hit what they see
+	lagcompensation->AddAdditionalEntity( this );
 }
 
 
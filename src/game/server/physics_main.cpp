@@ -33,6 +33,7 @@
 #include "vphysicsupdateai.h"
 #include "tier0/vcrmode.h"
 #include "pushentity.h"
+#include "player_move_prefetch.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -2054,6 +2055,8 @@ void Physics_RunThinkFunctions( bool simulating )
 		// Do we really need UTIL_RemoveImmediate()?
 		int count = SimThink_ListCopy( list, listMax );
 
+		PlayerMovePrefetch_Gather();
+
 		//DevMsg(1, "Count: %d\n", count );
 		for ( int i = 0; i < count; i++ )
 		{
@@ -2064,6 +2067,8 @@ void Physics_RunThinkFunctions( bool simulating )
 			Physics_SimulateEntity( list[i] );
 		}
 
+		PlayerMovePrefetch_Clear();
+
 		stackfree( list );
 		UTIL_EnableRemoveImmediate();
 	}
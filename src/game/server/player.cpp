@@ -69,6 +69,7 @@
 #include "dt_utlvector_send.h"
 #include "vote_controller.h"
 #include "ai_speech.h"
+#include "ilagcompensationmanager.h"
 #include "arsenio/func_shop.h"
 
 #include "weapon_frag.h"
@@ -620,6 +621,7 @@ CBasePlayer::CBasePlayer()
 	m_fLerpTime = 0.1f; // cl_interp default
 	m_bPredictWeapons = true;
 	m_bLagCompensation = false;
+	m_bQueueBullets = false;
 	m_flLaggedMovementValue = 1.0f;
 	m_StuckLast = 0;
 	m_impactEnergyScale = 1.0f;
@@ -3028,6 +3030,20 @@ int CBasePlayer::GetCommandContextCount(void) const
 	return m_CommandContext.Count();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Output : int
+//-----------------------------------------------------------------------------
+int CBasePlayer::GetQueuedCommandCount(void) const
+{
+	int nCommands = 0;
+	for (int i = 0; i < m_CommandContext.Count(); i++)
+	{
+		nCommands += m_CommandContext[i].numcmds;
+	}
+	return nCommands;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : index - 
@@ -3779,6 +3795,53 @@ void CBasePlayer::PlayerRunCommand(CUserCmd* ucmd, IMoveHelper* moveHelper)
 
 }
 
+ConVar sv_bullet_unlag("sv_bullet_unlag", "1", FCVAR_NONE, "Lag compensate bullets fired by players. Everything is rewound once per user command.");
+
+//-----------------------------------------------------------------------------
+// Purpose: Holds on to a FireBullets call made while a user command is being
+//			run. Returns false if the shots should be fired straight away.
+//-----------------------------------------------------------------------------
+bool CBasePlayer::QueueBullets(const FireBulletsInfo_t& info)
+{
+	if (!m_bQueueBullets)
+		return false;
+
+	m_QueuedBullets.AddToTail(info);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fires everything queued during the current command. Other players
+//			and lag compensated NPCs are rewound once to where this player saw
+//			them, and put back as soon as the last shot has been traced.
+//-----------------------------------------------------------------------------
+void CBasePlayer::FireQueuedBullets(void)
+{
+	m_bQueueBullets = false;
+
+	if (!m_QueuedBullets.Count())
+		return;
+
+	bool bRewind = (m_pCurrentCommand && sv_bullet_unlag.GetBool());
+	if (bRewind)
+	{
+		lagcompensation->StartLagCompensation(this, m_pCurrentCommand);
+	}
+
+	// Fire in the order the weapons asked for. Glass penetration calls back in
+	// with the queue closed, so it is traced under the same rewind.
+	for (int i = 0; i < m_QueuedBullets.Count(); i++)
+	{
+		CBaseEntity::FireBullets(m_QueuedBullets[i]);
+	}
+	m_QueuedBullets.RemoveAll();
+
+	if (bRewind)
+	{
+		lagcompensation->FinishLagCompensation(this);
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Strips off IN_xxx flags from the player's input
 //-----------------------------------------------------------------------------
@@ -634,6 +634,11 @@ public:
 	virtual void			PlayerRunCommand(CUserCmd *ucmd, IMoveHelper *moveHelper);
 	void					RunNullCommand();
 	CUserCmd *				GetCurrentCommand( void )	{ return m_pCurrentCommand; }
+
+	// Bullets fired while a user command runs are held here and traced together,
+	// under one rewind, once the command's PostThink is done.
+	bool					QueueBullets( const FireBulletsInfo_t &info );
+	void					FireQueuedBullets( void );
 	float					GetTimeSinceLastUserCommand( void ) { return ( !IsConnected() || IsFakeClient() || IsBot() ) ? 0.f : gpGlobals->curtime - m_flLastUserCommandTime; }
 
 	// Team Handling
@@ -876,6 +881,8 @@ private:
 	void				AdjustPlayerTimeBase( int simulation_ticks );
 
 public:
+	// Commands received and not run yet
+	int					GetQueuedCommandCount( void ) const;
 	
 
 
@@ -933,6 +940,8 @@ public:
 	int						m_nUpdateRate;		// user snapshot rate cl_updaterate
 	float					m_fLerpTime;		// users cl_interp
 	bool					m_bLagCompensation;	// user wants lag compenstation
+	bool					m_bQueueBullets;	// a user command is running, so FireBullets queues its shots
+	CUtlVector< FireBulletsInfo_t >	m_QueuedBullets;
 	bool					m_bPredictWeapons; //  user has client side predicted weapons
 	float					m_flLastDamageTime; // Health regen last hurt.
 
@@ -2241,6 +2250,11 @@ public:
 	virtual void			PlayerRunCommand(CUserCmd* ucmd, IMoveHelper* moveHelper);
 	void					RunNullCommand();
 	CUserCmd* GetCurrentCommand(void) { return m_pCurrentCommand; }
+
+	// Bullets fired while a user command runs are held here and traced together,
+	// under one rewind, once the command's PostThink is done.
+	bool					QueueBullets(const FireBulletsInfo_t& info);
+	void					FireQueuedBullets(void);
 	float					GetTimeSinceLastUserCommand(void) { return (!IsConnected() || IsFakeClient() || IsBot()) ? 0.f : gpGlobals->curtime - m_flLastUserCommandTime; }
 
 	// Team Handling
@@ -2483,6 +2497,8 @@ private:
 	void				AdjustPlayerTimeBase(int simulation_ticks);
 
 public:
+	// Commands received and not run yet
+	int					GetQueuedCommandCount(void) const;
 
 
 
@@ -2540,6 +2556,8 @@ public:
 	int						m_nUpdateRate;		// user snapshot rate cl_updaterate
 	float					m_fLerpTime;		// users cl_interp
 	bool					m_bLagCompensation;	// user wants lag compenstation
+	bool					m_bQueueBullets;	// a user command is running, so FireBullets queues its shots
+	CUtlVector< FireBulletsInfo_t >	m_QueuedBullets;
 	bool					m_bPredictWeapons; //  user has client side predicted weapons
 	float					m_flLastDamageTime; // Health regen last hurt.
 
@@ -14,6 +14,7 @@
 #include "movehelper_server.h"
 #include "iservervehicle.h"
 #include "tier0/vprof.h"
+#include "movement_replay.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -83,6 +84,22 @@ void CPlayerMove::FinishCommand( CBasePlayer *player )
 	CBaseEntity::SetPredictionPlayer( NULL );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Runs the movement of a command without the thinks, weapons and
+//			touches around it. Whatever the move touched is forgotten.
+//-----------------------------------------------------------------------------
+void CPlayerMove::ReplayMovement( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move )
+{
+	StartCommand( player, ucmd );
+
+	MoveHelperServer()->SetHost( player );
+	g_pGameMovement->ProcessMovement( player, move );
+	MoveHelperServer()->ResetTouchList();
+	MoveHelperServer()->SetHost( NULL );
+
+	FinishCommand( player );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Checks if the player is standing on a moving entity and adjusts velocity and 
 //  basevelocity appropriately
@@ -335,6 +352,9 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 
 	StartCommand( player, ucmd );
 
+	// Shots fired from here on wait for FireQueuedBullets
+	player->m_bQueueBullets = true;
+
 	// Set globals appropriately
 	gpGlobals->curtime		=  playerCurTime;
 	gpGlobals->frametime	=  playerFrameTime;
@@ -431,7 +451,9 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 	{
 		VPROF( "g_pGameMovement->ProcessMovement()" );
 		Assert( g_pGameMovement );
+		MovementRecorder_PreMove( player, ucmd, g_pMoveData );
 		g_pGameMovement->ProcessMovement( player, g_pMoveData );
+		MovementRecorder_PostMove( player, g_pMoveData );
 	}
 	else
 	{
@@ -449,6 +471,9 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 
 	RunPostThink( player );
 
+	// Trace everything the weapons fired during this command under one rewind
+	player->FireQueuedBullets();
+
 	g_pGameMovement->FinishTrackPredictionErrors( player );
 
 	FinishCommand( player );
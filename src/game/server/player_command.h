@@ -34,6 +34,9 @@ public:
 	// Run a movement command from the player
 	void			RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper );
 
+	// Runs only the movement of a recorded command, see movement_replay.cpp
+	void			ReplayMovement( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move );
+
 protected:
 	// Prepare for running movement
 	virtual void	SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move );
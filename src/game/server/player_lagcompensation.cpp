@@ -10,8 +10,8 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
+#include "collisionutils.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -37,11 +37,19 @@ ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_DEVELOPMENTONLY, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
+ConVar sv_unlag_entities( "sv_unlag_entities", "1", FCVAR_DEVELOPMENTONLY, "Enables lag compensation of NPCs and other entities that opted into it" );
+ConVar sv_unlag_aim_cone( "sv_unlag_aim_cone", "30", FCVAR_DEVELOPMENTONLY, "Only lag compensate NPCs and other entities whose backtracked volume is within this many degrees of the shooter's aim. 0 = no culling" );
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
 #define MAX_LAYER_RECORDS (CBaseAnimatingOverlay::MAX_OVERLAYS)
 
+// Must be a power of two, and hold sv_maxunlag worth of ticks at the highest tickrate
+#define LAG_HISTORY_SIZE	128
+#define LAG_HISTORY_MASK	( LAG_HISTORY_SIZE - 1 )
+
 struct LayerRecord
 {
 	int m_sequence;
@@ -115,29 +123,176 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// Purpose: History of one lag compensated entity. A fixed size ring with one
+// array per field, so the binary search over simulation times (and the
+// teleport checks) only touch the data they need.
+//-----------------------------------------------------------------------------
+class CLagTrack
+{
+public:
+	CLagTrack()
+	{
+		Reset( NULL );
+	}
+
+	void Reset( CBaseAnimating *pEntity )
+	{
+		m_hEntity = pEntity;
+		m_pOverlay = pEntity ? dynamic_cast< CBaseAnimatingOverlay * >( pEntity ) : NULL;
+		m_nHead = 0;
+		m_nCount = 0;
+		m_flNewestBreakTime = -1.0f;
+	}
+
+	// Index 0 is the newest record, Count()-1 the oldest
+	int		Count() const			{ return m_nCount; }
+	int		Slot( int i ) const		{ return ( m_nHead - i ) & LAG_HISTORY_MASK; }
+
+	void	RemoveOlderThan( float flDeadTime );
+	void	AddRecord( CBaseAnimating *pEntity, float flTeleportDistanceSqr );
+
+	// Returns the newest record at or before flTargetTime, or the oldest one if there is none
+	int		FindRecord( float flTargetTime ) const;
+
+	EHANDLE					m_hEntity;
+	CBaseAnimatingOverlay	*m_pOverlay;
+	int						m_nHead;
+	int						m_nCount;
+
+	// Simulation time of the newest record we can't backtrack through: the entity was
+	// dead, or teleported on the way to the next record
+	float					m_flNewestBreakTime;
+
+	float					m_flSimulationTime[ LAG_HISTORY_SIZE ];
+	int						m_fFlags[ LAG_HISTORY_SIZE ];
+	Vector					m_vecOrigin[ LAG_HISTORY_SIZE ];
+	QAngle					m_vecAngles[ LAG_HISTORY_SIZE ];
+	Vector					m_vecMinsPreScaled[ LAG_HISTORY_SIZE ];
+	Vector					m_vecMaxsPreScaled[ LAG_HISTORY_SIZE ];
+	int						m_masterSequence[ LAG_HISTORY_SIZE ];
+	float					m_masterCycle[ LAG_HISTORY_SIZE ];
+	LayerRecord				m_layerRecords[ LAG_HISTORY_SIZE ][ MAX_LAYER_RECORDS ];
+
+	// Scratchpad for determining what needs to be restored
+	LagRecord				m_RestoreData;	// entity data before we moved it back
+	LagRecord				m_ChangeData;	// entity data where we moved it back
+};
+
+void CLagTrack::RemoveOlderThan( float flDeadTime )
+{
+	while ( m_nCount > 0 && m_flSimulationTime[ Slot( m_nCount - 1 ) ] < flDeadTime )
+	{
+		--m_nCount;
+	}
+}
+
+void CLagTrack::AddRecord( CBaseAnimating *pEntity, float flTeleportDistanceSqr )
+{
+	const Vector &vecOrigin = pEntity->GetLocalOrigin();
+	if ( m_nCount > 0 )
+	{
+		// If we moved too far since the last record, nothing can be backtracked past it
+		Vector delta = vecOrigin - m_vecOrigin[ m_nHead ];
+		if ( delta.Length2DSqr() > flTeleportDistanceSqr )
+		{
+			m_flNewestBreakTime = MAX( m_flNewestBreakTime, m_flSimulationTime[ m_nHead ] );
+		}
+	}
+
+	// The ring overwrites the oldest record once it's full
+	m_nHead = ( m_nHead + 1 ) & LAG_HISTORY_MASK;
+	m_nCount = MIN( m_nCount + 1, LAG_HISTORY_SIZE );
+
+	int slot = m_nHead;
+	m_fFlags[ slot ] = 0;
+	if ( pEntity->IsAlive() )
+	{
+		m_fFlags[ slot ] |= LC_ALIVE;
+	}
+	else
+	{
+		m_flNewestBreakTime = MAX( m_flNewestBreakTime, pEntity->GetSimulationTime() );
+	}
+
+	m_flSimulationTime[ slot ]	= pEntity->GetSimulationTime();
+	m_vecAngles[ slot ]			= pEntity->GetLocalAngles();
+	m_vecOrigin[ slot ]			= vecOrigin;
+	m_vecMinsPreScaled[ slot ]	= pEntity->CollisionProp()->OBBMinsPreScaled();
+	m_vecMaxsPreScaled[ slot ]	= pEntity->CollisionProp()->OBBMaxsPreScaled();
+
+	if ( m_pOverlay )
+	{
+		LayerRecord *pLayerRecords = m_layerRecords[ slot ];
+		int layerCount = m_pOverlay->GetNumAnimOverlays();
+		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
+		{
+			CAnimationLayer *currentLayer = m_pOverlay->GetAnimOverlay(layerIndex);
+			if( currentLayer )
+			{
+				pLayerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				pLayerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				pLayerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				pLayerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+			}
+		}
+	}
+	m_masterSequence[ slot ] = pEntity->GetSequence();
+	m_masterCycle[ slot ] = pEntity->GetCycle();
+}
+
+int CLagTrack::FindRecord( float flTargetTime ) const
+{
+	Assert( m_nCount > 0 );
+
+	// Simulation times decrease from the head to the tail
+	int lo = 0;
+	int hi = m_nCount - 1;
+	if ( m_flSimulationTime[ Slot( hi ) ] > flTargetTime )
+		return hi;
+
+	while ( lo < hi )
+	{
+		int mid = ( lo + hi ) >> 1;
+		if ( m_flSimulationTime[ Slot( mid ) ] <= flTargetTime )
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+
 //
-// Try to take the player from his current origin to vWantedPos.
-// If it can't get there, leave the player where he is.
+// Try to take the entity from its current origin to vWantedPos.
+// If it can't get there, leave the entity where it is.
 // 
 
 ConVar sv_unlag_debug( "sv_unlag_debug", "0", FCVAR_GAMEDLL | FCVAR_DEVELOPMENTONLY );
 
 float g_flFractionScale = 0.95;
-static void RestorePlayerTo( CBasePlayer *pPlayer, const Vector &vWantedPos )
+static void RestoreEntityTo( CBaseAnimating *pEntity, const Vector &vWantedPos )
 {
 	// Try to move to the wanted position from our current position.
 	trace_t tr;
-	VPROF_BUDGET( "RestorePlayerTo", "CLagCompensationManager" );
-	UTIL_TraceEntity( pPlayer, vWantedPos, vWantedPos, MASK_PLAYERSOLID, pPlayer, COLLISION_GROUP_PLAYER_MOVEMENT, &tr );
+	VPROF_BUDGET( "RestoreEntityTo", "CLagCompensationManager" );
+
+	unsigned int mask = pEntity->IsPlayer() ? MASK_PLAYERSOLID : MASK_NPCSOLID;
+	int collisionGroup = pEntity->IsPlayer() ? COLLISION_GROUP_PLAYER_MOVEMENT : pEntity->GetCollisionGroup();
+	UTIL_TraceEntity( pEntity, vWantedPos, vWantedPos, mask, pEntity, collisionGroup, &tr );
 	if ( tr.startsolid || tr.allsolid )
 	{
 		if ( sv_unlag_debug.GetBool() )
 		{
-			DevMsg( "RestorePlayerTo() could not restore player position for client \"%s\" ( %.1f %.1f %.1f )\n",
-					pPlayer->GetPlayerName(), vWantedPos.x, vWantedPos.y, vWantedPos.z );
+			DevMsg( "RestoreEntityTo() could not restore position for %s ( %.1f %.1f %.1f )\n",
+					pEntity->GetDebugName(), vWantedPos.x, vWantedPos.y, vWantedPos.z );
 		}
 
-		UTIL_TraceEntity( pPlayer, pPlayer->GetLocalOrigin(), vWantedPos, MASK_PLAYERSOLID, pPlayer, COLLISION_GROUP_PLAYER_MOVEMENT, &tr );
+		UTIL_TraceEntity( pEntity, pEntity->GetLocalOrigin(), vWantedPos, mask, pEntity, collisionGroup, &tr );
 		if ( tr.startsolid || tr.allsolid )
 		{
 			// In this case, the guy got stuck back wherever we lag compensated him to. Nasty.
@@ -149,8 +304,8 @@ static void RestorePlayerTo( CBasePlayer *pPlayer, const Vector &vWantedPos )
 		{
 			// We can get to a valid place, but not all the way back to where we were.
 			Vector vPos;
-			VectorLerp( pPlayer->GetLocalOrigin(), vWantedPos, tr.fraction * g_flFractionScale, vPos );
-			UTIL_SetOrigin( pPlayer, vPos, true );
+			VectorLerp( pEntity->GetLocalOrigin(), vWantedPos, tr.fraction * g_flFractionScale, vPos );
+			UTIL_SetOrigin( pEntity, vPos, true );
 
 			if ( sv_unlag_debug.GetBool() )
 				DevMsg( " restore got most of the way\n" );
@@ -158,8 +313,8 @@ static void RestorePlayerTo( CBasePlayer *pPlayer, const Vector &vWantedPos )
 	}
 	else
 	{
-		// Cool, the player can go back to whence he came.
-		UTIL_SetOrigin( pPlayer, tr.endpos, true );
+		// Cool, the entity can go back to whence it came.
+		UTIL_SetOrigin( pEntity, tr.endpos, true );
 	}
 }
 
@@ -172,6 +327,9 @@ class CLagCompensationManager : public CAutoGameSystemPerFrame, public ILagCompe
 public:
 	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name ), m_flTeleportDistanceSqr( 64 *64 )
 	{
+		m_pCurrentPlayer = NULL;
+		m_bNeedToRestore = false;
+		memset( m_pTracks, 0, sizeof( m_pTracks ) );
 	}
 
 	// IServerSystem stuff
@@ -183,6 +341,7 @@ public:
 	virtual void LevelShutdownPostEntity()
 	{
 		ClearHistory();
+		m_AdditionalEntities.Purge();
 	}
 
 	// called after entities think
@@ -194,24 +353,35 @@ public:
 	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd );
 	void			FinishLagCompensation( CBasePlayer *player );
 
+	void			AddAdditionalEntity( CBaseAnimating *pEntity );
+	void			RemoveAdditionalEntity( CBaseAnimating *pEntity );
+
 private:
-	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	void			UpdateTrack( CBaseAnimating *pEntity, float flDeadTime );
+	void			RemoveTrack( int index );
+	void			BacktrackEntity( CBaseAnimating *pEntity, float flTargetTime );
+
+	// Could the shot the player is about to take hit anything in the backtracked volume?
+	bool			IsInAimCone( CLagTrack *track, CBaseAnimating *pEntity, float flTargetTime, const Vector &vecEye, const Vector &vecForward, float flSine, float flCosine );
 
 	void ClearHistory()
 	{
-		for ( int i=0; i<MAX_PLAYERS; i++ )
-			m_PlayerTrack[i].Purge();
+		for ( int i = m_TrackedEntities.Count(); --i >= 0; )
+		{
+			RemoveTrack( m_TrackedEntities[i] );
+		}
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// History for every player and additional entity, by entity index
+	CLagTrack				*m_pTracks[ MAX_EDICTS ];
+	CUtlVector< int >		m_TrackedEntities;
+
+	// NPCs etc. that asked to be lag compensated
+	CUtlVector< EHANDLE >	m_AdditionalEntities;
 
 	// Scratchpad for determining what needs to be restored
-	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
+	CBitVec<MAX_EDICTS>		m_RestoreEntity;
 	bool					m_bNeedToRestore;
-	
-	LagRecord				m_RestoreData[ MAX_PLAYERS ];	// player data before we moved him back
-	LagRecord				m_ChangeData[ MAX_PLAYERS ];	// player data where we moved him back
 
 	CBasePlayer				*m_pCurrentPlayer;	// The player we are doing lag compensation for
 
@@ -222,6 +392,67 @@ static CLagCompensationManager g_LagCompensationManager( "CLagCompensationManage
 ILagCompensationManager *lagcompensation = &g_LagCompensationManager;
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Entities other than players have to ask to be lag compensated
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::AddAdditionalEntity( CBaseAnimating *pEntity )
+{
+	EHANDLE hEntity( pEntity );
+	if ( m_AdditionalEntities.Find( hEntity ) == m_AdditionalEntities.InvalidIndex() )
+	{
+		m_AdditionalEntities.AddToTail( hEntity );
+	}
+}
+
+void CLagCompensationManager::RemoveAdditionalEntity( CBaseAnimating *pEntity )
+{
+	m_AdditionalEntities.FindAndFastRemove( EHANDLE( pEntity ) );
+	RemoveTrack( pEntity->entindex() );
+}
+
+
+void CLagCompensationManager::RemoveTrack( int index )
+{
+	if ( !m_pTracks[index] )
+		return;
+
+	delete m_pTracks[index];
+	m_pTracks[index] = NULL;
+	m_TrackedEntities.FindAndFastRemove( index );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops records that are too old and adds one for the current state
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::UpdateTrack( CBaseAnimating *pEntity, float flDeadTime )
+{
+	int index = pEntity->entindex();
+	CLagTrack *track = m_pTracks[index];
+	if ( !track )
+	{
+		track = m_pTracks[index] = new CLagTrack;
+		track->Reset( pEntity );
+		m_TrackedEntities.AddToTail( index );
+	}
+	else if ( track->m_hEntity.Get() != pEntity )
+	{
+		// Entity index got reused
+		track->Reset( pEntity );
+	}
+
+	// remove tail records that are too old
+	track->RemoveOlderThan( flDeadTime );
+
+	// check if head has same simulation time
+	if ( track->Count() > 0 && track->m_flSimulationTime[ track->m_nHead ] >= pEntity->GetSimulationTime() )
+		return; // don't add new entry for same or older time
+
+	// add new record to the track
+	track->AddRecord( pEntity, m_flTeleportDistanceSqr );
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Called once per frame after all entities have had a chance to think
 //-----------------------------------------------------------------------------
@@ -238,87 +469,82 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	VPROF_BUDGET( "FrameUpdatePostEntityThink", "CLagCompensationManager" );
 
 	// remove all records before that time:
-	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
+	float flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
-
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
-
 		if ( !pPlayer )
 		{
-			if ( track->Count() > 0 )
-			{
-				track->RemoveAll();
-			}
-
+			RemoveTrack( i );
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
+		UpdateTrack( pPlayer, flDeadtime );
+	}
 
-		// remove tail records that are too old
-		int tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+	// And everything else that wants to be lag compensated
+	bool bUnlagEntities = sv_unlag_entities.GetBool();
+	for ( int i = m_AdditionalEntities.Count(); --i >= 0; )
+	{
+		CBaseEntity *pEntity = m_AdditionalEntities[i];
+		CBaseAnimating *pAnimating = pEntity ? pEntity->GetBaseAnimating() : NULL;
+		if ( !pAnimating )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
-			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
-				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+			m_AdditionalEntities.FastRemove( i );
+			continue;
 		}
 
-		// check if head has same simulation time
-		if ( track->Count() > 0 )
+		if ( bUnlagEntities )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
-			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
-				continue; // don't add new entry for same or older time
+			UpdateTrack( pAnimating, flDeadtime );
 		}
-
-		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
-
-		record.m_fFlags = 0;
-		if ( pPlayer->IsAlive() )
+		else
 		{
-			record.m_fFlags |= LC_ALIVE;
+			RemoveTrack( pAnimating->entindex() );
 		}
+	}
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
-
-		int layerCount = pPlayer->GetNumAnimOverlays();
-		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
+	// Drop the history of entities that went away
+	for ( int i = m_TrackedEntities.Count(); --i >= 0; )
+	{
+		int index = m_TrackedEntities[i];
+		if ( !m_pTracks[index]->m_hEntity.Get() )
 		{
-			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
-			if( currentLayer )
-			{
-				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-				record.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-				record.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
-			}
+			RemoveTrack( index );
 		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
 	}
 
 	//Clear the current player.
 	m_pCurrentPlayer = NULL;
 }
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Sweeps the entity's box from where it was at flTargetTime to where it
+// is now, and checks that against a cone around the shooter's aim.
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::IsInAimCone( CLagTrack *track, CBaseAnimating *pEntity, float flTargetTime, 
+	const Vector &vecEye, const Vector &vecForward, float flSine, float flCosine )
+{
+	if ( track->Count() <= 0 )
+		return false;
+
+	int slot = track->Slot( track->FindRecord( flTargetTime ) );
+
+	Vector vecMins, vecMaxs;
+	pEntity->CollisionProp()->WorldSpaceAABB( &vecMins, &vecMaxs );
+	VectorMin( vecMins, track->m_vecOrigin[slot] + track->m_vecMinsPreScaled[slot], vecMins );
+	VectorMax( vecMaxs, track->m_vecOrigin[slot] + track->m_vecMaxsPreScaled[slot], vecMaxs );
+
+	Vector vecCenter;
+	VectorLerp( vecMins, vecMaxs, 0.5f, vecCenter );
+	float flRadius = ( vecMaxs - vecCenter ).Length();
+	return IsSphereIntersectingCone( vecCenter, flRadius, vecEye, vecForward, flSine, flCosine );
+}
+
+
 // Called during player movement to set up/restore after lag compensation
 void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd )
 {
@@ -331,8 +557,8 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		return;
 	}
 
-	// Assume no players need to be restored
-	m_RestorePlayer.ClearAll();
+	// Assume no entities need to be restored
+	m_RestoreEntity.ClearAll();
 	m_bNeedToRestore = false;
 
 	m_pCurrentPlayer = player;
@@ -347,8 +573,6 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 
 	// NOTE: Put this here so that it won't show up in single player mode.
 	VPROF_BUDGET( "StartLagCompensation", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-	Q_memset( m_RestoreData, 0, sizeof( m_RestoreData ) );
-	Q_memset( m_ChangeData, 0, sizeof( m_ChangeData ) );
 
 	// Get true latency
 
@@ -384,6 +608,8 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		// DevMsg("StartLagCompensation: delta too big (%.3f)\n", deltaTime );
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
+
+	float flTargetTime = TICKS_TO_TIME( targettick );
 	
 	// Iterate all active players
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
@@ -407,120 +633,121 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 			continue;
 
 		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		BacktrackEntity( pPlayer, flTargetTime );
+	}
+
+	if ( !sv_unlag_entities.GetBool() || m_AdditionalEntities.Count() == 0 )
+		return;
+
+	// Only move back the other entities the shot can actually reach
+	float flAimCone = sv_unlag_aim_cone.GetFloat();
+	bool bCullToAim = ( flAimCone > 0.0f && flAimCone < 180.0f );
+	float flSine = 0.0f, flCosine = 1.0f;
+	Vector vecEye, vecForward;
+	if ( bCullToAim )
+	{
+		SinCos( DEG2RAD( flAimCone ), &flSine, &flCosine );
+		vecEye = player->EyePosition();
+		AngleVectors( cmd->viewangles, &vecForward );
+	}
+
+	for ( int i = 0; i < m_AdditionalEntities.Count(); i++ )
+	{
+		CBaseEntity *pEntity = m_AdditionalEntities[i];
+		if ( !pEntity )
+			continue;
+
+		int index = pEntity->entindex();
+		CLagTrack *track = m_pTracks[index];
+		if ( !track || track->m_hEntity.Get() != pEntity )
+			continue;
+
+		// If this entity hasn't been transmitted to us and acked, then don't bother lag compensating it.
+		if ( pEntityTransmitBits && !pEntityTransmitBits->Get( index ) )
+			continue;
+
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		if ( bCullToAim && !IsInAimCone( track, pAnimating, flTargetTime, vecEye, vecForward, flSine, flCosine ) )
+			continue;
+
+		BacktrackEntity( pAnimating, flTargetTime );
 	}
 }
 
-void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
+void CLagCompensationManager::BacktrackEntity( CBaseAnimating *pEntity, float flTargetTime )
 {
 	Vector org;
 	Vector minsPreScaled;
 	Vector maxsPreScaled;
 	QAngle ang;
 
-	VPROF_BUDGET( "BacktrackPlayer", "CLagCompensationManager" );
-	int pl_index = pPlayer->entindex() - 1;
+	VPROF_BUDGET( "BacktrackEntity", "CLagCompensationManager" );
+	int index = pEntity->entindex();
 
-	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	// get track history of this entity
+	CLagTrack *track = m_pTracks[ index ];
 
 	// check if we have at leat one entry
-	if ( track->Count() <= 0 )
+	if ( !track || track->Count() <= 0 )
 		return;
 
-	int curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	// find the newest record at or before the target time
+	int recordIndex = track->FindRecord( flTargetTime );
 
-	Vector prevOrg = pPlayer->GetLocalOrigin();
-	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
-	{
-		// remember last record
-		prevRecord = record;
-
-		// get next record
-		record = &track->Element( curr );
-
-		if ( !(record->m_fFlags & LC_ALIVE) )
-		{
-			// player most be alive, lost track
-			return;
-		}
-
-		Vector delta = record->m_vecOrigin - prevOrg;
-		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
-		{
-			// lost track, too much difference
-			return; 
-		}
-
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
-
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
-	}
-
-	Assert( record );
+	// can't go back across a death or teleport
+	if ( track->m_flSimulationTime[ track->Slot( recordIndex ) ] <= track->m_flNewestBreakTime )
+		return;
 
-	if ( !record )
-	{
-		if ( sv_unlag_debug.GetBool() )
-		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
-		}
+	// or if game code moved us too far since the last record
+	Vector delta = track->m_vecOrigin[ track->m_nHead ] - pEntity->GetLocalOrigin();
+	if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
+		return;
 
-		return; // that should never happen
-	}
+	int record = track->Slot( recordIndex );
+	int prevRecord = ( recordIndex > 0 ) ? track->Slot( recordIndex - 1 ) : -1;
 
 	float frac = 0.0f;
-	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
+	if ( prevRecord >= 0 && 
+		 (track->m_flSimulationTime[record] < flTargetTime) &&
+		 (track->m_flSimulationTime[record] < track->m_flSimulationTime[prevRecord]) )
 	{
 		// we didn't find the exact time but have a valid previous record
 		// so interpolate between these two records;
 
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+		Assert( track->m_flSimulationTime[prevRecord] > track->m_flSimulationTime[record] );
+		Assert( flTargetTime < track->m_flSimulationTime[prevRecord] );
 
 		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+		frac = ( flTargetTime - track->m_flSimulationTime[record] ) / 
+			( track->m_flSimulationTime[prevRecord] - track->m_flSimulationTime[record] );
 
 		Assert( frac > 0 && frac < 1 ); // should never extrapolate
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
+		ang				= Lerp( frac, track->m_vecAngles[record], track->m_vecAngles[prevRecord] );
+		org				= Lerp( frac, track->m_vecOrigin[record], track->m_vecOrigin[prevRecord] );
+		minsPreScaled	= Lerp( frac, track->m_vecMinsPreScaled[record], track->m_vecMinsPreScaled[prevRecord] );
+		maxsPreScaled	= Lerp( frac, track->m_vecMaxsPreScaled[record], track->m_vecMaxsPreScaled[prevRecord] );
 	}
 	else
 	{
 		// we found the exact record or no other record to interpolate with
 		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		org				= track->m_vecOrigin[record];
+		ang				= track->m_vecAngles[record];
+		minsPreScaled	= track->m_vecMinsPreScaled[record];
+		maxsPreScaled	= track->m_vecMaxsPreScaled[record];
 	}
 
 	// See if this is still a valid position for us to teleport to
-	if ( sv_unlag_fixstuck.GetBool() )
+	if ( sv_unlag_fixstuck.GetBool() && pEntity->IsPlayer() )
 	{
 		// Try to move to the wanted position from our current position.
 		trace_t tr;
-		UTIL_TraceEntity( pPlayer, org, org, MASK_PLAYERSOLID, &tr );
+		UTIL_TraceEntity( pEntity, org, org, MASK_PLAYERSOLID, &tr );
 		if ( tr.startsolid || tr.allsolid )
 		{
 			if ( sv_unlag_debug.GetBool() )
-				DevMsg( "WARNING: BackupPlayer trying to back player into a bad position - client %s\n", pPlayer->GetPlayerName() );
+				DevMsg( "WARNING: BackupPlayer trying to back player into a bad position - %s\n", pEntity->GetDebugName() );
 
 			CBasePlayer *pHitPlayer = dynamic_cast<CBasePlayer *>( tr.m_pEnt );
 
@@ -529,24 +756,23 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			{
 				// If we haven't backtracked this player, do it now
 				// this deliberately ignores WantsLagCompensationOnEntity.
-				if ( !m_RestorePlayer.Get( pHitPlayer->entindex() - 1 ) )
+				if ( !m_RestoreEntity.Get( pHitPlayer->entindex() ) )
 				{
-					// prevent recursion - save a copy of m_RestorePlayer,
+					// prevent recursion - save a copy of m_RestoreEntity,
 					// pretend that this player is off-limits
-					int pl_index = pPlayer->entindex() - 1;
 
 					// Temp turn this flag on
-					m_RestorePlayer.Set( pl_index );
+					m_RestoreEntity.Set( index );
 
-					BacktrackPlayer( pHitPlayer, flTargetTime );
+					BacktrackEntity( pHitPlayer, flTargetTime );
 
 					// Remove the temp flag
-					m_RestorePlayer.Clear( pl_index );
+					m_RestoreEntity.Clear( index );
 				}				
 			}
 
 			// now trace us back as far as we can go
-			UTIL_TraceEntity( pPlayer, pPlayer->GetLocalOrigin(), org, MASK_PLAYERSOLID, &tr );
+			UTIL_TraceEntity( pEntity, pEntity->GetLocalOrigin(), org, MASK_PLAYERSOLID, &tr );
 
 			if ( tr.startsolid || tr.allsolid )
 			{
@@ -559,7 +785,7 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			{
 				// We can get to a valid place, but not all the way to the target
 				Vector vPos;
-				VectorLerp( pPlayer->GetLocalOrigin(), org, tr.fraction * g_flFractionScale, vPos );
+				VectorLerp( pEntity->GetLocalOrigin(), org, tr.fraction * g_flFractionScale, vPos );
 				
 				// This is as close as we're going to get
 				org = vPos;
@@ -570,34 +796,34 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 		}
 	}
 	
-	// See if this represents a change for the player
+	// See if this represents a change for the entity
 	int flags = 0;
-	LagRecord *restore = &m_RestoreData[ pl_index ];
-	LagRecord *change  = &m_ChangeData[ pl_index ];
+	LagRecord *restore = &track->m_RestoreData;
+	LagRecord *change  = &track->m_ChangeData;
 
-	QAngle angdiff = pPlayer->GetLocalAngles() - ang;
-	Vector orgdiff = pPlayer->GetLocalOrigin() - org;
+	QAngle angdiff = pEntity->GetLocalAngles() - ang;
+	Vector orgdiff = pEntity->GetLocalOrigin() - org;
 
 	// Always remember the pristine simulation time in case we need to restore it.
-	restore->m_flSimulationTime = pPlayer->GetSimulationTime();
+	restore->m_flSimulationTime = pEntity->GetSimulationTime();
 
 	if ( angdiff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
 	{
 		flags |= LC_ANGLES_CHANGED;
-		restore->m_vecAngles = pPlayer->GetLocalAngles();
-		pPlayer->SetLocalAngles( ang );
+		restore->m_vecAngles = pEntity->GetLocalAngles();
+		pEntity->SetLocalAngles( ang );
 		change->m_vecAngles = ang;
 	}
 
 	// Use absolute equality here
-	if ( minsPreScaled != pPlayer->CollisionProp()->OBBMinsPreScaled() || maxsPreScaled != pPlayer->CollisionProp()->OBBMaxsPreScaled() )
+	if ( minsPreScaled != pEntity->CollisionProp()->OBBMinsPreScaled() || maxsPreScaled != pEntity->CollisionProp()->OBBMaxsPreScaled() )
 	{
 		flags |= LC_SIZE_CHANGED;
 
-		restore->m_vecMinsPreScaled = pPlayer->CollisionProp()->OBBMinsPreScaled();
-		restore->m_vecMaxsPreScaled = pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		restore->m_vecMinsPreScaled = pEntity->CollisionProp()->OBBMinsPreScaled();
+		restore->m_vecMaxsPreScaled = pEntity->CollisionProp()->OBBMaxsPreScaled();
 		
-		pPlayer->SetSize( minsPreScaled, maxsPreScaled );
+		pEntity->SetSize( minsPreScaled, maxsPreScaled );
 		
 		change->m_vecMinsPreScaled = minsPreScaled;
 		change->m_vecMaxsPreScaled = maxsPreScaled;
@@ -607,8 +833,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	if ( orgdiff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
 	{
 		flags |= LC_ORIGIN_CHANGED;
-		restore->m_vecOrigin = pPlayer->GetLocalOrigin();
-		pPlayer->SetLocalOrigin( org );
+		restore->m_vecOrigin = pEntity->GetLocalOrigin();
+		pEntity->SetLocalOrigin( org );
 		change->m_vecOrigin = org;
 	}
 
@@ -616,11 +842,11 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	// standing still, but you breathe even on the server.
 	// This is quicker than actually comparing all bazillion floats.
 	flags |= LC_ANIMATION_CHANGED;
-	restore->m_masterSequence = pPlayer->GetSequence();
-	restore->m_masterCycle = pPlayer->GetCycle();
+	restore->m_masterSequence = pEntity->GetSequence();
+	restore->m_masterCycle = pEntity->GetCycle();
 
 	bool interpolationAllowed = false;
-	if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
+	if( prevRecord >= 0 && (track->m_masterSequence[record] == track->m_masterSequence[prevRecord]) )
 	{
 		// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
 		interpolationAllowed = true;
@@ -632,33 +858,34 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	if( frac > 0.0f && interpolationAllowed )
 	{
 		interpolatedMasters = true;
-		pPlayer->SetSequence( Lerp( frac, record->m_masterSequence, prevRecord->m_masterSequence ) );
-		pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+		pEntity->SetSequence( Lerp( frac, track->m_masterSequence[record], track->m_masterSequence[prevRecord] ) );
+		pEntity->SetCycle( Lerp( frac, track->m_masterCycle[record], track->m_masterCycle[prevRecord] ) );
 
-		if( record->m_masterCycle > prevRecord->m_masterCycle )
+		if( track->m_masterCycle[record] > track->m_masterCycle[prevRecord] )
 		{
 			// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
 			// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-			float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
-			pPlayer->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
+			float newCycle = Lerp( frac, track->m_masterCycle[record], track->m_masterCycle[prevRecord] + 1 );
+			pEntity->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
 		}
 		else
 		{
-			pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+			pEntity->SetCycle( Lerp( frac, track->m_masterCycle[record], track->m_masterCycle[prevRecord] ) );
 		}
 	}
 	if( !interpolatedMasters )
 	{
-		pPlayer->SetSequence(record->m_masterSequence);
-		pPlayer->SetCycle(record->m_masterCycle);
+		pEntity->SetSequence(track->m_masterSequence[record]);
+		pEntity->SetCycle(track->m_masterCycle[record]);
 	}
 
 	////////////////////////
 	// Now do all the layers
-	int layerCount = pPlayer->GetNumAnimOverlays();
+	CBaseAnimatingOverlay *pOverlay = track->m_pOverlay;
+	int layerCount = pOverlay ? pOverlay->GetNumAnimOverlays() : 0;
 	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 	{
-		CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
+		CAnimationLayer *currentLayer = pOverlay->GetAnimOverlay(layerIndex);
 		if( currentLayer )
 		{
 			restore->m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
@@ -666,11 +893,12 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			restore->m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
 			restore->m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
 
+			LayerRecord &recordsLayerRecord = track->m_layerRecords[record][layerIndex];
+
 			bool interpolated = false;
 			if( (frac > 0.0f)  &&  interpolationAllowed )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+				LayerRecord &prevRecordsLayerRecord = track->m_layerRecords[prevRecord][layerIndex];
 				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
 					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
 					)
@@ -696,10 +924,10 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			if( !interpolated )
 			{
 				//Either no interp, or interp failed.  Just use record.
-				currentLayer->m_flCycle = record->m_layerRecords[layerIndex].m_cycle;
-				currentLayer->m_nOrder = record->m_layerRecords[layerIndex].m_order;
-				currentLayer->m_nSequence = record->m_layerRecords[layerIndex].m_sequence;
-				currentLayer->m_flWeight = record->m_layerRecords[layerIndex].m_weight;
+				currentLayer->m_flCycle = recordsLayerRecord.m_cycle;
+				currentLayer->m_nOrder = recordsLayerRecord.m_order;
+				currentLayer->m_nSequence = recordsLayerRecord.m_sequence;
+				currentLayer->m_flWeight = recordsLayerRecord.m_weight;
 			}
 		}
 	}
@@ -708,21 +936,21 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 		return; // we didn't change anything
 
 	if ( sv_lagflushbonecache.GetBool() )
-		pPlayer->InvalidateBoneCache();
+		pEntity->InvalidateBoneCache();
 
 	/*char text[256]; Q_snprintf( text, sizeof(text), "time %.2f", flTargetTime );
-	pPlayer->DrawServerHitboxes( 10 );
+	pEntity->DrawServerHitboxes( 10 );
 	NDebugOverlay::Text( org, text, false, 10 );
-	NDebugOverlay::EntityBounds( pPlayer, 255, 0, 0, 32, 10 ); */
+	NDebugOverlay::EntityBounds( pEntity, 255, 0, 0, 32, 10 ); */
 
-	m_RestorePlayer.Set( pl_index ); //remember that we changed this player
-	m_bNeedToRestore = true;  // we changed at least one player
+	m_RestoreEntity.Set( index ); //remember that we changed this entity
+	m_bNeedToRestore = true;  // we changed at least one entity
 	restore->m_fFlags = flags; // we need to restore these flags
 	change->m_fFlags = flags; // we have changed these flags
 
 	if( sv_showlagcompensation.GetInt() == 1 )
 	{
-		pPlayer->DrawServerHitboxes(4, true);
+		pEntity->DrawServerHitboxes(4, true);
 	}
 }
 
@@ -734,27 +962,29 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 	m_pCurrentPlayer = NULL;
 
 	if ( !m_bNeedToRestore )
-		return; // no player was changed at all
+		return; // no entity was changed at all
 
-	// Iterate all active players
-	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	// Iterate all tracked entities
+	for ( int i = 0; i < m_TrackedEntities.Count(); i++ )
 	{
-		int pl_index = i - 1;
+		int index = m_TrackedEntities[i];
 		
-		if ( !m_RestorePlayer.Get( pl_index ) )
+		if ( !m_RestoreEntity.Get( index ) )
 		{
-			// player wasn't changed by lag compensation
+			// entity wasn't changed by lag compensation
 			continue;
 		}
 
-		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
-		if ( !pPlayer )
+		CLagTrack *track = m_pTracks[ index ];
+		CBaseEntity *pBaseEntity = track->m_hEntity.Get();
+		CBaseAnimating *pEntity = pBaseEntity ? pBaseEntity->GetBaseAnimating() : NULL;
+		if ( !pEntity )
 		{
 			continue;
 		}
 
-		LagRecord *restore = &m_RestoreData[ pl_index ];
-		LagRecord *change  = &m_ChangeData[ pl_index ];
+		LagRecord *restore = &track->m_RestoreData;
+		LagRecord *change  = &track->m_ChangeData;
 
 		bool restoreSimulationTime = false;
 
@@ -764,11 +994,11 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 	
 			// see if simulation made any changes, if no, then do the restore, otherwise,
 			//  leave new values in
-			if ( pPlayer->CollisionProp()->OBBMinsPreScaled() == change->m_vecMinsPreScaled &&
-				pPlayer->CollisionProp()->OBBMaxsPreScaled() == change->m_vecMaxsPreScaled )
+			if ( pEntity->CollisionProp()->OBBMinsPreScaled() == change->m_vecMinsPreScaled &&
+				pEntity->CollisionProp()->OBBMaxsPreScaled() == change->m_vecMaxsPreScaled )
 			{
 				// Restore it
-				pPlayer->SetSize( restore->m_vecMinsPreScaled, restore->m_vecMaxsPreScaled );
+				pEntity->SetSize( restore->m_vecMinsPreScaled, restore->m_vecMaxsPreScaled );
 			}
 #ifdef STAGING_ONLY
 			else
@@ -782,9 +1012,9 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 		{		   
 			restoreSimulationTime = true;
 
-			if ( pPlayer->GetLocalAngles() == change->m_vecAngles )
+			if ( pEntity->GetLocalAngles() == change->m_vecAngles )
 			{
-				pPlayer->SetLocalAngles( restore->m_vecAngles );
+				pEntity->SetLocalAngles( restore->m_vecAngles );
 			}
 		}
 
@@ -793,12 +1023,12 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 			restoreSimulationTime = true;
 
 			// Okay, let's see if we can do something reasonable with the change
-			Vector delta = pPlayer->GetLocalOrigin() - change->m_vecOrigin;
+			Vector delta = pEntity->GetLocalOrigin() - change->m_vecOrigin;
 			
-			// If it moved really far, just leave the player in the new spot!!!
+			// If it moved really far, just leave the entity in the new spot!!!
 			if ( delta.Length2DSqr() < m_flTeleportDistanceSqr )
 			{
-				RestorePlayerTo( pPlayer, restore->m_vecOrigin + delta );
+				RestoreEntityTo( pEntity, restore->m_vecOrigin + delta );
 			}
 		}
 
@@ -806,13 +1036,14 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 		{
 			restoreSimulationTime = true;
 
-			pPlayer->SetSequence(restore->m_masterSequence);
-			pPlayer->SetCycle(restore->m_masterCycle);
+			pEntity->SetSequence(restore->m_masterSequence);
+			pEntity->SetCycle(restore->m_masterCycle);
 
-			int layerCount = pPlayer->GetNumAnimOverlays();
+			CBaseAnimatingOverlay *pOverlay = track->m_pOverlay;
+			int layerCount = pOverlay ? pOverlay->GetNumAnimOverlays() : 0;
 			for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 			{
-				CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
+				CAnimationLayer *currentLayer = pOverlay->GetAnimOverlay(layerIndex);
 				if( currentLayer )
 				{
 					currentLayer->m_flCycle = restore->m_layerRecords[layerIndex].m_cycle;
@@ -825,9 +1056,7 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 
 		if ( restoreSimulationTime )
 		{
-			pPlayer->SetSimulationTime( restore->m_flSimulationTime );
+			pEntity->SetSimulationTime( restore->m_flSimulationTime );
 		}
 	}
 }
-
-
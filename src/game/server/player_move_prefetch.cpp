@@ -0,0 +1,151 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Player movement collision prefetch, see player_move_prefetch.h
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "player.h"
+#include "player_move_prefetch.h"
+#include "collisionproperty.h"
+#include "collisionutils.h"
+#include "engine/IEngineTrace.h"
+#include "vstdlib/jobthread.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar sv_parallel_move_prefetch( "sv_parallel_move_prefetch", "0", 0, "Gather the collision around players with commands to run on worker threads before the entities are simulated." );
+
+extern ConVar sv_move_tracelist;
+extern ConVar sv_move_tracelist_margin;
+
+bool g_bPlayerMovePrefetchActive = false;
+
+struct PlayerMovePrefetch_t
+{
+	CBasePlayer		*m_pPlayer;			// NULL when there is nothing (left) for this player
+	Vector			m_vecMins;
+	Vector			m_vecMaxs;
+	CTraceListData	*m_pList;
+};
+
+static PlayerMovePrefetch_t s_Prefetch[ MAX_PLAYERS ];
+static int s_nPrefetch;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Worker. Gathering only reads the world and the partition.
+//-----------------------------------------------------------------------------
+static void PlayerMovePrefetchGather( PlayerMovePrefetch_t &prefetch )
+{
+	prefetch.m_pList->Reset();
+	enginetrace->SetupLeafAndEntityListBox( prefetch.m_vecMins, prefetch.m_vecMaxs, *prefetch.m_pList );
+
+	// a full list may have left things out
+	if ( prefetch.m_pList->IsEmpty() ||
+		prefetch.m_pList->LeafCount() >= prefetch.m_pList->LeafCountMax() ||
+		prefetch.m_pList->EntityCount() >= prefetch.m_pList->EntityCountMax() )
+	{
+		prefetch.m_pPlayer = NULL;
+	}
+}
+
+void PlayerMovePrefetch_Gather()
+{
+	s_nPrefetch = 0;
+	if ( !sv_parallel_move_prefetch.GetBool() || !sv_move_tracelist.GetBool() )
+		return;
+
+	VPROF( "PlayerMovePrefetch_Gather" );
+
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer || pPlayer->IsInAVehicle() )
+			continue;
+
+		int nCommands = pPlayer->GetQueuedCommandCount();
+		if ( !nCommands )
+			continue;
+
+		PlayerMovePrefetch_t &prefetch = s_Prefetch[ s_nPrefetch++ ];
+		if ( !prefetch.m_pList )
+		{
+			prefetch.m_pList = new CTraceListData;
+		}
+
+		// far enough for all the commands at the speed the player has now,
+		// moves that go further gather their own
+		Vector vecHullMins, vecHullMaxs;
+		VectorMin( VEC_HULL_MIN_SCALED( pPlayer ), VEC_DUCK_HULL_MIN_SCALED( pPlayer ), vecHullMins );
+		VectorMax( VEC_HULL_MAX_SCALED( pPlayer ), VEC_DUCK_HULL_MAX_SCALED( pPlayer ), vecHullMaxs );
+
+		float flReach = sv_move_tracelist_margin.GetFloat() + ( pPlayer->GetAbsVelocity().Length() + pPlayer->GetBaseVelocity().Length() ) * nCommands * TICK_INTERVAL;
+		Vector vecReach( flReach, flReach, flReach );
+
+		prefetch.m_pPlayer = pPlayer;
+		prefetch.m_vecMins = pPlayer->GetAbsOrigin() + vecHullMins - vecReach;
+		prefetch.m_vecMaxs = pPlayer->GetAbsOrigin() + vecHullMaxs + vecReach;
+	}
+
+	if ( !s_nPrefetch )
+		return;
+
+	// the workers mustn't be the ones to flush entities that moved
+	UpdateDirtySpatialPartitionEntities();
+
+	ParallelProcess( "PlayerMovePrefetchGather", s_Prefetch, s_nPrefetch, &PlayerMovePrefetchGather );
+
+	g_bPlayerMovePrefetchActive = true;
+}
+
+void PlayerMovePrefetch_Clear()
+{
+	g_bPlayerMovePrefetchActive = false;
+	s_nPrefetch = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops the collision of every other player the entity may now be
+//			in. Its own player moving doesn't matter to it, traces ignore it.
+//-----------------------------------------------------------------------------
+void PlayerMovePrefetch_EntityMoved( CBaseEntity *pEntity, const Vector &vecMins, const Vector &vecMaxs )
+{
+	for ( int i = 0; i < s_nPrefetch; i++ )
+	{
+		PlayerMovePrefetch_t &prefetch = s_Prefetch[i];
+		if ( !prefetch.m_pPlayer || prefetch.m_pPlayer == pEntity )
+			continue;
+
+		if ( IsBoxIntersectingBox( vecMins, vecMaxs, prefetch.m_vecMins, prefetch.m_vecMaxs ) )
+		{
+			prefetch.m_pPlayer = NULL;
+		}
+	}
+}
+
+CTraceListData *PlayerMovePrefetch_Get( CBasePlayer *pPlayer, Vector *pMins, Vector *pMaxs )
+{
+	if ( !g_bPlayerMovePrefetchActive )
+		return NULL;
+
+	// entities that moved since are only put in place by the next query, do it now
+	UpdateDirtySpatialPartitionEntities();
+
+	for ( int i = 0; i < s_nPrefetch; i++ )
+	{
+		PlayerMovePrefetch_t &prefetch = s_Prefetch[i];
+		if ( prefetch.m_pPlayer == pPlayer )
+		{
+			*pMins = prefetch.m_vecMins;
+			*pMaxs = prefetch.m_vecMaxs;
+			return prefetch.m_pList;
+		}
+	}
+
+	return NULL;
+}
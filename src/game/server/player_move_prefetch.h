@@ -0,0 +1,42 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Gathers the collision around every player with commands to run
+//			on worker threads, before the entities are simulated, so the
+//			moves that run one after another later don't each gather it.
+//			A player's collision is dropped as soon as anything else that
+//			could be in it moves or changes solidity, and the move gathers
+//			it again itself.
+//
+//=============================================================================//
+
+#ifndef PLAYER_MOVE_PREFETCH_H
+#define PLAYER_MOVE_PREFETCH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CBaseEntity;
+class CBasePlayer;
+class CTraceListData;
+
+// Around Physics_RunThinkFunctions()
+void PlayerMovePrefetch_Gather();
+void PlayerMovePrefetch_Clear();
+
+// The collision gathered for the player and the box it covers, NULL if
+// there is none or it is no longer good
+CTraceListData *PlayerMovePrefetch_Get( CBasePlayer *pPlayer, Vector *pMins, Vector *pMaxs );
+
+// Called when an entity's place in the spatial partition changes
+extern bool g_bPlayerMovePrefetchActive;
+void PlayerMovePrefetch_EntityMoved( CBaseEntity *pEntity, const Vector &vecMins, const Vector &vecMaxs );
+
+inline void PlayerMovePrefetch_OnPartitionChanged( CBaseEntity *pEntity, const Vector &vecMins, const Vector &vecMaxs )
+{
+	if ( g_bPlayerMovePrefetchActive )
+	{
+		PlayerMovePrefetch_EntityMoved( pEntity, vecMins, vecMaxs );
+	}
+}
+
+#endif // PLAYER_MOVE_PREFETCH_H
@@ -12,6 +12,92 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+//-----------------------------------------------------------------------------
+// Purpose: converts a keyvalue into one known field of a data block
+// Input  : *pObject - pointer to the struct or class that holds the field
+//			*pField - description of the field
+//			char *szValue - value to set the variable to
+// Output : Returns true if the field was set, false if it can't hold a keyvalue.
+//-----------------------------------------------------------------------------
+bool ParseKeyvalueField( void *pObject, typedescription_t *pField, const char *szValue )
+{
+	char *pDest = (char *)pObject + pField->fieldOffset[ TD_OFFSET_NORMAL ];
+
+	switch( pField->fieldType )
+	{
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+	case FIELD_STRING:
+		*(string_t *)pDest = AllocPooledString( szValue );
+		return true;
+
+	case FIELD_TIME:
+	case FIELD_FLOAT:
+		*(float *)pDest = atof( szValue );
+		return true;
+
+	case FIELD_BOOLEAN:
+		*(bool *)pDest = (bool)(atoi( szValue ) != 0);
+		return true;
+
+	case FIELD_CHARACTER:
+		*(char *)pDest = (char)atoi( szValue );
+		return true;
+
+	case FIELD_SHORT:
+		*(short *)pDest = (short)atoi( szValue );
+		return true;
+
+	case FIELD_INTEGER:
+	case FIELD_TICK:
+		*(int *)pDest = atoi( szValue );
+		return true;
+
+	case FIELD_POSITION_VECTOR:
+	case FIELD_VECTOR:
+		UTIL_StringToVector( (float *)pDest, szValue );
+		return true;
+
+	case FIELD_VMATRIX:
+	case FIELD_VMATRIX_WORLDSPACE:
+		UTIL_StringToFloatArray( (float *)pDest, 16, szValue );
+		return true;
+
+	case FIELD_MATRIX3X4_WORLDSPACE:
+		UTIL_StringToFloatArray( (float *)pDest, 12, szValue );
+		return true;
+
+	case FIELD_COLOR32:
+		UTIL_StringToColor32( (color32 *)pDest, szValue );
+		return true;
+
+	case FIELD_CUSTOM:
+	{
+		SaveRestoreFieldInfo_t fieldInfo =
+		{
+			pDest,
+			pObject,
+			pField
+		};
+		pField->pSaveRestoreOps->Parse( fieldInfo, szValue );
+		return true;
+	}
+
+	default:
+	case FIELD_INTERVAL: // Fixme, could write this if needed
+	case FIELD_CLASSPTR:
+	case FIELD_MODELINDEX:
+	case FIELD_MATERIALINDEX:
+	case FIELD_EDICT:
+		Warning( "Bad field in entity!!\n" );
+		Assert(0);
+		break;
+	}
+
+	return false;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: iterates through a typedescript data block, so it can insert key/value data into the block
 // Input  : *pObject - pointer to the struct or class the data is to be insterted into
@@ -45,77 +131,104 @@ bool ParseKeyvalue( void *pObject, typedescription_t *pFields, int iNumFields, c
 
 		if ( (pField->flags & FTYPEDESC_KEY) && !stricmp(pField->externalName, szKeyName) )
 		{
-			switch( pField->fieldType )
-			{
-			case FIELD_MODELNAME:
-			case FIELD_SOUNDNAME:
-			case FIELD_STRING:
-				(*(string_t *)((char *)pObject + fieldOffset)) = AllocPooledString( szValue );
-				return true;
-
-			case FIELD_TIME:
-			case FIELD_FLOAT:
-				(*(float *)((char *)pObject + fieldOffset)) = atof( szValue );
-				return true;
-
-			case FIELD_BOOLEAN:
-				(*(bool *)((char *)pObject + fieldOffset)) = (bool)(atoi( szValue ) != 0);
-				return true;
-
-			case FIELD_CHARACTER:
-				(*(char *)((char *)pObject + fieldOffset)) = (char)atoi( szValue );
-				return true;
-
-			case FIELD_SHORT:
-				(*(short *)((char *)pObject + fieldOffset)) = (short)atoi( szValue );
-				return true;
-
-			case FIELD_INTEGER:
-			case FIELD_TICK:
-				(*(int *)((char *)pObject + fieldOffset)) = atoi( szValue );
-				return true;
-
-			case FIELD_POSITION_VECTOR:
-			case FIELD_VECTOR:
-				UTIL_StringToVector( (float *)((char *)pObject + fieldOffset), szValue );
+			if ( ParseKeyvalueField( pObject, pField, szValue ) )
 				return true;
+		}
+	}
 
-			case FIELD_VMATRIX:
-			case FIELD_VMATRIX_WORLDSPACE:
-				UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 16, szValue );
-				return true;
+	return false;
+}
 
-			case FIELD_MATRIX3X4_WORLDSPACE:
-				UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 12, szValue );
-				return true;
 
-			case FIELD_COLOR32:
-				UTIL_StringToColor32( (color32 *) ((char *)pObject + fieldOffset), szValue );
-				return true;
+//-----------------------------------------------------------------------------
+// Purpose: prints one known field of a data block as a keyvalue
+// Input  : *pObject - pointer to the struct or class that holds the field
+//			*pField - description of the field
+//			char *szValue - receives the value
+// Output : Returns true if the value was written, false if the field can't be printed.
+//-----------------------------------------------------------------------------
+bool ExtractKeyvalueField( void *pObject, typedescription_t *pField, char *szValue, int iMaxLen )
+{
+	char *pSrc = (char *)pObject + pField->fieldOffset[ TD_OFFSET_NORMAL ];
 
-			case FIELD_CUSTOM:
-			{
-				SaveRestoreFieldInfo_t fieldInfo =
-				{
-					(char *)pObject + fieldOffset,
-					pObject,
-					pField
-				};
-				pField->pSaveRestoreOps->Parse( fieldInfo, szValue );
-				return true;
-			}
+	switch( pField->fieldType )
+	{
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+	case FIELD_STRING:
+		Q_strncpy( szValue, pSrc, iMaxLen );
+		return true;
+
+	case FIELD_TIME:
+	case FIELD_FLOAT:
+		Q_snprintf( szValue, iMaxLen, "%f", *(float *)pSrc );
+		return true;
+
+	case FIELD_BOOLEAN:
+		Q_snprintf( szValue, iMaxLen, "%d", *(bool *)pSrc != 0);
+		return true;
+
+	case FIELD_CHARACTER:
+		Q_snprintf( szValue, iMaxLen, "%d", *(char *)pSrc );
+		return true;
+
+	case FIELD_SHORT:
+		Q_snprintf( szValue, iMaxLen, "%d", *(short *)pSrc );
+		return true;
+
+	case FIELD_INTEGER:
+	case FIELD_TICK:
+		Q_snprintf( szValue, iMaxLen, "%d", *(int *)pSrc );
+		return true;
+
+	case FIELD_POSITION_VECTOR:
+	case FIELD_VECTOR:
+		Q_snprintf( szValue, iMaxLen, "%f %f %f", 
+			((float *)pSrc)[0],
+			((float *)pSrc)[1],
+			((float *)pSrc)[2] );
+		return true;
+
+	case FIELD_VMATRIX:
+	case FIELD_VMATRIX_WORLDSPACE:
+		//UTIL_StringToFloatArray( (float *)pSrc, 16, szValue );
+		return false;
+
+	case FIELD_MATRIX3X4_WORLDSPACE:
+		//UTIL_StringToFloatArray( (float *)pSrc, 12, szValue );
+		return false;
+
+	case FIELD_COLOR32:
+		Q_snprintf( szValue, iMaxLen, "%d %d %d %d", 
+			((int *)pSrc)[0],
+			((int *)pSrc)[1],
+			((int *)pSrc)[2],
+			((int *)pSrc)[3] );
+		return true;
+
+	case FIELD_CUSTOM:
+	{
+		/*
+		SaveRestoreFieldInfo_t fieldInfo =
+		{
+			pSrc,
+			pObject,
+			pField
+		};
+		pField->pSaveRestoreOps->Parse( fieldInfo, szValue );
+		*/
+		return false;
+	}
 
-			default:
-			case FIELD_INTERVAL: // Fixme, could write this if needed
-			case FIELD_CLASSPTR:
-			case FIELD_MODELINDEX:
-			case FIELD_MATERIALINDEX:
-			case FIELD_EDICT:
-				Warning( "Bad field in entity!!\n" );
-				Assert(0);
-				break;
-			}
-		}
+	default:
+	case FIELD_INTERVAL: // Fixme, could write this if needed
+	case FIELD_CLASSPTR:
+	case FIELD_MODELINDEX:
+	case FIELD_MATERIALINDEX:
+	case FIELD_EDICT:
+		Warning( "Bad field in entity!!\n" );
+		Assert(0);
+		break;
 	}
 
 	return false;
@@ -155,85 +268,8 @@ bool ExtractKeyvalue( void *pObject, typedescription_t *pFields, int iNumFields,
 
 		if ( (pField->flags & FTYPEDESC_KEY) && !stricmp(pField->externalName, szKeyName) )
 		{
-			switch( pField->fieldType )
-			{
-			case FIELD_MODELNAME:
-			case FIELD_SOUNDNAME:
-			case FIELD_STRING:
-				Q_strncpy( szValue, ((char *)pObject + fieldOffset), iMaxLen );
-				return true;
-
-			case FIELD_TIME:
-			case FIELD_FLOAT:
-				Q_snprintf( szValue, iMaxLen, "%f", (*(float *)((char *)pObject + fieldOffset)) );
+			if ( ExtractKeyvalueField( pObject, pField, szValue, iMaxLen ) )
 				return true;
-
-			case FIELD_BOOLEAN:
-				Q_snprintf( szValue, iMaxLen, "%d", (*(bool *)((char *)pObject + fieldOffset)) != 0);
-				return true;
-
-			case FIELD_CHARACTER:
-				Q_snprintf( szValue, iMaxLen, "%d", (*(char *)((char *)pObject + fieldOffset)) );
-				return true;
-
-			case FIELD_SHORT:
-				Q_snprintf( szValue, iMaxLen, "%d", (*(short *)((char *)pObject + fieldOffset)) );
-				return true;
-
-			case FIELD_INTEGER:
-			case FIELD_TICK:
-				Q_snprintf( szValue, iMaxLen, "%d", (*(int *)((char *)pObject + fieldOffset)) );
-				return true;
-
-			case FIELD_POSITION_VECTOR:
-			case FIELD_VECTOR:
-				Q_snprintf( szValue, iMaxLen, "%f %f %f", 
-					((float *)((char *)pObject + fieldOffset))[0],
-					((float *)((char *)pObject + fieldOffset))[1],
-					((float *)((char *)pObject + fieldOffset))[2] );
-				return true;
-
-			case FIELD_VMATRIX:
-			case FIELD_VMATRIX_WORLDSPACE:
-				//UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 16, szValue );
-				return false;
-
-			case FIELD_MATRIX3X4_WORLDSPACE:
-				//UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 12, szValue );
-				return false;
-
-			case FIELD_COLOR32:
-				Q_snprintf( szValue, iMaxLen, "%d %d %d %d", 
-					((int *)((char *)pObject + fieldOffset))[0],
-					((int *)((char *)pObject + fieldOffset))[1],
-					((int *)((char *)pObject + fieldOffset))[2],
-					((int *)((char *)pObject + fieldOffset))[3] );
-				return true;
-
-			case FIELD_CUSTOM:
-			{
-				/*
-				SaveRestoreFieldInfo_t fieldInfo =
-				{
-					(char *)pObject + fieldOffset,
-					pObject,
-					pField
-				};
-				pField->pSaveRestoreOps->Parse( fieldInfo, szValue );
-				*/
-				return false;
-			}
-
-			default:
-			case FIELD_INTERVAL: // Fixme, could write this if needed
-			case FIELD_CLASSPTR:
-			case FIELD_MODELINDEX:
-			case FIELD_MATERIALINDEX:
-			case FIELD_EDICT:
-				Warning( "Bad field in entity!!\n" );
-				Assert(0);
-				break;
-			}
 		}
 	}
 
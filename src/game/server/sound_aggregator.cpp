@@ -0,0 +1,246 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Sound culling and merging, see sound_aggregator.h
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "sound_aggregator.h"
+#include "soundchars.h"
+#include "tier2/soundutils.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar sv_sound_aggregate( "sv_sound_aggregate", "1", FCVAR_CHEAT, "Cull sounds for players out of earshot and merge repeated NPC sounds." );
+ConVar sv_sound_merge_radius( "sv_sound_merge_radius", "128", FCVAR_CHEAT, "A one-shot NPC voice or body sound is dropped if another NPC played the same sound this close by, to the same players, inside sv_sound_merge_window." );
+ConVar sv_sound_merge_window( "sv_sound_merge_window", "0.1", FCVAR_CHEAT, "Seconds an NPC sound keeps others like it from playing nearby." );
+
+CSoundAggregator g_SoundAggregator;
+
+
+//-----------------------------------------------------------------------------
+CSoundAggregator::CSoundAggregator()
+{
+	ResetStats();
+}
+
+//-----------------------------------------------------------------------------
+void CSoundAggregator::Reset( void )
+{
+	m_recent.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+void CSoundAggregator::ResetStats( void )
+{
+	m_nSent = 0;
+	m_nMerged = 0;
+	m_nCulled = 0;
+	m_nRecipientsCulled = 0;
+	m_nStatsStartTick = gpGlobals ? gpGlobals->tickcount : 0;
+}
+
+//-----------------------------------------------------------------------------
+void CSoundAggregator::PrintStats( void )
+{
+	int ticks = MAX( gpGlobals->tickcount - m_nStatsStartTick, 1 );
+
+	Msg( "Sounds over %d ticks: %d sent (%.2f/tick), %d merged, %d culled, %d recipients culled from sent sounds\n",
+		ticks, m_nSent, (float)m_nSent / (float)ticks, m_nMerged, m_nCulled, m_nRecipientsCulled );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: True if the same sound started close to origin a moment ago and
+//			was sent to all of recipients. If not, this one is remembered
+//			for the sounds after it.
+//-----------------------------------------------------------------------------
+bool CSoundAggregator::IsMerged( HSOUNDSCRIPTHANDLE handle, const Vector &origin, const CBitVec< ABSOLUTE_PLAYER_LIMIT > &recipients )
+{
+	float window = sv_sound_merge_window.GetFloat();
+	float radiusSqr = sv_sound_merge_radius.GetFloat() * sv_sound_merge_radius.GetFloat();
+
+	for ( int i = m_recent.Count() - 1; i >= 0; --i )
+	{
+		const RecentSound_t &recent = m_recent[i];
+
+		// curtime also goes backwards across a level change
+		if ( gpGlobals->curtime - recent.m_time > window || recent.m_time > gpGlobals->curtime )
+		{
+			m_recent.FastRemove( i );
+			continue;
+		}
+
+		if ( recent.m_handle != handle || ( recent.m_origin - origin ).LengthSqr() > radiusSqr )
+			continue;
+
+		// anyone who didn't get the earlier one would miss the sound altogether
+		bool covered = true;
+		for ( int bit = recipients.FindNextSetBit( 0 ); bit > -1; bit = recipients.FindNextSetBit( bit + 1 ) )
+		{
+			if ( !recent.m_recipients.IsBitSet( bit ) )
+			{
+				covered = false;
+				break;
+			}
+		}
+
+		if ( covered )
+			return true;
+	}
+
+	RecentSound_t &added = m_recent[ m_recent.AddToTail() ];
+	added.m_handle = handle;
+	added.m_origin = origin;
+	added.m_time = gpGlobals->curtime;
+	added.m_recipients.Copy( recipients );
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: True if the wave has a cue point or a sampler loop, which is what
+//			makes the engine loop it
+//-----------------------------------------------------------------------------
+bool CSoundAggregator::IsLoopingWave( const char *pWaveName )
+{
+	const char *pName = PSkipSoundChars( pWaveName );
+
+	int i = m_loopingWaves.Find( pName );
+	if ( i != m_loopingWaves.InvalidIndex() )
+		return m_loopingWaves[i];
+
+	bool bLooping = false;
+
+	char path[ MAX_PATH ];
+	Q_snprintf( path, sizeof( path ), "sound/%s", pName );
+
+	InFileRIFF riff( path, *g_pFSIOReadBinary );
+	if ( riff.IsValid() && riff.RIFFSize() > 0 && riff.RIFFName() == RIFF_WAVE )
+	{
+		IterateRIFF walk( riff, riff.RIFFSize() );
+		for ( ; walk.ChunkAvailable() && !bLooping; walk.ChunkNext() )
+		{
+			if ( walk.ChunkName() == WAVE_CUE )
+			{
+				bLooping = true;
+			}
+			else if ( walk.ChunkName() == WAVE_SAMPLER )
+			{
+				// the loop count follows the first seven fields of the sampler chunk
+				int sampler[ 8 ];
+				if ( walk.ChunkReadPartial( sampler, sizeof( sampler ) ) == sizeof( sampler ) )
+				{
+					bLooping = ( LittleDWord( sampler[7] ) > 0 );
+				}
+			}
+		}
+	}
+
+	m_loopingWaves.Insert( pName, bLooping );
+	return bLooping;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same distance test as CPASAttenuationFilter::Filter(), but with the
+//			soundlevel the sound actually plays at, and for any filter
+//-----------------------------------------------------------------------------
+IRecipientFilter *CSoundAggregator::Filter( IRecipientFilter &filter, int entindex, HSOUNDSCRIPTHANDLE handle, int channel, const char *pWaveName, const Vector *pOrigin, soundlevel_t soundlevel, int flags )
+{
+	VPROF( "CSoundAggregator::Filter" );
+
+	// leave stops and changes to sounds that are already playing alone
+	if ( !sv_sound_aggregate.GetBool() || ( flags & ( SND_STOP | SND_CHANGE_VOL | SND_CHANGE_PITCH ) ) )
+	{
+		++m_nSent;
+		return &filter;
+	}
+
+	// Nothing to trim in single player, and reliable sounds are sent whole
+	if ( gpGlobals->maxClients == 1 || filter.IsReliable() || filter.IsInitMessage() )
+	{
+		++m_nSent;
+		return &filter;
+	}
+
+	CBaseEntity *emitter = CBaseEntity::Instance( entindex );
+
+	Vector origin;
+	if ( pOrigin )
+	{
+		origin = *pOrigin;
+	}
+	else if ( emitter && entindex > 0 )
+	{
+		origin = emitter->GetSoundEmissionOrigin();
+	}
+	else
+	{
+		++m_nSent;
+		return &filter;
+	}
+
+	// sounds with no attenuation are heard everywhere
+	float attenuation = SNDLVL_TO_ATTN( soundlevel );
+	float maxAudibleSqr = FLT_MAX;
+	if ( attenuation > 0.0f )
+	{
+		maxAudibleSqr = ( 2 * SOUND_NORMAL_CLIP_DIST ) / attenuation;
+		maxAudibleSqr *= maxAudibleSqr;
+	}
+
+	m_audible.Reset();
+	CBitVec< ABSOLUTE_PLAYER_LIMIT > audibleBits;
+	audibleBits.ClearAll();
+
+	int count = filter.GetRecipientCount();
+	for ( int i = 0; i < count; ++i )
+	{
+		CBasePlayer *player = UTIL_PlayerByIndex( filter.GetRecipientIndex( i ) );
+		if ( !player )
+			continue;
+
+		// never remove the HLTV or Replay bot
+		if ( player->IsHLTV() || player->IsReplay() || ( player->EarPosition() - origin ).LengthSqr() <= maxAudibleSqr )
+		{
+			m_audible.AddRecipient( player );
+			audibleBits.Set( player->entindex() - 1 );
+		}
+	}
+
+	if ( m_audible.GetRecipientCount() == 0 && count > 0 )
+	{
+		++m_nCulled;
+		return NULL;
+	}
+
+	// Only one-shots on the voice and body channels. Anything else may be stopped
+	// or changed later, and the NPC whose copy was dropped would never hear of it.
+	if ( emitter && emitter->IsNPC() && ( channel == CHAN_VOICE || channel == CHAN_BODY ) &&
+		 !IsLoopingWave( pWaveName ) && IsMerged( handle, origin, audibleBits ) )
+	{
+		++m_nMerged;
+		return NULL;
+	}
+
+	++m_nSent;
+
+	if ( m_audible.GetRecipientCount() == count )
+		return &filter;
+
+	m_nRecipientsCulled += count - m_audible.GetRecipientCount();
+	return &m_audible;
+}
+
+
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( sv_sound_aggregate_stats, "Show how many sounds were sent, merged and culled since the last call", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_SoundAggregator.PrintStats();
+	g_SoundAggregator.ResetStats();
+}
@@ -0,0 +1,65 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Trims sounds on their way to the engine. Recipients that are out
+//			of earshot are taken off the filter, and an NPC sound that was
+//			just played by another NPC close by, to everyone who would hear
+//			this one, is dropped instead of stacking another voice of it on
+//			the clients. Only one-shot voice and body sounds are merged; a
+//			looping sound or one on another channel may be stopped or changed
+//			later, and that has to reach the NPC that is actually playing it.
+//
+//=============================================================================//
+
+#ifndef SOUND_AGGREGATOR_H
+#define SOUND_AGGREGATOR_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "recipientfilter.h"
+#include "bitvec.h"
+#include "utldict.h"
+#include "SoundEmitterSystem/isoundemittersystembase.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: Called by the sound emitter for every soundscript sound
+//-----------------------------------------------------------------------------
+class CSoundAggregator
+{
+public:
+	CSoundAggregator();
+
+	// Returns the filter to send the sound with, or NULL if it shouldn't be sent.
+	// The returned filter is only good until the next call.
+	IRecipientFilter *Filter( IRecipientFilter &filter, int entindex, HSOUNDSCRIPTHANDLE handle, int channel, const char *pWaveName, const Vector *pOrigin, soundlevel_t soundlevel, int flags );
+
+	void Reset( void );						// forget recent sounds, on level change
+	void PrintStats( void );
+	void ResetStats( void );
+
+private:
+	bool IsMerged( HSOUNDSCRIPTHANDLE handle, const Vector &origin, const CBitVec< ABSOLUTE_PLAYER_LIMIT > &recipients );
+	bool IsLoopingWave( const char *pWaveName );
+
+	struct RecentSound_t
+	{
+		HSOUNDSCRIPTHANDLE m_handle;
+		Vector m_origin;
+		float m_time;
+		CBitVec< ABSOLUTE_PLAYER_LIMIT > m_recipients;	// player index - 1, as in CRecipientFilter::AddPlayersFromBitMask()
+	};
+	CUtlVector< RecentSound_t > m_recent;	// NPC sounds played inside sv_sound_merge_window
+	CUtlDict< bool, int > m_loopingWaves;	// wave name -> has a loop point, read from the file the first time
+
+	CRecipientFilter m_audible;				// what Filter() hands back when it took someone off
+
+	int m_nSent;
+	int m_nMerged;
+	int m_nCulled;							// sounds nobody could hear
+	int m_nRecipientsCulled;				// recipients taken off sounds that were still sent
+	int m_nStatsStartTick;
+};
+
+extern CSoundAggregator g_SoundAggregator;
+
+#endif // SOUND_AGGREGATOR_H
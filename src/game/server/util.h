@@ -115,6 +115,8 @@ public:
 	virtual IServerNetworkable *Create( const char *pClassName ) = 0;
 	virtual void Destroy( IServerNetworkable *pNetworkable ) = 0;
 	virtual size_t GetEntitySize() = 0;
+	// The class's datadesc, readable without creating an entity
+	virtual datamap_t *GetDataDescMap() = 0;
 };
 
 template <class T>
@@ -144,6 +146,13 @@ public:
 	{
 		return sizeof(T);
 	}
+
+	virtual datamap_t *GetDataDescMap()
+	{
+		datamap_t *pMap;
+		DataMapAccess( (T *)NULL, &pMap );
+		return pMap;
+	}
 };
 
 #define LINK_ENTITY_TO_CLASS(mapClassName,DLLClassName) \
@@ -27,6 +27,7 @@
 #ifndef CLIENT_DLL
 #include "envmicrophone.h"
 #include "sceneentity.h"
+#include "sound_aggregator.h"
 #else
 #include <vgui_controls/Controls.h>
 #include <vgui/IVGui.h>
@@ -130,6 +131,109 @@ void Hack_FixEscapeChars( char *str )
 	Q_strncpy( str, osave, len );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Remembers which soundscript handle a sound name string resolved to,
+//			keyed by the string's address. Nearly every EmitSound() call passes
+//			a literal, so each call site ends up with its own slot and skips the
+//			sorted name lookup in the sound emitter. The name is compared
+//			against the entry before a slot is trusted, since a reused buffer
+//			can hold a different name at the same address.
+//-----------------------------------------------------------------------------
+#define SOUNDSCRIPT_CACHE_BITS	10
+#define SOUNDSCRIPT_CACHE_SIZE	( 1 << SOUNDSCRIPT_CACHE_BITS )
+
+class CSoundScriptHandleCache
+{
+public:
+	CSoundScriptHandleCache()
+	{
+		Clear();
+		ResetStats();
+	}
+
+	HSOUNDSCRIPTHANDLE Find( const char *soundname )
+	{
+		VPROF( "CSoundScriptHandleCache::Find" );
+
+		if ( !soundname || !soundname[0] )
+			return SOUNDEMITTER_INVALID_HANDLE;
+
+		Slot_t &slot = m_slots[ HashName( soundname ) ];
+		if ( slot.m_pName == soundname &&
+			 soundemitterbase->IsValidIndex( slot.m_handle ) &&
+			 !Q_stricmp( soundemitterbase->GetSoundName( slot.m_handle ), soundname ) )
+		{
+			++m_nHits;
+			return slot.m_handle;
+		}
+
+		++m_nLookups;
+
+		HSOUNDSCRIPTHANDLE handle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( soundname );
+		if ( handle != SOUNDEMITTER_INVALID_HANDLE )
+		{
+			slot.m_pName = soundname;
+			slot.m_handle = handle;
+		}
+
+		return handle;
+	}
+
+	// handles change when the scripts are reloaded
+	void Clear( void )
+	{
+		for ( int i = 0; i < SOUNDSCRIPT_CACHE_SIZE; ++i )
+		{
+			m_slots[i].m_pName = NULL;
+			m_slots[i].m_handle = SOUNDEMITTER_INVALID_HANDLE;
+		}
+	}
+
+	void ResetStats( void )
+	{
+		m_nHits = 0;
+		m_nLookups = 0;
+		m_nStatsStartFrame = gpGlobals ? gpGlobals->framecount : 0;
+	}
+
+	void PrintStats( void )
+	{
+		int frames = MAX( gpGlobals->framecount - m_nStatsStartFrame, 1 );
+		int used = 0;
+		for ( int i = 0; i < SOUNDSCRIPT_CACHE_SIZE; ++i )
+		{
+			if ( m_slots[i].m_pName )
+			{
+				++used;
+			}
+		}
+
+		Msg( "%s soundscript names over %d frames: %d cached, %d looked up (%.2f lookups/frame), %d of %d slots used\n",
+			CBaseEntity::IsServer() ? "(sv)" : "(cl)", frames, m_nHits, m_nLookups, (float)m_nLookups / (float)frames, used, SOUNDSCRIPT_CACHE_SIZE );
+	}
+
+private:
+	static int HashName( const char *soundname )
+	{
+		uintp key = (uintp)soundname;
+		return (int)( ( key ^ ( key >> SOUNDSCRIPT_CACHE_BITS ) ^ ( key >> ( 2 * SOUNDSCRIPT_CACHE_BITS ) ) ) & ( SOUNDSCRIPT_CACHE_SIZE - 1 ) );
+	}
+
+	struct Slot_t
+	{
+		const char *m_pName;
+		HSOUNDSCRIPTHANDLE m_handle;
+	};
+
+	Slot_t m_slots[ SOUNDSCRIPT_CACHE_SIZE ];
+
+	int m_nHits;
+	int m_nLookups;
+	int m_nStatsStartFrame;
+};
+
+static CSoundScriptHandleCache g_SoundScriptHandleCache;
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -233,11 +337,13 @@ public:
 #if !defined( CLIENT_DLL )
 		FinishLog();
 #endif
+		g_SoundScriptHandleCache.Clear();
 		soundemitterbase->ModShutdown();
 	}
 
 	void ReloadSoundEntriesInList( IFileList *pFilesToReload )
 	{
+		g_SoundScriptHandleCache.Clear();
 		soundemitterbase->ReloadSoundEntriesInList( pFilesToReload );
 	}
 
@@ -331,9 +437,11 @@ public:
 
 	virtual void LevelShutdownPostEntity()
 	{
+		g_SoundScriptHandleCache.Clear();
 		soundemitterbase->ClearSoundOverrides();
 
 #if !defined( CLIENT_DLL )
+		g_SoundAggregator.Reset();
 		FinishLog();
 #endif
 	}
@@ -517,8 +625,28 @@ public:
 			st = gpGlobals->curtime + (float)params.delay_msec / 1000.f;
 		}
 
+		IRecipientFilter *pFilter = &filter;
+#if !defined( CLIENT_DLL )
+		pFilter = g_SoundAggregator.Filter( filter, entindex, handle, params.channel, params.soundname, ep.m_pOrigin, (soundlevel_t)params.soundlevel, ep.m_nFlags );
+		if ( !pFilter )
+		{
+			// callers still time things off the duration of a sound nobody hears
+			if ( ep.m_pflSoundDuration )
+			{
+				*ep.m_pflSoundDuration = enginesound->GetSoundDuration( params.soundname );
+			}
+
+			// the caption goes to everyone the sound was meant for
+			if ( !( ep.m_nFlags & ( SND_CHANGE_PITCH | SND_CHANGE_VOL ) ) )
+			{
+				EmitCloseCaption( filter, entindex, params, ep );
+			}
+			return;
+		}
+#endif
+
 		enginesound->EmitSound( 
-			filter, 
+			*pFilter, 
 			entindex, 
 			params.channel, 
 			params.soundname,
@@ -624,7 +752,7 @@ public:
 
 		if ( ep.m_hSoundScriptHandle == SOUNDEMITTER_INVALID_HANDLE )
 		{
-			ep.m_hSoundScriptHandle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( ep.m_pSoundName );
+			ep.m_hSoundScriptHandle = g_SoundScriptHandleCache.Find( ep.m_pSoundName );
 		}
 
 		if ( ep.m_hSoundScriptHandle == -1 )
@@ -865,7 +993,7 @@ public:
 	{
 		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
 		{
-			handle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( soundname );
+			handle = g_SoundScriptHandleCache.Find( soundname );
 		}
 
 		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
@@ -898,7 +1026,7 @@ public:
 
 	void StopSound( int entindex, const char *soundname )
 	{
-		HSOUNDSCRIPTHANDLE handle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( soundname );
+		HSOUNDSCRIPTHANDLE handle = g_SoundScriptHandleCache.Find( soundname );
 		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
 		{
 			return;
@@ -1023,6 +1151,21 @@ CON_COMMAND_F( sv_soundemitter_flush, "Flushes the sounds.txt system (server onl
 	S_SoundEmitterSystemFlush( );
 }
 
+#if defined( CLIENT_DLL )
+CON_COMMAND_F( cl_soundemitter_cache_stats, "Show how many soundscript names were looked up rather than cached since the last call (client only)", FCVAR_CHEAT )
+#else
+CON_COMMAND_F( sv_soundemitter_cache_stats, "Show how many soundscript names were looked up rather than cached since the last call (server only)", FCVAR_CHEAT )
+#endif
+{
+#if !defined( CLIENT_DLL )
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+#endif
+
+	g_SoundScriptHandleCache.PrintStats();
+	g_SoundScriptHandleCache.ResetStats();
+}
+
 #if !defined(_RETAIL)
 
 #if !defined( CLIENT_DLL ) 
@@ -1337,7 +1480,14 @@ void CBaseEntity::StopSound( int iEntIndex, int iChannel, const char *pSample )
 
 soundlevel_t CBaseEntity::LookupSoundLevel( const char *soundname )
 {
-	return soundemitterbase->LookupSoundLevel( soundname );
+	HSOUNDSCRIPTHANDLE handle = g_SoundScriptHandleCache.Find( soundname );
+	if ( handle == SOUNDEMITTER_INVALID_HANDLE )
+	{
+		// raw waves and unknown names
+		return soundemitterbase->LookupSoundLevel( soundname );
+	}
+
+	return soundemitterbase->LookupSoundLevelByHandle( soundname, handle );
 }
 
 
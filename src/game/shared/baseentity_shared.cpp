@@ -16,6 +16,7 @@
 #include "shot_manipulator.h"
 #include "ai_debug_shared.h"
 #include "mapentities_shared.h"
+#include "datadesc_lookup.h"
 #include "debugoverlay_shared.h"
 #include "coordsize.h"
 #include "vphysics/performance.h"
@@ -33,6 +34,7 @@
 	#include "player_pickup.h"
 	#include "waterbullet.h"
 	#include "func_break.h"
+	#include "collisionutils.h"
 
 #ifdef HL2MP
 	#include "te_hl2mp_shotgun_shot.h"
@@ -65,7 +67,9 @@ ConVar hl2_episodic( "hl2_episodic", "0", FCVAR_REPLICATED );
 #ifdef GAME_DLL
 	ConVar ent_debugkeys( "ent_debugkeys", "" );
 	extern bool ParseKeyvalue( void *pObject, typedescription_t *pFields, int iNumFields, const char *szKeyName, const char *szValue );
-	extern bool ExtractKeyvalue( void *pObject, typedescription_t *pFields, int iNumFields, const char *szKeyName, char *szValue, int iMaxLen );
+	extern bool ParseKeyvalueField( void *pObject, typedescription_t *pField, const char *szValue );
+	extern bool ExtractKeyvalueField( void *pObject, typedescription_t *pField, char *szValue, int iMaxLen );
+	extern bool MapEntity_ApplyParsedKey( CBaseEntity *pEntity, const char *szKeyName, const char *szValue, bool *pbHandled );
 #endif
 
 bool CBaseEntity::m_bAllowPrecache = false;
@@ -454,11 +458,14 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 	// loop through the data description, and try and place the keys in
 	if ( !*ent_debugkeys.GetString() )
 	{
-		for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
-		{
-			if ( ::ParseKeyvalue(this, dmap->dataDesc, dmap->dataNumFields, szKeyName, szValue) )
-				return true;
-		}
+		// keys the map loader already looked up skip the lookup too
+		bool bHandled;
+		if ( MapEntity_ApplyParsedKey( this, szKeyName, szValue, &bHandled ) )
+			return bHandled;
+
+		const DataDescKey_t *pKey = DataDesc_FindKey( GetDataDescMap(), szKeyName );
+		if ( pKey && ::ParseKeyvalueField( (char *)this + pKey->m_nOwnerOffset, pKey->m_pField, szValue ) )
+			return true;
 	}
 	else
 	{
@@ -608,11 +615,9 @@ bool CBaseEntity::GetKeyValue( const char *szKeyName, char *szValue, int iMaxLen
 		return true;
 	}
 
-	for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
-	{
-		if ( ::ExtractKeyvalue( this, dmap->dataDesc, dmap->dataNumFields, szKeyName, szValue, iMaxLen ) )
-			return true;
-	}
+	const DataDescKey_t *pKey = DataDesc_FindKey( GetDataDescMap(), szKeyName );
+	if ( pKey && ::ExtractKeyvalueField( (char *)this + pKey->m_nOwnerOffset, pKey->m_pField, szValue, iMaxLen ) )
+		return true;
 #endif
 
 	return false;
@@ -1600,8 +1605,193 @@ public:
 typedef CTraceFilterSimpleList CBulletsTraceFilter;
 #endif
 
+#if defined( GAME_DLL ) && !defined( PORTAL ) && !defined( TF_DLL )
+#define BATCHED_BULLETS
+
+ConVar sv_bullet_batch( "sv_bullet_batch", "1", FCVAR_CHEAT, "Resolve all the pellets of a multi-shot FireBullets call against a single entity query" );
+
+// Half of the shotgun pellets are traced as hulls this big
+static const Vector s_vecBulletHullMins( -3, -3, -3 );
+static const Vector s_vecBulletHullMaxs( 3, 3, 3 );
+
+// Impacts closer than this to one already reported in the same batch don't make another AI sound
+#define BULLET_BATCH_SOUND_MERGE_DIST_SQR	( 64.0f * 64.0f )
+
+//-----------------------------------------------------------------------------
+// All the shots of one FireBullets call. Every shot is traced against the world
+// and static props first, then the boxes of all the shortened rays go through a
+// single spatial partition query, and each shot is only clipped against the
+// candidates whose bounds it actually crosses.
+//
+// Those traces see the world as it was before any pellet did damage. Once a
+// pellet kills, breaks or removes something one of them hit, the batch goes
+// stale and the remaining pellets are traced one by one again.
+//-----------------------------------------------------------------------------
+class CBulletBatch : public IPartitionEnumerator
+{
+public:
+	struct Shot_t
+	{
+		Vector	m_vecDir;
+		bool	m_bHull;
+		trace_t	m_Trace;
+	};
+
+	CBulletBatch( ITraceFilter *pFilter ) : m_pFilter( pFilter ), m_bStale( false ) {}
+
+	void AddShot( const Vector &vecDir, bool bHull )
+	{
+		int i = m_Shots.AddToTail();
+		m_Shots[i].m_vecDir = vecDir;
+		m_Shots[i].m_bHull = bHull;
+	}
+
+	void Resolve( const Vector &vecSrc, float flDistance );
+
+	// Returns false if there was already an AI sound close enough to this impact
+	bool ShouldInsertImpactSound( const Vector &vecImpact )
+	{
+		for ( int i = 0; i < m_SoundPositions.Count(); i++ )
+		{
+			if ( vecImpact.DistToSqr( m_SoundPositions[i] ) < BULLET_BATCH_SOUND_MERGE_DIST_SQR )
+				return false;
+		}
+		m_SoundPositions.AddToTail( vecImpact );
+		return true;
+	}
+
+	// Called after each pellet has done its damage
+	void CheckHitEntities( CBaseEntity *pHit )
+	{
+		if ( pHit && !pHit->IsWorld() && m_HitEntities.Find( pHit ) == m_HitEntities.InvalidIndex() )
+		{
+			m_HitEntities.AddToTail( pHit );
+		}
+
+		for ( int i = 0; i < m_HitEntities.Count(); i++ )
+		{
+			CBaseEntity *pEntity = m_HitEntities[i];
+			if ( !pEntity || pEntity->IsMarkedForDeletion() || !pEntity->IsAlive() || !pEntity->IsSolid() )
+			{
+				m_bStale = true;
+				return;
+			}
+		}
+	}
+
+	bool IsStale() const { return m_bStale; }
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		if ( m_pFilter->ShouldHitEntity( pHandleEntity, MASK_SHOT ) )
+		{
+			CBaseEntity *pEntity = EntityFromEntityHandle( pHandleEntity );
+			if ( pEntity )
+			{
+				int i = m_Candidates.AddToTail();
+				m_Candidates[i].m_pEntity = pEntity;
+				pEntity->CollisionProp()->WorldSpaceSurroundingBounds( &m_Candidates[i].m_vecMins, &m_Candidates[i].m_vecMaxs );
+			}
+		}
+		return ITERATION_CONTINUE;
+	}
+
+	CUtlVectorFixedGrowable< Shot_t, 16 >	m_Shots;
+
+private:
+	struct Candidate_t
+	{
+		CBaseEntity	*m_pEntity;
+		Vector		m_vecMins;
+		Vector		m_vecMaxs;
+	};
+
+	ITraceFilter							*m_pFilter;
+	CUtlVectorFixedGrowable< Candidate_t, 16 >	m_Candidates;
+	CUtlVectorFixedGrowable< Vector, 16 >	m_SoundPositions;
+	CUtlVectorFixedGrowable< EHANDLE, 16 >	m_HitEntities;
+	bool									m_bStale;
+};
+
+void CBulletBatch::Resolve( const Vector &vecSrc, float flDistance )
+{
+	VPROF( "CBulletBatch::Resolve" );
+
+	// Narrow every shot down to the static geometry first
+	CTraceFilterWorldAndPropsOnly worldFilter;
+	Vector vecMins = vecSrc;
+	Vector vecMaxs = vecSrc;
+	for ( int i = 0; i < m_Shots.Count(); i++ )
+	{
+		Shot_t &shot = m_Shots[i];
+		Ray_t ray;
+		if ( shot.m_bHull )
+		{
+			ray.Init( vecSrc, vecSrc + shot.m_vecDir * flDistance, s_vecBulletHullMins, s_vecBulletHullMaxs );
+		}
+		else
+		{
+			ray.Init( vecSrc, vecSrc + shot.m_vecDir * flDistance );
+		}
+		enginetrace->TraceRay( ray, MASK_SHOT, &worldFilter, &shot.m_Trace );
+		VectorMin( vecMins, shot.m_Trace.endpos, vecMins );
+		VectorMax( vecMaxs, shot.m_Trace.endpos, vecMaxs );
+	}
+
+	// One query for everything any of the shots could hit
+	m_Candidates.RemoveAll();
+	::partition->EnumerateElementsInBox( PARTITION_ENGINE_SOLID_EDICTS, vecMins + s_vecBulletHullMins, vecMaxs + s_vecBulletHullMaxs, false, this );
+	if ( !m_Candidates.Count() )
+		return;
+
+	for ( int i = 0; i < m_Shots.Count(); i++ )
+	{
+		Shot_t &shot = m_Shots[i];
+		trace_t &tr = shot.m_Trace;
+		if ( tr.startsolid )
+			continue;
+
+		Ray_t ray;
+		Vector vecExtents( 0, 0, 0 );
+		if ( shot.m_bHull )
+		{
+			ray.Init( vecSrc, vecSrc + shot.m_vecDir * flDistance, s_vecBulletHullMins, s_vecBulletHullMaxs );
+			vecExtents = s_vecBulletHullMaxs;
+		}
+		else
+		{
+			ray.Init( vecSrc, vecSrc + shot.m_vecDir * flDistance );
+		}
+
+		for ( int j = 0; j < m_Candidates.Count(); j++ )
+		{
+			// Only the part of the shot in front of the world hit matters
+			const Candidate_t &candidate = m_Candidates[j];
+			if ( !IsBoxIntersectingRay( candidate.m_vecMins - vecExtents, candidate.m_vecMaxs + vecExtents, vecSrc, tr.endpos - vecSrc ) )
+				continue;
+
+			trace_t trEntity;
+			enginetrace->ClipRayToEntity( ray, MASK_SHOT, candidate.m_pEntity, &trEntity );
+			if ( trEntity.startsolid || trEntity.fraction < tr.fraction )
+			{
+				tr = trEntity;
+				if ( tr.startsolid )
+					break;
+			}
+		}
+	}
+}
+#endif // BATCHED_BULLETS
+
 void CBaseEntity::FireBullets( const FireBulletsInfo_t &info )
 {
+#if defined( GAME_DLL ) && !defined( HL2MP )
+	// Shots a player fires while a user command runs are traced once it's done,
+	// all under one rewind of everybody else.
+	if ( IsPlayer() && static_cast< CBasePlayer * >( this )->QueueBullets( info ) )
+		return;
+#endif
+
 	static int	tracerCount;
 	trace_t		tr;
 	CAmmoDef*	pAmmoDef	= GetAmmoDef();
@@ -1709,6 +1899,32 @@ void CBaseEntity::FireBullets( const FireBulletsInfo_t &info )
 		bcc->GetActiveWeapon()->m_nPelletHits = 0;
 	}
 
+#ifdef BATCHED_BULLETS
+	// Work out all the pellets up front so they can be traced together
+	CBulletBatch batch( &traceFilter );
+	bool bBatched = ( info.m_iShots > 1 && sv_bullet_batch.GetBool() );
+	if ( bBatched )
+	{
+		for ( int iShot = 0; iShot < info.m_iShots; iShot++ )
+		{
+			if ( IsPlayer() )
+			{
+				RandomSeed( iSeed + iShot );
+			}
+
+			if ( iShot == 0 && (info.m_nFlags & FIRE_BULLETS_FIRST_SHOT_ACCURATE) )
+			{
+				batch.AddShot( Manipulator.GetShotDirection(), false );
+			}
+			else
+			{
+				batch.AddShot( Manipulator.ApplySpread( info.m_vecSpread ), IsPlayer() && ( iShot % 2 ) );
+			}
+		}
+		batch.Resolve( info.m_vecSrc, info.m_flDistance );
+	}
+#endif
+
 
 	for (int iShot = 0; iShot < info.m_iShots; iShot++)
 	{
@@ -1721,6 +1937,17 @@ void CBaseEntity::FireBullets( const FireBulletsInfo_t &info )
 			RandomSeed( iSeed );	// init random system with this seed
 		}
 
+#ifdef BATCHED_BULLETS
+		// NPC spread isn't seeded, so their pellets keep the direction they were
+		// traced with. Players draw theirs again from the same seed, which gives
+		// the same direction and leaves the random stream where the client's
+		// prediction has it.
+		if ( bBatched && !IsPlayer() )
+		{
+			vecDir = batch.m_Shots[iShot].m_vecDir;
+		}
+		else
+#endif
 		// If we're firing multiple shots, and the first shot has to be bang on target, ignore spread
 		if ( iShot == 0 && info.m_iShots > 1 && (info.m_nFlags & FIRE_BULLETS_FIRST_SHOT_ACCURATE) )
 		{
@@ -1741,6 +1968,13 @@ void CBaseEntity::FireBullets( const FireBulletsInfo_t &info )
 #endif
 
 
+#ifdef BATCHED_BULLETS
+		if ( bBatched && !batch.IsStale() )
+		{
+			tr = batch.m_Shots[iShot].m_Trace;
+		}
+		else
+#endif
 		if( IsPlayer() && info.m_iShots > 1 && iShot % 2 )
 		{
 			// Half of the shotgun pellets are hulls that make it easier to hit targets with the shotgun.
@@ -1906,6 +2140,9 @@ void CBaseEntity::FireBullets( const FireBulletsInfo_t &info )
 
 			}
 			
+#ifdef BATCHED_BULLETS
+			if ( !bBatched || batch.ShouldInsertImpactSound( tr.endpos ) )
+#endif
 		    CSoundEnt::InsertSound( SOUND_BULLET_IMPACT, tr.endpos, 200, 0.5, this, soundEntChannel );
 #endif
 
@@ -2086,6 +2323,13 @@ void CBaseEntity::FireBullets( const FireBulletsInfo_t &info )
 		}
 #endif
 
+#ifdef BATCHED_BULLETS
+		if ( bBatched && !batch.IsStale() )
+		{
+			batch.CheckHitEntities( tr.m_pEnt );
+		}
+#endif
+
 		iSeed++;
 	}
 
@@ -24,6 +24,7 @@
 #include "baseanimating.h"
 #include "sendproxy.h"
 #include "hierarchy.h"
+#include "player_move_prefetch.h"
 #endif
 
 #include "predictable_entity.h"
@@ -1347,6 +1348,13 @@ void CCollisionProperty::UpdateServerPartitionMask( )
 	}
 	Assert( mask != 0 );
 	partition->Insert( mask, handle );
+
+	if ( g_bPlayerMovePrefetchActive )
+	{
+		Vector vecSurroundMins, vecSurroundMaxs;
+		WorldSpaceSurroundingBounds( &vecSurroundMins, &vecSurroundMaxs );
+		PlayerMovePrefetch_EntityMoved( m_pOuter, vecSurroundMins, vecSurroundMaxs );
+	}
 #endif
 }
 
@@ -1410,10 +1418,16 @@ void CCollisionProperty::UpdatePartition( )
 				vecSurroundMins -= Vector( 1, 1, 1 );
 				vecSurroundMaxs += Vector( 1, 1, 1 );
 				partition->ElementMoved( GetPartitionHandle(), vecSurroundMins,  vecSurroundMaxs );
+#ifndef CLIENT_DLL
+				PlayerMovePrefetch_OnPartitionChanged( m_pOuter, vecSurroundMins, vecSurroundMaxs );
+#endif
 			}
 			else
 			{
 				partition->ElementMoved( GetPartitionHandle(), GetCollisionOrigin(),  GetCollisionOrigin() );
+#ifndef CLIENT_DLL
+				PlayerMovePrefetch_OnPartitionChanged( m_pOuter, GetCollisionOrigin(), GetCollisionOrigin() );
+#endif
 			}
 		}
 	}
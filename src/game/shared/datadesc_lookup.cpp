@@ -0,0 +1,284 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Hashed name lookups into a class's datadesc, see datadesc_lookup.h
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "datadesc_lookup.h"
+#include "tier1/generichash.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+//-----------------------------------------------------------------------------
+// Lookup counters, bumped from map load worker threads too
+//-----------------------------------------------------------------------------
+static CInterlockedInt s_nLookupTables;
+static CInterlockedInt s_nLookupBytes;
+static CInterlockedInt s_nKeyLookups;
+static CInterlockedInt s_nKeyHits;
+static CInterlockedInt s_nInputLookups;
+static CInterlockedInt s_nInputHits;
+static CInterlockedInt s_nFieldLookups;
+static CInterlockedInt s_nFieldHits;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Caseless open addressing table of names, filled once. When a name
+//			is added twice the first entry stays, the way a linear search
+//			finds it, and gets flagged as having duplicates.
+//-----------------------------------------------------------------------------
+class CDataDescNameTable
+{
+public:
+	struct Entry_t
+	{
+		const char			*m_pszName;		// NULL for a free slot
+		unsigned int		m_nHash;
+		DataDescKey_t		m_Key;
+		bool				m_bDuplicate;
+	};
+
+	CDataDescNameTable() : m_nMask( 0 ), m_pEntries( NULL ) {}
+	~CDataDescNameTable() { delete [] m_pEntries; }
+
+	// Sized for nNames insertions, at most half full
+	void Init( int nNames )
+	{
+		int nSlots = 4;
+		while ( nSlots < nNames * 2 )
+		{
+			nSlots <<= 1;
+		}
+
+		m_nMask = nSlots - 1;
+		m_pEntries = new Entry_t[nSlots];
+		memset( m_pEntries, 0, nSlots * sizeof( Entry_t ) );
+	}
+
+	void Insert( const char *pszName, typedescription_t *pField, int nOwnerOffset )
+	{
+		if ( !pszName )
+			return;
+
+		unsigned int nHash = HashStringCaseless( pszName );
+		Entry_t *pEntry = Probe( pszName, nHash );
+		if ( pEntry->m_pszName )
+		{
+			pEntry->m_bDuplicate = true;
+			return;
+		}
+
+		pEntry->m_pszName = pszName;
+		pEntry->m_nHash = nHash;
+		pEntry->m_Key.m_pField = pField;
+		pEntry->m_Key.m_nOwnerOffset = nOwnerOffset;
+	}
+
+	const Entry_t *Find( const char *pszName ) const
+	{
+		const Entry_t *pEntry = Probe( pszName, HashStringCaseless( pszName ) );
+		return pEntry->m_pszName ? pEntry : NULL;
+	}
+
+	int GetMemoryUsage() const { return ( m_nMask + 1 ) * sizeof( Entry_t ); }
+
+private:
+	// The entry holding the name, or the free slot it would go in
+	Entry_t *Probe( const char *pszName, unsigned int nHash ) const
+	{
+		for ( int i = nHash & m_nMask; ; i = ( i + 1 ) & m_nMask )
+		{
+			Entry_t *pEntry = &m_pEntries[i];
+			if ( !pEntry->m_pszName || ( pEntry->m_nHash == nHash && !V_stricmp( pEntry->m_pszName, pszName ) ) )
+				return pEntry;
+		}
+	}
+
+	int			m_nMask;
+	Entry_t		*m_pEntries;
+};
+
+
+//-----------------------------------------------------------------------------
+// The tables of one datamap
+//-----------------------------------------------------------------------------
+struct datadesclookup_t
+{
+	CDataDescNameTable	m_Keys;		// external names of keyvalue fields, whole chain
+	CDataDescNameTable	m_Inputs;	// external names of inputs, whole chain
+	CDataDescNameTable	m_Fields;	// field names, this map only
+};
+
+static CDataMapSideTable< datadesclookup_t > s_Lookups;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds keyvalue fields in the order ParseKeyvalue() visits them
+//-----------------------------------------------------------------------------
+static int AddKeyFields_r( CDataDescNameTable *pTable, typedescription_t *pFields, int nFields, int nOffset )
+{
+	int nAdded = 0;
+	for ( int i = 0; i < nFields; i++ )
+	{
+		typedescription_t *pField = &pFields[i];
+
+		if ( ( pField->fieldType == FIELD_EMBEDDED ) && ( pField->fieldSize == 1 ) )
+		{
+			for ( datamap_t *dmap = pField->td; dmap != NULL; dmap = dmap->baseMap )
+			{
+				nAdded += AddKeyFields_r( pTable, dmap->dataDesc, dmap->dataNumFields, nOffset + pField->fieldOffset[ TD_OFFSET_NORMAL ] );
+			}
+		}
+
+		if ( pField->flags & FTYPEDESC_KEY )
+		{
+			if ( pTable )
+			{
+				pTable->Insert( pField->externalName, pField, nOffset );
+			}
+			nAdded++;
+		}
+	}
+	return nAdded;
+}
+
+static int AddInputs( CDataDescNameTable *pTable, datamap_t *pMap )
+{
+	int nAdded = 0;
+	for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+	{
+		for ( int i = 0; i < dmap->dataNumFields; i++ )
+		{
+			typedescription_t *pField = &dmap->dataDesc[i];
+			if ( pField->flags & FTYPEDESC_INPUT )
+			{
+				if ( pTable )
+				{
+					pTable->Insert( pField->externalName, pField, 0 );
+				}
+				nAdded++;
+			}
+		}
+	}
+	return nAdded;
+}
+
+static datadesclookup_t *BuildLookup( datamap_t *pMap )
+{
+	datadesclookup_t *pLookup = new datadesclookup_t;
+
+	// count first so the tables never have to grow
+	int nKeys = 0;
+	for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+	{
+		nKeys += AddKeyFields_r( NULL, dmap->dataDesc, dmap->dataNumFields, 0 );
+	}
+
+	pLookup->m_Keys.Init( nKeys );
+	for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+	{
+		AddKeyFields_r( &pLookup->m_Keys, dmap->dataDesc, dmap->dataNumFields, 0 );
+	}
+
+	pLookup->m_Inputs.Init( AddInputs( NULL, pMap ) );
+	AddInputs( &pLookup->m_Inputs, pMap );
+
+	pLookup->m_Fields.Init( pMap->dataNumFields );
+	for ( int i = 0; i < pMap->dataNumFields; i++ )
+	{
+		pLookup->m_Fields.Insert( pMap->dataDesc[i].fieldName, &pMap->dataDesc[i], 0 );
+	}
+
+	return pLookup;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The tables of a datamap, built by whichever thread needs them
+//			first. A thread that loses the race to publish throws its copy away.
+//-----------------------------------------------------------------------------
+static datadesclookup_t *GetLookup( datamap_t *pMap )
+{
+	datadesclookup_t *pLookup = s_Lookups.Find( pMap );
+	if ( pLookup )
+		return pLookup;
+
+	pLookup = BuildLookup( pMap );
+
+	datadesclookup_t *pPublished = s_Lookups.Publish( pMap, pLookup );
+	if ( pPublished != pLookup )
+	{
+		delete pLookup;
+		return pPublished;
+	}
+
+	++s_nLookupTables;
+	s_nLookupBytes += sizeof( datadesclookup_t ) + pLookup->m_Keys.GetMemoryUsage() + pLookup->m_Inputs.GetMemoryUsage() + pLookup->m_Fields.GetMemoryUsage();
+	return pLookup;
+}
+
+
+//-----------------------------------------------------------------------------
+// Lookups
+//-----------------------------------------------------------------------------
+const DataDescKey_t *DataDesc_FindKey( datamap_t *pMap, const char *pszKeyName )
+{
+	++s_nKeyLookups;
+	if ( !pMap || !pszKeyName )
+		return NULL;
+
+	const CDataDescNameTable::Entry_t *pEntry = GetLookup( pMap )->m_Keys.Find( pszKeyName );
+	if ( !pEntry )
+		return NULL;
+
+	++s_nKeyHits;
+	return &pEntry->m_Key;
+}
+
+typedescription_t *DataDesc_FindInput( datamap_t *pMap, const char *pszInputName )
+{
+	++s_nInputLookups;
+	if ( !pMap || !pszInputName )
+		return NULL;
+
+	const CDataDescNameTable::Entry_t *pEntry = GetLookup( pMap )->m_Inputs.Find( pszInputName );
+	if ( !pEntry )
+		return NULL;
+
+	++s_nInputHits;
+	return pEntry->m_Key.m_pField;
+}
+
+typedescription_t *DataDesc_FindField( datamap_t *pMap, const char *pszFieldName, bool *pbUnique )
+{
+	++s_nFieldLookups;
+	*pbUnique = true;
+	if ( !pMap || !pszFieldName )
+		return NULL;
+
+	const CDataDescNameTable::Entry_t *pEntry = GetLookup( pMap )->m_Fields.Find( pszFieldName );
+	if ( !pEntry )
+		return NULL;
+
+	++s_nFieldHits;
+	*pbUnique = !pEntry->m_bDuplicate;
+	return pEntry->m_Key.m_pField;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reports how much the tables are used
+//-----------------------------------------------------------------------------
+#ifdef CLIENT_DLL
+CON_COMMAND( cl_datadesc_lookup_stats, "Print client datadesc name lookup table statistics." )
+#else
+CON_COMMAND( datadesc_lookup_stats, "Print server datadesc name lookup table statistics." )
+#endif
+{
+	Msg( "%d datamaps with lookup tables, %d bytes\n", (int)s_nLookupTables, (int)s_nLookupBytes );
+	Msg( "  keyvalues: %10d lookups, %10d hits\n", (int)s_nKeyLookups, (int)s_nKeyHits );
+	Msg( "  inputs:    %10d lookups, %10d hits\n", (int)s_nInputLookups, (int)s_nInputHits );
+	Msg( "  fields:    %10d lookups, %10d hits\n", (int)s_nFieldLookups, (int)s_nFieldHits );
+}
@@ -0,0 +1,176 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Hashed name lookups into a class's datadesc. The tables for a
+//			datamap are built from its whole base class chain the first time
+//			it is searched and kept in a side table from then on, so
+//			keyvalues, inputs and restored fields are found without walking
+//			the chain and comparing names field by field.
+//
+//=============================================================================//
+
+#ifndef DATADESC_LOOKUP_H
+#define DATADESC_LOOKUP_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "datamap.h"
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
+
+//-----------------------------------------------------------------------------
+// A keyvalue field, and the offset of the object that holds it from the
+// object the datamap describes (non zero for fields of embedded structs)
+//-----------------------------------------------------------------------------
+struct DataDescKey_t
+{
+	typedescription_t	*m_pField;
+	int					m_nOwnerOffset;
+};
+
+// Keyvalue (FTYPEDESC_KEY) fields by external name. Finds the same field
+// ParseKeyvalue() would reach first walking the chain: each map from the
+// most derived one down, fields of embedded structs before the field itself.
+const DataDescKey_t *DataDesc_FindKey( datamap_t *pMap, const char *pszKeyName );
+
+// Inputs (FTYPEDESC_INPUT) by external name, most derived class first
+typedescription_t *DataDesc_FindInput( datamap_t *pMap, const char *pszInputName );
+
+// Fields of this map only, not its bases, by field name. *pbUnique is
+// cleared when several of its fields share the name and the caller has to
+// decide between them itself.
+typedescription_t *DataDesc_FindField( datamap_t *pMap, const char *pszFieldName, bool *pbUnique );
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Data the game builds per datamap, kept beside the datamaps rather
+//			than in them. datamap_t can't grow: vphysics is prebuilt against
+//			its layout and hands its own datamaps to save/restore.
+//			Entries are only ever added, so Find() takes no lock: a slot's data
+//			is written before its key, and a table that fills up is replaced
+//			by a bigger copy while the old one stays around for anyone still
+//			reading it. Publish() is the only thing that locks.
+//-----------------------------------------------------------------------------
+template < class T >
+class CDataMapSideTable
+{
+public:
+	CDataMapSideTable() : m_pTable( NULL ), m_nCount( 0 ) {}
+
+	~CDataMapSideTable()
+	{
+		for ( int i = 0; i < m_OldTables.Count(); i++ )
+		{
+			free( m_OldTables[i] );
+		}
+		free( (void *)m_pTable );
+	}
+
+	T *Find( const datamap_t *pMap ) const
+	{
+		const Table_t *pTable = m_pTable;
+		if ( !pTable )
+			return NULL;
+
+		for ( unsigned int i = Hash( pMap ) & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
+		{
+			const datamap_t *pKey = pTable->m_Slots[i].m_pKey;
+			if ( pKey == pMap )
+				return pTable->m_Slots[i].m_pData;
+			if ( !pKey )
+				return NULL;
+		}
+	}
+
+	// Stores pData for pMap unless another thread got there first. Returns
+	// what the table holds afterwards; if that isn't pData the caller frees it.
+	T *Publish( const datamap_t *pMap, T *pData )
+	{
+		AUTO_LOCK( m_Lock );
+
+		T *pPublished = Find( pMap );
+		if ( pPublished )
+			return pPublished;
+
+		// keep the table at most half full
+		if ( !m_pTable || ( m_nCount + 1 ) * 2 > (int)m_pTable->m_nMask + 1 )
+		{
+			Grow();
+		}
+
+		Table_t *pTable = const_cast< Table_t * >( m_pTable );
+		unsigned int i = Hash( pMap ) & pTable->m_nMask;
+		while ( pTable->m_Slots[i].m_pKey )
+		{
+			i = ( i + 1 ) & pTable->m_nMask;
+		}
+
+		pTable->m_Slots[i].m_pData = pData;
+		ThreadMemoryBarrier();
+		pTable->m_Slots[i].m_pKey = pMap;
+		m_nCount++;
+		return pData;
+	}
+
+private:
+	struct Slot_t
+	{
+		const datamap_t * volatile	m_pKey;		// NULL for a free slot
+		T							*m_pData;
+	};
+
+	struct Table_t
+	{
+		unsigned int	m_nMask;
+		Slot_t			m_Slots[1];
+	};
+
+	static unsigned int Hash( const datamap_t *pMap )
+	{
+		// datamaps are static objects, the low bits are all alignment
+		uintp n = (uintp)pMap;
+		return (unsigned int)( ( n >> 4 ) ^ ( n >> 12 ) );
+	}
+
+	void Grow()
+	{
+		unsigned int nSlots = m_pTable ? ( m_pTable->m_nMask + 1 ) * 2 : 512;
+		size_t nBytes = sizeof( Table_t ) + ( nSlots - 1 ) * sizeof( Slot_t );
+
+		Table_t *pNew = (Table_t *)malloc( nBytes );
+		memset( pNew, 0, nBytes );
+		pNew->m_nMask = nSlots - 1;
+
+		const Table_t *pOld = m_pTable;
+		if ( pOld )
+		{
+			for ( unsigned int i = 0; i <= pOld->m_nMask; i++ )
+			{
+				const datamap_t *pKey = pOld->m_Slots[i].m_pKey;
+				if ( !pKey )
+					continue;
+
+				unsigned int j = Hash( pKey ) & pNew->m_nMask;
+				while ( pNew->m_Slots[j].m_pKey )
+				{
+					j = ( j + 1 ) & pNew->m_nMask;
+				}
+				pNew->m_Slots[j].m_pData = pOld->m_Slots[i].m_pData;
+				pNew->m_Slots[j].m_pKey = pKey;
+			}
+
+			// readers may still be in it
+			m_OldTables.AddToTail( (void *)pOld );
+		}
+
+		ThreadMemoryBarrier();
+		m_pTable = pNew;
+	}
+
+	const Table_t * volatile	m_pTable;
+	int							m_nCount;
+	CUtlVector< void * >		m_OldTables;
+	CThreadFastMutex			m_Lock;
+};
+
+#endif // DATADESC_LOOKUP_H
@@ -42,6 +42,7 @@ extern IFileSystem *filesystem;
 
 #ifndef CLIENT_DLL
 	#include "env_player_surface_trigger.h"
+	#include "player_move_prefetch.h"
 	static ConVar dispcoll_drawplane( "dispcoll_drawplane", "0" );
 #endif
 
@@ -653,6 +654,12 @@ CGameMovement::CGameMovement( void )
 
 	mv					= NULL;
 
+	m_pMoveTraceList		= NULL;
+	m_pMoveTraceListInUse	= NULL;
+	m_nMoveTraceMemo		= 0;
+	m_iNextMoveTraceMemo	= 0;
+	ResetMoveTraceStats();
+
 	memset( m_flStuckCheckTime, 0, sizeof(m_flStuckCheckTime) );
 }
 
@@ -661,6 +668,7 @@ CGameMovement::CGameMovement( void )
 //-----------------------------------------------------------------------------
 CGameMovement::~CGameMovement( void )
 {
+	delete m_pMoveTraceList;
 }
 
 //-----------------------------------------------------------------------------
@@ -887,9 +895,7 @@ inline void CGameMovement::TracePlayerBBox( const Vector& start, const Vector& e
 
 CBaseHandle CGameMovement::TestPlayerPosition( const Vector& pos, int collisionGroup, trace_t& pm )
 {
-	Ray_t ray;
-	ray.Init( pos, pos, GetPlayerMins(), GetPlayerMaxs() );
-	UTIL_TraceRay( ray, PlayerSolidMask(), mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
+	TraceMoveHull( pos, pos, GetPlayerMins(), GetPlayerMaxs(), PlayerSolidMask(), collisionGroup, pm );
 	if ( (pm.contents & PlayerSolidMask()) && pm.m_pEnt )
 	{
 		return pm.m_pEnt->GetRefEHandle();
@@ -1236,11 +1242,15 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 
 	DiffPrint( "start %f %f %f", mv->GetAbsOrigin().x, mv->GetAbsOrigin().y, mv->GetAbsOrigin().z );
 
+	SetupMoveTraceList();
+
 	// Run the command.
 	PlayerMove();
 
 	FinishMove();
 
+	ClearMoveTraceList();
+
 	DiffPrint( "end %f %f %f", mv->GetAbsOrigin().x, mv->GetAbsOrigin().y, mv->GetAbsOrigin().z );
 
 	// CheckV( player->CurrentCommandNumber(), "EndPos", mv->GetAbsOrigin() );
@@ -4972,9 +4982,7 @@ void CGameMovement::TracePlayerBBox( const Vector& start, const Vector& end, uns
 {
 	VPROF( "CGameMovement::TracePlayerBBox" );
 
-	Ray_t ray;
-	ray.Init( start, end, GetPlayerMins(), GetPlayerMaxs() );
-	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
+	TraceMoveHull( start, end, GetPlayerMins(), GetPlayerMaxs(), fMask, collisionGroup, pm );
 }
 
 
@@ -4986,8 +4994,155 @@ void  CGameMovement::TryTouchGround( const Vector& start, const Vector& end, con
 {
 	VPROF( "CGameMovement::TryTouchGround" );
 
+	TraceMoveHull( start, end, mins, maxs, fMask, collisionGroup, pm );
+}
+
+
+static inline bool IsBoxInsideBox( const Vector &vecMins, const Vector &vecMaxs, const Vector &vecOuterMins, const Vector &vecOuterMaxs )
+{
+	return vecMins.x >= vecOuterMins.x && vecMins.y >= vecOuterMins.y && vecMins.z >= vecOuterMins.z &&
+		vecMaxs.x <= vecOuterMaxs.x && vecMaxs.y <= vecOuterMaxs.y && vecMaxs.z <= vecOuterMaxs.z;
+}
+
+ConVar sv_move_tracelist( "sv_move_tracelist", "1", FCVAR_REPLICATED, "Gather the collision around the player once per move and run the move's hull traces against it." );
+ConVar sv_move_tracelist_margin( "sv_move_tracelist_margin", "128", FCVAR_REPLICATED, "How far past the player's hull and this move's travel the gathered collision reaches." );
+
+//-----------------------------------------------------------------------------
+// Purpose: Gathers the world leaves and entities the move can reach. Traces
+//			that stay inside the box run against them alone, the rest go
+//			to the engine as before.
+//-----------------------------------------------------------------------------
+void CGameMovement::SetupMoveTraceList( void )
+{
+	m_pMoveTraceListInUse = NULL;
+	FlushMoveTraceMemo();
+
+	if ( !sv_move_tracelist.GetBool() )
+		return;
+
+	VPROF( "CGameMovement::SetupMoveTraceList" );
+
+	Vector vecHullMins, vecHullMaxs;
+	VectorMin( GetPlayerMins( false ), GetPlayerMins( true ), vecHullMins );
+	VectorMax( GetPlayerMaxs( false ), GetPlayerMaxs( true ), vecHullMaxs );
+
+	float flReach = sv_move_tracelist_margin.GetFloat() + ( mv->m_vecVelocity.Length() + player->GetBaseVelocity().Length() ) * gpGlobals->frametime;
+	Vector vecReach( flReach, flReach, flReach );
+
+	m_vecMoveTraceMins = mv->GetAbsOrigin() + vecHullMins - vecReach;
+	m_vecMoveTraceMaxs = mv->GetAbsOrigin() + vecHullMaxs + vecReach;
+
+#ifndef CLIENT_DLL
+	// use the collision gathered before the players were simulated, if it covers this move
+	Vector vecPrefetchMins, vecPrefetchMaxs;
+	CTraceListData *pPrefetched = PlayerMovePrefetch_Get( player, &vecPrefetchMins, &vecPrefetchMaxs );
+	if ( pPrefetched && IsBoxInsideBox( m_vecMoveTraceMins, m_vecMoveTraceMaxs, vecPrefetchMins, vecPrefetchMaxs ) )
+	{
+		m_vecMoveTraceMins = vecPrefetchMins;
+		m_vecMoveTraceMaxs = vecPrefetchMaxs;
+		m_pMoveTraceListInUse = pPrefetched;
+		return;
+	}
+#endif
+
+	if ( !m_pMoveTraceList )
+	{
+		m_pMoveTraceList = new CTraceListData;
+	}
+
+	m_pMoveTraceList->Reset();
+	enginetrace->SetupLeafAndEntityListBox( m_vecMoveTraceMins, m_vecMoveTraceMaxs, *m_pMoveTraceList );
+
+	// a full list may have left things out
+	if ( !m_pMoveTraceList->IsEmpty() &&
+		m_pMoveTraceList->LeafCount() < m_pMoveTraceList->LeafCountMax() &&
+		m_pMoveTraceList->EntityCount() < m_pMoveTraceList->EntityCountMax() )
+	{
+		m_pMoveTraceListInUse = m_pMoveTraceList;
+	}
+}
+
+void CGameMovement::ClearMoveTraceList( void )
+{
+	m_pMoveTraceListInUse = NULL;
+	FlushMoveTraceMemo();
+}
+
+void CGameMovement::FlushMoveTraceMemo( void )
+{
+	m_nMoveTraceMemo = 0;
+	m_iNextMoveTraceMemo = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Hull traces for the player. Nothing but the player moves during a
+//			move, so a trace that was already done this move gives the same
+//			result again.
+//-----------------------------------------------------------------------------
+void CGameMovement::TraceMoveHull( const Vector& start, const Vector& end, const Vector& mins, const Vector& maxs, unsigned int fMask, int collisionGroup, trace_t& pm )
+{
+	m_MoveTraceStats.m_nTraces++;
+
+	if ( !m_pMoveTraceListInUse )
+	{
+		Ray_t ray;
+		ray.Init( start, end, mins, maxs );
+		UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
+		return;
+	}
+
+	for ( int i = 0; i < m_nMoveTraceMemo; i++ )
+	{
+		const MoveTraceMemo_t &memo = m_MoveTraceMemo[i];
+		if ( memo.m_vecStart == start && memo.m_vecEnd == end && memo.m_vecMins == mins && memo.m_vecMaxs == maxs &&
+			memo.m_fMask == fMask && memo.m_nCollisionGroup == collisionGroup )
+		{
+			pm = memo.m_Trace;
+			m_MoveTraceStats.m_nMemoHits++;
+			return;
+		}
+	}
+
+	Vector vecSweptMins, vecSweptMaxs;
+	VectorMin( start, end, vecSweptMins );
+	VectorMax( start, end, vecSweptMaxs );
+	vecSweptMins += mins;
+	vecSweptMaxs += maxs;
+
 	Ray_t ray;
 	ray.Init( start, end, mins, maxs );
-	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
+
+	CTraceFilterSimple traceFilter( mv->m_nPlayerHandle.Get(), collisionGroup );
+	if ( IsBoxInsideBox( vecSweptMins, vecSweptMaxs, m_vecMoveTraceMins, m_vecMoveTraceMaxs ) )
+	{
+		enginetrace->TraceRayAgainstLeafAndEntityList( ray, *m_pMoveTraceListInUse, fMask, &traceFilter, &pm );
+		m_MoveTraceStats.m_nListTraces++;
+#if 0
+		trace_t verificationTrace;
+		enginetrace->TraceRay( ray, fMask, &traceFilter, &verificationTrace );
+		Assert( fabsf(verificationTrace.fraction - pm.fraction) < 0.01 &&
+				VectorsAreEqual( verificationTrace.endpos, pm.endpos, 0.01 ) &&
+				verificationTrace.m_pEnt == pm.m_pEnt );
+#endif
+	}
+	else
+	{
+		enginetrace->TraceRay( ray, fMask, &traceFilter, &pm );
+	}
+
+	MoveTraceMemo_t &memo = m_MoveTraceMemo[ m_iNextMoveTraceMemo ];
+	memo.m_vecStart = start;
+	memo.m_vecEnd = end;
+	memo.m_vecMins = mins;
+	memo.m_vecMaxs = maxs;
+	memo.m_fMask = fMask;
+	memo.m_nCollisionGroup = collisionGroup;
+	memo.m_Trace = pm;
+
+	m_iNextMoveTraceMemo = ( m_iNextMoveTraceMemo + 1 ) % MAX_MOVE_TRACE_MEMO;
+	if ( m_nMoveTraceMemo < MAX_MOVE_TRACE_MEMO )
+	{
+		m_nMoveTraceMemo++;
+	}
 }
 
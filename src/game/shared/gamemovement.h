@@ -38,6 +38,7 @@ enum
 struct surfacedata_t;
 
 class CBasePlayer;
+class CTraceListData;
 
 class CGameMovement : public IGameMovement
 {
@@ -73,6 +74,16 @@ public:
 	virtual unsigned int PlayerSolidMask( bool brushOnly = false );	///< returns the solid mask for the given player, so bots can have a more-restrictive set
 	CBasePlayer		*player;
 	CMoveData *GetMoveData() { return mv; }
+
+	// Hull traces of moves since the last ResetMoveTraceStats()
+	struct MoveTraceStats_t
+	{
+		int				m_nTraces;
+		int				m_nMemoHits;		// answered by the per move memo
+		int				m_nListTraces;		// run against the gathered collision
+	};
+	const MoveTraceStats_t &GetMoveTraceStats() const { return m_MoveTraceStats; }
+	void			ResetMoveTraceStats() { memset( &m_MoveTraceStats, 0, sizeof( m_MoveTraceStats ) ); }
 protected:
 	// Input/Output for this movement
 	CMoveData		*mv;
@@ -264,6 +275,14 @@ protected:
 	void ResetGetPointContentsCache();
 	int GetPointContentsCached( const Vector &point, int slot );
 
+	// Collision around the player, gathered once per move so the many hull
+	// traces of a move don't each walk the world and the partition
+	void			SetupMoveTraceList( void );
+	void			ClearMoveTraceList( void );
+	// Call after moving anything other than the player during a move
+	void			FlushMoveTraceMemo( void );
+	void			TraceMoveHull( const Vector& start, const Vector& end, const Vector& mins, const Vector& maxs, unsigned int fMask, int collisionGroup, trace_t& pm );
+
 	// Ducking
 	virtual void	Duck( void );
 	virtual void	HandleDuckingSpeedCrop();
@@ -322,6 +341,32 @@ protected:
 	int m_CachedGetPointContents[ MAX_PLAYERS ][ MAX_PC_CACHE_SLOTS ];
 	Vector m_CachedGetPointContentsPoint[ MAX_PLAYERS ][ MAX_PC_CACHE_SLOTS ];	
 
+	enum
+	{
+		MAX_MOVE_TRACE_MEMO = 8,
+	};
+
+	// A hull trace already done this move
+	struct MoveTraceMemo_t
+	{
+		Vector			m_vecStart;
+		Vector			m_vecEnd;
+		Vector			m_vecMins;
+		Vector			m_vecMaxs;
+		unsigned int	m_fMask;
+		int				m_nCollisionGroup;
+		trace_t			m_Trace;
+	};
+
+	CTraceListData	*m_pMoveTraceList;
+	CTraceListData	*m_pMoveTraceListInUse;	// NULL when the move's traces go to the engine
+	Vector			m_vecMoveTraceMins;		// what m_pMoveTraceListInUse covers
+	Vector			m_vecMoveTraceMaxs;
+	MoveTraceMemo_t	m_MoveTraceMemo[ MAX_MOVE_TRACE_MEMO ];
+	int				m_nMoveTraceMemo;
+	int				m_iNextMoveTraceMemo;
+	MoveTraceStats_t m_MoveTraceStats;
+
 	Vector			m_vecProximityMins;		// Used to be globals in sv_user.cpp.
 	Vector			m_vecProximityMaxs;
 
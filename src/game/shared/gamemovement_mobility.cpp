@@ -686,6 +686,7 @@ void CGameMovement::WallRunAnticipateBump( void )
 				vecHeldObjOrigin = held_object->GetAbsOrigin();
 				// Send it to the edge of the universe
 				held_object->SetAbsOrigin( Vector( -20000, -20000, -20000 ) );
+				FlushMoveTraceMemo();
 
 				// Try the trace again
 				TracePlayerBBox(
@@ -802,6 +803,7 @@ void CGameMovement::WallRunAnticipateBump( void )
 		if (held_object)
 		{
 			held_object->SetAbsOrigin( vecHeldObjOrigin );
+			FlushMoveTraceMemo();
 		}
 		return;
 	}
@@ -847,6 +849,7 @@ void CGameMovement::WallRunAnticipateBump( void )
 	if (held_object)
 	{
 		held_object->SetAbsOrigin( vecHeldObjOrigin );
+		FlushMoveTraceMemo();
 	}
 	return;
 }
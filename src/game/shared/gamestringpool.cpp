@@ -8,16 +8,24 @@
 #include "cbase.h"
 
 #include "utlhashtable.h"
+#include "utlstringintern.h"
 #ifndef GC
 #include "igamesystem.h"
 #endif
 #include "gamestringpool.h"
+#if !defined(CLIENT_DLL) && !defined( GC )
+#include "mapentities_shared.h"
+#include "utlbuffer.h"
+#include "vstdlib/jobthread.h"
+#endif
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 //-----------------------------------------------------------------------------
-// Purpose: The actual storage for pooled per-level strings
+// Purpose: The actual storage for pooled per-level strings. Lookups and
+//			adds are safe from any thread, so entity keyvalues can be pooled
+//			by map load workers; only the level shutdown purge is not.
 //-----------------------------------------------------------------------------
 #ifdef GC
 class CGameStringPool
@@ -30,29 +38,27 @@ class CGameStringPool : public CBaseGameSystem
 
 	void FreeAll()
 	{
-#if 0 && _DEBUG
-		m_Strings.DbgCheckIntegrity();
-		m_KeyLookupCache.DbgCheckIntegrity();
-#endif
-		m_Strings.Purge();
+		m_Strings.RemoveAll();
 		m_KeyLookupCache.Purge();
 	}
 
-	CUtlHashtable<CUtlConstString> m_Strings;
+	CUtlStringInternTable m_Strings;
+
+	CThreadFastMutex m_KeyLookupMutex;
 	CUtlHashtable<const void*, const char*> m_KeyLookupCache;
 
 public:
 
-	CGameStringPool() : m_Strings(256) { }
+	CGameStringPool() : m_Strings( false, 1 << 22 ) { }
 
 	~CGameStringPool() { FreeAll(); }
 
 	void Dump( void )
 	{
 		CUtlVector<const char*> strings( 0, m_Strings.Count() );
-		for (UtlHashHandle_t i = m_Strings.FirstHandle(); i != m_Strings.InvalidHandle(); i = m_Strings.NextHandle(i))
+		for ( int i = 0; i < m_Strings.Count(); i++ )
 		{
-			strings.AddToTail( strings[i] );
+			strings.AddToTail( m_Strings.String( i ) );
 		}
 		struct _Local {
 			static int __cdecl F(const char * const *a, const char * const *b) { return strcmp(*a, *b); }
@@ -64,22 +70,22 @@ public:
 			DevMsg( "  %d (0x%p) : %s\n", i, strings[i], strings[i] );
 		}
 		DevMsg( "\n" );
-		DevMsg( "Size:  %d items\n", strings.Count() );
+		DevMsg( "Size:  %d items, %d bytes\n", strings.Count(), m_Strings.GetMemoryUsage() );
 	}
 
 	const char *Find(const char *string)
 	{
-		UtlHashHandle_t i = m_Strings.Find( string );
-		return i == m_Strings.InvalidHandle() ? NULL : m_Strings[ i ].Get();
+		return m_Strings.FindStringPointer( string );
 	}
 
 	const char *Allocate(const char *string)
 	{
-		return m_Strings[ m_Strings.Insert( string ) ].Get();
+		return m_Strings.AddStringPointer( string );
 	}
 
 	const char *AllocateWithKey(const char *string, const void* key)
 	{
+		AUTO_LOCK( m_KeyLookupMutex );
 		const char * &cached = m_KeyLookupCache[ m_KeyLookupCache.Insert( key, NULL ) ];
 		if (cached == NULL)
 		{
@@ -135,4 +141,124 @@ void CC_DumpGameStringTable( void )
 	g_GameStringPool.Dump();
 }
 static ConCommand dumpgamestringtable("dumpgamestringtable", CC_DumpGameStringTable, "Dump the contents of the game string table to the console.", FCVAR_CHEAT);
+
+//------------------------------------------------------------------------------
+// Purpose: Pools every key and value in the current map's entity lump, the
+//			way map load does, through the RB-tree symbol table, the hash
+//			table this pool used to be built on, and the intern table on one
+//			thread and on the job pool.
+//------------------------------------------------------------------------------
+struct StringPoolBenchChunk_t
+{
+	CUtlStringInternTable *m_pTable;
+	const char **m_ppStrings;
+	int m_nCount;
+};
+
+static void StringPoolBenchInternChunk( StringPoolBenchChunk_t &chunk )
+{
+	for ( int i = 0; i < chunk.m_nCount; i++ )
+	{
+		chunk.m_pTable->AddString( chunk.m_ppStrings[i] );
+	}
+}
+
+CON_COMMAND_F( gamestringpool_benchmark, "Times pooling the current map's entity keyvalues with each string table. Usage: gamestringpool_benchmark [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nIterations = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 1000 ) : 20;
+
+	// tokenize once, only the pooling is timed
+	CUtlBuffer tokenData;
+	CUtlVector< int > tokenOffsets;
+	char szToken[MAPKEY_MAXLENGTH];
+	for ( const char *pData = MapEntity_ParseToken( engine->GetMapEntitiesString(), szToken ); pData; pData = MapEntity_ParseToken( pData, szToken ) )
+	{
+		if ( ( szToken[0] == '{' || szToken[0] == '}' ) && !szToken[1] )
+			continue;
+
+		tokenOffsets.AddToTail( tokenData.TellPut() );
+		tokenData.Put( szToken, Q_strlen( szToken ) + 1 );
+	}
+
+	int nTokens = tokenOffsets.Count();
+	if ( !nTokens )
+	{
+		Msg( "gamestringpool_benchmark: no entity data\n" );
+		return;
+	}
+
+	CUtlVector< const char * > tokens;
+	tokens.SetCount( nTokens );
+	for ( int i = 0; i < nTokens; i++ )
+	{
+		tokens[i] = (const char *)tokenData.Base() + tokenOffsets[i];
+	}
+
+	const int nChunkSize = 256;
+	CUtlVector< StringPoolBenchChunk_t > chunks;
+
+	double flRBTree = 0.0, flHash = 0.0, flIntern = 0.0, flInternMT = 0.0;
+	int nUnique = 0;
+	for ( int nPass = 0; nPass < nIterations; nPass++ )
+	{
+		double flStart = Plat_FloatTime();
+		{
+			CUtlSymbolTable table( 0, 256 );
+			for ( int i = 0; i < nTokens; i++ )
+			{
+				table.AddString( tokens[i] );
+			}
+			nUnique = table.GetNumStrings();
+		}
+		double flEnd = Plat_FloatTime();
+		flRBTree += flEnd - flStart;
+
+		flStart = flEnd;
+		{
+			CUtlHashtable<CUtlConstString> table( 256 );
+			for ( int i = 0; i < nTokens; i++ )
+			{
+				table.Insert( tokens[i] );
+			}
+		}
+		flEnd = Plat_FloatTime();
+		flHash += flEnd - flStart;
+
+		flStart = flEnd;
+		{
+			CUtlStringInternTable table;
+			for ( int i = 0; i < nTokens; i++ )
+			{
+				table.AddString( tokens[i] );
+			}
+		}
+		flEnd = Plat_FloatTime();
+		flIntern += flEnd - flStart;
+
+		flStart = flEnd;
+		{
+			CUtlStringInternTable table;
+			chunks.RemoveAll();
+			for ( int i = 0; i < nTokens; i += nChunkSize )
+			{
+				StringPoolBenchChunk_t &chunk = chunks[ chunks.AddToTail() ];
+				chunk.m_pTable = &table;
+				chunk.m_ppStrings = tokens.Base() + i;
+				chunk.m_nCount = MIN( nChunkSize, nTokens - i );
+			}
+			ParallelProcess( "gamestringpool_benchmark", chunks.Base(), chunks.Count(), &StringPoolBenchInternChunk );
+		}
+		flEnd = Plat_FloatTime();
+		flInternMT += flEnd - flStart;
+	}
+
+	Msg( "gamestringpool_benchmark: %d keys and values, %d unique, %d iterations\n", nTokens, nUnique, nIterations );
+	Msg( "  rbtree symbol table: %.3f ms per pass\n", flRBTree * 1000.0 / nIterations );
+	Msg( "  hash table:          %.3f ms per pass\n", flHash * 1000.0 / nIterations );
+	Msg( "  intern table:        %.3f ms per pass\n", flIntern * 1000.0 / nIterations );
+	Msg( "  intern table, jobs:  %.3f ms per pass\n", flInternMT * 1000.0 / nIterations );
+}
 #endif
@@ -45,6 +45,7 @@ void RegisterUserMessages( void )
 	usermessages->Register( "LogoTimeMsg", 4 );
 	usermessages->Register( "AchievementEvent", -1 );
 	usermessages->Register( "UpdateJalopyRadar", -1 );
+	usermessages->Register( "UpdateRadar", -1 );		// blips for the HUD radar, see radar_shared.h
 
 #ifndef _X360
 	// NVNT register haptic user messages
@@ -0,0 +1,110 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: The UpdateRadar message. The server keeps what it last sent each
+//			client about every blip and only sends the blips that changed,
+//			as small steps from that state when they fit. The message is
+//			reliable, so the client's copy always matches the server's.
+//
+//			byte	RADAR_MSG_* flags
+//			byte	number of blips
+//			varint32 array	entity index of each blip, as the step up from
+//							the one before (blips go in index order)
+//			then for each blip:
+//				2 bits	RadarBlipOp_t
+//				RADAR_BLIP_FLAG_BITS	RADAR_BLIP_* flags, unless removed
+//				position and yaw, absolute or as deltas, unless removed
+//
+//=============================================================================//
+
+#ifndef RADAR_SHARED_H
+#define RADAR_SHARED_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "coordsize.h"
+
+#define RADAR_MSG_RESET				(1<<0)	// forget every blip before reading this message
+
+#define RADAR_BLIP_NPC				(1<<0)	// otherwise a player
+#define RADAR_BLIP_HOSTILE			(1<<1)	// NPC that hates the receiving player
+#define RADAR_BLIP_FLAG_BITS		2
+
+enum RadarBlipOp_t
+{
+	RADAR_BLIP_REMOVE,
+	RADAR_BLIP_FULL,
+	RADAR_BLIP_DELTA,
+
+	RADAR_BLIP_OP_BITS = 2
+};
+
+// x and y go in 16 unit steps, z in 32 and yaw in 256ths of a turn
+#define RADAR_XY_SHIFT				4
+#define RADAR_Z_SHIFT				5
+#define RADAR_XY_BITS				( COORD_INTEGER_BITS - RADAR_XY_SHIFT + 1 )	// signed
+#define RADAR_Z_BITS				( COORD_INTEGER_BITS - RADAR_Z_SHIFT + 1 )
+#define RADAR_YAW_BITS				8
+
+// a blip that moved less than this many steps since the last message is sent as a delta
+#define RADAR_DELTA_XY_BITS			6	// signed
+#define RADAR_DELTA_Z_BITS			4
+
+// an entity index step takes one varint byte below 128, two up to MAX_EDICTS
+#define RADAR_INDEX_STEP_MAX_BITS	16
+#define RADAR_BLIP_FULL_BITS		( RADAR_INDEX_STEP_MAX_BITS + RADAR_BLIP_OP_BITS + RADAR_BLIP_FLAG_BITS + 2 * RADAR_XY_BITS + RADAR_Z_BITS + RADAR_YAW_BITS )
+#define RADAR_MSG_MAX_BITS			( ( MAX_USER_MSG_DATA - 2 ) * 8 )	// room left after the flags and count bytes
+#define RADAR_MSG_MAX_BLIPS			255
+
+inline int RadarIndexStepBits( int step )
+{
+	return ( step < 128 ) ? 8 : RADAR_INDEX_STEP_MAX_BITS;
+}
+
+//-----------------------------------------------------------------------------
+// A blip as the quantized values both sides keep
+//-----------------------------------------------------------------------------
+struct RadarBlipState_t
+{
+	int m_x;
+	int m_y;
+	int m_z;
+	int m_yaw;
+	int m_flags;
+
+	void Quantize( const Vector &origin, float yaw, int flags )
+	{
+		m_x = RoundFloatToInt( origin.x ) >> RADAR_XY_SHIFT;
+		m_y = RoundFloatToInt( origin.y ) >> RADAR_XY_SHIFT;
+		m_z = RoundFloatToInt( origin.z ) >> RADAR_Z_SHIFT;
+		m_yaw = RoundFloatToInt( anglemod( yaw ) * ( 1 << RADAR_YAW_BITS ) / 360.0f ) & ( ( 1 << RADAR_YAW_BITS ) - 1 );
+		m_flags = flags;
+	}
+
+	Vector GetOrigin( void ) const
+	{
+		// middle of the step
+		return Vector( ( m_x << RADAR_XY_SHIFT ) + ( 1 << ( RADAR_XY_SHIFT - 1 ) ),
+					   ( m_y << RADAR_XY_SHIFT ) + ( 1 << ( RADAR_XY_SHIFT - 1 ) ),
+					   ( m_z << RADAR_Z_SHIFT ) + ( 1 << ( RADAR_Z_SHIFT - 1 ) ) );
+	}
+
+	float GetYaw( void ) const
+	{
+		return m_yaw * 360.0f / ( 1 << RADAR_YAW_BITS );
+	}
+
+	bool FitsDelta( const RadarBlipState_t &from ) const
+	{
+		const int xyLimit = 1 << ( RADAR_DELTA_XY_BITS - 1 );
+		const int zLimit = 1 << ( RADAR_DELTA_Z_BITS - 1 );
+		return ( abs( m_x - from.m_x ) < xyLimit && abs( m_y - from.m_y ) < xyLimit && abs( m_z - from.m_z ) < zLimit );
+	}
+
+	bool operator==( const RadarBlipState_t &other ) const
+	{
+		return m_x == other.m_x && m_y == other.m_y && m_z == other.m_z && m_yaw == other.m_yaw && m_flags == other.m_flags;
+	}
+};
+
+#endif // RADAR_SHARED_H
@@ -185,14 +185,13 @@ bool ReadPlayerClassDataFromFileForSlot( IFileSystem* filesystem, const char *sz
 
 	char sz[128];
 	Q_snprintf( sz, sizeof( sz ), "scripts/playerclass_%s", szPlayerClassName );
-	KeyValues *pKV = ReadEncryptedKVFile( filesystem, sz, pICEKey );
+	CKeyValuesArena arena;
+	KeyValues *pKV = ReadEncryptedKVFile( filesystem, sz, pICEKey, false, &arena );
 	if ( !pKV )
 		return false;
 
 	pFileInfo->Parse( pKV, szPlayerClassName );
 
-	pKV->deleteThis();
-
 	return true;
 }
 
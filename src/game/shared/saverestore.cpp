@@ -24,11 +24,13 @@
 #include "vphysics/object_hash.h"
 #include "datacache/imdlcache.h"
 #include "tier0/vprof.h"
+#include "datadesc_lookup.h"
 
 #if !defined( CLIENT_DLL )
 
 #include "globalstate.h"
 #include "entitylist.h"
+#include "vstdlib/jobthread.h"
 
 #else
 
@@ -43,6 +45,11 @@ void AddRestoredEntity( CBaseEntity *pEntity );
 void AddRestoredEntity( C_BaseEntity *pEntity );
 #endif
 
+#if !defined( _X360 )
+#include <emmintrin.h>
+#define SAVERESTORE_SSE2 1
+#endif
+
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -93,6 +100,385 @@ static int gSizes[FIELD_TYPECOUNT] =
 	FIELD_SIZE( FIELD_VECTOR2D ),
 };
 
+//-----------------------------------------------------------------------------
+// Compiled field lists. The first time a datamap is saved its datadesc is
+// flattened into the fields that can be saved at all, each with its size and
+// how to test it for being empty, so writing an object doesn't go through
+// ShouldSaveField() and WriteField() for the common types.
+//-----------------------------------------------------------------------------
+enum SaveFieldOpType_t
+{
+	SAVEFIELD_RAW,			// written as it is in memory, empty when all zero
+	SAVEFIELD_ZERO_EMPTY,	// empty when all zero, written by WriteField()
+	SAVEFIELD_EHANDLE,		// empty when all handles are invalid, written by WriteField()
+	SAVEFIELD_GENERIC,		// ShouldSaveField() and WriteField()
+};
+
+// Raw fields next to each other are put together with their headers and written at once
+#define SAVEFIELD_RUN_BYTES		512
+
+struct savefieldop_t
+{
+	typedescription_t	*m_pField;
+	int					m_nOffset;
+	int					m_nBytes;
+	unsigned char		m_nType;		// SaveFieldOpType_t
+	unsigned char		m_nRunLength;	// raw fields in the run that starts here
+	bool				m_bDependent;	// written relative to the save, see SaveDependentField_t
+};
+
+// Bytes of the object the saved fields are written from
+struct savefieldrange_t
+{
+	int					m_nOffset;
+	int					m_nBytes;
+};
+
+struct savefieldprogram_t
+{
+	savefieldop_t		*m_pOps;
+	int					m_nOps;
+	short				*m_pFieldOps;	// op of each datadesc entry, -1 if it isn't saved
+	bool				m_bThreadSafe;	// every field can be written off the main thread
+
+	savefieldrange_t	*m_pRanges;		// by offset, none overlapping
+	int					m_nRanges;
+	int					m_nRangeBytes;
+};
+
+static CDataMapSideTable< savefieldprogram_t > s_SaveFieldPrograms;
+
+static savefieldprogram_t *GetSaveFieldProgram( datamap_t *pMap );
+
+//-----------------------------------------------------------------------------
+// Purpose: True when all the bytes are zero. Vectors, matrices and character
+//			arrays are tested 16 bytes at a time.
+//-----------------------------------------------------------------------------
+static inline bool SaveFieldDataIsZero( const char *pData, int nBytes )
+{
+#ifdef SAVERESTORE_SSE2
+	if ( nBytes >= 16 )
+	{
+		__m128i bits = _mm_setzero_si128();
+		const char *pLimit = pData + ( nBytes & ~15 );
+		for ( ; pData < pLimit; pData += 16 )
+		{
+			bits = _mm_or_si128( bits, _mm_loadu_si128( (const __m128i *)pData ) );
+		}
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi8( bits, _mm_setzero_si128() ) ) != 0xFFFF )
+			return false;
+		nBytes &= 15;
+	}
+#endif
+
+	int nBits = 0;
+	for ( ; nBytes >= (int)sizeof(int); nBytes -= sizeof(int), pData += sizeof(int) )
+	{
+		nBits |= *(const int *)pData;
+	}
+	for ( ; nBytes > 0; nBytes--, pData++ )
+	{
+		nBits |= *pData;
+	}
+	return ( nBits == 0 );
+}
+
+static bool SaveFieldHandlesAreInvalid( const char *pData, int nHandles )
+{
+	const unsigned int *pHandle = (const unsigned int *)pData;
+	for ( int i = 0; i < nHandles; i++ )
+	{
+		if ( pHandle[i] != 0xFFFFFFFF )
+			return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Picks the quickest way to test and write a field that gives the
+//			same result as ShouldSaveField() and WriteField()
+//-----------------------------------------------------------------------------
+static SaveFieldOpType_t GetSaveFieldOpType( typedescription_t *pField, int nBytes )
+{
+	// let ShouldSaveField() complain about fields declared with the wrong type
+	if ( pField->fieldType == FIELD_EMBEDDED || pField->fieldType == FIELD_CUSTOM || pField->fieldSizeInBytes != nBytes )
+		return SAVEFIELD_GENERIC;
+
+	switch ( pField->fieldType )
+	{
+	case FIELD_FLOAT:
+	case FIELD_VECTOR:
+	case FIELD_QUATERNION:
+	case FIELD_INTEGER:
+	case FIELD_BOOLEAN:
+	case FIELD_SHORT:
+	case FIELD_CHARACTER:
+	case FIELD_COLOR32:
+	case FIELD_VMATRIX:
+	case FIELD_INTERVAL:
+		if ( (int)sizeof(SaveRestoreRecordHeader_t) + nBytes <= SAVEFIELD_RUN_BYTES )
+			return SAVEFIELD_RAW;
+		return SAVEFIELD_ZERO_EMPTY;
+
+	case FIELD_EHANDLE:
+		return SAVEFIELD_EHANDLE;
+
+	default:
+		return SAVEFIELD_ZERO_EMPTY;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Whether what's written for the field depends on the save too
+//-----------------------------------------------------------------------------
+static bool IsSaveFieldDependent( typedescription_t *pField )
+{
+	switch ( pField->fieldType )
+	{
+	case FIELD_CLASSPTR:
+	case FIELD_EHANDLE:
+	case FIELD_EDICT:
+	case FIELD_POSITION_VECTOR:
+	case FIELD_TIME:
+	case FIELD_TICK:
+	case FIELD_VMATRIX_WORLDSPACE:
+	case FIELD_MATRIX3X4_WORLDSPACE:
+	case FIELD_MODELINDEX:
+	case FIELD_MATERIALINDEX:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Whether writing the field only reads the object and the save info
+//-----------------------------------------------------------------------------
+static bool IsSaveFieldThreadSafe( typedescription_t *pField )
+{
+	switch ( pField->fieldType )
+	{
+	case FIELD_FLOAT:
+	case FIELD_STRING:
+	case FIELD_VECTOR:
+	case FIELD_QUATERNION:
+	case FIELD_INTEGER:
+	case FIELD_BOOLEAN:
+	case FIELD_SHORT:
+	case FIELD_CHARACTER:
+	case FIELD_COLOR32:
+	case FIELD_CLASSPTR:
+	case FIELD_EHANDLE:
+	case FIELD_EDICT:
+	case FIELD_POSITION_VECTOR:
+	case FIELD_TIME:
+	case FIELD_TICK:
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+	case FIELD_FUNCTION:
+	case FIELD_VMATRIX:
+	case FIELD_VMATRIX_WORLDSPACE:
+	case FIELD_MATRIX3X4_WORLDSPACE:
+	case FIELD_INTERVAL:
+		return true;
+
+	case FIELD_EMBEDDED:
+		if ( ( pField->flags & FTYPEDESC_PTR ) || !pField->td )
+			return false;
+		for ( datamap_t *dmap = pField->td; dmap != NULL; dmap = dmap->baseMap )
+		{
+			if ( !GetSaveFieldProgram( dmap )->m_bThreadSafe )
+				return false;
+		}
+		return true;
+
+	default:
+		// custom save ops, model and material indices all use systems that belong to the main thread
+		return false;
+	}
+}
+
+static savefieldprogram_t *CompileSaveFieldProgram( datamap_t *pMap )
+{
+	savefieldprogram_t *pProgram = new savefieldprogram_t;
+	pProgram->m_pOps = new savefieldop_t[ MAX( pMap->dataNumFields, 1 ) ];
+	pProgram->m_pFieldOps = new short[ MAX( pMap->dataNumFields, 1 ) ];
+	pProgram->m_nOps = 0;
+	pProgram->m_bThreadSafe = true;
+
+	for ( int i = 0; i < pMap->dataNumFields; i++ )
+	{
+		typedescription_t *pField = &pMap->dataDesc[i];
+		pProgram->m_pFieldOps[i] = -1;
+
+		if ( !(pField->flags & FTYPEDESC_SAVE) || pField->fieldType == FIELD_VOID )
+			continue;
+
+		savefieldop_t &op = pProgram->m_pOps[ pProgram->m_nOps ];
+		pProgram->m_pFieldOps[i] = pProgram->m_nOps++;
+
+		op.m_pField = pField;
+		op.m_nOffset = pField->fieldOffset[ TD_OFFSET_NORMAL ];
+		op.m_nBytes = ( pField->fieldType < FIELD_TYPECOUNT ) ? pField->fieldSize * gSizes[pField->fieldType] : 0;
+		op.m_nType = ( pField->fieldType < FIELD_TYPECOUNT ) ? GetSaveFieldOpType( pField, op.m_nBytes ) : SAVEFIELD_GENERIC;
+		op.m_nRunLength = 0;
+		op.m_bDependent = IsSaveFieldDependent( pField );
+
+		if ( !IsSaveFieldThreadSafe( pField ) )
+		{
+			pProgram->m_bThreadSafe = false;
+		}
+	}
+
+	// group the raw fields into runs
+	savefieldop_t *pOps = pProgram->m_pOps;
+	for ( int i = 0; i < pProgram->m_nOps; )
+	{
+		if ( pOps[i].m_nType != SAVEFIELD_RAW )
+		{
+			i++;
+			continue;
+		}
+
+		int nRunBytes = 0;
+		int j = i;
+		while ( j < pProgram->m_nOps && j - i < 255 && pOps[j].m_nType == SAVEFIELD_RAW &&
+				nRunBytes + (int)sizeof(SaveRestoreRecordHeader_t) + pOps[j].m_nBytes <= SAVEFIELD_RUN_BYTES )
+		{
+			nRunBytes += sizeof(SaveRestoreRecordHeader_t) + pOps[j].m_nBytes;
+			j++;
+		}
+		pOps[i].m_nRunLength = j - i;
+		i = j;
+	}
+
+	// the memory the fields are written from, sorted and merged
+	pProgram->m_pRanges = new savefieldrange_t[ MAX( pProgram->m_nOps, 1 ) ];
+	pProgram->m_nRanges = 0;
+	pProgram->m_nRangeBytes = 0;
+	for ( int i = 0; i < pProgram->m_nOps; i++ )
+	{
+		typedescription_t *pField = pOps[i].m_pField;
+		savefieldrange_t range;
+		range.m_nOffset = pOps[i].m_nOffset;
+		if ( pField->fieldType == FIELD_EMBEDDED )
+		{
+			range.m_nBytes = ( pField->flags & FTYPEDESC_PTR ) ? sizeof(void *) : pField->fieldSize * pField->fieldSizeInBytes;
+		}
+		else
+		{
+			range.m_nBytes = MAX( pOps[i].m_nBytes, pField->fieldSizeInBytes );
+		}
+		if ( range.m_nBytes <= 0 )
+			continue;
+
+		int j = pProgram->m_nRanges++;
+		for ( ; j > 0 && pProgram->m_pRanges[j - 1].m_nOffset > range.m_nOffset; j-- )
+		{
+			pProgram->m_pRanges[j] = pProgram->m_pRanges[j - 1];
+		}
+		pProgram->m_pRanges[j] = range;
+	}
+
+	int nMerged = 0;
+	for ( int i = 0; i < pProgram->m_nRanges; i++ )
+	{
+		savefieldrange_t &range = pProgram->m_pRanges[i];
+		savefieldrange_t *pLast = nMerged ? &pProgram->m_pRanges[nMerged - 1] : NULL;
+		if ( pLast && range.m_nOffset <= pLast->m_nOffset + pLast->m_nBytes )
+		{
+			pLast->m_nBytes = MAX( pLast->m_nBytes, range.m_nOffset + range.m_nBytes - pLast->m_nOffset );
+			continue;
+		}
+		pProgram->m_pRanges[nMerged++] = range;
+	}
+	pProgram->m_nRanges = nMerged;
+
+	for ( int i = 0; i < pProgram->m_nRanges; i++ )
+	{
+		pProgram->m_nRangeBytes += pProgram->m_pRanges[i].m_nBytes;
+	}
+
+	return pProgram;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The compiled fields of a datamap. Whichever thread needs them first
+//			builds them, a thread that loses the race to publish throws its
+//			copy away.
+//-----------------------------------------------------------------------------
+static savefieldprogram_t *GetSaveFieldProgram( datamap_t *pMap )
+{
+	savefieldprogram_t *pProgram = s_SaveFieldPrograms.Find( pMap );
+	if ( pProgram )
+		return pProgram;
+
+	pProgram = CompileSaveFieldProgram( pMap );
+
+	savefieldprogram_t *pPublished = s_SaveFieldPrograms.Publish( pMap, pProgram );
+	if ( pPublished != pProgram )
+	{
+		delete [] pProgram->m_pOps;
+		delete [] pProgram->m_pFieldOps;
+		delete [] pProgram->m_pRanges;
+		delete pProgram;
+	}
+	return pPublished;
+}
+
+// The map in pRootMap's chain that pFields belongs to, if any
+static datamap_t *FindFieldMap( datamap_t *pRootMap, typedescription_t *pFields, int fieldCount )
+{
+	for ( datamap_t *dmap = pRootMap; dmap != NULL; dmap = dmap->baseMap )
+	{
+		if ( dmap->dataDesc == pFields && dmap->dataNumFields == fieldCount )
+			return dmap;
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Fields of an object written ahead of time by a CSave with its own segment
+//-----------------------------------------------------------------------------
+struct SavePreparedBlock_t
+{
+	typedescription_t	*m_pFields;
+	const savefieldprogram_t *m_pProgram;
+	bool				m_bWritten;		// copied out in this save
+	int					m_iData;
+	int					m_nBytes;
+	int					m_iFirstFixup;
+	int					m_nFixups;
+	int					m_iFirstDependent;
+	int					m_nDependents;
+	int					m_iFieldData;	// copy of the fields it was written from
+};
+
+struct SavePreparedObject_t
+{
+	CSave				*m_pParent;
+	const void			*m_pObject;		// NULL when nothing is prepared
+	datamap_t			*m_pRootMap;
+	unsigned long		m_hEntity;
+	const SavePreparedObject_t *m_pPrevious;	// the same entity in the last save, if kept
+	CUtlVector<char>	m_Data;
+	CUtlVector<SaveSymbolFixup_t> m_Fixups;
+	CUtlVector<SaveDependentField_t> m_Dependents;
+	CUtlVector<char>	m_FieldData;
+	CUtlVector<SavePreparedBlock_t> m_Blocks;
+};
+
+//-------------------------------------
+
+#define SAVE_SYMBOL_CACHE_SIZE	1024
+
+struct SaveSymbolCacheEntry_t
+{
+	const char			*m_pszName;
+	int					m_nSymbol;
+};
+
 
 // helpers to offset worldspace matrices
 static void VMatrixOffset( VMatrix &dest, const VMatrix &matrixIn, const Vector &offset )
@@ -191,7 +577,12 @@ inputfunc_t *UTIL_FunctionFromName( datamap_t *pMap, const char *pName )
 CSave::CSave( CSaveRestoreData *pdata )
  :	m_pData(pdata),
 	m_pGameInfo( pdata ),
-	m_bAsync( pdata->bAsync )
+	m_bAsync( pdata->bAsync ),
+	m_pSymbolCache( NULL ),
+	m_pSymbolFixups( NULL ),
+	m_pDependentFields( NULL ),
+	m_bOverflowed( false ),
+	m_pPrepared( NULL )
 {
 	m_BlockStartStack.EnsureCapacity( 32 );
 
@@ -201,17 +592,34 @@ CSave::CSave( CSaveRestoreData *pdata )
 
 //-------------------------------------
 
+CSave::CSave( CSave *pParent, CSaveRestoreSegment *pSegment, CUtlVector<SaveSymbolFixup_t> *pSymbolFixups, CUtlVector<SaveDependentField_t> *pDependentFields )
+ :	m_pData( pSegment ),
+	m_pGameInfo( pParent->m_pGameInfo ),
+	m_bAsync( pParent->m_bAsync ),
+	m_pSymbolCache( NULL ),
+	m_pSymbolFixups( pSymbolFixups ),
+	m_pDependentFields( pDependentFields ),
+	m_bOverflowed( false ),
+	m_pPrepared( NULL )
+{
+	m_BlockStartStack.EnsureCapacity( 32 );
+	m_hLogFile = NULL;
+}
+
+//-------------------------------------
+
+CSave::~CSave()
+{
+	delete [] m_pSymbolCache;
+}
+
+//-------------------------------------
+
 inline int CSave::DataEmpty( const char *pdata, int size )
 {
 	if ( size != 4 )
 	{
-		const char *pLimit = pdata + size;
-		while ( pdata < pLimit )
-		{
-			if ( *pdata++ )
-				return 0;
-		}
-		return 1;
+		return SaveFieldDataIsZero( pdata, size );
 	}
 
 	return ( *((int *)pdata) == 0 );
@@ -699,7 +1107,6 @@ bool CSave::ShouldSaveField( const void *pData, typedescription_t *pField )
 				Assert( 0 );
 			}
 
-			// old byte-by-byte null check
 			if ( DataEmpty( (const char *)pData, pField->fieldSize * gSizes[pField->fieldType] ) )
 				return false;
 		}
@@ -816,6 +1223,12 @@ bool CSave::WriteField( const char *pname, void *pData, datamap_t *pRootMap, typ
 
 int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRootMap, typedescription_t *pFields, int fieldCount )
 {
+	if ( m_pPrepared && WritePreparedFields( pBaseData, pRootMap, pFields ) )
+		return 1;
+
+	// fields of a map in the chain use its compiled field list, unless every field is being logged
+	datamap_t *pFieldMap = !IsLogging() ? FindFieldMap( pRootMap, pFields, fieldCount ) : NULL;
+
 	typedescription_t *pTest;
 	int iHeaderPos = m_pData->GetCurPos();
 	int count = -1;
@@ -835,17 +1248,24 @@ int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRo
 	__dcbt( 512, pDest );
 #endif
 
-	for ( int i = 0; i < fieldCount; i++ )
+	if ( pFieldMap )
 	{
-		pTest = &pFields[ i ];
-		void *pOutputData = ( (char *)pBaseData + pTest->fieldOffset[ TD_OFFSET_NORMAL ] );
-			
-		if ( !ShouldSaveField( pOutputData, pTest ) )
-			continue;
+		count = WriteCompiledFields( pname, pBaseData, pRootMap, pFieldMap );
+	}
+	else
+	{
+		for ( int i = 0; i < fieldCount; i++ )
+		{
+			pTest = &pFields[ i ];
+			void *pOutputData = ( (char *)pBaseData + pTest->fieldOffset[ TD_OFFSET_NORMAL ] );
+				
+			if ( !ShouldSaveField( pOutputData, pTest ) )
+				continue;
 
-		if ( !WriteField( pname, pOutputData, pRootMap, pTest ) )
-			break;
-		count++;
+			if ( !WriteField( pname, pOutputData, pRootMap, pTest ) )
+				break;
+			count++;
+		}
 	}
 
 	int iCurPos = m_pData->GetCurPos();
@@ -858,6 +1278,162 @@ int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRo
 	return 1;
 }
 
+//-------------------------------------
+// Purpose: WriteFields() for the fields of a datamap, through its compiled
+//			field list. Returns the number of fields written.
+
+int CSave::WriteCompiledFields( const char *pname, const void *pBaseData, datamap_t *pRootMap, datamap_t *pFieldMap )
+{
+	const savefieldprogram_t *pProgram = GetSaveFieldProgram( pFieldMap );
+	const savefieldop_t *pOp = pProgram->m_pOps;
+	const savefieldop_t *pOpLimit = pOp + pProgram->m_nOps;
+	int count = 0;
+
+	while ( pOp < pOpLimit )
+	{
+		if ( pOp->m_nType == SAVEFIELD_RAW )
+		{
+			// build the records of the run in place and write them all at once
+			char runBuffer[SAVEFIELD_RUN_BYTES];
+			int nRunBytes = 0;
+			int iRunPos = GetWritePos();
+
+			for ( const savefieldop_t *pRunLimit = pOp + pOp->m_nRunLength; pOp < pRunLimit; ++pOp )
+			{
+				const char *pData = (const char *)pBaseData + pOp->m_nOffset;
+				if ( SaveFieldDataIsZero( pData, pOp->m_nBytes ) )
+					continue;
+
+				SaveRestoreRecordHeader_t *pHeader = (SaveRestoreRecordHeader_t *)( runBuffer + nRunBytes );
+				pHeader->size = pOp->m_nBytes;
+				if ( m_pSymbolFixups )
+				{
+					SaveSymbolFixup_t fixup = { iRunPos + nRunBytes, pOp->m_pField->fieldName };
+					m_pSymbolFixups->AddToTail( fixup );
+					pHeader->symbol = 0;
+				}
+				else
+				{
+					pHeader->symbol = FindSymbol( pOp->m_pField->fieldName );
+				}
+
+				memcpy( pHeader + 1, pData, pOp->m_nBytes );
+				nRunBytes += sizeof(SaveRestoreRecordHeader_t) + pOp->m_nBytes;
+				count++;
+			}
+
+			if ( nRunBytes )
+			{
+				BufferData( runBuffer, nRunBytes );
+			}
+			continue;
+		}
+
+		void *pOutputData = (char *)pBaseData + pOp->m_nOffset;
+		bool bSave;
+		switch ( pOp->m_nType )
+		{
+		case SAVEFIELD_ZERO_EMPTY:
+			bSave = !SaveFieldDataIsZero( (const char *)pOutputData, pOp->m_nBytes );
+			break;
+
+		case SAVEFIELD_EHANDLE:
+			bSave = !SaveFieldHandlesAreInvalid( (const char *)pOutputData, pOp->m_pField->fieldSize );
+			break;
+
+		default:
+			bSave = ShouldSaveField( pOutputData, pOp->m_pField );
+			break;
+		}
+
+		if ( bSave )
+		{
+			if ( m_pDependentFields && pOp->m_bDependent )
+			{
+				SaveDependentField_t dependent = { GetWritePos(), pOp->m_pField, pOutputData };
+				m_pDependentFields->AddToTail( dependent );
+			}
+
+			if ( !WriteField( pname, pOutputData, pRootMap, pOp->m_pField ) )
+				break;
+			count++;
+		}
+		++pOp;
+	}
+
+	return count;
+}
+
+//-------------------------------------
+// Purpose: Writes records written earlier again, at the same place and for
+//			this save. They come out the same size, these field types are
+//			all fixed size.
+
+void CSave::RewriteDependentFields( const SaveDependentField_t *pFields, int nFields )
+{
+	int iEndPos = GetWritePos();
+	for ( int i = 0; i < nFields; i++ )
+	{
+		SetWritePos( pFields[i].m_iPos );
+		WriteField( pFields[i].m_pField->fieldName, pFields[i].m_pData, NULL, pFields[i].m_pField );
+	}
+	SetWritePos( iEndPos );
+}
+
+//-------------------------------------
+// Purpose: True if the object still holds what a prepared block was written from
+
+static bool SavePreparedFieldsMatch( const SavePreparedObject_t *pPrepared, const SavePreparedBlock_t &block )
+{
+	const char *pFieldData = pPrepared->m_FieldData.Base() + block.m_iFieldData;
+	for ( int i = 0; i < block.m_pProgram->m_nRanges; i++ )
+	{
+		const savefieldrange_t &range = block.m_pProgram->m_pRanges[i];
+		if ( memcmp( (const char *)pPrepared->m_pObject + range.m_nOffset, pFieldData, range.m_nBytes ) != 0 )
+			return false;
+		pFieldData += range.m_nBytes;
+	}
+	return true;
+}
+
+//-------------------------------------
+// Purpose: Copies in the fields of the current prepared object, if they
+//			were written ahead of time
+// Output : true if they were
+
+bool CSave::WritePreparedFields( const void *pBaseData, datamap_t *pRootMap, typedescription_t *pFields )
+{
+	SavePreparedObject_t *pPrepared = m_pPrepared;
+	if ( pPrepared->m_pObject != pBaseData || pPrepared->m_pRootMap != pRootMap )
+		return false;
+
+	for ( int i = 0; i < pPrepared->m_Blocks.Count(); i++ )
+	{
+		SavePreparedBlock_t &block = pPrepared->m_Blocks[i];
+		if ( block.m_pFields != pFields || block.m_bWritten )
+			continue;
+
+		// The fields were prepared, or reused, before the entity's Save() ran. Overrides
+		// that set fields before chaining down (CHalfLife2Proxy) get them written now.
+		if ( !SavePreparedFieldsMatch( pPrepared, block ) )
+			return false;
+
+		// the symbols go in now, so the symbol table fills up in the same order as writing the fields here would
+		for ( int j = block.m_iFirstFixup; j < block.m_iFirstFixup + block.m_nFixups; j++ )
+		{
+			const SaveSymbolFixup_t &fixup = pPrepared->m_Fixups[j];
+			SaveRestoreRecordHeader_t *pHeader = (SaveRestoreRecordHeader_t *)( pPrepared->m_Data.Base() + fixup.m_iPos );
+			pHeader->symbol = FindSymbol( fixup.m_pszName );
+		}
+
+		BufferData( pPrepared->m_Data.Base() + block.m_iData, block.m_nBytes );
+		block.m_bWritten = true;
+		return true;
+	}
+
+	return false;
+}
+
 //-------------------------------------
 // Purpose: Recursively saves all the classes in an object, in reverse order (top down)
 // Output : int 0 on failure, 1 on success
@@ -930,7 +1506,16 @@ void CSave::BufferField( const char *pname, int size, const char *pdata )
 void CSave::WriteHeader( const char *pname, int size )
 {
 	short shortSize = size;
-	short hashvalue = m_pData->FindCreateSymbol( pname );
+	short hashvalue = 0;
+	if ( m_pSymbolFixups )
+	{
+		SaveSymbolFixup_t fixup = { GetWritePos(), pname };
+		m_pSymbolFixups->AddToTail( fixup );
+	}
+	else
+	{
+		hashvalue = FindSymbol( pname );
+	}
 	if ( size > SHRT_MAX || size < 0 )
 	{
 		Warning( "CSave::WriteHeader() size parameter exceeds 'short'!\n" );
@@ -948,13 +1533,45 @@ void CSave::BufferData( const char *pdata, int size )
 	if ( !m_pData )
 		return;
 
+	// a CSave writing for a parent just stops, and its parent writes the fields itself
+	if ( m_bOverflowed && m_pSymbolFixups )
+		return;
+
 	if ( !m_pData->Write( pdata, size ) )
 	{
-		Warning( "Save/Restore overflow!\n" );
-		Assert(0);
+		m_bOverflowed = true;
+		if ( !m_pSymbolFixups )
+		{
+			Warning( "Save/Restore overflow!\n" );
+			Assert(0);
+		}
 	}
 }
 
+//-------------------------------------
+// Purpose: FindCreateSymbol(), remembering the symbols of recent names. A
+//			remembered symbol still holds when the table has that very
+//			pointer at that index: nothing is ever removed from the table,
+//			so a search for the name would stop there.
+
+unsigned short CSave::FindSymbol( const char *pszName )
+{
+	if ( !m_pSymbolCache )
+	{
+		m_pSymbolCache = new SaveSymbolCacheEntry_t[SAVE_SYMBOL_CACHE_SIZE];
+		memset( m_pSymbolCache, 0, SAVE_SYMBOL_CACHE_SIZE * sizeof(SaveSymbolCacheEntry_t) );
+	}
+
+	uintp nName = (uintp)pszName;
+	SaveSymbolCacheEntry_t &entry = m_pSymbolCache[ ( nName ^ ( nName >> 10 ) ) & ( SAVE_SYMBOL_CACHE_SIZE - 1 ) ];
+	if ( entry.m_pszName == pszName && entry.m_nSymbol < m_pData->SizeSymbolTable() && m_pData->StringFromSymbol( entry.m_nSymbol ) == pszName )
+		return entry.m_nSymbol;
+
+	entry.m_pszName = pszName;
+	entry.m_nSymbol = m_pData->FindCreateSymbol( pszName );
+	return entry.m_nSymbol;
+}
+
 //---------------------------------------------------------
 //
 // Game centric save methods.
@@ -1650,6 +2267,10 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 	// Clear out base data
 	EmptyFields( pBaseData, pFields, fieldCount );
 	
+	// Fields that belong to a map in the chain can be looked up by name
+	datamap_t *pFieldMap = FindFieldMap( pRootMap, pFields, fieldCount );
+	const savefieldprogram_t *pProgram = pFieldMap ? GetSaveFieldProgram( pFieldMap ) : NULL;
+
 	// Skip over the struct name
 	int i;
 	int nFieldsSaved = ReadInt();						// Read field count
@@ -1660,10 +2281,32 @@ int CRestore::ReadFields( const char *pname, void *pBaseData, datamap_t *pRootMa
 	{
 		ReadHeader( &header );
 
-		typedescription_t *pField = FindField( m_pData->StringFromSymbol( header.symbol ), pFields, fieldCount, &searchCookie);
+		const char *pszFieldName = m_pData->StringFromSymbol( header.symbol );
+		typedescription_t *pField = NULL;
+		bool bUnique = false;
+		if ( pFieldMap )
+		{
+			pField = DataDesc_FindField( pFieldMap, pszFieldName, &bUnique );
+		}
+		if ( !bUnique )
+		{
+			// not a datamap's fields, or several share the name and the search order decides
+			pField = FindField( pszFieldName, pFields, fieldCount, &searchCookie );
+		}
 		if ( pField && ShouldReadField( pField ) )
 		{
-			ReadField( header, ((char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ]), pRootMap, pField );
+			char *pDest = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
+
+			// plain data saved at the size it has now is copied straight in
+			int iOp = pProgram ? pProgram->m_pFieldOps[ pField - pFields ] : -1;
+			if ( iOp != -1 && pProgram->m_pOps[iOp].m_nType == SAVEFIELD_RAW && pProgram->m_pOps[iOp].m_nBytes == header.size )
+			{
+				BufferReadBytes( pDest, header.size );
+			}
+			else
+			{
+				ReadField( header, pDest, pRootMap, pField );
+			}
 		}
 		else
 		{
@@ -2453,9 +3096,291 @@ void CEntitySaveRestoreBlockHandler::PreSave( CSaveRestoreData *pSaveData )
 
 //---------------------------------
 
+#if !defined( CLIENT_DLL )
+
+ConVar sv_parallel_save_fields( "sv_parallel_save_fields", "1", 0, "Write the datadesc fields of saved entities on worker threads when they don't need the main thread." );
+ConVar sv_save_reuse_unchanged( "sv_save_reuse_unchanged", "1", 0, "Keep the fields written on worker threads, and copy them into the next save for classes of entities that haven't changed." );
+ConVar sv_save_reuse_compact_interval( "sv_save_reuse_compact_interval", "8", 0, "Every this many saves, write all fields from scratch and drop the kept buffers. 0 never does." );
+
+// Largest buffer an entity's fields may be prepared in, bigger ones are written the usual way
+#define SAVE_PREPARE_MAX_BYTES	( 256 * 1024 )
+
+// The prepared fields of the last save, for the next one to copy from
+static CUtlVector<SavePreparedObject_t> s_PreviousSave;
+static CUtlMap<unsigned long, int> s_PreviousSaveIndex( DefLessFunc( unsigned long ) );
+static int s_nSavesSinceCompact;
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes one class of the entity at the end of its buffer
+// Output : false if it doesn't fit the largest buffer allowed
+//-----------------------------------------------------------------------------
+static bool SavePrepareClassFields( SavePreparedObject_t &prepared, datamap_t *dmap, SavePreparedBlock_t &block )
+{
+	for ( int nBytes = 4096; nBytes <= SAVE_PREPARE_MAX_BYTES; nBytes *= 4 )
+	{
+		prepared.m_Data.SetCountNonDestructively( block.m_iData + nBytes );
+		prepared.m_Fixups.SetCountNonDestructively( block.m_iFirstFixup );
+		prepared.m_Dependents.SetCountNonDestructively( block.m_iFirstDependent );
+
+		CSaveRestoreSegment segment;
+		segment.Init( prepared.m_Data.Base() + block.m_iData, nBytes );
+		CSave save( prepared.m_pParent, &segment, &prepared.m_Fixups, &prepared.m_Dependents );
+		save.WriteFields( dmap->dataClassName, prepared.m_pObject, prepared.m_pRootMap, dmap->dataDesc, dmap->dataNumFields );
+		if ( save.IsOverflowed() )
+			continue;
+
+		block.m_nBytes = save.GetWritePos();
+		block.m_nFixups = prepared.m_Fixups.Count() - block.m_iFirstFixup;
+		block.m_nDependents = prepared.m_Dependents.Count() - block.m_iFirstDependent;
+		prepared.m_Data.SetCountNonDestructively( block.m_iData + block.m_nBytes );
+
+		// symbols are filled in the whole buffer, dependent fields are written again in the block
+		for ( int i = block.m_iFirstFixup; i < prepared.m_Fixups.Count(); i++ )
+		{
+			prepared.m_Fixups[i].m_iPos += block.m_iData;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies a class of the entity from the last save, if none of the
+//			fields it was written from has changed since. This runs before the
+//			entity's Save(), so like a freshly prepared block the copy is only
+//			used if WritePreparedFields() finds the fields still the same.
+//-----------------------------------------------------------------------------
+static bool SaveReuseClassFields( SavePreparedObject_t &prepared, datamap_t *dmap, SavePreparedBlock_t &block )
+{
+	const SavePreparedObject_t *pPrevious = prepared.m_pPrevious;
+	if ( !pPrevious )
+		return false;
+
+	const SavePreparedBlock_t *pPreviousBlock = NULL;
+	for ( int i = 0; i < pPrevious->m_Blocks.Count(); i++ )
+	{
+		if ( pPrevious->m_Blocks[i].m_pFields == dmap->dataDesc )
+		{
+			pPreviousBlock = &pPrevious->m_Blocks[i];
+			break;
+		}
+	}
+
+	if ( !pPreviousBlock )
+		return false;
+
+	int nFieldBytes = GetSaveFieldProgram( dmap )->m_nRangeBytes;
+	if ( memcmp( pPrevious->m_FieldData.Base() + pPreviousBlock->m_iFieldData, prepared.m_FieldData.Base() + block.m_iFieldData, nFieldBytes ) != 0 )
+		return false;
+
+	prepared.m_Data.AddMultipleToTail( pPreviousBlock->m_nBytes, pPrevious->m_Data.Base() + pPreviousBlock->m_iData );
+	block.m_nBytes = pPreviousBlock->m_nBytes;
+
+	for ( int i = 0; i < pPreviousBlock->m_nFixups; i++ )
+	{
+		SaveSymbolFixup_t fixup = pPrevious->m_Fixups[ pPreviousBlock->m_iFirstFixup + i ];
+		fixup.m_iPos += block.m_iData - pPreviousBlock->m_iData;
+		prepared.m_Fixups.AddToTail( fixup );
+	}
+	block.m_nFixups = pPreviousBlock->m_nFixups;
+
+	prepared.m_Dependents.AddMultipleToTail( pPreviousBlock->m_nDependents, pPrevious->m_Dependents.Base() + pPreviousBlock->m_iFirstDependent );
+	block.m_nDependents = pPreviousBlock->m_nDependents;
+
+	// times, ticks, entity references and positions are written for this save
+	if ( block.m_nDependents )
+	{
+		CUtlVector<SaveSymbolFixup_t> unusedFixups;
+		CSaveRestoreSegment segment;
+		segment.Init( prepared.m_Data.Base() + block.m_iData, block.m_nBytes );
+		CSave save( prepared.m_pParent, &segment, &unusedFixups );
+		save.RewriteDependentFields( prepared.m_Dependents.Base() + block.m_iFirstDependent, block.m_nDependents );
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the classes of an entity whose fields can be written off
+//			the main thread into the entity's own buffer, as WriteAll() would
+//-----------------------------------------------------------------------------
+static void SavePrepareEntityFields( SavePreparedObject_t &prepared )
+{
+	if ( !prepared.m_pObject )
+		return;
+
+	// base classes first, the same as DoWriteAll()
+	datamap_t *chain[64];
+	int nChain = 0;
+	for ( datamap_t *dmap = prepared.m_pRootMap; dmap != NULL && nChain < ARRAYSIZE(chain); dmap = dmap->baseMap )
+	{
+		chain[nChain++] = dmap;
+	}
+
+	for ( int i = nChain - 1; i >= 0; i-- )
+	{
+		datamap_t *dmap = chain[i];
+		const savefieldprogram_t *pProgram = GetSaveFieldProgram( dmap );
+		if ( !pProgram->m_bThreadSafe )
+			continue;
+
+		SavePreparedBlock_t block;
+		block.m_pFields = dmap->dataDesc;
+		block.m_pProgram = pProgram;
+		block.m_bWritten = false;
+		block.m_iData = prepared.m_Data.Count();
+		block.m_nBytes = 0;
+		block.m_iFirstFixup = prepared.m_Fixups.Count();
+		block.m_nFixups = 0;
+		block.m_iFirstDependent = prepared.m_Dependents.Count();
+		block.m_nDependents = 0;
+
+		// keep what the fields are written from, the next save compares against it
+		block.m_iFieldData = prepared.m_FieldData.Count();
+		for ( int j = 0; j < pProgram->m_nRanges; j++ )
+		{
+			const savefieldrange_t &range = pProgram->m_pRanges[j];
+			prepared.m_FieldData.AddMultipleToTail( range.m_nBytes, (const char *)prepared.m_pObject + range.m_nOffset );
+		}
+
+		if ( !SaveReuseClassFields( prepared, dmap, block ) && !SavePrepareClassFields( prepared, dmap, block ) )
+		{
+			// too big, write it on the main thread after all
+			prepared.m_Blocks.Purge();
+			prepared.m_Fixups.Purge();
+			prepared.m_Dependents.Purge();
+			prepared.m_FieldData.Purge();
+			prepared.m_Data.Purge();
+			return;
+		}
+
+		prepared.m_Blocks.AddToTail( block );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills in prepared[] for the entities Save() is about to write
+//-----------------------------------------------------------------------------
+static void SavePrepareEntities( CSave *pSave, CUtlVector<SavePreparedObject_t> &prepared )
+{
+	if ( !sv_parallel_save_fields.GetBool() || pSave->IsLogging() )
+		return;
+
+	VPROF( "SavePrepareEntities" );
+
+	// now and then everything is written from scratch, which also lets go of buffers that grew
+	bool bReuse = sv_save_reuse_unchanged.GetBool();
+	if ( sv_save_reuse_compact_interval.GetInt() > 0 && ++s_nSavesSinceCompact >= sv_save_reuse_compact_interval.GetInt() )
+	{
+		s_nSavesSinceCompact = 0;
+		bReuse = false;
+	}
+
+	CGameSaveRestoreInfo *pSaveData = pSave->GetGameSaveRestoreInfo();
+	prepared.SetCount( pSaveData->NumEntities() );
+
+	for ( int i = 0; i < pSaveData->NumEntities(); i++ )
+	{
+		SavePreparedObject_t &object = prepared[i];
+		object.m_pParent = pSave;
+		object.m_pObject = NULL;
+		object.m_pRootMap = NULL;
+		object.m_hEntity = 0;
+		object.m_pPrevious = NULL;
+
+		CBaseEntity *pEnt = pSaveData->GetEntityInfo( i )->hEnt;
+		if ( !pEnt || ( pEnt->ObjectCaps() & FCAP_DONT_SAVE ) )
+			continue;
+
+		object.m_pObject = pEnt;
+		object.m_pRootMap = pEnt->GetDataDescMap();
+		object.m_hEntity = pEnt->GetRefEHandle().ToInt();
+
+		if ( bReuse )
+		{
+			unsigned short iPrevious = s_PreviousSaveIndex.Find( object.m_hEntity );
+			if ( iPrevious != s_PreviousSaveIndex.InvalidIndex() )
+			{
+				const SavePreparedObject_t &previous = s_PreviousSave[ s_PreviousSaveIndex[iPrevious] ];
+				if ( previous.m_pObject == object.m_pObject && previous.m_pRootMap == object.m_pRootMap )
+				{
+					object.m_pPrevious = &previous;
+				}
+			}
+		}
+
+		// compile here, so the workers only ever read the field lists
+		for ( datamap_t *dmap = object.m_pRootMap; dmap != NULL; dmap = dmap->baseMap )
+		{
+			GetSaveFieldProgram( dmap );
+		}
+	}
+
+	ParallelProcess( "SavePrepareEntityFields", prepared.Base(), prepared.Count(), &SavePrepareEntityFields );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Keeps this save's prepared fields for the next save. Entities
+//			that weren't saved this time drop out.
+//-----------------------------------------------------------------------------
+static void SaveKeepPreparedEntities( CUtlVector<SavePreparedObject_t> &prepared )
+{
+	s_PreviousSave.Swap( prepared );
+	s_PreviousSaveIndex.RemoveAll();
+
+	if ( !sv_save_reuse_unchanged.GetBool() )
+	{
+		s_PreviousSave.Purge();
+		return;
+	}
+
+	for ( int i = 0; i < s_PreviousSave.Count(); i++ )
+	{
+		SavePreparedObject_t &object = s_PreviousSave[i];
+
+		// what they point at goes away with the last save
+		object.m_pPrevious = NULL;
+		object.m_pParent = NULL;
+
+		if ( object.m_pObject && object.m_Blocks.Count() )
+		{
+			s_PreviousSaveIndex.Insert( object.m_hEntity, i );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Kept fields point at entities and pooled strings of the level
+//-----------------------------------------------------------------------------
+class CSavePreparedFieldsSystem : public CAutoGameSystem
+{
+public:
+	CSavePreparedFieldsSystem() : CAutoGameSystem( "CSavePreparedFieldsSystem" ) {}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		s_PreviousSave.Purge();
+		s_PreviousSaveIndex.RemoveAll();
+		s_nSavesSinceCompact = 0;
+	}
+};
+
+static CSavePreparedFieldsSystem g_SavePreparedFieldsSystem;
+
+#endif // !CLIENT_DLL
+
+//---------------------------------
+
 void CEntitySaveRestoreBlockHandler::Save( ISave *pSave )
 {
 	CGameSaveRestoreInfo *pSaveData = pSave->GetGameSaveRestoreInfo();
+
+	// CSave is the only ISave there is
+	CSave *pGameSave = static_cast<CSave *>( pSave );
+	CUtlVector<SavePreparedObject_t> prepared;
+#if !defined( CLIENT_DLL )
+	SavePrepareEntities( pGameSave, prepared );
+#endif
 	
 	// write entity list that was previously built by SaveInitEntities()
 	for ( int i = 0; i < pSaveData->NumEntities(); i++ )
@@ -2476,7 +3401,9 @@ void CEntitySaveRestoreBlockHandler::Save( ISave *pSave )
 #endif
 
 			pSaveData->SetCurrentEntityContext( pEnt );
+			pGameSave->SetPreparedFields( ( i < prepared.Count() ) ? &prepared[i] : NULL );
 			pEnt->Save( *pSave );
+			pGameSave->SetPreparedFields( NULL );
 			pSaveData->SetCurrentEntityContext( NULL );
 
 			pEntInfo->size = pSave->GetWritePos() - pEntInfo->location;	// Size of entity block is data size written to block
@@ -2495,6 +3422,10 @@ void CEntitySaveRestoreBlockHandler::Save( ISave *pSave )
 #endif
 		}
 	}
+
+#if !defined( CLIENT_DLL )
+	SaveKeepPreparedEntities( prepared );
+#endif
 }
 
 //---------------------------------
@@ -28,6 +28,30 @@ struct edict_t;
 struct datamap_t;
 class CBaseEntity;
 struct interval_t;
+struct SavePreparedObject_t;
+struct SaveSymbolCacheEntry_t;
+
+//-------------------------------------
+// A record header written by a CSave that leaves symbols to its parent,
+// see the CSave( CSave *, ... ) constructor
+
+struct SaveSymbolFixup_t
+{
+	int			m_iPos;			// of the header in the buffer
+	const char	*m_pszName;
+};
+
+//-------------------------------------
+// A record whose bytes depend on the save as well as on the field (times,
+// ticks, entity references, world positions), so it has to be written
+// again before the bytes can be used in another save
+
+struct SaveDependentField_t
+{
+	int					m_iPos;		// of the header in the buffer
+	typedescription_t	*m_pField;
+	void				*m_pData;
+};
 
 //-----------------------------------------------------------------------------
 //
@@ -39,11 +63,18 @@ class CSave : public ISave
 {
 public:
 	CSave( CSaveRestoreData *pdata );
+
+	// Writes into a separate segment for pParent, typically on another thread.
+	// Record headers get no symbol; their names go to pSymbolFixups instead.
+	// Records that depend on the save go to pDependentFields, if given.
+	CSave( CSave *pParent, CSaveRestoreSegment *pSegment, CUtlVector<SaveSymbolFixup_t> *pSymbolFixups, CUtlVector<SaveDependentField_t> *pDependentFields = NULL );
+	~CSave();
 	
 	//---------------------------------
 	// Logging
 	void			StartLogging( const char *pszLogName );
 	void			EndLogging( void );
+	bool			IsLogging( void );
 
 	//---------------------------------
 	bool			IsAsync();
@@ -61,6 +92,13 @@ public:
 	
 	int				WriteFields( const char *pname, const void *pBaseData, datamap_t *pMap, typedescription_t *pFields, int fieldCount );
 
+	// Fields of the object written ahead of time, copied in when WriteFields() reaches them
+	void			SetPreparedFields( SavePreparedObject_t *pPrepared )	{ m_pPrepared = pPrepared; }
+	bool			IsOverflowed() const									{ return m_bOverflowed; }
+
+	// Writes the records again in place, for this save
+	void			RewriteDependentFields( const SaveDependentField_t *pFields, int nFields );
+
 	//---------------------------------
 	// Block support
 	//
@@ -140,7 +178,6 @@ public:
 private:
 
 	//---------------------------------
-	bool			IsLogging( void );
 	void			Log( const char *pName, fieldtype_t fieldType, void *value, int count );
 
 	//---------------------------------
@@ -148,9 +185,12 @@ private:
 	void			BufferField( const char *pname, int size, const char *pdata );
 	void			BufferData( const char *pdata, int size );
 	void			WriteHeader( const char *pname, int size );
+	unsigned short	FindSymbol( const char *pszName );
 
 	int				DoWriteAll( const void *pLeafObject, datamap_t *pLeafMap, datamap_t *pCurMap );
 	bool 			WriteField( const char *pname, void *pData, datamap_t *pRootMap, typedescription_t *pField );
+	int				WriteCompiledFields( const char *pname, const void *pBaseData, datamap_t *pRootMap, datamap_t *pFieldMap );
+	bool			WritePreparedFields( const void *pBaseData, datamap_t *pRootMap, typedescription_t *pFields );
 	
 	bool 			WriteBasicField( const char *pname, void *pData, datamap_t *pRootMap, typedescription_t *pField );
 	
@@ -179,6 +219,16 @@ private:
 
 	FileHandle_t		m_hLogFile;
 	bool				m_bAsync;
+
+	// Symbols of recently written names, checked against the symbol table on use
+	SaveSymbolCacheEntry_t *m_pSymbolCache;
+
+	// Set when writing for a parent CSave
+	CUtlVector<SaveSymbolFixup_t> *m_pSymbolFixups;
+	CUtlVector<SaveDependentField_t> *m_pDependentFields;
+	bool				m_bOverflowed;
+
+	SavePreparedObject_t *m_pPrepared;
 };
 
 //-----------------------------------------------------------------------------
@@ -6,14 +6,18 @@
 //=============================================================================//
 #include "cbase.h"
 #include <KeyValues.h>
+#include "kvimage.h"
 #include <tier0/mem.h>
 #include "filesystem.h"
 #include "utldict.h"
+#include "utlbuffer.h"
 #include "ammodef.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+ConVar kv_use_images( "kv_use_images", "1", 0, "Load script files from their prebuilt binary images (built with kv_build_images) when those are up to date." );
+
 // The sound categories found in the weapon classname.txt files
 // This needs to match the WeaponSound_t enum in weapon_parse.h
 #if !defined(_STATIC_LINKED) || defined(CLIENT_DLL)
@@ -193,7 +197,7 @@ void PrecacheFileWeaponInfoDatabase( IFileSystem *filesystem, const unsigned cha
 	manifest->deleteThis();
 }
 
-KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameWithoutExtension, const unsigned char *pICEKey, bool bForceReadEncryptedFile /*= false*/ )
+KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameWithoutExtension, const unsigned char *pICEKey, bool bForceReadEncryptedFile /*= false*/, CKeyValuesArena *pArena /*= NULL*/ )
 {
 	Assert( strchr( szFilenameWithoutExtension, '.' ) == NULL );
 	char szFullName[512];
@@ -206,11 +210,26 @@ KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameW
 	}
 
 	// Open the weapon data file, and abort if we can't
-	KeyValues *pKV = new KeyValues( "WeaponDatafile" );
+	KeyValues *pKV = pArena ? NULL : new KeyValues( "WeaponDatafile" );
 
 	Q_snprintf(szFullName,sizeof(szFullName), "%s.txt", szFilenameWithoutExtension);
 
-	if ( bForceReadEncryptedFile || !pKV->LoadFromFile( filesystem, szFullName, pSearchPath ) ) // try to load the normal .txt file first
+	bool bLoaded = false;
+	if ( !bForceReadEncryptedFile ) // try to load the normal .txt file first
+	{
+		if ( pArena )
+		{
+			pArena->UsesImages( kv_use_images.GetBool() );
+			pKV = pArena->LoadFromFile( filesystem, szFullName, pSearchPath );
+			bLoaded = ( pKV != NULL );
+		}
+		else
+		{
+			bLoaded = pKV->LoadFromFile( filesystem, szFullName, pSearchPath );
+		}
+	}
+
+	if ( !bLoaded )
 	{
 #ifndef _XBOX
 		if ( pICEKey )
@@ -221,7 +240,8 @@ KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameW
 
 			if (!f)
 			{
-				pKV->deleteThis();
+				if ( pKV )
+					pKV->deleteThis();
 				return NULL;
 			}
 			// load file into a null-terminated buffer
@@ -236,23 +256,36 @@ KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameW
 
 			UTIL_DecodeICE( (unsigned char*)buffer, fileSize, pICEKey );
 
-			bool retOK = pKV->LoadFromBuffer( szFullName, buffer, filesystem );
+			bool retOK;
+			if ( pArena )
+			{
+				// the arena keeps its own copy of the text
+				pKV = pArena->LoadFromBuffer( szFullName, buffer, filesystem );
+				retOK = ( pKV != NULL );
+			}
+			else
+			{
+				retOK = pKV->LoadFromBuffer( szFullName, buffer, filesystem );
+			}
 
 			MemFreeScratch();
 
 			if ( !retOK )
 			{
-				pKV->deleteThis();
+				if ( pKV )
+					pKV->deleteThis();
 				return NULL;
 			}
 		}
 		else
 		{
-			pKV->deleteThis();
+			if ( pKV )
+				pKV->deleteThis();
 			return NULL;
 		}
 #else
-		pKV->deleteThis();
+		if ( pKV )
+			pKV->deleteThis();
 		return NULL;
 #endif
 	}
@@ -285,21 +318,22 @@ bool ReadWeaponDataFromFileForSlot( IFileSystem* filesystem, const char *szWeapo
 	char sz[128];
 	Q_snprintf( sz, sizeof( sz ), "scripts/%s", szWeaponName );
 
+	// Parse() copies everything it needs out, so the whole tree can come from
+	// one arena and be thrown away in one go
+	CKeyValuesArena arena;
 	KeyValues *pKV = ReadEncryptedKVFile( filesystem, sz, pICEKey,
 #if defined( DOD_DLL )
-		true			// Only read .ctx files!
+		true,			// Only read .ctx files!
 #else
-		false
+		false,
 #endif
-		);
+		&arena );
 
 	if ( !pKV )
 		return false;
 
 	pFileInfo->Parse( pKV, szWeaponName );
 
-	pKV->deleteThis();
-
 	return true;
 }
 
@@ -507,3 +541,165 @@ void FileWeaponInfo_t::Parse( KeyValues *pKeyValuesData, const char *szWeaponNam
 	}
 }
 
+
+#ifdef GAME_DLL
+//-----------------------------------------------------------------------------
+// Purpose: Times KeyValues text loads over a set of script files, once through
+//			the regular heap loader and once through a CKeyValuesArena. Files are
+//			read up front so only parsing and tree construction are measured.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( kv_load_benchmark, "Times KeyValues loading, heap vs. arena. Usage: kv_load_benchmark [wildcard] [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	const char *pWildcard = ( args.ArgC() > 1 ) ? args[1] : "scripts/*.txt";
+	int nIterations = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, 1000 ) : 20;
+
+	char szDir[MAX_PATH];
+	Q_strncpy( szDir, pWildcard, sizeof( szDir ) );
+	Q_StripFilename( szDir );
+
+	CUtlBuffer corpus;
+	CUtlVector< int > fileOffsets;
+
+	FileFindHandle_t findHandle;
+	for ( const char *pFileName = filesystem->FindFirstEx( pWildcard, "GAME", &findHandle ); pFileName; pFileName = filesystem->FindNext( findHandle ) )
+	{
+		if ( filesystem->FindIsDirectory( findHandle ) )
+			continue;
+
+		char szPath[MAX_PATH];
+		Q_ComposeFileName( szDir, pFileName, szPath, sizeof( szPath ) );
+
+		CUtlBuffer buf;
+		if ( !filesystem->ReadFile( szPath, "GAME", buf ) )
+			continue;
+
+		fileOffsets.AddToTail( corpus.TellPut() );
+		corpus.Put( buf.Base(), buf.TellPut() );
+		corpus.PutChar( 0 );
+	}
+	filesystem->FindClose( findHandle );
+
+	if ( !fileOffsets.Count() )
+	{
+		Msg( "kv_load_benchmark: no files match %s\n", pWildcard );
+		return;
+	}
+
+	const char *pCorpus = (const char *)corpus.Base();
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		for ( int j = 0; j < fileOffsets.Count(); j++ )
+		{
+			KeyValues *pKV = new KeyValues( "benchmark" );
+			pKV->LoadFromBuffer( pWildcard, pCorpus + fileOffsets[j], filesystem );
+			pKV->deleteThis();
+		}
+	}
+	double flHeap = Plat_FloatTime() - flStart;
+
+	CKeyValuesArena arena;
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		for ( int j = 0; j < fileOffsets.Count(); j++ )
+		{
+			arena.LoadFromBuffer( pWildcard, pCorpus + fileOffsets[j], filesystem );
+			arena.Clear();
+		}
+	}
+	double flArena = Plat_FloatTime() - flStart;
+
+	// one more pass to report how much memory the whole corpus takes in an arena
+	for ( int j = 0; j < fileOffsets.Count(); j++ )
+	{
+		arena.LoadFromBuffer( pWildcard, pCorpus + fileOffsets[j], filesystem );
+	}
+
+	Msg( "kv_load_benchmark: %d files, %d bytes, %d iterations\n", fileOffsets.Count(), corpus.TellPut() - fileOffsets.Count(), nIterations );
+	Msg( "  heap:  %.2f ms per pass\n", flHeap * 1000.0 / nIterations );
+	Msg( "  arena: %.2f ms per pass (%.2fx), %d bytes for the whole corpus\n", flArena * 1000.0 / nIterations, flArena > 0.0 ? flHeap / flArena : 0.0, arena.GetBytesUsed() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bakes script files into binary KeyValues images next to the text
+//			(name.txt -> name.txt.kvb), which arena loads then use instead of
+//			tokenizing the text. Conditionals are evaluated for the platform
+//			running the command, and #include/#base are merged in, so rebuild
+//			the images after editing any file they pull in.
+//-----------------------------------------------------------------------------
+static const char *s_pKVImageDefaultWildcards[] =
+{
+	"scripts/*.txt",
+	"resource/*.res",
+	"resource/ui/*.res",
+};
+
+static void BuildKVImages( const char *pWildcard, int &nBuilt, int &nFailed )
+{
+	char szDir[MAX_PATH];
+	Q_strncpy( szDir, pWildcard, sizeof( szDir ) );
+	Q_StripFilename( szDir );
+
+	FileFindHandle_t findHandle;
+	for ( const char *pFileName = filesystem->FindFirstEx( pWildcard, "GAME", &findHandle ); pFileName; pFileName = filesystem->FindNext( findHandle ) )
+	{
+		if ( filesystem->FindIsDirectory( findHandle ) )
+			continue;
+
+		char szPath[MAX_PATH];
+		Q_ComposeFileName( szDir, pFileName, szPath, sizeof( szPath ) );
+
+		KeyValues *pKV = new KeyValues( "kvimage" );
+		KeyValues::AutoDelete autoDelete( pKV );
+		if ( !pKV->LoadFromFile( filesystem, szPath, "GAME" ) )
+		{
+			Warning( "kv_build_images: couldn't parse %s\n", szPath );
+			nFailed++;
+			continue;
+		}
+
+		char szImage[MAX_PATH];
+		Q_snprintf( szImage, sizeof( szImage ), "%s%s", szPath, KVIMAGE_EXTENSION );
+
+		CUtlBuffer buf;
+		if ( !CKeyValuesImage::Write( pKV, buf ) || !filesystem->WriteFile( szImage, "MOD", buf ) )
+		{
+			Warning( "kv_build_images: couldn't write %s\n", szImage );
+			nFailed++;
+			continue;
+		}
+		nBuilt++;
+	}
+	filesystem->FindClose( findHandle );
+}
+
+CON_COMMAND_F( kv_build_images, "Builds binary KeyValues images of script files. Usage: kv_build_images [wildcard ...]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nBuilt = 0;
+	int nFailed = 0;
+	if ( args.ArgC() > 1 )
+	{
+		for ( int i = 1; i < args.ArgC(); i++ )
+		{
+			BuildKVImages( args[i], nBuilt, nFailed );
+		}
+	}
+	else
+	{
+		for ( int i = 0; i < ARRAYSIZE( s_pKVImageDefaultWildcards ); i++ )
+		{
+			BuildKVImages( s_pKVImageDefaultWildcards[i], nBuilt, nFailed );
+		}
+	}
+
+	Msg( "kv_build_images: %d images written, %d failed\n", nBuilt, nFailed );
+}
+#endif
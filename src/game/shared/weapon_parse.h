@@ -57,6 +57,7 @@ int GetWeaponSoundFromString( const char *pszString );
 
 class CHudTexture;
 class KeyValues;
+class CKeyValuesArena;
 
 //-----------------------------------------------------------------------------
 // Purpose: Contains the data read from the weapon's script file. 
@@ -171,10 +172,12 @@ void PrecacheFileWeaponInfoDatabase( IFileSystem *filesystem, const unsigned cha
 // Read a possibly-encrypted KeyValues file in. 
 // If pICEKey is NULL, then it appends .txt to the filename and loads it as an unencrypted file.
 // If pICEKey is non-NULL, then it appends .ctx to the filename and loads it as an encrypted file.
+// If pArena is non-NULL, the keys are loaded into it and go away when it is cleared.
+// Arena loads also pick up an up to date binary image of the .txt (see kv_build_images).
 //
 // (This should be moved into a more appropriate place).
 //
-KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameWithoutExtension, const unsigned char *pICEKey, bool bForceReadEncryptedFile = false );
+KeyValues* ReadEncryptedKVFile( IFileSystem *filesystem, const char *szFilenameWithoutExtension, const unsigned char *pICEKey, bool bForceReadEncryptedFile = false, CKeyValuesArena *pArena = NULL );
 
 
 // Each game implements this. It can return a derived class and override Parse() if it wants.
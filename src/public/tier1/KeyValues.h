@@ -39,6 +39,8 @@ class CUtlBuffer;
 class Color;
 typedef void * FileHandle_t;
 class CKeyValuesGrowableStringTable;
+class CKeyValuesArena;
+class CKeyValuesImage;
 
 //-----------------------------------------------------------------------------
 // Purpose: Simple recursive data access class
@@ -239,8 +241,12 @@ public:
 	types_t GetDataType(const char *keyName = NULL);
 
 	// Virtual deletion function - ensures that KeyValues object is deleted from correct heap
+	// Does nothing for keys owned by a CKeyValuesArena, the arena frees them all at once.
 	void deleteThis();
 
+	// true if this key lives in a CKeyValuesArena rather than the KeyValues heap
+	bool IsArenaAllocated() const { return m_nArena != 0; }
+
 	void SetStringValue( char const *strValue );
 
 	// unpack a key values list into a structure
@@ -256,6 +262,8 @@ public:
 	void RecursiveMergeKeyValues( KeyValues *baseKV );
 
 private:
+	friend class CKeyValuesArena;
+
 	KeyValues( KeyValues& );	// prevent copy constructor being used
 
 	// prevent delete being called except through deleteThis()
@@ -299,8 +307,11 @@ private:
 	const char * ReadToken( CUtlBuffer &buf, bool &wasQuoted, bool &wasConditional );
 	void WriteIndents( IBaseFileSystem *filesystem, FileHandle_t f, CUtlBuffer *pBuf, int indentLevel );
 
+	// Value storage; arena keys draw from their arena and never free individually
 	void FreeAllocatedValue();
-	void AllocateValueBlock(int size);
+	char *AllocateStringValue( int nLen );
+	wchar_t *AllocateWStringValue( int nLen );
+	KeyValues *AllocateKey( const char *keyName );
 
 	int m_iKeyName;	// keyname is a symbol defined in KeyValuesSystem
 
@@ -320,7 +331,7 @@ private:
 	char	   m_iDataType;
 	char	   m_bHasEscapeSequences; // true, if while parsing this KeyValue, Escape Sequences are used (default false)
 	char	   m_bEvaluateConditionals; // true, if while parsing this KeyValue, conditionals blocks are evaluated (default true)
-	char	   unused[1];
+	unsigned char m_nArena;			// slot of the CKeyValuesArena that owns this key, 0 for heap keys
 
 	KeyValues *m_pPeer;	// pointer to next key in list
 	KeyValues *m_pSub;	// pointer to Start of a new sub key list
@@ -349,6 +360,99 @@ public:
 
 typedef KeyValues::AutoDelete KeyValuesAD;
 
+//-----------------------------------------------------------------------------
+// Purpose: Bump allocator that owns whole KeyValues trees loaded from text.
+//
+//	Every key, the source text and every string value of a tree live in a few
+//	large blocks that are released together by Clear() or the destructor, so
+//	freeing a tree costs the same no matter how many keys it has. The text is
+//	parsed in place: string values that need no escape processing point
+//	straight into the arena's copy of the file instead of being duplicated.
+//
+//	Keys owned by an arena can be read and modified like any other KeyValues,
+//	but deleteThis() on them does nothing, and they must not be handed to code
+//	that takes ownership of KeyValues (or to another module, see
+//	SetUseGrowableStringTable). MakeCopy() gives you a regular heap tree.
+//-----------------------------------------------------------------------------
+class CKeyValuesArena
+{
+public:
+	CKeyValuesArena( int nBlockSize = 64 * 1024 );
+	~CKeyValuesArena();
+
+	// Same rules as KeyValues::LoadFromFile/LoadFromBuffer. Returns the first top
+	// level key (the remaining top level keys are its peers), NULL on failure.
+	KeyValues *LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID = NULL );
+	KeyValues *LoadFromBuffer( char const *resourceName, const char *pBuffer, IBaseFileSystem* pFileSystem = NULL, const char *pPathID = NULL );
+
+	void UsesEscapeSequences( bool state ) { m_bHasEscapeSequences = state; }	// default false
+	void UsesConditionals( bool state ) { m_bEvaluateConditionals = state; }	// default true
+
+	// When set, LoadFromFile() first looks for a prebuilt binary image of the
+	// file (resourceName + KVIMAGE_EXTENSION, see kvimage.h) that is at least
+	// as new as the text, and only tokenizes the text if there isn't one.
+	void UsesImages( bool state ) { m_bUseImages = state; }	// default false
+
+	// Builds a tree from an image that lives elsewhere (mmapped, ...). Strings
+	// are copied into the arena, so the image can go away afterwards.
+	KeyValues *LoadFromImage( const CKeyValuesImage &image );
+
+	// Releases every tree loaded from this arena. Keeps the first block around for reuse.
+	void Clear();
+
+	// Raw allocation out of the arena, lives until Clear()
+	void *Alloc( int nBytes, int nAlign = 4 );
+	KeyValues *AllocKeyValues( const char *setName );
+
+	int GetBytesUsed() const;
+	int GetBytesAllocated() const;
+
+	static CKeyValuesArena *FromKeyValues( const KeyValues *pKV );
+
+private:
+	struct Block_t
+	{
+		Block_t *m_pNext;
+		int m_nSize;
+		int m_nUsed;
+	};
+
+	CKeyValuesArena( const CKeyValuesArena & );	// forbid
+	CKeyValuesArena &operator=( const CKeyValuesArena & );	// forbid
+
+	void Register();
+	char *AllocText( int nLen );
+	KeyValues *ParseText( char const *resourceName, char *pText, IBaseFileSystem* pFileSystem, const char *pPathID );
+	KeyValues *CopyTree( KeyValues *pSrc );
+	KeyValues *LoadImageFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID );
+	KeyValues *BuildFromImage( const CKeyValuesImage &image, const char *pStrings );
+	void RecursiveParse( KeyValues *pParent );
+	char *ReadToken( bool &wasQuoted, bool &wasConditional );
+	char *CopyToken( const char *pStart, const char *pEnd );
+	char *AllocUTF8FromUnicode( const wchar_t *pUnicode );
+	void SetValueFromToken( KeyValues *pKey, char *pValue );
+	int GetKeySymbol( const char *pName );
+
+	Block_t *m_pHead;		// block currently being filled, newest first
+	int m_nBlockSize;
+	int m_nArena;			// registry slot stamped into every key we own
+
+	// Parser state
+	char *m_pParse;
+	char *m_pPeekToken;
+	bool m_bHavePeek;
+	bool m_bPeekQuoted;
+	bool m_bPeekConditional;
+	bool m_bUnterminated;	// a quoted token ran into the end of the text
+	bool m_bHasEscapeSequences;
+	bool m_bEvaluateConditionals;
+	bool m_bUseImages;
+
+	// Direct mapped cache in front of the key name symbol table
+	enum { SYMBOL_CACHE_SIZE = 256 };
+	int m_SymbolCache[SYMBOL_CACHE_SIZE];
+};
+
 enum KeyValuesUnpackDestinationTypes_t
 {
 	UNPACK_TYPE_FLOAT,										// dest is a float
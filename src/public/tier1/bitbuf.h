@@ -217,6 +217,15 @@ public:
 	void			WriteBitVec3Normal( const Vector& fa );
 	void			WriteBitAngles( const QAngle& fa );
 
+	// Bulk versions of the above. The output is bit-for-bit the same as writing each
+	// element on its own, but the fields are packed into a 64-bit accumulator and
+	// only go to the buffer a dword at a time.
+	void			WriteBitCoordArray( const float *pValues, int nCount );
+	void			WriteBitVec3CoordArray( const Vector *pValues, int nCount );
+	void			WriteBitVec3NormalArray( const Vector *pValues, int nCount );
+	void			WriteBitAngleArray( const float *pAngles, int nCount, int numbits );
+	void			WriteVarInt32Array( const uint32 *pValues, int nCount );
+
 
 // Byte functions.
 public:
@@ -592,6 +601,13 @@ public:
 	void			ReadBitVec3Normal( Vector& fa );
 	void			ReadBitAngles( QAngle& fa );
 
+	// Bulk readers, matching the bf_write array writers
+	void			ReadBitCoordArray( float *pValues, int nCount );
+	void			ReadBitVec3CoordArray( Vector *pValues, int nCount );
+	void			ReadBitVec3NormalArray( Vector *pValues, int nCount );
+	void			ReadBitAngleArray( float *pAngles, int nCount, int numbits );
+	void			ReadVarInt32Array( uint32 *pValues, int nCount );
+
 	// Faster for comparisons but do not fully decode float values
 	unsigned int	ReadBitCoordBits();
 	unsigned int	ReadBitCoordMPBits( bool bIntegral, bool bLowPrecision );
@@ -0,0 +1,224 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Flat, position independent binary image of a KeyValues tree.
+//			Shipped script data (scripts/*.txt, resource/*.res) can be baked
+//			into images ahead of time and read in place, from an mmapped file
+//			or a single read, instead of being re-tokenized on every load.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef KVIMAGE_H
+#define KVIMAGE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/commonmacros.h"
+#include "KeyValues.h"
+
+class CUtlBuffer;
+
+//-----------------------------------------------------------------------------
+// On disk layout. Everything is an offset from the start of the image, nothing
+// is a pointer, so the image can be used from wherever it ends up in memory.
+// Images are written in the byte order of the machine that built them; an
+// image with the wrong order fails the magic check and the caller falls back
+// to the text file. Bump KVIMAGE_VERSION whenever any of these change.
+//-----------------------------------------------------------------------------
+#define KVIMAGE_MAGIC				MAKEID( 'K', 'V', 'B', 'I' )
+#define KVIMAGE_VERSION				1
+#define KVIMAGE_EXTENSION			".kvb"		// appended to the text file name
+
+// Header flags, the text load settings the image was built with
+#define KVIMAGE_ESCAPE_SEQUENCES	0x0001
+#define KVIMAGE_NO_CONDITIONALS		0x0002
+
+// Node flags
+#define KVIMAGE_NODE_LAST			0x01		// last key in its parent (or last top level key)
+
+struct KVImageHeader_t
+{
+	int m_nMagic;
+	int m_nVersion;
+	int m_nImageSize;
+	int m_nFlags;			// KVIMAGE_ESCAPE_SEQUENCES, ...
+
+	int m_nNodeCount;
+	int m_nRootCount;		// top level keys are nodes [0, m_nRootCount)
+	int m_nNodeOffset;		// KVImageNode_t[m_nNodeCount]
+
+	int m_nSortedCount;
+	int m_nSortedOffset;	// int[m_nSortedCount], node indices, see KVImageNode_t::m_nSorted
+
+	int m_nSymbolCount;
+	int m_nSymbolOffset;	// KVImageSymbol_t[m_nSymbolCount], sorted by hash
+
+	int m_nStringBytes;
+	int m_nStringOffset;	// 8 byte aligned string data, offset 0 is always ""
+};
+
+// One entry per distinct (caseless) key name in the image
+struct KVImageSymbol_t
+{
+	unsigned int m_nHash;	// HashStringCaseless() of the name
+	int m_nName;			// string table offset
+};
+
+// Nodes are laid out breadth first, so the children of a node are contiguous
+struct KVImageNode_t
+{
+	int m_nSymbol;			// key name, index into the symbol table
+	unsigned char m_nType;	// KeyValues::types_t
+	unsigned char m_nFlags;	// KVIMAGE_NODE_LAST
+	unsigned short m_nUnused;
+	int m_nString;			// string table offset of the value as KeyValues::GetString() would print it
+	union
+	{
+		int m_nInt;
+		float m_flFloat;
+		int m_nUint64;		// TYPE_UINT64: string table offset of the 8 byte aligned value
+		unsigned char m_Color[4];
+	};
+	int m_nFirstChild;		// node index of the first child
+	int m_nChildCount;
+	int m_nSorted;			// the children, sorted by symbol, are m_Sorted[m_nSorted .. m_nSorted + m_nChildCount)
+};
+
+class CKeyValuesImage;
+
+//-----------------------------------------------------------------------------
+// Purpose: Read only handle to one key of an image. Two ints, pass it by value.
+//			Mirrors the read half of the KeyValues API; lookups binary search
+//			the sorted key table instead of walking the peer list.
+//-----------------------------------------------------------------------------
+class KVImageKey
+{
+public:
+	KVImageKey() : m_pImage( NULL ), m_nNode( -1 ) {}
+	KVImageKey( const CKeyValuesImage *pImage, int nNode ) : m_pImage( pImage ), m_nNode( nNode ) {}
+
+	bool IsValid() const { return m_pImage != NULL && m_nNode >= 0; }
+	int GetIndex() const { return m_nNode; }
+
+	const char *GetName() const;
+	KeyValues::types_t GetDataType() const;
+
+	// Same semantics as KeyValues::FindKey(), including "a/b/c" paths. The
+	// symbol version takes a value from CKeyValuesImage::FindSymbol().
+	KVImageKey FindKey( const char *pKeyName ) const;
+	KVImageKey FindKeyBySymbol( int nImageSymbol ) const;
+
+	KVImageKey GetFirstSubKey() const;
+	KVImageKey GetNextKey() const;
+	KVImageKey GetFirstTrueSubKey() const;
+	KVImageKey GetNextTrueSubKey() const;
+	KVImageKey GetFirstValue() const;
+	KVImageKey GetNextValue() const;
+
+	// Same conversions as the KeyValues getters. A NULL key name reads this key.
+	int GetInt( const char *pKeyName = NULL, int nDefaultValue = 0 ) const;
+	uint64 GetUint64( const char *pKeyName = NULL, uint64 nDefaultValue = 0 ) const;
+	float GetFloat( const char *pKeyName = NULL, float flDefaultValue = 0.0f ) const;
+	const char *GetString( const char *pKeyName = NULL, const char *pDefaultValue = "" ) const;
+	bool GetBool( const char *pKeyName = NULL, bool bDefaultValue = false ) const { return GetInt( pKeyName, bDefaultValue ? 1 : 0 ) ? true : false; }
+	Color GetColor( const char *pKeyName = NULL ) const;
+	bool IsEmpty( const char *pKeyName = NULL ) const;
+
+private:
+	const KVImageNode_t &Node() const;
+	KVImageKey Resolve( const char *pKeyName ) const;
+
+	const CKeyValuesImage *m_pImage;
+	int m_nNode;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Validated view of an image in memory. Does not copy or own the
+//			data, which has to stay put (and 8 byte aligned) for as long as
+//			the view and any key handles from it are in use.
+//-----------------------------------------------------------------------------
+class CKeyValuesImage
+{
+public:
+	CKeyValuesImage();
+
+	// Checks every offset in the image once, so lookups don't have to.
+	// Returns false, and leaves the view empty, for anything malformed.
+	bool Init( const void *pData, int nSize );
+	void Shutdown();
+	bool IsValid() const { return m_pHeader != NULL; }
+
+	int GetFlags() const { return m_pHeader->m_nFlags; }
+	int GetImageSize() const { return m_pHeader->m_nImageSize; }
+	int GetNodeCount() const { return m_pHeader->m_nNodeCount; }
+	int GetSymbolCount() const { return m_pHeader->m_nSymbolCount; }
+
+	// First top level key, the others are its GetNextKey() chain
+	KVImageKey GetRoot() const { return KVImageKey( this, m_pHeader->m_nRootCount ? 0 : -1 ); }
+
+	// Image symbol of a key name, -1 if no key in the image has that name
+	int FindSymbol( const char *pName ) const;
+	const char *GetSymbolString( int nImageSymbol ) const { return GetString( m_pSymbols[nImageSymbol].m_nName ); }
+
+	const KVImageNode_t &GetNode( int nNode ) const { return m_pNodes[nNode]; }
+	const char *GetString( int nOffset ) const { return m_pStrings + nOffset; }
+	const char *GetStringTable() const { return m_pStrings; }
+	int GetStringTableSize() const { return m_pHeader->m_nStringBytes; }
+	int FindChild( int nParent, int nImageSymbol ) const;
+
+	// Bakes pRoot and its peers into an image. nFlags records the text load
+	// settings (KVIMAGE_ESCAPE_SEQUENCES, ...) so loaders can reject images
+	// built with different ones. TYPE_PTR values don't survive and are written
+	// empty, wide strings are stored as UTF-8 strings.
+	static bool Write( KeyValues *pRoot, CUtlBuffer &buf, int nFlags = 0 );
+
+private:
+	const KVImageHeader_t *m_pHeader;
+	const KVImageNode_t *m_pNodes;
+	const int *m_pSorted;
+	const KVImageSymbol_t *m_pSymbols;
+	const char *m_pStrings;
+};
+
+//-----------------------------------------------------------------------------
+// inline methods
+//-----------------------------------------------------------------------------
+inline const KVImageNode_t &KVImageKey::Node() const
+{
+	return m_pImage->GetNode( m_nNode );
+}
+
+inline const char *KVImageKey::GetName() const
+{
+	return m_pImage->GetSymbolString( Node().m_nSymbol );
+}
+
+inline KeyValues::types_t KVImageKey::GetDataType() const
+{
+	return (KeyValues::types_t)Node().m_nType;
+}
+
+inline KVImageKey KVImageKey::FindKeyBySymbol( int nImageSymbol ) const
+{
+	if ( !IsValid() || nImageSymbol < 0 )
+		return KVImageKey();
+	return KVImageKey( m_pImage, m_pImage->FindChild( m_nNode, nImageSymbol ) );
+}
+
+inline KVImageKey KVImageKey::GetFirstSubKey() const
+{
+	if ( !IsValid() || !Node().m_nChildCount )
+		return KVImageKey();
+	return KVImageKey( m_pImage, Node().m_nFirstChild );
+}
+
+inline KVImageKey KVImageKey::GetNextKey() const
+{
+	if ( !IsValid() || ( Node().m_nFlags & KVIMAGE_NODE_LAST ) )
+		return KVImageKey();
+	return KVImageKey( m_pImage, m_nNode + 1 );
+}
+
+#endif // KVIMAGE_H
@@ -80,6 +80,10 @@ public:
 	// Remove an element from a particular bucket
 	void RemoveElementFromBucket( CBucketHandlePram bucket, CElementHandlePram element );
 
+	// Remove an element from the bucket referenced by a FirstBucket/NextBucket iterator.
+	// Returns the iterator of the next bucket associated with the element.
+	I RemoveBucketFromElement( CElementHandlePram element, I idx );
+
 	// Remove an element from all buckets
 	void RemoveElement( CElementHandlePram element );
 	void RemoveBucket( CBucketHandlePram element );
@@ -241,8 +245,46 @@ bool CBidirectionalSet<CBucketHandle,CElementHandle,S,I>::IsElementInBucket( CBu
 template< class CBucketHandle, class CElementHandle, class S, class I >
 void CBidirectionalSet<CBucketHandle,CElementHandle,S,I>::RemoveElementFromBucket( CBucketHandlePram bucket, CElementHandlePram element )
 {
-	// FIXME: Implement me!
-	Assert(0);
+	Assert( m_FirstBucket && m_FirstElement );
+
+	// Search through the (usually short) list of buckets the element is in
+	I i = m_FirstBucket( element );
+	while ( i != m_BucketsUsedByElement.InvalidIndex() )
+	{
+		if ( m_BucketsUsedByElement[i].m_Bucket == bucket )
+		{
+			RemoveBucketFromElement( element, i );
+			return;
+		}
+		i = m_BucketsUsedByElement.Next( i );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Remove an element from the bucket referenced by an iterator
+//-----------------------------------------------------------------------------
+template< class CBucketHandle, class CElementHandle, class S, class I >
+I CBidirectionalSet<CBucketHandle,CElementHandle,S,I>::RemoveBucketFromElement( CElementHandlePram element, I idx )
+{
+	Assert( m_FirstBucket && m_FirstElement );
+	Assert( m_BucketsUsedByElement.IsValidIndex( idx ) );
+
+	CBucketHandlePram bucket = m_BucketsUsedByElement[idx].m_Bucket;
+	I elementListIndex = m_BucketsUsedByElement[idx].m_ElementListIndex;
+
+	// Unhook the element from the bucket's list of elements
+	if ( elementListIndex == m_FirstElement( bucket ) )
+		m_FirstElement( bucket ) = m_ElementsInBucket.Next( elementListIndex );
+	m_ElementsInBucket.Free( elementListIndex );
+
+	// Unhook the bucket from the element's list of buckets
+	I next = m_BucketsUsedByElement.Next( idx );
+	if ( idx == m_FirstBucket( element ) )
+		m_FirstBucket( element ) = next;
+	m_BucketsUsedByElement.Free( idx );
+
+	return next;
 }
 
 
@@ -0,0 +1,128 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Concurrent string intern table. Lookups never lock; inserts lock
+//			one of a set of shards, picked by hash, so threads adding
+//			different strings rarely meet.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef UTLSTRINGINTERN_H
+#define UTLSTRINGINTERN_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+
+
+//-----------------------------------------------------------------------------
+// CUtlStringInternTable:
+// description:
+//    Maps strings to dense ids (0, 1, 2, ... in insertion order) and back.
+//    Every string is stored once and its pointer stays valid until
+//    RemoveAll(), so interned pointers can be compared directly.
+//
+//    AddString(), Find() and String() may be called from any number of
+//    threads at once. RemoveAll() and the destructor may not overlap with
+//    anything else.
+//-----------------------------------------------------------------------------
+class CUtlStringInternTable
+{
+public:
+	enum
+	{
+		INVALID_ID = -1,
+		SHARD_BITS = 4,
+		SHARD_COUNT = 1 << SHARD_BITS,
+	};
+
+	// nMaxStrings bounds the ids handed out; adding more than that fails
+	CUtlStringInternTable( bool bCaseInsensitive = false, int nMaxStrings = 1 << 20 );
+	~CUtlStringInternTable();
+
+	// Finds and/or adds the string. INVALID_ID for NULL or when full.
+	int AddString( const char *pString );
+
+	// INVALID_ID if the string was never added
+	int Find( const char *pString ) const;
+
+	// Only for ids this table handed out
+	const char *String( int nId ) const
+	{
+		Assert( nId >= 0 && nId < Count() );
+		return m_pEntryBlocks[ nId >> ENTRY_BLOCK_SHIFT ][ nId & ( ENTRY_BLOCK_SIZE - 1 ) ].m_pString;
+	}
+
+	// Shortcuts for callers that only deal in interned pointers
+	const char *AddStringPointer( const char *pString ) { int nId = AddString( pString ); return ( nId != INVALID_ID ) ? String( nId ) : NULL; }
+	const char *FindStringPointer( const char *pString ) const { int nId = Find( pString ); return ( nId != INVALID_ID ) ? String( nId ) : NULL; }
+
+	int Count() const { return MIN( (int)m_nNextId, m_nMaxStrings ); }
+	int GetMemoryUsage() const;
+
+	void RemoveAll();
+
+private:
+	enum
+	{
+		ENTRY_BLOCK_SHIFT = 10,
+		ENTRY_BLOCK_SIZE = 1 << ENTRY_BLOCK_SHIFT,
+		MIN_SLOT_COUNT = 64,
+		STRING_POOL_SIZE = 16 * 1024,
+	};
+
+	// id -> string. Written once, before the id is published to any shard.
+	struct Entry_t
+	{
+		const char *m_pString;
+		unsigned int m_nHash;
+	};
+
+	// Open addressing table of ids (INVALID_ID when free). Replaced, never
+	// resized in place, so a reader holding an old one still sees a
+	// consistent table; old ones are kept until RemoveAll().
+	struct SlotTable_t
+	{
+		int m_nMask;
+		int m_nUsed;
+		SlotTable_t *m_pRetired;
+		int volatile m_Slots[1];
+	};
+
+	struct StringPool_t
+	{
+		StringPool_t *m_pNext;
+		int m_nSize;
+		int m_nUsed;
+	};
+
+	struct Shard_t
+	{
+		SlotTable_t * volatile m_pTable;
+		CThreadFastMutex m_Lock;
+		StringPool_t *m_pPools;
+		int m_nPoolBytes;
+	};
+
+	CUtlStringInternTable( const CUtlStringInternTable & );	// forbid
+	CUtlStringInternTable &operator=( const CUtlStringInternTable & );	// forbid
+
+	unsigned int HashString( const char *pString ) const;
+	bool StringsMatch( const char *pLeft, const char *pRight ) const;
+	int FindInTable( const SlotTable_t *pTable, const char *pString, unsigned int nHash, int *pFreeSlot ) const;
+	static SlotTable_t *AllocSlotTable( int nSlots );
+	void GrowShard( Shard_t &shard );
+	const char *CopyString( Shard_t &shard, const char *pString );
+	Entry_t *AllocEntry( int nId );
+	const Entry_t &GetEntry( int nId ) const { return m_pEntryBlocks[ nId >> ENTRY_BLOCK_SHIFT ][ nId & ( ENTRY_BLOCK_SIZE - 1 ) ]; }
+
+	Shard_t m_Shards[SHARD_COUNT];
+	Entry_t * volatile *m_pEntryBlocks;
+	int m_nMaxStrings;
+	int volatile m_nNextId;
+	bool m_bInsensitive;
+};
+
+#endif // UTLSTRINGINTERN_H
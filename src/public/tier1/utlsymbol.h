@@ -16,6 +16,7 @@
 #include "tier0/threadtools.h"
 #include "tier1/utlrbtree.h"
 #include "tier1/utlvector.h"
+#include "tier1/utlstringintern.h"
 
 
 //-----------------------------------------------------------------------------
@@ -23,6 +24,7 @@
 //-----------------------------------------------------------------------------
 class CUtlSymbolTable;
 class CUtlSymbolTableMT;
+class CUtlSymbolTableInterned;
 
 
 //-----------------------------------------------------------------------------
@@ -67,10 +69,10 @@ protected:
 	static void Initialize();
 	
 	// returns the current symbol table
-	static CUtlSymbolTableMT* CurrTable();
+	static CUtlSymbolTableInterned* CurrTable();
 		
 	// The standard global symbol table
-	static CUtlSymbolTableMT* s_pSymbolTable; 
+	static CUtlSymbolTableInterned* s_pSymbolTable; 
 
 	static bool s_bAllowStaticSymbolTable;
 
@@ -211,6 +213,46 @@ private:
 #endif
 };
 
+//-----------------------------------------------------------------------------
+// CUtlSymbolTableInterned:
+// description:
+//    Thread safe symbol table for the global CUtlSymbol table. Backed by a
+//    CUtlStringInternTable, so lookups don't lock at all and adds only lock
+//    one shard; symbols are still dense ids handed out in insertion order.
+//    CUtlSymbolTableMT keeps its old layout, prebuilt libraries (dmxloader)
+//    have statics of it compiled against its inline methods.
+//-----------------------------------------------------------------------------
+class CUtlSymbolTableInterned
+{
+public:
+	CUtlSymbolTableInterned( int growSize = 0, int initSize = 32, bool caseInsensitive = false )
+		: m_Strings( caseInsensitive, UTL_INVAL_SYMBOL )
+	{
+	}
+
+	CUtlSymbol AddString( const char* pString )
+	{
+		int nId = m_Strings.AddString( pString );
+		return CUtlSymbol( ( nId == CUtlStringInternTable::INVALID_ID ) ? UTL_INVAL_SYMBOL : (UtlSymId_t)nId );
+	}
+
+	CUtlSymbol Find( const char* pString ) const
+	{
+		int nId = m_Strings.Find( pString );
+		return CUtlSymbol( ( nId == CUtlStringInternTable::INVALID_ID ) ? UTL_INVAL_SYMBOL : (UtlSymId_t)nId );
+	}
+
+	const char* String( CUtlSymbol id ) const
+	{
+		if ( !id.IsValid() )
+			return "";
+		return m_Strings.String( (UtlSymId_t)id );
+	}
+	
+private:
+	CUtlStringInternTable m_Strings;
+};
+
 
 
 //-----------------------------------------------------------------------------
@@ -16,6 +16,7 @@
 #endif
 
 #include <KeyValues.h>
+#include "kvimage.h"
 #include "filesystem.h"
 #include <vstdlib/IKeyValuesSystem.h>
 
@@ -29,6 +30,14 @@
 #include "UtlSortVector.h"
 #include "convar.h"
 
+#if !defined( _X360 )
+#include <emmintrin.h>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+#define KEYVALUES_SSE2_SCAN 1
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
 
@@ -448,9 +457,7 @@ void KeyValues::Init()
 	
 	m_bHasEscapeSequences = false;
 	m_bEvaluateConditionals = true;
-
-	// for future proof
-	memset( unused, 0, sizeof(unused) );
+	m_nArena = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -474,20 +481,17 @@ void KeyValues::RemoveEverything()
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		dat->deleteThis();
 	}
 
 	for ( dat = m_pPeer; dat && dat != this; dat = datNext )
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		dat->deleteThis();
 	}
 
-	delete [] m_sValue;
-	m_sValue = NULL;
-	delete [] m_wsValue;
-	m_wsValue = NULL;
+	FreeAllocatedValue();
 }
 
 //-----------------------------------------------------------------------------
@@ -964,7 +968,7 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 		if (bCreate)
 		{
 			// we need to create a new key
-			dat = new KeyValues( searchStr );
+			dat = AllocateKey( searchStr );
 //			Assert(dat != NULL);
 
 			dat->UsesEscapeSequences( m_bHasEscapeSequences != 0 );	// use same format as parent
@@ -1044,7 +1048,7 @@ KeyValues* KeyValues::CreateKey( const char *keyName )
 KeyValues* KeyValues::CreateKeyUsingKnownLastChild( const char *keyName, KeyValues *pLastChild )
 {
 	// Create a new key
-	KeyValues* dat = new KeyValues( keyName );
+	KeyValues* dat = AllocateKey( keyName );
 
 	dat->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // use same format as parent does
 	dat->UsesConditionals( m_bEvaluateConditionals != 0 );
@@ -1506,11 +1510,8 @@ void KeyValues::SetColor( const char *keyName, Color value)
 
 void KeyValues::SetStringValue( char const *strValue )
 {
-	// delete the old value
-	delete [] m_sValue;
-	// make sure we're not storing the WSTRING  - as we're converting over to STRING
-	delete [] m_wsValue;
-	m_wsValue = NULL;
+	// delete the old value, make sure we're not storing the WSTRING  - as we're converting over to STRING
+	FreeAllocatedValue();
 
 	if (!strValue)
 	{
@@ -1520,7 +1521,7 @@ void KeyValues::SetStringValue( char const *strValue )
 
 	// allocate memory for the new value and copy it in
 	int len = Q_strlen( strValue );
-	m_sValue = new char[len + 1];
+	m_sValue = AllocateStringValue( len + 1 );
 	Q_memcpy( m_sValue, strValue, len+1 );
 
 	m_iDataType = TYPE_STRING;
@@ -1540,11 +1541,8 @@ void KeyValues::SetString( const char *keyName, const char *value )
 			return;
 		}
 
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, make sure we're not storing the WSTRING  - as we're converting over to STRING
+		dat->FreeAllocatedValue();
 
 		if (!value)
 		{
@@ -1554,7 +1552,7 @@ void KeyValues::SetString( const char *keyName, const char *value )
 
 		// allocate memory for the new value and copy it in
 		int len = Q_strlen( value );
-		dat->m_sValue = new char[len + 1];
+		dat->m_sValue = dat->AllocateStringValue( len + 1 );
 		Q_memcpy( dat->m_sValue, value, len+1 );
 
 		dat->m_iDataType = TYPE_STRING;
@@ -1569,11 +1567,8 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 	KeyValues *dat = FindKey( keyName, true );
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_wsValue;
-		// make sure we're not storing the STRING  - as we're converting over to WSTRING
-		delete [] dat->m_sValue;
-		dat->m_sValue = NULL;
+		// delete the old value, make sure we're not storing the STRING  - as we're converting over to WSTRING
+		dat->FreeAllocatedValue();
 
 		if (!value)
 		{
@@ -1583,7 +1578,7 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 
 		// allocate memory for the new value and copy it in
 		int len = wcslen( value );
-		dat->m_wsValue = new wchar_t[len + 1];
+		dat->m_wsValue = dat->AllocateWStringValue( len + 1 );
 		Q_memcpy( dat->m_wsValue, value, (len+1) * sizeof(wchar_t) );
 
 		dat->m_iDataType = TYPE_WSTRING;
@@ -1613,13 +1608,10 @@ void KeyValues::SetUint64( const char *keyName, uint64 value )
 
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, make sure we're not storing the WSTRING  - as we're converting over to STRING
+		dat->FreeAllocatedValue();
 
-		dat->m_sValue = new char[sizeof(uint64)];
+		dat->m_sValue = dat->AllocateStringValue( sizeof(uint64) );
 		*((uint64 *)dat->m_sValue) = value;
 		dat->m_iDataType = TYPE_UINT64;
 	}
@@ -1886,7 +1878,10 @@ bool KeyValues::IsEmpty(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::Clear( void )
 {
-	delete m_pSub;
+	if ( m_pSub )
+	{
+		m_pSub->deleteThis();
+	}
 	m_pSub = NULL;
 	m_iDataType = TYPE_NONE;
 }
@@ -1908,9 +1903,62 @@ KeyValues::types_t KeyValues::GetDataType(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::deleteThis()
 {
+	// arena keys go away with their arena
+	if ( m_nArena )
+		return;
+
 	delete this;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Frees the string/wide string value. Arena keys just drop theirs,
+//			the memory is reclaimed when the arena is cleared.
+//-----------------------------------------------------------------------------
+void KeyValues::FreeAllocatedValue()
+{
+	if ( !m_nArena )
+	{
+		delete [] m_sValue;
+		delete [] m_wsValue;
+	}
+	m_sValue = NULL;
+	m_wsValue = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Allocates value storage from wherever this key itself lives
+//-----------------------------------------------------------------------------
+char *KeyValues::AllocateStringValue( int nLen )
+{
+	CKeyValuesArena *pArena = m_nArena ? CKeyValuesArena::FromKeyValues( this ) : NULL;
+	if ( pArena )
+		return (char *)pArena->Alloc( nLen );
+
+	return new char[nLen];
+}
+
+wchar_t *KeyValues::AllocateWStringValue( int nLen )
+{
+	CKeyValuesArena *pArena = m_nArena ? CKeyValuesArena::FromKeyValues( this ) : NULL;
+	if ( pArena )
+		return (wchar_t *)pArena->Alloc( nLen * sizeof( wchar_t ) );
+
+	return new wchar_t[nLen];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Creates a new key from the same storage as this one, so keys added
+//			to an arena tree are released along with it
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::AllocateKey( const char *keyName )
+{
+	CKeyValuesArena *pArena = m_nArena ? CKeyValuesArena::FromKeyValues( this ) : NULL;
+	if ( pArena )
+		return pArena->AllocKeyValues( keyName );
+
+	return new KeyValues( keyName );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : includedKeys - 
@@ -2142,7 +2190,7 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBase
 
 		if ( !pCurrentKey )
 		{
-			pCurrentKey = new KeyValues( s );
+			pCurrentKey = AllocateKey( s );
 			Assert( pCurrentKey );
 
 			pCurrentKey->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // same format has parent use
@@ -2328,11 +2376,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 				break;
 			}
 			
-			if (dat->m_sValue)
-			{
-				delete[] dat->m_sValue;
-				dat->m_sValue = NULL;
-			}
+			dat->FreeAllocatedValue();
 
 			int len = Q_strlen( value );
 
@@ -2372,7 +2416,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 							digit -= 'A' - ( '9' + 1 );
 					retVal = ( retVal * 16 ) + ( digit - '0' );
 				}
-				dat->m_sValue = new char[sizeof(uint64)];
+				dat->m_sValue = dat->AllocateStringValue( sizeof(uint64) );
 				*((uint64 *)dat->m_sValue) = retVal;
 				dat->m_iDataType = TYPE_UINT64;
 			}
@@ -2394,7 +2438,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			if (dat->m_iDataType == TYPE_STRING)
 			{
 				// copy in the string information
-				dat->m_sValue = new char[len+1];
+				dat->m_sValue = dat->AllocateStringValue( len + 1 );
 				Q_memcpy( dat->m_sValue, value, len+1 );
 			}
 
@@ -2639,6 +2683,978 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, int nStackDepth )
 	return buffer.IsValid();
 }
 
+//-----------------------------------------------------------------------------
+// KeyValues arena
+//
+// Arenas are found from their keys through a small registry; the slot is kept
+// in a spare byte of every key so sizeof(KeyValues) doesn't change. Keys of an
+// arena that didn't get a slot still skip deletion, but fall back to the heap
+// for anything allocated after load.
+//-----------------------------------------------------------------------------
+#define KEYVALUES_ARENA_UNREGISTERED	255
+
+static CKeyValuesArena *s_pKeyValuesArenas[KEYVALUES_ARENA_UNREGISTERED];
+static CThreadFastMutex s_KeyValuesArenaMutex;
+
+// Character classes for the in place tokenizer
+enum
+{
+	KVCHAR_SPACE = 0x01,	// isspace() in the C locale
+	KVCHAR_BREAK = 0x02,	// ends an unquoted token
+};
+
+static unsigned char s_KeyValuesCharClass[256];
+static char s_szKeyValuesOpenBrace[] = "{";
+static char s_szKeyValuesCloseBrace[] = "}";
+
+static void InitKeyValuesCharClass()
+{
+	if ( s_KeyValuesCharClass[0] )
+		return;
+
+	const char *pSpaces = " \t\n\v\f\r";
+	for ( const char *p = pSpaces; *p; p++ )
+	{
+		s_KeyValuesCharClass[(unsigned char)*p] = KVCHAR_SPACE | KVCHAR_BREAK;
+	}
+	s_KeyValuesCharClass['"'] = KVCHAR_BREAK;
+	s_KeyValuesCharClass['{'] = KVCHAR_BREAK;
+	s_KeyValuesCharClass['}'] = KVCHAR_BREAK;
+	s_KeyValuesCharClass[0] = KVCHAR_BREAK;
+}
+
+#ifdef KEYVALUES_SSE2_SCAN
+static inline int KeyValuesFirstBit( unsigned int nMask )
+{
+#ifdef _WIN32
+	unsigned long nBit;
+	_BitScanForward( &nBit, nMask );
+	return (int)nBit;
+#else
+	return __builtin_ctz( nMask );
+#endif
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the first c0, c1 or terminator at or after p. Arena text is
+//			followed by 16 zero bytes, so the unaligned loads can't run off the
+//			end of the buffer before they see a terminator.
+//-----------------------------------------------------------------------------
+static inline char *KeyValuesScanFor( char *p, char c0, char c1 )
+{
+#ifdef KEYVALUES_SSE2_SCAN
+	const __m128i v0 = _mm_set1_epi8( c0 );
+	const __m128i v1 = _mm_set1_epi8( c1 );
+	const __m128i vZero = _mm_setzero_si128();
+	for ( ;; p += 16 )
+	{
+		__m128i chunk = _mm_loadu_si128( (const __m128i *)p );
+		__m128i hit = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( chunk, v0 ), _mm_cmpeq_epi8( chunk, v1 ) ), 
+			_mm_cmpeq_epi8( chunk, vZero ) );
+		int nMask = _mm_movemask_epi8( hit );
+		if ( nMask )
+			return p + KeyValuesFirstBit( nMask );
+	}
+#else
+	while ( *p && *p != c0 && *p != c1 )
+	{
+		++p;
+	}
+	return p;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same table as GetCStringCharConversion(), unknown escapes give 0
+//-----------------------------------------------------------------------------
+static inline char KeyValuesUnescape( char c )
+{
+	switch ( c )
+	{
+	case 'n':	return '\n';
+	case 't':	return '\t';
+	case 'v':	return '\v';
+	case 'b':	return '\b';
+	case 'r':	return '\r';
+	case 'f':	return '\f';
+	case 'a':	return '\a';
+	case '\\':	return '\\';
+	case '?':	return '\?';
+	case '\'':	return '\'';
+	case '"':	return '"';
+	}
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: #include and #base merge other files in; those loads go through
+//			the regular loader. Localized values ("#GameUI_...") only cost a
+//			strnicmp each.
+//-----------------------------------------------------------------------------
+static bool KeyValuesHasIncludes( const char *pText )
+{
+	for ( const char *p = strchr( pText, '#' ); p; p = strchr( p + 1, '#' ) )
+	{
+		if ( !Q_strnicmp( p, "#include", 8 ) || !Q_strnicmp( p, "#base", 5 ) )
+			return true;
+	}
+	return false;
+}
+
+CKeyValuesArena::CKeyValuesArena( int nBlockSize ) :
+	m_pHead( NULL ),
+	m_nBlockSize( nBlockSize ),
+	m_nArena( 0 ),
+	m_pParse( NULL ),
+	m_pPeekToken( NULL ),
+	m_bHavePeek( false ),
+	m_bPeekQuoted( false ),
+	m_bPeekConditional( false ),
+	m_bUnterminated( false ),
+	m_bHasEscapeSequences( false ),
+	m_bEvaluateConditionals( true ),
+	m_bUseImages( false )
+{
+	for ( int i = 0; i < SYMBOL_CACHE_SIZE; i++ )
+	{
+		m_SymbolCache[i] = INVALID_KEY_SYMBOL;
+	}
+}
+
+CKeyValuesArena::~CKeyValuesArena()
+{
+	Clear();
+	free( m_pHead );
+	m_pHead = NULL;
+
+	if ( m_nArena && m_nArena != KEYVALUES_ARENA_UNREGISTERED )
+	{
+		AUTO_LOCK( s_KeyValuesArenaMutex );
+		s_pKeyValuesArenas[m_nArena] = NULL;
+	}
+}
+
+void CKeyValuesArena::Register()
+{
+	AUTO_LOCK( s_KeyValuesArenaMutex );
+	for ( int i = 1; i < KEYVALUES_ARENA_UNREGISTERED; i++ )
+	{
+		if ( !s_pKeyValuesArenas[i] )
+		{
+			s_pKeyValuesArenas[i] = this;
+			m_nArena = i;
+			return;
+		}
+	}
+
+	AssertMsg( 0, "CKeyValuesArena: too many live arenas\n" );
+	m_nArena = KEYVALUES_ARENA_UNREGISTERED;
+}
+
+CKeyValuesArena *CKeyValuesArena::FromKeyValues( const KeyValues *pKV )
+{
+	int nSlot = pKV->m_nArena;
+	if ( !nSlot || nSlot == KEYVALUES_ARENA_UNREGISTERED )
+		return NULL;
+
+	return s_pKeyValuesArenas[nSlot];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Releases everything loaded from this arena
+//-----------------------------------------------------------------------------
+void CKeyValuesArena::Clear()
+{
+	// hang on to one regular block so the next load doesn't go back to the heap
+	Block_t *pKeep = NULL;
+	Block_t *pNext;
+	for ( Block_t *pBlock = m_pHead; pBlock; pBlock = pNext )
+	{
+		pNext = pBlock->m_pNext;
+		if ( !pKeep && pBlock->m_nSize == m_nBlockSize )
+		{
+			pKeep = pBlock;
+			continue;
+		}
+		free( pBlock );
+	}
+
+	if ( pKeep )
+	{
+		pKeep->m_pNext = NULL;
+		pKeep->m_nUsed = sizeof( Block_t );
+	}
+	m_pHead = pKeep;
+
+	m_pParse = NULL;
+	m_pPeekToken = NULL;
+	m_bHavePeek = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bump allocation. Requests bigger than a block get a block of their
+//			own behind the current one, so its free space isn't thrown away.
+//-----------------------------------------------------------------------------
+void *CKeyValuesArena::Alloc( int nBytes, int nAlign )
+{
+	Assert( nBytes >= 0 && nAlign > 0 && ( nAlign & ( nAlign - 1 ) ) == 0 );
+
+	if ( !m_nArena )
+	{
+		Register();
+	}
+
+	if ( m_pHead )
+	{
+		byte *pMem = AlignValue( (byte *)m_pHead + m_pHead->m_nUsed, nAlign );
+		if ( pMem + nBytes <= (byte *)m_pHead + m_pHead->m_nSize )
+		{
+			m_pHead->m_nUsed = pMem + nBytes - (byte *)m_pHead;
+			return pMem;
+		}
+	}
+
+	int nNeeded = sizeof( Block_t ) + nBytes + nAlign;
+	int nSize = max( nNeeded, m_nBlockSize );
+
+	MEM_ALLOC_CREDIT_( "CKeyValuesArena" );
+	Block_t *pBlock = (Block_t *)malloc( nSize );
+	pBlock->m_nSize = nSize;
+	if ( m_pHead && nNeeded > m_nBlockSize )
+	{
+		pBlock->m_pNext = m_pHead->m_pNext;
+		m_pHead->m_pNext = pBlock;
+	}
+	else
+	{
+		pBlock->m_pNext = m_pHead;
+		m_pHead = pBlock;
+	}
+
+	byte *pMem = AlignValue( (byte *)( pBlock + 1 ), nAlign );
+	pBlock->m_nUsed = pMem + nBytes - (byte *)pBlock;
+	return pMem;
+}
+
+int CKeyValuesArena::GetBytesUsed() const
+{
+	int nBytes = 0;
+	for ( Block_t *pBlock = m_pHead; pBlock; pBlock = pBlock->m_pNext )
+	{
+		nBytes += pBlock->m_nUsed;
+	}
+	return nBytes;
+}
+
+int CKeyValuesArena::GetBytesAllocated() const
+{
+	int nBytes = 0;
+	for ( Block_t *pBlock = m_pHead; pBlock; pBlock = pBlock->m_pNext )
+	{
+		nBytes += pBlock->m_nSize;
+	}
+	return nBytes;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Constructs a key in arena memory. KeyValues has no vtable, so Init()
+//			is all the construction it needs.
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesArena::AllocKeyValues( const char *setName )
+{
+	KeyValues *pKV = (KeyValues *)Alloc( sizeof( KeyValues ), sizeof( void * ) );
+	pKV->Init();
+	pKV->m_nArena = (unsigned char)m_nArena;
+	pKV->m_bHasEscapeSequences = m_bHasEscapeSequences;
+	pKV->m_bEvaluateConditionals = m_bEvaluateConditionals;
+	if ( setName )
+	{
+		pKV->m_iKeyName = GetKeySymbol( setName );
+	}
+	return pKV;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Key names repeat a lot within a file ("damage", "xpos", ...), so a
+//			small cache in front of the shared symbol table saves most of the
+//			locked lookups.
+//-----------------------------------------------------------------------------
+int CKeyValuesArena::GetKeySymbol( const char *pName )
+{
+	int &nCached = m_SymbolCache[ HashStringCaseless( pName ) & ( SYMBOL_CACHE_SIZE - 1 ) ];
+	if ( nCached != INVALID_KEY_SYMBOL && !V_stricmp( KeyValues::CallGetStringForSymbol( nCached ), pName ) )
+		return nCached;
+
+	nCached = KeyValues::CallGetSymbolForString( pName, true );
+	return nCached;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Text buffers get a terminator and a zeroed tail for the vector scans
+//-----------------------------------------------------------------------------
+char *CKeyValuesArena::AllocText( int nLen )
+{
+	char *pText = (char *)Alloc( nLen + 1 + 16 );
+	memset( pText + nLen, 0, 1 + 16 );
+	return pText;
+}
+
+char *CKeyValuesArena::AllocUTF8FromUnicode( const wchar_t *pUnicode )
+{
+	int nUTF8Len = V_UnicodeToUTF8( pUnicode, NULL, 0 );
+	char *pText = AllocText( nUTF8Len );
+	V_UnicodeToUTF8( pUnicode, pText, nUTF8Len );
+	return pText;
+}
+
+char *CKeyValuesArena::CopyToken( const char *pStart, const char *pEnd )
+{
+	int nLen = pEnd - pStart;
+	char *pToken = (char *)Alloc( nLen + 1, 1 );
+	Q_memcpy( pToken, pStart, nLen );
+	pToken[nLen] = 0;
+	return pToken;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Load keyValues from disk, straight into arena memory
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesArena::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID )
+{
+	Assert( filesystem );
+	if ( m_bUseImages )
+	{
+		KeyValues *pImageKV = LoadImageFile( filesystem, resourceName, pathID );
+		if ( pImageKV )
+			return pImageKV;
+	}
+
+	FileHandle_t f = filesystem->Open( resourceName, "rb", pathID );
+	if ( !f )
+		return NULL;
+
+	s_LastFileLoadingFrom = (char*)resourceName;
+
+	int fileSize = filesystem->Size( f );
+	char *pText = AllocText( fileSize );
+	bool bRetOK = ( filesystem->Read( pText, fileSize, f ) == fileSize );
+
+	filesystem->Close( f );	// close file after reading
+
+	if ( !bRetOK )
+		return NULL;
+
+	// Translate Unicode files into UTF-8 before proceeding
+	if ( fileSize > 2 && (uint8)pText[0] == 0xFF && (uint8)pText[1] == 0xFE )
+	{
+		pText = AllocUTF8FromUnicode( (wchar_t*)(pText+2) );
+	}
+
+	return ParseText( resourceName, pText, filesystem, NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads resourceName's prebuilt image, if there is one that isn't
+//			older than the text and was built with our load settings. The
+//			image is read straight into the arena and the tree's strings
+//			point into it.
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesArena::LoadImageFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID )
+{
+	char szImageName[MAX_PATH];
+	Q_snprintf( szImageName, sizeof( szImageName ), "%s%s", resourceName, KVIMAGE_EXTENSION );
+
+	FileHandle_t f = filesystem->Open( szImageName, "rb", pathID );
+	if ( !f )
+		return NULL;
+
+	if ( filesystem->GetFileTime( szImageName, pathID ) < filesystem->GetFileTime( resourceName, pathID ) )
+	{
+		DevMsg( "KeyValues: %s is out of date, loading %s\n", szImageName, resourceName );
+		filesystem->Close( f );
+		return NULL;
+	}
+
+	int nFlags = ( m_bHasEscapeSequences ? KVIMAGE_ESCAPE_SEQUENCES : 0 ) | ( m_bEvaluateConditionals ? 0 : KVIMAGE_NO_CONDITIONALS );
+
+	// check the header before committing arena memory to the rest
+	KVImageHeader_t header;
+	int fileSize = filesystem->Size( f );
+	if ( fileSize < (int)sizeof( header ) || filesystem->Read( &header, sizeof( header ), f ) != sizeof( header ) ||
+		 header.m_nMagic != KVIMAGE_MAGIC || header.m_nVersion != KVIMAGE_VERSION || header.m_nFlags != nFlags )
+	{
+		filesystem->Close( f );
+		return NULL;
+	}
+
+	byte *pImage = (byte *)Alloc( fileSize, 8 );
+	Q_memcpy( pImage, &header, sizeof( header ) );
+	int nRest = fileSize - sizeof( header );
+	bool bRetOK = ( filesystem->Read( pImage + sizeof( header ), nRest, f ) == nRest );
+	filesystem->Close( f );
+
+	CKeyValuesImage image;
+	if ( !bRetOK || !image.Init( pImage, fileSize ) )
+	{
+		Warning( "KeyValues: %s is corrupt, loading %s\n", szImageName, resourceName );
+		return NULL;
+	}
+
+	s_LastFileLoadingFrom = (char*)resourceName;
+	return BuildFromImage( image, image.GetStringTable() );
+}
+
+KeyValues *CKeyValuesArena::LoadFromImage( const CKeyValuesImage &image )
+{
+	if ( !image.IsValid() )
+		return NULL;
+
+	char *pStrings = (char *)Alloc( image.GetStringTableSize(), 8 );
+	Q_memcpy( pStrings, image.GetStringTable(), image.GetStringTableSize() );
+	return BuildFromImage( image, pStrings );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: One allocation for every key, linked up by node index. pStrings is
+//			a copy of the image's string table that lives as long as the arena.
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesArena::BuildFromImage( const CKeyValuesImage &image, const char *pStrings )
+{
+	int nNodes = image.GetNodeCount();
+	if ( !nNodes || !image.GetRoot().IsValid() )
+		return NULL;
+
+	// one symbol table lookup per distinct name instead of one per key
+	CUtlVector< int > symbols;
+	symbols.SetCount( image.GetSymbolCount() );
+	for ( int i = 0; i < symbols.Count(); i++ )
+	{
+		symbols[i] = GetKeySymbol( image.GetSymbolString( i ) );
+	}
+
+	KeyValues *pKeys = (KeyValues *)Alloc( nNodes * sizeof( KeyValues ), sizeof( void * ) );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		const KVImageNode_t &node = image.GetNode( i );
+		KeyValues *pKV = &pKeys[i];
+		pKV->Init();
+		pKV->m_nArena = (unsigned char)m_nArena;
+		pKV->m_bHasEscapeSequences = m_bHasEscapeSequences;
+		pKV->m_bEvaluateConditionals = m_bEvaluateConditionals;
+		pKV->m_iKeyName = symbols[node.m_nSymbol];
+		pKV->m_iDataType = node.m_nType;
+
+		switch ( node.m_nType )
+		{
+		case KeyValues::TYPE_STRING:
+			pKV->m_sValue = (char *)pStrings + node.m_nString;
+			break;
+		case KeyValues::TYPE_INT:
+			pKV->m_iValue = node.m_nInt;
+			break;
+		case KeyValues::TYPE_FLOAT:
+			pKV->m_flValue = node.m_flFloat;
+			break;
+		case KeyValues::TYPE_UINT64:
+			pKV->m_sValue = (char *)pStrings + node.m_nUint64;
+			break;
+		case KeyValues::TYPE_COLOR:
+			Q_memcpy( pKV->m_Color, node.m_Color, sizeof( pKV->m_Color ) );
+			break;
+		}
+
+		pKV->m_pSub = node.m_nChildCount ? &pKeys[node.m_nFirstChild] : NULL;
+		pKV->m_pPeer = ( node.m_nFlags & KVIMAGE_NODE_LAST ) ? NULL : &pKeys[i + 1];
+	}
+
+	return pKeys;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Read from a buffer, the arena keeps its own copy of the text
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesArena::LoadFromBuffer( char const *resourceName, const char *pBuffer, IBaseFileSystem* pFileSystem, const char *pPathID )
+{
+	if ( !pBuffer )
+		return NULL;
+
+	int nLen = Q_strlen( pBuffer );
+	char *pText;
+
+	// Translate Unicode files into UTF-8 before proceeding
+	if ( nLen > 2 && (uint8)pBuffer[0] == 0xFF && (uint8)pBuffer[1] == 0xFE )
+	{
+		pText = AllocUTF8FromUnicode( (wchar_t*)(pBuffer+2) );
+	}
+	else
+	{
+		pText = AllocText( nLen );
+		Q_memcpy( pText, pBuffer, nLen );
+	}
+
+	return ParseText( resourceName, pText, pFileSystem, pPathID );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Tokenizes pText in place. Same grammar as KeyValues::ReadToken(), but
+//			tokens are terminated inside the text instead of being copied out,
+//			and there is no token length limit.
+//-----------------------------------------------------------------------------
+char *CKeyValuesArena::ReadToken( bool &wasQuoted, bool &wasConditional )
+{
+	if ( m_bHavePeek )
+	{
+		m_bHavePeek = false;
+		wasQuoted = m_bPeekQuoted;
+		wasConditional = m_bPeekConditional;
+		return m_pPeekToken;
+	}
+
+	wasQuoted = false;
+	wasConditional = false;
+
+	char *p = m_pParse;
+
+	// eating white spaces and remarks loop
+	while ( true )
+	{
+		while ( s_KeyValuesCharClass[(unsigned char)*p] & KVCHAR_SPACE )
+		{
+			++p;
+		}
+
+		// stop if it's not a comment; a new token starts here
+		if ( p[0] != '/' || p[1] != '/' )
+			break;
+
+		p = KeyValuesScanFor( p + 2, '\n', '\n' );
+		if ( *p )
+		{
+			++p;
+		}
+	}
+
+	if ( !*p )
+	{
+		m_pParse = p;
+		return NULL;	// file ends after reading whitespaces
+	}
+
+	// read quoted strings specially
+	if ( *p == '\"' )
+	{
+		wasQuoted = true;
+
+		// 0x7F is the escape of GetNoEscCharConversion(), it just ends the string
+		const char chEscape = m_bHasEscapeSequences ? '\\' : 0x7F;
+		char *pStart = ++p;
+		p = KeyValuesScanFor( p, '\"', chEscape );
+		if ( *p == chEscape )
+		{
+			// slow path, unescape in place; the output never overtakes the input
+			char *pOut = p;
+			while ( *p && *p != '\"' )
+			{
+				if ( *p == chEscape )
+				{
+					char c = m_bHasEscapeSequences ? KeyValuesUnescape( p[1] ) : 0;
+					*pOut++ = c;
+					p += c ? 2 : 1;
+				}
+				else
+				{
+					*pOut++ = *p++;
+				}
+			}
+			m_bUnterminated = ( *p == 0 );
+			if ( *p )
+			{
+				++p;
+			}
+			*pOut = 0;
+		}
+		else if ( *p )
+		{
+			*p++ = 0;
+		}
+		else
+		{
+			m_bUnterminated = true;
+		}
+
+		m_pParse = p;
+		return pStart;
+	}
+
+	if ( *p == '{' || *p == '}' )
+	{
+		// it's a control char, just return this one char and stop reading
+		m_pParse = p + 1;
+		return ( *p == '{' ) ? s_szKeyValuesOpenBrace : s_szKeyValuesCloseBrace;
+	}
+
+	// read in the token until we hit a whitespace or a control character
+	char *pStart = p;
+	bool bConditionalStart = false;
+	while ( !( s_KeyValuesCharClass[(unsigned char)*p] & KVCHAR_BREAK ) )
+	{
+		if ( *p == '[' )
+		{
+			bConditionalStart = true;
+		}
+		else if ( *p == ']' && bConditionalStart )
+		{
+			wasConditional = true;
+		}
+		++p;
+	}
+
+	if ( s_KeyValuesCharClass[(unsigned char)*p] & KVCHAR_SPACE )
+	{
+		*p = 0;
+		m_pParse = p + 1;
+		return pStart;
+	}
+
+	m_pParse = p;
+	if ( !*p )
+		return pStart;
+
+	// butts up against a '{', '}' or '"' we still have to read
+	return CopyToken( pStart, p );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same typing rules as KeyValues::RecursiveLoadFromBuffer(). Strings
+//			are not copied, they point into the arena's text.
+//-----------------------------------------------------------------------------
+void CKeyValuesArena::SetValueFromToken( KeyValues *dat, char *value )
+{
+	// most values are paths and names; strtol/strtod can only match a string
+	// that starts like a number (or "inf"/"nan" for the posix strtod)
+	unsigned char c = *value;
+	if ( !c || !( ( c >= '0' && c <= '9' ) || c == '-' || c == '+' || c == '.' || 
+		( s_KeyValuesCharClass[c] & KVCHAR_SPACE ) || c == 'i' || c == 'I' || c == 'n' || c == 'N' ) )
+	{
+		dat->m_sValue = value;
+		dat->m_iDataType = KeyValues::TYPE_STRING;
+		return;
+	}
+
+	int len = Q_strlen( value );
+
+	// Here, let's determine if we got a float or an int....
+	char* pIEnd;	// pos where int scan ended
+	char* pFEnd;	// pos where float scan ended
+	const char* pSEnd = value + len ; // pos where token ends
+
+	int ival = strtol( value, &pIEnd, 10 );
+	float fval = (float)strtod( value, &pFEnd );
+	bool bOverflow = ( ival == LONG_MAX || ival == LONG_MIN ) && errno == ERANGE;
+#ifdef POSIX
+	// strtod supports hex representation in strings under posix but we DON'T
+	// want that support in keyvalues, so undo it here if needed
+	if ( len > 1 &&  tolower(value[1]) == 'x' )
+	{
+		fval = 0.0f;
+		pFEnd = (char *)value;
+	}
+#endif
+
+	if ( ( 18 == len ) && ( value[0] == '0' ) && ( value[1] == 'x' ) )
+	{
+		// an 18-byte value prefixed with "0x" (followed by 16 hex digits) is an int64 value
+		int64 retVal = 0;
+		for( int i=2; i < 2 + 16; i++ )
+		{
+			char digit = value[i];
+			if ( digit >= 'a' ) 
+				digit -= 'a' - ( '9' + 1 );
+			else
+				if ( digit >= 'A' )
+					digit -= 'A' - ( '9' + 1 );
+			retVal = ( retVal * 16 ) + ( digit - '0' );
+		}
+		dat->m_sValue = (char *)Alloc( sizeof(uint64), sizeof(uint64) );
+		*((uint64 *)dat->m_sValue) = retVal;
+		dat->m_iDataType = KeyValues::TYPE_UINT64;
+	}
+	else if ( (pFEnd > pIEnd) && (pFEnd == pSEnd) )
+	{
+		dat->m_flValue = fval; 
+		dat->m_iDataType = KeyValues::TYPE_FLOAT;
+	}
+	else if (pIEnd == pSEnd && !bOverflow)
+	{
+		dat->m_iValue = ival; 
+		dat->m_iDataType = KeyValues::TYPE_INT;
+	}
+	else
+	{
+		dat->m_sValue = value;
+		dat->m_iDataType = KeyValues::TYPE_STRING;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Top level of a text load, mirrors KeyValues::LoadFromBuffer()
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesArena::ParseText( char const *resourceName, char *pText, IBaseFileSystem* pFileSystem, const char *pPathID )
+{
+	if ( KeyValuesHasIncludes( pText ) )
+	{
+		KeyValues *pLoaded = new KeyValues( resourceName );
+		pLoaded->UsesEscapeSequences( m_bHasEscapeSequences );
+		pLoaded->UsesConditionals( m_bEvaluateConditionals );
+		pLoaded->LoadFromBuffer( resourceName, pText, pFileSystem, pPathID );
+
+		KeyValues *pKV = CopyTree( pLoaded );
+		pLoaded->deleteThis();
+		return pKV;
+	}
+
+	InitKeyValuesCharClass();
+
+	m_pParse = pText;
+	m_bHavePeek = false;
+	m_bUnterminated = false;
+	g_KeyValuesErrorStack.SetFilename( resourceName );
+
+	KeyValues *pFirstKey = NULL;
+	KeyValues *pLastKey = NULL;
+	bool wasQuoted;
+	bool wasConditional;
+	while ( true )
+	{
+		bool bAccepted = true;
+
+		// the first thing must be a key
+		const char *s = ReadToken( wasQuoted, wasConditional );
+		if ( m_bUnterminated || !s || *s == 0 )
+			break;
+
+		KeyValues *pCurrentKey = AllocKeyValues( s );
+
+		// get the '{'
+		s = ReadToken( wasQuoted, wasConditional );
+
+		if ( wasConditional )
+		{
+			bAccepted = !m_bEvaluateConditionals || EvaluateConditional( s );
+
+			// Now get the '{'
+			s = ReadToken( wasQuoted, wasConditional );
+		}
+
+		if ( s && *s == '{' && !wasQuoted )
+		{
+			// header is valid so load the file
+			RecursiveParse( pCurrentKey );
+		}
+		else
+		{
+			g_KeyValuesErrorStack.ReportError("LoadFromBuffer: missing {" );
+		}
+
+		if ( bAccepted )
+		{
+			if ( pLastKey )
+			{
+				pLastKey->m_pPeer = pCurrentKey;
+			}
+			else
+			{
+				pFirstKey = pCurrentKey;
+			}
+			pLastKey = pCurrentKey;
+		}
+	}
+
+	g_KeyValuesErrorStack.SetFilename( "" );
+
+	// an empty file still loads, like it does into an existing KeyValues
+	if ( !pFirstKey )
+	{
+		pFirstKey = AllocKeyValues( resourceName );
+	}
+
+	return pFirstKey;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors KeyValues::RecursiveLoadFromBuffer()
+//-----------------------------------------------------------------------------
+void CKeyValuesArena::RecursiveParse( KeyValues *pParent )
+{
+	CKeyErrorContext errorReport( pParent );
+	bool wasQuoted;
+	bool wasConditional;
+	// keep this out of the stack until a key is parsed
+	CKeyErrorContext errorKey( INVALID_KEY_SYMBOL );
+
+	KeyValues *pLastChild = NULL;
+
+	// Keep parsing until we hit the closing brace which terminates this block, or a parse error
+	while ( 1 )
+	{
+		bool bAccepted = true;
+
+		// get the key name
+		const char * name = ReadToken( wasQuoted, wasConditional );
+
+		if ( !name )	// EOF stop reading
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got EOF instead of keyname" );
+			break;
+		}
+
+		if ( !*name ) // empty token, maybe "" or EOF
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got empty keyname" );
+			break;
+		}
+
+		if ( *name == '}' && !wasQuoted )	// top level closed, stop reading
+			break;
+
+		// Always create the key; note that this could potentially
+		// cause some duplication, but that's what we want sometimes
+		KeyValues *dat = AllocKeyValues( name );
+		pParent->AddSubkeyUsingKnownLastChild( dat, pLastChild );
+
+		errorKey.Reset( dat->GetNameSymbol() );
+
+		// get the value
+		char *value = ReadToken( wasQuoted, wasConditional );
+
+		if ( wasConditional && value )
+		{
+			bAccepted = !m_bEvaluateConditionals || EvaluateConditional( value );
+
+			// get the real value
+			value = ReadToken( wasQuoted, wasConditional );
+		}
+
+		if ( !value )
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got NULL key" );
+			break;
+		}
+
+		if ( *value == '}' && !wasQuoted )
+		{
+			g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got } in key" );
+			break;
+		}
+
+		if ( *value == '{' && !wasQuoted )
+		{
+			// this isn't a key, it's a section
+			errorKey.Reset( INVALID_KEY_SYMBOL );
+			// sub value list
+			RecursiveParse( dat );
+		}
+		else 
+		{
+			if ( wasConditional )
+			{
+				g_KeyValuesErrorStack.ReportError("RecursiveLoadFromBuffer:  got conditional between key and value" );
+				break;
+			}
+
+			SetValueFromToken( dat, value );
+
+			// Look ahead one token for a conditional tag; the text has already been
+			// terminated in place, so keep the token around instead of seeking back
+			char *peek = ReadToken( wasQuoted, wasConditional );
+			if ( wasConditional )
+			{
+				bAccepted = !m_bEvaluateConditionals || EvaluateConditional( peek );
+			}
+			else
+			{
+				m_pPeekToken = peek;
+				m_bPeekQuoted = wasQuoted;
+				m_bPeekConditional = wasConditional;
+				m_bHavePeek = true;
+			}
+		}
+
+		if ( bAccepted )
+		{
+			pLastChild = dat;
+		}
+		else
+		{
+			// unlink it, the memory goes with the arena
+			if ( pLastChild == NULL )
+			{
+				pParent->m_pSub = NULL;
+			}
+			else
+			{
+				pLastChild->m_pPeer = NULL;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies a heap tree (and its peers) into the arena
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesArena::CopyTree( KeyValues *pSrc )
+{
+	KeyValues *pFirst = NULL;
+	KeyValues *pLast = NULL;
+	for ( ; pSrc; pSrc = pSrc->m_pPeer )
+	{
+		KeyValues *pDst = AllocKeyValues( NULL );
+		pDst->m_iKeyName = pSrc->m_iKeyName;
+		pDst->m_iDataType = pSrc->m_iDataType;
+		pDst->m_bHasEscapeSequences = pSrc->m_bHasEscapeSequences;
+		pDst->m_bEvaluateConditionals = pSrc->m_bEvaluateConditionals;
+
+		switch ( pSrc->m_iDataType )
+		{
+		case KeyValues::TYPE_STRING:
+			if ( pSrc->m_sValue )
+			{
+				pDst->m_sValue = CopyToken( pSrc->m_sValue, pSrc->m_sValue + Q_strlen( pSrc->m_sValue ) );
+			}
+			break;
+		case KeyValues::TYPE_WSTRING:
+			if ( pSrc->m_wsValue )
+			{
+				int len = wcslen( pSrc->m_wsValue ) + 1;
+				pDst->m_wsValue = (wchar_t *)Alloc( len * sizeof( wchar_t ) );
+				Q_memcpy( pDst->m_wsValue, pSrc->m_wsValue, len * sizeof( wchar_t ) );
+			}
+			break;
+		case KeyValues::TYPE_UINT64:
+			pDst->m_sValue = (char *)Alloc( sizeof(uint64), sizeof(uint64) );
+			Q_memcpy( pDst->m_sValue, pSrc->m_sValue, sizeof(uint64) );
+			break;
+		default:
+			pDst->m_pValue = pSrc->m_pValue;
+			break;
+		}
+
+		pDst->m_pSub = CopyTree( pSrc->m_pSub );
+
+		if ( pLast )
+		{
+			pLast->m_pPeer = pDst;
+		}
+		else
+		{
+			pFirst = pDst;
+		}
+		pLast = pDst;
+	}
+	return pFirst;
+}
+
 #include "tier0/memdbgoff.h"
 
 //-----------------------------------------------------------------------------
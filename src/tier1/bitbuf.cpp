@@ -119,6 +119,257 @@ public:
 static CBitWriteMasksInit g_BitWriteMasksInit;
 
 
+// ---------------------------------------------------------------------------------------- //
+// Bulk encoding helpers.
+//
+// Fields are gathered LSB first in a 64-bit accumulator, which is the same order
+// WriteUBitLong lays bits down in, and reach the buffer 32 bits at a time. Optional
+// fields get a width of zero instead of a branch around the write.
+// ---------------------------------------------------------------------------------------- //
+
+class CBitWriteAccumulator
+{
+public:
+	CBitWriteAccumulator( bf_write *pBuf ) : m_pBuf( pBuf ), m_nAccum( 0 ), m_nBits( 0 ) {}
+	~CBitWriteAccumulator() { Flush(); }
+
+	// nBits <= 32, and nothing may be set in data above nBits
+	FORCEINLINE void Put( uint32 data, int nBits )
+	{
+		m_nAccum |= (uint64)data << m_nBits;
+		m_nBits += nBits;
+		if ( m_nBits >= 32 )
+		{
+			m_pBuf->WriteUBitLong( (uint32)m_nAccum, 32, false );
+			m_nAccum >>= 32;
+			m_nBits -= 32;
+		}
+	}
+
+	void Flush()
+	{
+		if ( m_nBits > 0 )
+		{
+			m_pBuf->WriteUBitLong( (uint32)m_nAccum, m_nBits, false );
+		}
+		m_nAccum = 0;
+		m_nBits = 0;
+	}
+
+private:
+	bf_write	*m_pBuf;
+	uint64		m_nAccum;
+	int			m_nBits;
+};
+
+class CBitReadAccumulator
+{
+public:
+	CBitReadAccumulator( bf_read *pBuf ) : m_pBuf( pBuf ), m_nAccum( 0 ), m_nBits( 0 ) {}
+
+	// Hand back whatever got fetched but not used
+	~CBitReadAccumulator()
+	{
+		if ( !m_pBuf->IsOverflowed() )
+		{
+			m_pBuf->Seek( m_pBuf->GetNumBitsRead() - m_nBits );
+		}
+	}
+
+	// 0 <= nBits <= 32
+	FORCEINLINE uint32 Get( int nBits )
+	{
+		if ( m_nBits < nBits )
+		{
+			Refill( nBits );
+		}
+		uint32 data = (uint32)m_nAccum & g_ExtraMasks[nBits];
+		m_nAccum >>= nBits;
+		m_nBits -= nBits;
+		return data;
+	}
+
+private:
+	void Refill( int nBits )
+	{
+		int nFetch = MIN( 32, m_pBuf->GetNumBitsLeft() );
+		if ( nFetch > 0 )
+		{
+			m_nAccum |= (uint64)m_pBuf->ReadUBitLong( nFetch ) << m_nBits;
+			m_nBits += nFetch;
+		}
+
+		if ( m_nBits < nBits )
+		{
+			// Ran off the end. Like ReadUBitLong, the field comes back as zero
+			m_pBuf->SetOverflowFlag();
+			CallErrorHandler( BITBUFERROR_BUFFER_OVERRUN, m_pBuf->GetDebugName() );
+			m_nAccum = 0;
+			m_nBits = nBits;
+		}
+	}
+
+	bf_read		*m_pBuf;
+	uint64		m_nAccum;
+	int			m_nBits;
+};
+
+// Same encoding as WriteBitCoord, returns the bits and sets nBits to how many of them to send
+static FORCEINLINE uint32 EncodeBitCoord( const float f, int &nBits )
+{
+	int		signbit = (f <= -COORD_RESOLUTION);
+	int		intval = (int)abs(f);
+	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+	uint32 hasInt = ( intval != 0 );
+	uint32 hasFract = ( fractval != 0 );
+	uint32 hasAny = hasInt | hasFract;
+
+	// Integer flag, fraction flag, then the sign if either is set
+	uint32 bits = hasInt | ( hasFract << 1 ) | ( ( signbit & hasAny ) << 2 );
+	nBits = 2 + hasAny;
+
+	// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
+	bits |= ( (uint32)( intval - 1 ) & ( ( 1u << COORD_INTEGER_BITS ) - 1 ) & ( 0u - hasInt ) ) << nBits;
+	nBits += hasInt * COORD_INTEGER_BITS;
+
+	bits |= (uint32)fractval << nBits;
+	nBits += hasFract * COORD_FRACTIONAL_BITS;
+	return bits;
+}
+
+static FORCEINLINE int IsCoordNonZero( const float f )
+{
+	return (f >= COORD_RESOLUTION) || (f <= -COORD_RESOLUTION);
+}
+
+// Same encoding as WriteBitNormal, always 1 + NORMAL_FRACTIONAL_BITS bits
+static FORCEINLINE uint32 EncodeBitNormal( const float f )
+{
+	uint32 signbit = (f <= -NORMAL_RESOLUTION);
+
+	// NOTE: Since +/-1 are valid values for a normal, they're encoded as all ones
+	unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+	fractval = ( fractval > NORMAL_DENOMINATOR ) ? NORMAL_DENOMINATOR : fractval;
+
+	return signbit | ( fractval << 1 );
+}
+
+static FORCEINLINE int IsNormalNonZero( const float f )
+{
+	return (f >= NORMAL_RESOLUTION) || (f <= -NORMAL_RESOLUTION);
+}
+
+static FORCEINLINE void PutBitVec3Coord( CBitWriteAccumulator &accum, const Vector &fa )
+{
+	uint32 xflag = IsCoordNonZero( fa[0] );
+	uint32 yflag = IsCoordNonZero( fa[1] );
+	uint32 zflag = IsCoordNonZero( fa[2] );
+	accum.Put( xflag | ( yflag << 1 ) | ( zflag << 2 ), 3 );
+
+	int nBits;
+	uint32 bits;
+	bits = EncodeBitCoord( fa[0], nBits );
+	accum.Put( bits & ( 0u - xflag ), nBits * xflag );
+	bits = EncodeBitCoord( fa[1], nBits );
+	accum.Put( bits & ( 0u - yflag ), nBits * yflag );
+	bits = EncodeBitCoord( fa[2], nBits );
+	accum.Put( bits & ( 0u - zflag ), nBits * zflag );
+}
+
+static FORCEINLINE void PutBitVec3Normal( CBitWriteAccumulator &accum, const Vector &fa )
+{
+	const int nNormalBits = 1 + NORMAL_FRACTIONAL_BITS;
+
+	uint32 xflag = IsNormalNonZero( fa[0] );
+	uint32 yflag = IsNormalNonZero( fa[1] );
+	uint32 zsign = ( fa[2] <= -NORMAL_RESOLUTION );
+
+	// Never more than 2 + 12 + 12 + 1 bits, so it all goes in one piece
+	uint32 bits = xflag | ( yflag << 1 );
+	int nBits = 2;
+	bits |= ( EncodeBitNormal( fa[0] ) & ( 0u - xflag ) ) << nBits;
+	nBits += nNormalBits * xflag;
+	bits |= ( EncodeBitNormal( fa[1] ) & ( 0u - yflag ) ) << nBits;
+	nBits += nNormalBits * yflag;
+	bits |= zsign << nBits;
+	accum.Put( bits, nBits + 1 );
+}
+
+static FORCEINLINE void PutVarInt32( CBitWriteAccumulator &accum, uint32 data )
+{
+	while ( data > 0x7F )
+	{
+		accum.Put( ( data & 0x7F ) | 0x80, 8 );
+		data >>= 7;
+	}
+	accum.Put( data, 8 );
+}
+
+static FORCEINLINE float GetBitCoord( CBitReadAccumulator &accum )
+{
+	uint32 flags = accum.Get( 2 );
+	uint32 hasInt = flags & 1;
+	uint32 hasFract = flags >> 1;
+
+	int signbit = accum.Get( hasInt | hasFract );
+
+	// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
+	int intval = accum.Get( hasInt * COORD_INTEGER_BITS ) + hasInt;
+	int fractval = accum.Get( hasFract * COORD_FRACTIONAL_BITS );
+
+	float value = intval + ((float)fractval * COORD_RESOLUTION);
+	return signbit ? -value : value;
+}
+
+static FORCEINLINE float GetBitNormal( CBitReadAccumulator &accum )
+{
+	uint32 bits = accum.Get( 1 + NORMAL_FRACTIONAL_BITS );
+	float value = (float)( bits >> 1 ) * NORMAL_RESOLUTION;
+	return ( bits & 1 ) ? -value : value;
+}
+
+static FORCEINLINE void GetBitVec3Coord( CBitReadAccumulator &accum, Vector &fa )
+{
+	uint32 flags = accum.Get( 3 );
+	fa[0] = ( flags & 1 ) ? GetBitCoord( accum ) : 0.0f;
+	fa[1] = ( flags & 2 ) ? GetBitCoord( accum ) : 0.0f;
+	fa[2] = ( flags & 4 ) ? GetBitCoord( accum ) : 0.0f;
+}
+
+static FORCEINLINE void GetBitVec3Normal( CBitReadAccumulator &accum, Vector &fa )
+{
+	uint32 flags = accum.Get( 2 );
+	fa[0] = ( flags & 1 ) ? GetBitNormal( accum ) : 0.0f;
+	fa[1] = ( flags & 2 ) ? GetBitNormal( accum ) : 0.0f;
+
+	// The first two imply the third (but not its sign)
+	int znegative = accum.Get( 1 );
+
+	float fafafbfb = fa[0] * fa[0] + fa[1] * fa[1];
+	if (fafafbfb < 1.0f)
+		fa[2] = sqrt( 1.0f - fafafbfb );
+	else
+		fa[2] = 0.0f;
+
+	if (znegative)
+		fa[2] = -fa[2];
+}
+
+static FORCEINLINE uint32 GetVarInt32( CBitReadAccumulator &accum )
+{
+	uint32 result = 0;
+	for ( int count = 0; count < bitbuf::kMaxVarint32Bytes; ++count )
+	{
+		uint32 b = accum.Get( 8 );
+		result |= (b & 0x7F) << (7 * count);
+		if ( !( b & 0x80 ) )
+			break;
+	}
+	return result;
+}
+
+
 // ---------------------------------------------------------------------------------------- //
 // bf_write
 // ---------------------------------------------------------------------------------------- //
@@ -621,99 +872,85 @@ void bf_write::WriteBitCoord (const float f)
 #if defined( BB_PROFILING )
 	VPROF( "bf_write::WriteBitCoord" );
 #endif
-	int		signbit = (f <= -COORD_RESOLUTION);
-	int		intval = (int)abs(f);
-	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
-
-
-	// Send the bit flags that indicate whether we have an integer part and/or a fraction part.
-	WriteOneBit( intval );
-	WriteOneBit( fractval );
-
-	if ( intval || fractval )
-	{
-		// Send the sign bit
-		WriteOneBit( signbit );
-
-		// Send the integer if we have one.
-		if ( intval )
-		{
-			// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
-			intval--;
-			WriteUBitLong( (unsigned int)intval, COORD_INTEGER_BITS );
-		}
-		
-		// Send the fraction if we have one
-		if ( fractval )
-		{
-			WriteUBitLong( (unsigned int)fractval, COORD_FRACTIONAL_BITS );
-		}
-	}
+	CBitWriteAccumulator accum( this );
+	int nBits;
+	uint32 bits = EncodeBitCoord( f, nBits );
+	accum.Put( bits, nBits );
 }
 
 void bf_write::WriteBitVec3Coord( const Vector& fa )
 {
-	int		xflag, yflag, zflag;
-
-	xflag = (fa[0] >= COORD_RESOLUTION) || (fa[0] <= -COORD_RESOLUTION);
-	yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
-	zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
-
-	WriteOneBit( xflag );
-	WriteOneBit( yflag );
-	WriteOneBit( zflag );
-
-	if ( xflag )
-		WriteBitCoord( fa[0] );
-	if ( yflag )
-		WriteBitCoord( fa[1] );
-	if ( zflag )
-		WriteBitCoord( fa[2] );
+	CBitWriteAccumulator accum( this );
+	PutBitVec3Coord( accum, fa );
 }
 
 void bf_write::WriteBitNormal( float f )
 {
-	int	signbit = (f <= -NORMAL_RESOLUTION);
-
-	// NOTE: Since +/-1 are valid values for a normal, I'm going to encode that as all ones
-	unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+	WriteUBitLong( EncodeBitNormal( f ), 1 + NORMAL_FRACTIONAL_BITS, false );
+}
 
-	// clamp..
-	if (fractval > NORMAL_DENOMINATOR)
-		fractval = NORMAL_DENOMINATOR;
+void bf_write::WriteBitVec3Normal( const Vector& fa )
+{
+	CBitWriteAccumulator accum( this );
+	PutBitVec3Normal( accum, fa );
+}
 
-	// Send the sign bit
-	WriteOneBit( signbit );
+void bf_write::WriteBitAngles( const QAngle& fa )
+{
+	// FIXME:
+	Vector tmp( fa.x, fa.y, fa.z );
+	WriteBitVec3Coord( tmp );
+}
 
-	// Send the fractional component
-	WriteUBitLong( fractval, NORMAL_FRACTIONAL_BITS );
+void bf_write::WriteBitCoordArray( const float *pValues, int nCount )
+{
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		int nBits;
+		uint32 bits = EncodeBitCoord( pValues[i], nBits );
+		accum.Put( bits, nBits );
+	}
 }
 
-void bf_write::WriteBitVec3Normal( const Vector& fa )
+void bf_write::WriteBitVec3CoordArray( const Vector *pValues, int nCount )
 {
-	int		xflag, yflag;
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		PutBitVec3Coord( accum, pValues[i] );
+	}
+}
 
-	xflag = (fa[0] >= NORMAL_RESOLUTION) || (fa[0] <= -NORMAL_RESOLUTION);
-	yflag = (fa[1] >= NORMAL_RESOLUTION) || (fa[1] <= -NORMAL_RESOLUTION);
+void bf_write::WriteBitVec3NormalArray( const Vector *pValues, int nCount )
+{
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		PutBitVec3Normal( accum, pValues[i] );
+	}
+}
 
-	WriteOneBit( xflag );
-	WriteOneBit( yflag );
+void bf_write::WriteBitAngleArray( const float *pAngles, int nCount, int numbits )
+{
+	unsigned int shift = BitForBitnum(numbits);
+	unsigned int mask = shift - 1;
 
-	if ( xflag )
-		WriteBitNormal( fa[0] );
-	if ( yflag )
-		WriteBitNormal( fa[1] );
-	
-	// Write z sign bit
-	int	signbit = (fa[2] <= -NORMAL_RESOLUTION);
-	WriteOneBit( signbit );
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		int d = (int)( (pAngles[i] / 360.0) * shift );
+		accum.Put( (unsigned int)d & mask, numbits );
+	}
 }
 
-void bf_write::WriteBitAngles( const QAngle& fa )
+void bf_write::WriteVarInt32Array( const uint32 *pValues, int nCount )
 {
-	// FIXME:
-	Vector tmp( fa.x, fa.y, fa.z );
-	WriteBitVec3Coord( tmp );
+	CBitWriteAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		PutVarInt32( accum, pValues[i] );
+	}
 }
 
 void bf_write::WriteChar(int val)
@@ -1341,6 +1578,54 @@ void bf_read::ReadBitAngles( QAngle& fa )
 	fa.Init( tmp.x, tmp.y, tmp.z );
 }
 
+void bf_read::ReadBitCoordArray( float *pValues, int nCount )
+{
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		pValues[i] = GetBitCoord( accum );
+	}
+}
+
+void bf_read::ReadBitVec3CoordArray( Vector *pValues, int nCount )
+{
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		GetBitVec3Coord( accum, pValues[i] );
+	}
+}
+
+void bf_read::ReadBitVec3NormalArray( Vector *pValues, int nCount )
+{
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		GetBitVec3Normal( accum, pValues[i] );
+	}
+}
+
+void bf_read::ReadBitAngleArray( float *pAngles, int nCount, int numbits )
+{
+	float shift = (float)( BitForBitnum(numbits) );
+
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		int d = accum.Get( numbits );
+		pAngles[i] = (float)d * (360.0 / shift);
+	}
+}
+
+void bf_read::ReadVarInt32Array( uint32 *pValues, int nCount )
+{
+	CBitReadAccumulator accum( this );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		pValues[i] = GetVarInt32( accum );
+	}
+}
+
 int64 bf_read::ReadLongLong()
 {
 	int64 retval;
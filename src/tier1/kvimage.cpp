@@ -0,0 +1,631 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Flat binary KeyValues images, see kvimage.h
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier1/kvimage.h"
+#include "tier1/generichash.h"
+#include "tier1/strtools.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utldict.h"
+#include "tier1/utlvector.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// KVImageKey
+//-----------------------------------------------------------------------------
+
+// Walks a "a/b/c" path down from this key, like KeyValues::FindKey()
+KVImageKey KVImageKey::Resolve( const char *pKeyName ) const
+{
+	if ( !IsValid() || !pKeyName || !pKeyName[0] )
+		return *this;
+
+	char szBuf[256];
+	const char *pSearch = pKeyName;
+	const char *pSubStr = strchr( pKeyName, '/' );
+	if ( pSubStr )
+	{
+		int nSize = MIN( pSubStr - pKeyName, (int)sizeof( szBuf ) - 1 );
+		Q_memcpy( szBuf, pKeyName, nSize );
+		szBuf[nSize] = 0;
+		pSearch = szBuf;
+	}
+
+	KVImageKey key = FindKeyBySymbol( m_pImage->FindSymbol( pSearch ) );
+	if ( pSubStr && key.IsValid() )
+		return key.Resolve( pSubStr + 1 );
+
+	return key;
+}
+
+KVImageKey KVImageKey::FindKey( const char *pKeyName ) const
+{
+	return Resolve( pKeyName );
+}
+
+KVImageKey KVImageKey::GetFirstTrueSubKey() const
+{
+	KVImageKey key = GetFirstSubKey();
+	while ( key.IsValid() && key.GetDataType() != KeyValues::TYPE_NONE )
+	{
+		key = key.GetNextKey();
+	}
+	return key;
+}
+
+KVImageKey KVImageKey::GetNextTrueSubKey() const
+{
+	KVImageKey key = GetNextKey();
+	while ( key.IsValid() && key.GetDataType() != KeyValues::TYPE_NONE )
+	{
+		key = key.GetNextKey();
+	}
+	return key;
+}
+
+KVImageKey KVImageKey::GetFirstValue() const
+{
+	KVImageKey key = GetFirstSubKey();
+	while ( key.IsValid() && key.GetDataType() == KeyValues::TYPE_NONE )
+	{
+		key = key.GetNextKey();
+	}
+	return key;
+}
+
+KVImageKey KVImageKey::GetNextValue() const
+{
+	KVImageKey key = GetNextKey();
+	while ( key.IsValid() && key.GetDataType() == KeyValues::TYPE_NONE )
+	{
+		key = key.GetNextKey();
+	}
+	return key;
+}
+
+int KVImageKey::GetInt( const char *pKeyName, int nDefaultValue ) const
+{
+	KVImageKey key = Resolve( pKeyName );
+	if ( !key.IsValid() )
+		return nDefaultValue;
+
+	const KVImageNode_t &node = key.Node();
+	switch ( node.m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+		return atoi( m_pImage->GetString( node.m_nString ) );
+	case KeyValues::TYPE_FLOAT:
+		return (int)node.m_flFloat;
+	case KeyValues::TYPE_UINT64:
+		// can't convert, since it would lose data
+		Assert( 0 );
+		return 0;
+	default:
+		return node.m_nInt;
+	}
+}
+
+uint64 KVImageKey::GetUint64( const char *pKeyName, uint64 nDefaultValue ) const
+{
+	KVImageKey key = Resolve( pKeyName );
+	if ( !key.IsValid() )
+		return nDefaultValue;
+
+	const KVImageNode_t &node = key.Node();
+	switch ( node.m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+		return (uint64)Q_atoi64( m_pImage->GetString( node.m_nString ) );
+	case KeyValues::TYPE_FLOAT:
+		return (int)node.m_flFloat;
+	case KeyValues::TYPE_UINT64:
+		return *(const uint64 *)m_pImage->GetString( node.m_nUint64 );
+	default:
+		return node.m_nInt;
+	}
+}
+
+float KVImageKey::GetFloat( const char *pKeyName, float flDefaultValue ) const
+{
+	KVImageKey key = Resolve( pKeyName );
+	if ( !key.IsValid() )
+		return flDefaultValue;
+
+	const KVImageNode_t &node = key.Node();
+	switch ( node.m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+		return (float)atof( m_pImage->GetString( node.m_nString ) );
+	case KeyValues::TYPE_FLOAT:
+		return node.m_flFloat;
+	case KeyValues::TYPE_INT:
+		return (float)node.m_nInt;
+	case KeyValues::TYPE_UINT64:
+		return (float)( *(const uint64 *)m_pImage->GetString( node.m_nUint64 ) );
+	default:
+		return 0.0f;
+	}
+}
+
+// Numbers were printed at build time, so this never has to convert anything
+const char *KVImageKey::GetString( const char *pKeyName, const char *pDefaultValue ) const
+{
+	KVImageKey key = Resolve( pKeyName );
+	if ( !key.IsValid() )
+		return pDefaultValue;
+
+	const KVImageNode_t &node = key.Node();
+	switch ( node.m_nType )
+	{
+	case KeyValues::TYPE_STRING:
+	case KeyValues::TYPE_INT:
+	case KeyValues::TYPE_FLOAT:
+	case KeyValues::TYPE_UINT64:
+		return m_pImage->GetString( node.m_nString );
+	default:
+		return pDefaultValue;
+	}
+}
+
+Color KVImageKey::GetColor( const char *pKeyName ) const
+{
+	Color color( 0, 0, 0, 0 );
+	KVImageKey key = Resolve( pKeyName );
+	if ( !key.IsValid() )
+		return color;
+
+	const KVImageNode_t &node = key.Node();
+	if ( node.m_nType == KeyValues::TYPE_COLOR )
+	{
+		color.SetColor( node.m_Color[0], node.m_Color[1], node.m_Color[2], node.m_Color[3] );
+	}
+	else if ( node.m_nType == KeyValues::TYPE_FLOAT )
+	{
+		color[0] = node.m_flFloat;
+	}
+	else if ( node.m_nType == KeyValues::TYPE_INT )
+	{
+		color[0] = node.m_nInt;
+	}
+	else if ( node.m_nType == KeyValues::TYPE_STRING )
+	{
+		// parse the colors out of the string
+		float a = 0.0f, b = 0.0f, c = 0.0f, d = 0.0f;
+		sscanf( m_pImage->GetString( node.m_nString ), "%f %f %f %f", &a, &b, &c, &d );
+		color[0] = (unsigned char)a;
+		color[1] = (unsigned char)b;
+		color[2] = (unsigned char)c;
+		color[3] = (unsigned char)d;
+	}
+	return color;
+}
+
+bool KVImageKey::IsEmpty( const char *pKeyName ) const
+{
+	KVImageKey key = Resolve( pKeyName );
+	if ( !key.IsValid() )
+		return true;
+
+	return key.Node().m_nType == KeyValues::TYPE_NONE && !key.Node().m_nChildCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// CKeyValuesImage
+//-----------------------------------------------------------------------------
+CKeyValuesImage::CKeyValuesImage()
+{
+	Shutdown();
+}
+
+void CKeyValuesImage::Shutdown()
+{
+	m_pHeader = NULL;
+	m_pNodes = NULL;
+	m_pSorted = NULL;
+	m_pSymbols = NULL;
+	m_pStrings = NULL;
+}
+
+// true if [nOffset, nOffset + nCount * nElementSize) is inside the image
+static bool KVImageSectionValid( int nImageSize, int nOffset, int nCount, int nElementSize, int nAlign )
+{
+	if ( nOffset < (int)sizeof( KVImageHeader_t ) || nCount < 0 || ( nOffset & ( nAlign - 1 ) ) )
+		return false;
+	return (int64)nOffset + (int64)nCount * nElementSize <= nImageSize;
+}
+
+bool CKeyValuesImage::Init( const void *pData, int nSize )
+{
+	Shutdown();
+
+	if ( !pData || nSize < (int)sizeof( KVImageHeader_t ) || ( (uintp)pData & 7 ) )
+		return false;
+
+	const KVImageHeader_t *pHeader = (const KVImageHeader_t *)pData;
+	if ( pHeader->m_nMagic != KVIMAGE_MAGIC || pHeader->m_nVersion != KVIMAGE_VERSION )
+		return false;
+
+	int nImageSize = pHeader->m_nImageSize;
+	if ( nImageSize < (int)sizeof( KVImageHeader_t ) || nImageSize > nSize )
+		return false;
+
+	if ( !KVImageSectionValid( nImageSize, pHeader->m_nNodeOffset, pHeader->m_nNodeCount, sizeof( KVImageNode_t ), 4 ) ||
+		 !KVImageSectionValid( nImageSize, pHeader->m_nSortedOffset, pHeader->m_nSortedCount, sizeof( int ), 4 ) ||
+		 !KVImageSectionValid( nImageSize, pHeader->m_nSymbolOffset, pHeader->m_nSymbolCount, sizeof( KVImageSymbol_t ), 4 ) ||
+		 !KVImageSectionValid( nImageSize, pHeader->m_nStringOffset, pHeader->m_nStringBytes, 1, 8 ) )
+		return false;
+
+	int nNodes = pHeader->m_nNodeCount;
+	int nSymbols = pHeader->m_nSymbolCount;
+	int nStringBytes = pHeader->m_nStringBytes;
+	if ( pHeader->m_nRootCount < 0 || pHeader->m_nRootCount > nNodes )
+		return false;
+
+	// every string is terminated by the end of the table at the latest
+	const char *pStrings = (const char *)pData + pHeader->m_nStringOffset;
+	if ( nStringBytes < 1 || pStrings[0] || pStrings[nStringBytes - 1] )
+		return false;
+
+	const KVImageSymbol_t *pSymbols = (const KVImageSymbol_t *)( (const byte *)pData + pHeader->m_nSymbolOffset );
+	for ( int i = 0; i < nSymbols; i++ )
+	{
+		if ( pSymbols[i].m_nName < 0 || pSymbols[i].m_nName >= nStringBytes )
+			return false;
+		if ( i && pSymbols[i].m_nHash < pSymbols[i - 1].m_nHash )
+			return false;
+	}
+
+	const int *pSorted = (const int *)( (const byte *)pData + pHeader->m_nSortedOffset );
+	for ( int i = 0; i < pHeader->m_nSortedCount; i++ )
+	{
+		if ( pSorted[i] < 0 || pSorted[i] >= nNodes )
+			return false;
+	}
+
+	const KVImageNode_t *pNodes = (const KVImageNode_t *)( (const byte *)pData + pHeader->m_nNodeOffset );
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		const KVImageNode_t &node = pNodes[i];
+		if ( node.m_nSymbol < 0 || node.m_nSymbol >= nSymbols || node.m_nType >= KeyValues::TYPE_NUMTYPES )
+			return false;
+		if ( node.m_nString < 0 || node.m_nString >= nStringBytes )
+			return false;
+		if ( node.m_nType == KeyValues::TYPE_UINT64 &&
+			 ( node.m_nUint64 < 0 || ( node.m_nUint64 & 7 ) || node.m_nUint64 + (int)sizeof( uint64 ) > nStringBytes ) )
+			return false;
+
+		// GetNextKey() steps to i + 1 unless the node is flagged last
+		if ( !( node.m_nFlags & KVIMAGE_NODE_LAST ) && i + 1 >= nNodes )
+			return false;
+
+		// breadth first layout means children always come after their parent,
+		// which also rules out cycles
+		if ( node.m_nChildCount )
+		{
+			if ( node.m_nChildCount < 0 || node.m_nFirstChild <= i || node.m_nFirstChild > nNodes - node.m_nChildCount )
+				return false;
+			if ( node.m_nSorted < 0 || node.m_nSorted > pHeader->m_nSortedCount - node.m_nChildCount )
+				return false;
+		}
+	}
+
+	m_pHeader = pHeader;
+	m_pNodes = pNodes;
+	m_pSorted = pSorted;
+	m_pSymbols = pSymbols;
+	m_pStrings = pStrings;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The symbol table is sorted by caseless hash; collisions are rare,
+//			so this is a binary search plus a stricmp or two.
+//-----------------------------------------------------------------------------
+int CKeyValuesImage::FindSymbol( const char *pName ) const
+{
+	if ( !IsValid() || !pName )
+		return -1;
+
+	unsigned int nHash = HashStringCaseless( pName );
+	int nLow = 0;
+	int nHigh = m_pHeader->m_nSymbolCount;
+	while ( nLow < nHigh )
+	{
+		int nMid = ( nLow + nHigh ) >> 1;
+		if ( m_pSymbols[nMid].m_nHash < nHash )
+		{
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid;
+		}
+	}
+
+	for ( ; nLow < m_pHeader->m_nSymbolCount && m_pSymbols[nLow].m_nHash == nHash; nLow++ )
+	{
+		if ( !Q_stricmp( GetString( m_pSymbols[nLow].m_nName ), pName ) )
+			return nLow;
+	}
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Lower bound on the parent's sorted children. Ties are sorted by
+//			node index, so a repeated key name finds the first one in file
+//			order, the same key KeyValues::FindKey() would return.
+//-----------------------------------------------------------------------------
+int CKeyValuesImage::FindChild( int nParent, int nImageSymbol ) const
+{
+	const KVImageNode_t &parent = m_pNodes[nParent];
+	const int *pChildren = m_pSorted + parent.m_nSorted;
+
+	int nLow = 0;
+	int nHigh = parent.m_nChildCount;
+	while ( nLow < nHigh )
+	{
+		int nMid = ( nLow + nHigh ) >> 1;
+		if ( m_pNodes[ pChildren[nMid] ].m_nSymbol < nImageSymbol )
+		{
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid;
+		}
+	}
+
+	if ( nLow < parent.m_nChildCount && m_pNodes[ pChildren[nLow] ].m_nSymbol == nImageSymbol )
+		return pChildren[nLow];
+	return -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Image writer
+//-----------------------------------------------------------------------------
+namespace
+{
+	struct KVImageBuildSymbol_t
+	{
+		unsigned int m_nHash;
+		const char *m_pName;
+		int m_nOriginal;	// index before sorting
+	};
+
+	int __cdecl KVImageSymbolLessFunc( const KVImageBuildSymbol_t *pLeft, const KVImageBuildSymbol_t *pRight )
+	{
+		if ( pLeft->m_nHash != pRight->m_nHash )
+			return ( pLeft->m_nHash < pRight->m_nHash ) ? -1 : 1;
+		return Q_stricmp( pLeft->m_pName, pRight->m_pName );
+	}
+
+	class CKVImageStringTable
+	{
+	public:
+		CKVImageStringTable() : m_Strings( k_eDictCompareTypeCaseSensitive )
+		{
+			m_Data.PutChar( 0 );
+		}
+
+		int AddString( const char *pString )
+		{
+			if ( !pString || !pString[0] )
+				return 0;
+
+			int i = m_Strings.Find( pString );
+			if ( i != m_Strings.InvalidIndex() )
+				return m_Strings[i];
+
+			int nOffset = m_Data.TellPut();
+			m_Data.Put( pString, Q_strlen( pString ) + 1 );
+			m_Strings.Insert( pString, nOffset );
+			return nOffset;
+		}
+
+		int AddUint64( uint64 nValue )
+		{
+			while ( m_Data.TellPut() & 7 )
+			{
+				m_Data.PutChar( 0 );
+			}
+			int nOffset = m_Data.TellPut();
+			m_Data.Put( &nValue, sizeof( nValue ) );
+			return nOffset;
+		}
+
+		CUtlBuffer m_Data;
+		CUtlDict< int, int > m_Strings;
+	};
+}
+
+bool CKeyValuesImage::Write( KeyValues *pRoot, CUtlBuffer &buf, int nFlags )
+{
+	if ( !pRoot || buf.IsText() || !buf.IsValid() )
+		return false;
+
+	// breadth first, so every node's children end up next to each other
+	CUtlVector< KeyValues * > keys;
+	CUtlVector< KVImageNode_t > nodes;
+	for ( KeyValues *pKey = pRoot; pKey; pKey = pKey->GetNextKey() )
+	{
+		keys.AddToTail( pKey );
+	}
+	int nRootCount = keys.Count();
+
+	CUtlDict< int, int > symbolLookup;	// caseless, like the KeyValues symbol table
+	CUtlVector< KVImageBuildSymbol_t > symbols;
+	CKVImageStringTable strings;
+	CUtlVector< int > sorted;
+
+	nodes.SetCount( nRootCount );
+	for ( int i = 0; i < keys.Count(); i++ )
+	{
+		KeyValues *pKey = keys[i];
+		KVImageNode_t &node = nodes[i];
+		Q_memset( &node, 0, sizeof( node ) );
+
+		const char *pName = pKey->GetName();
+		int nSymbol = symbolLookup.Find( pName );
+		if ( nSymbol == symbolLookup.InvalidIndex() )
+		{
+			KVImageBuildSymbol_t &symbol = symbols[ symbols.AddToTail() ];
+			symbol.m_nHash = HashStringCaseless( pName );
+			symbol.m_pName = pName;
+			symbol.m_nOriginal = symbols.Count() - 1;
+			nSymbol = symbolLookup.Insert( pName, symbol.m_nOriginal );
+		}
+		node.m_nSymbol = symbolLookup[nSymbol];
+
+		char szValue[64];
+		switch ( pKey->GetDataType() )
+		{
+		case KeyValues::TYPE_STRING:
+			node.m_nType = KeyValues::TYPE_STRING;
+			node.m_nString = strings.AddString( pKey->GetString() );
+			break;
+		case KeyValues::TYPE_WSTRING:
+		{
+			char szUTF8[1024];
+			Q_UnicodeToUTF8( pKey->GetWString(), szUTF8, sizeof( szUTF8 ) );
+			node.m_nType = KeyValues::TYPE_STRING;
+			node.m_nString = strings.AddString( szUTF8 );
+			break;
+		}
+		case KeyValues::TYPE_INT:
+			node.m_nType = KeyValues::TYPE_INT;
+			node.m_nInt = pKey->GetInt();
+			Q_snprintf( szValue, sizeof( szValue ), "%d", node.m_nInt );
+			node.m_nString = strings.AddString( szValue );
+			break;
+		case KeyValues::TYPE_FLOAT:
+			node.m_nType = KeyValues::TYPE_FLOAT;
+			node.m_flFloat = pKey->GetFloat();
+			Q_snprintf( szValue, sizeof( szValue ), "%f", node.m_flFloat );
+			node.m_nString = strings.AddString( szValue );
+			break;
+		case KeyValues::TYPE_UINT64:
+			node.m_nType = KeyValues::TYPE_UINT64;
+			Q_snprintf( szValue, sizeof( szValue ), "%lld", pKey->GetUint64() );
+			node.m_nString = strings.AddString( szValue );
+			node.m_nUint64 = strings.AddUint64( pKey->GetUint64() );
+			break;
+		case KeyValues::TYPE_COLOR:
+		{
+			Color color = pKey->GetColor();
+			node.m_nType = KeyValues::TYPE_COLOR;
+			node.m_Color[0] = color.r();
+			node.m_Color[1] = color.g();
+			node.m_Color[2] = color.b();
+			node.m_Color[3] = color.a();
+			break;
+		}
+		default:
+			// TYPE_NONE, and pointers which mean nothing outside this process
+			node.m_nType = KeyValues::TYPE_NONE;
+			break;
+		}
+
+		// queue the children
+		node.m_nFirstChild = keys.Count();
+		for ( KeyValues *pSub = pKey->GetFirstSubKey(); pSub; pSub = pSub->GetNextKey() )
+		{
+			keys.AddToTail( pSub );
+		}
+		node.m_nChildCount = keys.Count() - node.m_nFirstChild;
+		if ( !node.m_nChildCount )
+		{
+			node.m_nFirstChild = 0;
+		}
+		nodes.SetCount( keys.Count() );
+	}
+
+	if ( nRootCount )
+	{
+		nodes[nRootCount - 1].m_nFlags |= KVIMAGE_NODE_LAST;
+	}
+
+	// sort the symbols by hash and renumber the nodes to match
+	symbols.Sort( KVImageSymbolLessFunc );
+	CUtlVector< int > symbolRemap;
+	symbolRemap.SetCount( symbols.Count() );
+	CUtlVector< KVImageSymbol_t > outSymbols;
+	outSymbols.SetCount( symbols.Count() );
+	for ( int i = 0; i < symbols.Count(); i++ )
+	{
+		symbolRemap[ symbols[i].m_nOriginal ] = i;
+		outSymbols[i].m_nHash = symbols[i].m_nHash;
+		outSymbols[i].m_nName = strings.AddString( symbols[i].m_pName );
+	}
+
+	for ( int i = 0; i < nodes.Count(); i++ )
+	{
+		nodes[i].m_nSymbol = symbolRemap[ nodes[i].m_nSymbol ];
+	}
+
+	// per node child tables sorted by (symbol, node index); child lists are
+	// short, an insertion sort is all this needs
+	for ( int i = 0; i < nodes.Count(); i++ )
+	{
+		KVImageNode_t &node = nodes[i];
+		if ( !node.m_nChildCount )
+			continue;
+
+		nodes[node.m_nFirstChild + node.m_nChildCount - 1].m_nFlags |= KVIMAGE_NODE_LAST;
+
+		node.m_nSorted = sorted.Count();
+		for ( int j = 0; j < node.m_nChildCount; j++ )
+		{
+			int nChild = node.m_nFirstChild + j;
+			int nSymbol = nodes[nChild].m_nSymbol;
+			int k = sorted.AddToTail( nChild );
+			while ( k > node.m_nSorted && nodes[ sorted[k - 1] ].m_nSymbol > nSymbol )
+			{
+				sorted[k] = sorted[k - 1];
+				k--;
+			}
+			sorted[k] = nChild;
+		}
+	}
+
+	// lay it out
+	KVImageHeader_t header;
+	Q_memset( &header, 0, sizeof( header ) );
+	header.m_nMagic = KVIMAGE_MAGIC;
+	header.m_nVersion = KVIMAGE_VERSION;
+	header.m_nFlags = nFlags;
+	header.m_nNodeCount = nodes.Count();
+	header.m_nRootCount = nRootCount;
+	header.m_nNodeOffset = AlignValue( (int)sizeof( header ), 8 );
+	header.m_nSortedCount = sorted.Count();
+	header.m_nSortedOffset = header.m_nNodeOffset + nodes.Count() * sizeof( KVImageNode_t );
+	header.m_nSymbolCount = outSymbols.Count();
+	header.m_nSymbolOffset = header.m_nSortedOffset + sorted.Count() * sizeof( int );
+	header.m_nStringBytes = strings.m_Data.TellPut();
+	header.m_nStringOffset = AlignValue( header.m_nSymbolOffset + outSymbols.Count() * (int)sizeof( KVImageSymbol_t ), 8 );
+	header.m_nImageSize = header.m_nStringOffset + header.m_nStringBytes;
+
+	int nStart = buf.TellPut();
+	buf.Put( &header, sizeof( header ) );
+	while ( buf.TellPut() - nStart < header.m_nNodeOffset )
+	{
+		buf.PutChar( 0 );
+	}
+	buf.Put( nodes.Base(), nodes.Count() * sizeof( KVImageNode_t ) );
+	buf.Put( sorted.Base(), sorted.Count() * sizeof( int ) );
+	buf.Put( outSymbols.Base(), outSymbols.Count() * sizeof( KVImageSymbol_t ) );
+	while ( buf.TellPut() - nStart < header.m_nStringOffset )
+	{
+		buf.PutChar( 0 );
+	}
+	buf.Put( strings.m_Data.Base(), header.m_nStringBytes );
+
+	return buf.IsValid();
+}
@@ -0,0 +1,303 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Concurrent string intern table, see utlstringintern.h
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier1/utlstringintern.h"
+#include "tier1/generichash.h"
+#include "tier1/strtools.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+//-----------------------------------------------------------------------------
+// constructor, destructor
+//-----------------------------------------------------------------------------
+CUtlStringInternTable::CUtlStringInternTable( bool bCaseInsensitive, int nMaxStrings ) :
+	m_nMaxStrings( nMaxStrings ),
+	m_nNextId( 0 ),
+	m_bInsensitive( bCaseInsensitive )
+{
+	Assert( nMaxStrings > 0 );
+
+	// the block directory is sized up front, so it never moves under a reader
+	int nBlocks = ( nMaxStrings + ENTRY_BLOCK_SIZE - 1 ) >> ENTRY_BLOCK_SHIFT;
+	m_pEntryBlocks = (Entry_t * volatile *)calloc( nBlocks, sizeof( Entry_t * ) );
+
+	for ( int i = 0; i < SHARD_COUNT; i++ )
+	{
+		m_Shards[i].m_pTable = AllocSlotTable( MIN_SLOT_COUNT );
+		m_Shards[i].m_pPools = NULL;
+		m_Shards[i].m_nPoolBytes = 0;
+	}
+}
+
+CUtlStringInternTable::~CUtlStringInternTable()
+{
+	RemoveAll();
+
+	for ( int i = 0; i < SHARD_COUNT; i++ )
+	{
+		free( m_Shards[i].m_pTable );
+	}
+	free( (void *)m_pEntryBlocks );
+}
+
+//-----------------------------------------------------------------------------
+// Releases every string. Not thread safe, nothing else may be using the table.
+//-----------------------------------------------------------------------------
+void CUtlStringInternTable::RemoveAll()
+{
+	for ( int i = 0; i < SHARD_COUNT; i++ )
+	{
+		Shard_t &shard = m_Shards[i];
+
+		SlotTable_t *pRetired = shard.m_pTable->m_pRetired;
+		while ( pRetired )
+		{
+			SlotTable_t *pNext = pRetired->m_pRetired;
+			free( pRetired );
+			pRetired = pNext;
+		}
+
+		// keep the current table, just empty it
+		shard.m_pTable->m_pRetired = NULL;
+		shard.m_pTable->m_nUsed = 0;
+		for ( int j = 0; j <= shard.m_pTable->m_nMask; j++ )
+		{
+			shard.m_pTable->m_Slots[j] = INVALID_ID;
+		}
+
+		StringPool_t *pPool = shard.m_pPools;
+		while ( pPool )
+		{
+			StringPool_t *pNext = pPool->m_pNext;
+			free( pPool );
+			pPool = pNext;
+		}
+		shard.m_pPools = NULL;
+		shard.m_nPoolBytes = 0;
+	}
+
+	int nBlocks = ( m_nMaxStrings + ENTRY_BLOCK_SIZE - 1 ) >> ENTRY_BLOCK_SHIFT;
+	for ( int i = 0; i < nBlocks; i++ )
+	{
+		free( m_pEntryBlocks[i] );
+		m_pEntryBlocks[i] = NULL;
+	}
+
+	m_nNextId = 0;
+}
+
+int CUtlStringInternTable::GetMemoryUsage() const
+{
+	int nBytes = 0;
+	for ( int i = 0; i < SHARD_COUNT; i++ )
+	{
+		for ( const SlotTable_t *pTable = m_Shards[i].m_pTable; pTable; pTable = pTable->m_pRetired )
+		{
+			nBytes += sizeof( SlotTable_t ) + pTable->m_nMask * sizeof( int );
+		}
+		nBytes += m_Shards[i].m_nPoolBytes;
+	}
+
+	int nBlocks = ( Count() + ENTRY_BLOCK_SIZE - 1 ) >> ENTRY_BLOCK_SHIFT;
+	return nBytes + nBlocks * ENTRY_BLOCK_SIZE * sizeof( Entry_t );
+}
+
+
+//-----------------------------------------------------------------------------
+// hashing
+//-----------------------------------------------------------------------------
+inline unsigned int CUtlStringInternTable::HashString( const char *pString ) const
+{
+	return m_bInsensitive ? HashStringCaseless( pString ) : ::HashString( pString );
+}
+
+inline bool CUtlStringInternTable::StringsMatch( const char *pLeft, const char *pRight ) const
+{
+	return m_bInsensitive ? !V_stricmp( pLeft, pRight ) : !V_strcmp( pLeft, pRight );
+}
+
+// The top bits pick the shard, the low bits the slot
+#define INTERN_SHARD( nHash )	( (nHash) >> ( 32 - CUtlStringInternTable::SHARD_BITS ) )
+
+
+//-----------------------------------------------------------------------------
+// Linear probe. Returns the id, or INVALID_ID with the free slot that ended
+// the probe in *pFreeSlot. The precomputed hash rejects nearly every
+// mismatch before any string is touched.
+//-----------------------------------------------------------------------------
+int CUtlStringInternTable::FindInTable( const SlotTable_t *pTable, const char *pString, unsigned int nHash, int *pFreeSlot ) const
+{
+	int nMask = pTable->m_nMask;
+	for ( int i = nHash & nMask; ; i = ( i + 1 ) & nMask )
+	{
+		int nId = pTable->m_Slots[i];
+		if ( nId == INVALID_ID )
+		{
+			if ( pFreeSlot )
+			{
+				*pFreeSlot = i;
+			}
+			return INVALID_ID;
+		}
+
+		// pairs with the barrier in AddString(): the entry is written before its id is
+		ThreadMemoryBarrier();
+
+		const Entry_t &entry = GetEntry( nId );
+		if ( entry.m_nHash == nHash && StringsMatch( entry.m_pString, pString ) )
+			return nId;
+	}
+}
+
+int CUtlStringInternTable::Find( const char *pString ) const
+{
+	if ( !pString )
+		return INVALID_ID;
+
+	unsigned int nHash = HashString( pString );
+	const SlotTable_t *pTable = m_Shards[ INTERN_SHARD( nHash ) ].m_pTable;
+	ThreadMemoryBarrier();
+	return FindInTable( pTable, pString, nHash, NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Finds and/or adds a string
+//-----------------------------------------------------------------------------
+int CUtlStringInternTable::AddString( const char *pString )
+{
+	if ( !pString )
+		return INVALID_ID;
+
+	unsigned int nHash = HashString( pString );
+	Shard_t &shard = m_Shards[ INTERN_SHARD( nHash ) ];
+
+	// most adds are for strings that are already there, don't lock for those
+	int nId = FindInTable( shard.m_pTable, pString, nHash, NULL );
+	if ( nId != INVALID_ID )
+		return nId;
+
+	AUTO_LOCK( shard.m_Lock );
+
+	// someone may have added it while we waited for the lock
+	int nFreeSlot;
+	nId = FindInTable( shard.m_pTable, pString, nHash, &nFreeSlot );
+	if ( nId != INVALID_ID )
+		return nId;
+
+	// keep the load factor at or under one half
+	if ( ( shard.m_pTable->m_nUsed + 1 ) * 2 > shard.m_pTable->m_nMask + 1 )
+	{
+		GrowShard( shard );
+		FindInTable( shard.m_pTable, pString, nHash, &nFreeSlot );
+	}
+
+	nId = ThreadInterlockedIncrement( &m_nNextId ) - 1;
+	if ( nId >= m_nMaxStrings )
+	{
+		AssertMsg( 0, "CUtlStringInternTable: out of ids\n" );
+		m_nNextId = m_nMaxStrings;
+		return INVALID_ID;
+	}
+
+	Entry_t *pEntry = AllocEntry( nId );
+	pEntry->m_pString = CopyString( shard, pString );
+	pEntry->m_nHash = nHash;
+
+	// publish the id only once the entry behind it is complete
+	ThreadMemoryBarrier();
+	shard.m_pTable->m_Slots[nFreeSlot] = nId;
+	shard.m_pTable->m_nUsed++;
+	return nId;
+}
+
+
+//-----------------------------------------------------------------------------
+// Storage. Everything here runs under the shard lock.
+//-----------------------------------------------------------------------------
+CUtlStringInternTable::SlotTable_t *CUtlStringInternTable::AllocSlotTable( int nSlots )
+{
+	Assert( ( nSlots & ( nSlots - 1 ) ) == 0 );
+	SlotTable_t *pTable = (SlotTable_t *)malloc( sizeof( SlotTable_t ) + ( nSlots - 1 ) * sizeof( int ) );
+	pTable->m_nMask = nSlots - 1;
+	pTable->m_nUsed = 0;
+	pTable->m_pRetired = NULL;
+	for ( int i = 0; i < nSlots; i++ )
+	{
+		pTable->m_Slots[i] = INVALID_ID;
+	}
+	return pTable;
+}
+
+void CUtlStringInternTable::GrowShard( Shard_t &shard )
+{
+	SlotTable_t *pOld = shard.m_pTable;
+	SlotTable_t *pNew = AllocSlotTable( ( pOld->m_nMask + 1 ) * 2 );
+
+	for ( int i = 0; i <= pOld->m_nMask; i++ )
+	{
+		int nId = pOld->m_Slots[i];
+		if ( nId == INVALID_ID )
+			continue;
+
+		int nMask = pNew->m_nMask;
+		int j = GetEntry( nId ).m_nHash & nMask;
+		while ( pNew->m_Slots[j] != INVALID_ID )
+		{
+			j = ( j + 1 ) & nMask;
+		}
+		pNew->m_Slots[j] = nId;
+	}
+	pNew->m_nUsed = pOld->m_nUsed;
+
+	// readers still walking the old table are fine, it stays complete and alive
+	pNew->m_pRetired = pOld;
+	ThreadMemoryBarrier();
+	shard.m_pTable = pNew;
+}
+
+const char *CUtlStringInternTable::CopyString( Shard_t &shard, const char *pString )
+{
+	int nLen = V_strlen( pString ) + 1;
+
+	StringPool_t *pPool = shard.m_pPools;
+	if ( !pPool || pPool->m_nUsed + nLen > pPool->m_nSize )
+	{
+		int nSize = MAX( nLen, (int)STRING_POOL_SIZE );
+		pPool = (StringPool_t *)malloc( sizeof( StringPool_t ) + nSize );
+		pPool->m_nSize = nSize;
+		pPool->m_nUsed = 0;
+		pPool->m_pNext = shard.m_pPools;
+		shard.m_pPools = pPool;
+		shard.m_nPoolBytes += sizeof( StringPool_t ) + nSize;
+	}
+
+	char *pCopy = (char *)( pPool + 1 ) + pPool->m_nUsed;
+	memcpy( pCopy, pString, nLen );
+	pPool->m_nUsed += nLen;
+	return pCopy;
+}
+
+//-----------------------------------------------------------------------------
+// Entry blocks are shared by all shards; whoever needs a block first
+// installs it, a loser of the race frees its copy.
+//-----------------------------------------------------------------------------
+CUtlStringInternTable::Entry_t *CUtlStringInternTable::AllocEntry( int nId )
+{
+	Entry_t * volatile &pBlock = m_pEntryBlocks[ nId >> ENTRY_BLOCK_SHIFT ];
+	if ( !pBlock )
+	{
+		Entry_t *pNewBlock = (Entry_t *)malloc( ENTRY_BLOCK_SIZE * sizeof( Entry_t ) );
+		if ( !ThreadInterlockedAssignPointerIf( (void * volatile *)&pBlock, pNewBlock, NULL ) )
+		{
+			free( pNewBlock );
+		}
+	}
+	return &pBlock[ nId & ( ENTRY_BLOCK_SIZE - 1 ) ];
+}
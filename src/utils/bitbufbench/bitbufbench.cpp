@@ -0,0 +1,343 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Times the bulk bf_write/bf_read array functions against writing
+//			the same data one field at a time, and checks that both produce
+//			exactly the same bits.
+//
+// $NoKeywords: $
+//
+//===========================================================================//
+#include <stdlib.h>
+#include <stdio.h>
+#include "tier0/platform.h"
+#include "tier1/bitbuf.h"
+#include "coordsize.h"
+#include "mathlib/mathlib.h"
+
+#define NUM_ELEMENTS	1024
+#define BUFFER_SIZE		( NUM_ELEMENTS * 32 )
+
+// Odd start offset so nothing ends up dword aligned
+#define START_BIT		3
+
+static float	s_Floats[NUM_ELEMENTS];
+static Vector	s_Coords[NUM_ELEMENTS];
+static Vector	s_Normals[NUM_ELEMENTS];
+static float	s_Angles[NUM_ELEMENTS];
+static uint32	s_VarInts[NUM_ELEMENTS];
+
+static unsigned char	s_FieldBuffer[BUFFER_SIZE];
+static unsigned char	s_BulkBuffer[BUFFER_SIZE];
+
+static int		s_nFailures = 0;
+
+//-----------------------------------------------------------------------------
+// Test data. Mostly small values with some zeros, so all the optional fields
+// of the encodings get exercised.
+//-----------------------------------------------------------------------------
+static float RandomCoord()
+{
+	switch ( rand() % 4 )
+	{
+	case 0:		return 0.0f;
+	case 1:		return (float)( rand() % 64 ) / 64.0f - 0.5f;
+	default:	return ( (float)rand() / RAND_MAX - 0.5f ) * 2.0f * MAX_COORD_INTEGER;
+	}
+}
+
+static void InitTestData()
+{
+	srand( 1 );
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		s_Floats[i] = RandomCoord();
+		s_Coords[i].Init( RandomCoord(), RandomCoord(), RandomCoord() );
+
+		Vector normal( RandomCoord(), RandomCoord(), RandomCoord() );
+		if ( VectorNormalize( normal ) == 0.0f )
+		{
+			normal.Init( 0, 0, -1 );
+		}
+		s_Normals[i] = normal;
+
+		s_Angles[i] = (float)rand() / RAND_MAX * 360.0f;
+		s_VarInts[i] = (uint32)rand() >> ( rand() % 16 );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Writes everything with the per-field functions
+//-----------------------------------------------------------------------------
+static int WritePerField( bf_write &buf )
+{
+	buf.SeekToBit( START_BIT );
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.WriteBitCoord( s_Floats[i] );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.WriteBitVec3Coord( s_Coords[i] );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.WriteBitVec3Normal( s_Normals[i] );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.WriteBitAngle( s_Angles[i], 12 );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.WriteVarInt32( s_VarInts[i] );
+	}
+	return buf.GetNumBitsWritten();
+}
+
+static int WriteBulk( bf_write &buf )
+{
+	buf.SeekToBit( START_BIT );
+	buf.WriteBitCoordArray( s_Floats, NUM_ELEMENTS );
+	buf.WriteBitVec3CoordArray( s_Coords, NUM_ELEMENTS );
+	buf.WriteBitVec3NormalArray( s_Normals, NUM_ELEMENTS );
+	buf.WriteBitAngleArray( s_Angles, NUM_ELEMENTS, 12 );
+	buf.WriteVarInt32Array( s_VarInts, NUM_ELEMENTS );
+	return buf.GetNumBitsWritten();
+}
+
+//-----------------------------------------------------------------------------
+// The per-field encoders as they were before the bulk paths went in, built
+// only out of WriteOneBit/WriteUBitLong, to prove the output didn't change.
+//-----------------------------------------------------------------------------
+static void ReferenceWriteBitCoord( bf_write &buf, const float f )
+{
+	int		signbit = (f <= -COORD_RESOLUTION);
+	int		intval = (int)abs(f);
+	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+	buf.WriteOneBit( intval );
+	buf.WriteOneBit( fractval );
+
+	if ( intval || fractval )
+	{
+		buf.WriteOneBit( signbit );
+		if ( intval )
+		{
+			intval--;
+			buf.WriteUBitLong( (unsigned int)intval, COORD_INTEGER_BITS );
+		}
+		if ( fractval )
+		{
+			buf.WriteUBitLong( (unsigned int)fractval, COORD_FRACTIONAL_BITS );
+		}
+	}
+}
+
+static void ReferenceWriteBitNormal( bf_write &buf, float f )
+{
+	int	signbit = (f <= -NORMAL_RESOLUTION);
+	unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+	if (fractval > NORMAL_DENOMINATOR)
+		fractval = NORMAL_DENOMINATOR;
+
+	buf.WriteOneBit( signbit );
+	buf.WriteUBitLong( fractval, NORMAL_FRACTIONAL_BITS );
+}
+
+static int WriteReference( bf_write &buf )
+{
+	buf.SeekToBit( START_BIT );
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		ReferenceWriteBitCoord( buf, s_Floats[i] );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		const Vector &fa = s_Coords[i];
+		int xflag = (fa[0] >= COORD_RESOLUTION) || (fa[0] <= -COORD_RESOLUTION);
+		int yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
+		int zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
+		buf.WriteOneBit( xflag );
+		buf.WriteOneBit( yflag );
+		buf.WriteOneBit( zflag );
+		if ( xflag )
+			ReferenceWriteBitCoord( buf, fa[0] );
+		if ( yflag )
+			ReferenceWriteBitCoord( buf, fa[1] );
+		if ( zflag )
+			ReferenceWriteBitCoord( buf, fa[2] );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		const Vector &fa = s_Normals[i];
+		int xflag = (fa[0] >= NORMAL_RESOLUTION) || (fa[0] <= -NORMAL_RESOLUTION);
+		int yflag = (fa[1] >= NORMAL_RESOLUTION) || (fa[1] <= -NORMAL_RESOLUTION);
+		buf.WriteOneBit( xflag );
+		buf.WriteOneBit( yflag );
+		if ( xflag )
+			ReferenceWriteBitNormal( buf, fa[0] );
+		if ( yflag )
+			ReferenceWriteBitNormal( buf, fa[1] );
+		buf.WriteOneBit( fa[2] <= -NORMAL_RESOLUTION );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.WriteBitAngle( s_Angles[i], 12 );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		uint32 data = s_VarInts[i];
+		while ( data > 0x7F ) 
+		{
+			buf.WriteUBitLong( (data & 0x7F) | 0x80, 8 );
+			data >>= 7;
+		}
+		buf.WriteUBitLong( data & 0x7F, 8 );
+	}
+	return buf.GetNumBitsWritten();
+}
+
+//-----------------------------------------------------------------------------
+// Reads back what the writers produced
+//-----------------------------------------------------------------------------
+static Vector	s_ReadCoords[2][NUM_ELEMENTS];
+static Vector	s_ReadNormals[2][NUM_ELEMENTS];
+static float	s_ReadAngles[2][NUM_ELEMENTS];
+static uint32	s_ReadVarInts[2][NUM_ELEMENTS];
+static float	s_ReadSingleCoords[2][NUM_ELEMENTS];
+
+static void ReadPerField( bf_read &buf, int nSlot )
+{
+	buf.Seek( START_BIT );
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		s_ReadSingleCoords[nSlot][i] = buf.ReadBitCoord();
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.ReadBitVec3Coord( s_ReadCoords[nSlot][i] );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		buf.ReadBitVec3Normal( s_ReadNormals[nSlot][i] );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		s_ReadAngles[nSlot][i] = buf.ReadBitAngle( 12 );
+	}
+	for ( int i = 0; i < NUM_ELEMENTS; ++i )
+	{
+		s_ReadVarInts[nSlot][i] = buf.ReadVarInt32();
+	}
+}
+
+static void ReadBulk( bf_read &buf, int nSlot )
+{
+	buf.Seek( START_BIT );
+	buf.ReadBitCoordArray( s_ReadSingleCoords[nSlot], NUM_ELEMENTS );
+	buf.ReadBitVec3CoordArray( s_ReadCoords[nSlot], NUM_ELEMENTS );
+	buf.ReadBitVec3NormalArray( s_ReadNormals[nSlot], NUM_ELEMENTS );
+	buf.ReadBitAngleArray( s_ReadAngles[nSlot], NUM_ELEMENTS, 12 );
+	buf.ReadVarInt32Array( s_ReadVarInts[nSlot], NUM_ELEMENTS );
+}
+
+static void Check( bool bOk, const char *pMsg )
+{
+	if ( !bOk )
+	{
+		printf( "FAILED: %s\n", pMsg );
+		++s_nFailures;
+	}
+}
+
+static void CheckEncoding()
+{
+	static unsigned char s_RefBuffer[BUFFER_SIZE];
+	memset( s_RefBuffer, 0, sizeof( s_RefBuffer ) );
+	memset( s_FieldBuffer, 0, sizeof( s_FieldBuffer ) );
+	memset( s_BulkBuffer, 0, sizeof( s_BulkBuffer ) );
+
+	bf_write refBuf( "reference", s_RefBuffer, sizeof( s_RefBuffer ) );
+	bf_write fieldBuf( "per field", s_FieldBuffer, sizeof( s_FieldBuffer ) );
+	bf_write bulkBuf( "bulk", s_BulkBuffer, sizeof( s_BulkBuffer ) );
+
+	int nRefBits = WriteReference( refBuf );
+	int nFieldBits = WritePerField( fieldBuf );
+	int nBulkBits = WriteBulk( bulkBuf );
+
+	Check( !refBuf.IsOverflowed() && !fieldBuf.IsOverflowed() && !bulkBuf.IsOverflowed(), "buffer overflowed" );
+	Check( nRefBits == nFieldBits, "per field writers changed the bit count" );
+	Check( nRefBits == nBulkBits, "bulk writers changed the bit count" );
+	Check( !memcmp( s_RefBuffer, s_FieldBuffer, BitByte( nRefBits ) ), "per field writers changed the output" );
+	Check( !memcmp( s_RefBuffer, s_BulkBuffer, BitByte( nRefBits ) ), "bulk writers changed the output" );
+
+	bf_read fieldRead( "per field", s_RefBuffer, BitByte( nRefBits ), nRefBits );
+	bf_read bulkRead( "bulk", s_RefBuffer, BitByte( nRefBits ), nRefBits );
+	ReadPerField( fieldRead, 0 );
+	ReadBulk( bulkRead, 1 );
+
+	Check( fieldRead.GetNumBitsRead() == nRefBits && bulkRead.GetNumBitsRead() == nRefBits, "readers didn't consume everything" );
+	Check( !memcmp( s_ReadSingleCoords[0], s_ReadSingleCoords[1], sizeof( s_ReadSingleCoords[0] ) ), "coords decoded differently" );
+	Check( !memcmp( s_ReadCoords[0], s_ReadCoords[1], sizeof( s_ReadCoords[0] ) ), "vec3 coords decoded differently" );
+	Check( !memcmp( s_ReadNormals[0], s_ReadNormals[1], sizeof( s_ReadNormals[0] ) ), "normals decoded differently" );
+	Check( !memcmp( s_ReadAngles[0], s_ReadAngles[1], sizeof( s_ReadAngles[0] ) ), "angles decoded differently" );
+	Check( !memcmp( s_ReadVarInts[0], s_ReadVarInts[1], sizeof( s_ReadVarInts[0] ) ), "varints decoded differently" );
+	Check( !memcmp( s_ReadVarInts[0], s_VarInts, sizeof( s_VarInts ) ), "varints didn't round trip" );
+
+	printf( "%d bits per pass, %s\n", nRefBits, s_nFailures ? "output differs!" : "output matches" );
+}
+
+//-----------------------------------------------------------------------------
+// Timing
+//-----------------------------------------------------------------------------
+typedef int (*WriteFunc_t)( bf_write &buf );
+typedef void (*ReadFunc_t)( bf_read &buf, int nSlot );
+
+static double TimeWrite( WriteFunc_t pfnWrite, unsigned char *pBuffer, int nIterations )
+{
+	bf_write buf( pBuffer, BUFFER_SIZE );
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; ++i )
+	{
+		pfnWrite( buf );
+	}
+	return ( Plat_FloatTime() - flStart ) * 1000.0;
+}
+
+static double TimeRead( ReadFunc_t pfnRead, const unsigned char *pBuffer, int nBits, int nIterations )
+{
+	bf_read buf( pBuffer, BitByte( nBits ), nBits );
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; ++i )
+	{
+		pfnRead( buf, 0 );
+	}
+	return ( Plat_FloatTime() - flStart ) * 1000.0;
+}
+
+int main( int argc, char **argv )
+{
+	int nIterations = ( argc > 1 ) ? atoi( argv[1] ) : 1000;
+	if ( nIterations <= 0 )
+	{
+		printf( "Usage: bitbufbench [iterations]\n" );
+		return -1;
+	}
+
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f );
+	InitTestData();
+
+	CheckEncoding();
+
+	bf_write sizeBuf( s_FieldBuffer, BUFFER_SIZE );
+	int nBits = WritePerField( sizeBuf );
+
+	printf( "%d iterations of %d elements\n", nIterations, NUM_ELEMENTS );
+	printf( "  write  reference %8.2f ms\n", TimeWrite( WriteReference, s_FieldBuffer, nIterations ) );
+	printf( "  write  per field %8.2f ms\n", TimeWrite( WritePerField, s_FieldBuffer, nIterations ) );
+	printf( "  write  bulk      %8.2f ms\n", TimeWrite( WriteBulk, s_BulkBuffer, nIterations ) );
+	printf( "  read   per field %8.2f ms\n", TimeRead( ReadPerField, s_FieldBuffer, nBits, nIterations ) );
+	printf( "  read   bulk      %8.2f ms\n", TimeRead( ReadBulk, s_FieldBuffer, nBits, nIterations ) );
+
+	return s_nFailures ? -1 : 0;
+}